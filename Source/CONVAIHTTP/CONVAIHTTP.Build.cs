@@ -39,6 +39,9 @@ public class CONVAIHTTP : ModuleRules
 	{
 		PublicDefinitions.Add("CONVAIHTTP_PACKAGE=1");
 
+		// libcurl speaks HTTP/2 when built with nghttp2, which the loopback server of the load tests also uses for h2c
+		bool bWithNghttp2 = false;
+
 		PrivateIncludePaths.AddRange(
 			new string[] {
 				//"Runtime/Online/HTTP/Private",
@@ -71,6 +74,7 @@ public class CONVAIHTTP : ModuleRules
 				if (Target.Version.MajorVersion > 5 || Target.Version.MinorVersion >= 3)
 				{
 					AddEngineThirdPartyPrivateStaticDependencies(Target, "libcurl", "nghttp2", "OpenSSL", "zlib");
+					bWithNghttp2 = true;
 				}
 				else
 				{
@@ -88,6 +92,7 @@ public class CONVAIHTTP : ModuleRules
 		PrivateDefinitions.Add("WITH_CURL_LIBCURL =" + (bPlatformSupportsLibCurl ? "1" : "0"));
 		PrivateDefinitions.Add("WITH_CURL_XCURL=" + (bPlatformSupportsXCurl ? "1" : "0"));
 		PrivateDefinitions.Add("WITH_CURL= " + ((bPlatformSupportsLibCurl || bPlatformSupportsXCurl) ? "1" : "0"));
+		PrivateDefinitions.Add("WITH_CONVAIHTTP_NGHTTP2=" + (bWithNghttp2 ? "1" : "0"));
 
 		// Use Curl over WinHttp on platforms that support it (until WinHttp client security is in a good place at the least)
 		if (bPlatformSupportsWinHttp)
@@ -37,6 +37,7 @@ public:
 	virtual FString GetVerb() const override;
 	virtual void SetVerb(const FString& Verb) override;
 	virtual void SetURL(const FString& URL) override;
+	using FConvaihttpRequestImpl::SetContent;
 	virtual void SetContent(const TArray64<uint8>& ContentPayload) override;
 	virtual void SetContent(TArray64<uint8>&& ContentPayload) override;
 	virtual void SetContentAsString(const FString& ContentString) override;
@@ -10,6 +10,10 @@
 #include "Misc/Fork.h"
 
 #include "ConvaihttpThread.h"
+#include "ConvaihttpRetrySystem.h"
+#include "ConvaihttpMetrics.h"
+#include "ConvaihttpSlowRequestSampler.h"
+#include "ConvaihttpTrace.h"
 #include "Misc/ConfigCacheIni.h"
 #include "Misc/CommandLine.h"
 
@@ -178,6 +182,9 @@ void FConvaihttpManager::UpdateConfigs()
 {
 	ReloadFlushTimeLimits();
 
+	GConfig->GetDouble(TEXT("CONVAIHTTP"), TEXT("MaxHostThrottleSeconds"), MaxHostThrottleSeconds, GEngineIni);
+	FConvaihttpSlowRequestSampler::Get().UpdateConfigs();
+
 	if (Thread)
 	{
 		Thread->UpdateConfigs();
@@ -356,12 +363,84 @@ bool FConvaihttpManager::Tick(float DeltaSeconds)
 			FConvaihttpRequestRef CompletedRequestRef = CompletedRequest->AsShared();
 			Requests.Remove(CompletedRequestRef);
 			CompletedRequest->FinishRequest();
+			CONVAIHTTP_TRACE_EVENT(CompletedRequest, Delivered);
+			UpdateHostThrottle(*CompletedRequest);
+			FConvaihttpMetrics::Get().RecordRequestCompleted(*CompletedRequest);
 		}
 	}
 	// keep ticking
 	return true;
 }
 
+void FConvaihttpManager::ThrottleHost(const FString& Url, double Seconds)
+{
+	const FString HostKey = GetHostThrottleKey(Url);
+	if (HostKey.IsEmpty() || Seconds <= 0.0)
+	{
+		return;
+	}
+
+	Seconds = FMath::Min(Seconds, MaxHostThrottleSeconds);
+	const double EndTimeAbsoluteSeconds = FPlatformTime::Seconds() + Seconds;
+
+	FScopeLock ScopeLock(&HostThrottleLock);
+	double& HostEndTime = HostThrottleEndTimes.FindOrAdd(HostKey, 0.0);
+	if (EndTimeAbsoluteSeconds > HostEndTime)
+	{
+		UE_LOG(LogConvaihttp, Log, TEXT("Throttling requests to %s for %.1fs"), *HostKey, Seconds);
+		HostEndTime = EndTimeAbsoluteSeconds;
+		if (Thread)
+		{
+			Thread->ThrottleHost(HostKey, EndTimeAbsoluteSeconds);
+		}
+	}
+	NumThrottledHosts = HostThrottleEndTimes.Num();
+}
+
+double FConvaihttpManager::GetHostThrottleEndTime(const FString& Url, double NowAbsoluteSeconds) const
+{
+	if (!HasThrottledHosts())
+	{
+		return 0.0;
+	}
+
+	const FString HostKey = GetHostThrottleKey(Url);
+
+	FScopeLock ScopeLock(&HostThrottleLock);
+	const double* HostEndTime = HostThrottleEndTimes.Find(HostKey);
+	return (HostEndTime && *HostEndTime > NowAbsoluteSeconds) ? *HostEndTime : 0.0;
+}
+
+void FConvaihttpManager::UpdateHostThrottle(const IConvaihttpRequest& Request)
+{
+	const double NowAbsoluteSeconds = FPlatformTime::Seconds();
+
+	const TOptional<double> ThrottleSeconds = FConvaihttpRetrySystem::ReadThrottledTimeFromResponseInSeconds(Request.GetResponse());
+	if (ThrottleSeconds.IsSet())
+	{
+		ThrottleHost(Request.GetURL(), ThrottleSeconds.GetValue());
+	}
+
+	if (HasThrottledHosts())
+	{
+		// Forget the hosts whose throttle is over
+		FScopeLock ScopeLock(&HostThrottleLock);
+		for (TMap<FString, double>::TIterator It(HostThrottleEndTimes); It; ++It)
+		{
+			if (It.Value() <= NowAbsoluteSeconds)
+			{
+				It.RemoveCurrent();
+			}
+		}
+		NumThrottledHosts = HostThrottleEndTimes.Num();
+	}
+}
+
+FString FConvaihttpManager::GetHostThrottleKey(const FString& Url)
+{
+	return FPlatformConvaihttp::GetUrlDomainAndPort(Url).ToLower();
+}
+
 void FConvaihttpManager::FlushTick(float DeltaSeconds)
 {
 	Tick(DeltaSeconds);
@@ -427,6 +506,23 @@ void FConvaihttpManager::DumpRequests(FOutputDevice& Ar) const
 	}
 }
 
+void FConvaihttpManager::DumpThreadStats(FOutputDevice& Ar) const
+{
+	if (Thread)
+	{
+		Thread->DumpLoopStats(Ar);
+	}
+	else
+	{
+		Ar.Logf(TEXT("No CONVAIHTTP thread"));
+	}
+}
+
+double FConvaihttpManager::GetThreadBusySeconds() const
+{
+	return Thread ? FPlatformTime::ToSeconds64(Thread->GetBusyCycles()) : 0.0;
+}
+
 bool FConvaihttpManager::SupportsDynamicProxy() const
 {
 	return false;
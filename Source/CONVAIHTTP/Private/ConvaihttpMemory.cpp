@@ -0,0 +1,56 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "ConvaihttpMemory.h"
+#include "Misc/OutputDevice.h"
+
+LLM_DEFINE_TAG(Convaihttp, NAME_None, TEXT("Networking"));
+LLM_DEFINE_TAG(Convaihttp_RequestPayload, TEXT("RequestPayload"), TEXT("Convaihttp"));
+LLM_DEFINE_TAG(Convaihttp_ResponsePayload, TEXT("ResponsePayload"), TEXT("Convaihttp"));
+LLM_DEFINE_TAG(Convaihttp_Headers, TEXT("Headers"), TEXT("Convaihttp"));
+LLM_DEFINE_TAG(Convaihttp_Curl, TEXT("Curl"), TEXT("Convaihttp"));
+LLM_DEFINE_TAG(Convaihttp_OpenSSL, TEXT("OpenSSL"), TEXT("Convaihttp"));
+
+std::atomic<int64> FConvaihttpMemory::CurrentBytes[static_cast<int32>(EConvaihttpMemoryCategory::Count)] = {};
+std::atomic<int64> FConvaihttpMemory::PeakBytes[static_cast<int32>(EConvaihttpMemoryCategory::Count)] = {};
+
+namespace ConvaihttpMemory
+{
+	const TCHAR* LexToString(EConvaihttpMemoryCategory Category)
+	{
+		switch (Category)
+		{
+		case EConvaihttpMemoryCategory::RequestPayload:		return TEXT("RequestPayload");
+		case EConvaihttpMemoryCategory::ResponsePayload:	return TEXT("ResponsePayload");
+		case EConvaihttpMemoryCategory::Headers:			return TEXT("Headers");
+		case EConvaihttpMemoryCategory::Curl:				return TEXT("Curl");
+		case EConvaihttpMemoryCategory::OpenSSL:			return TEXT("OpenSSL");
+		default:											return TEXT("Unknown");
+		}
+	}
+}
+
+void FConvaihttpMemory::ResetPeaks()
+{
+	for (int32 Index = 0; Index < static_cast<int32>(EConvaihttpMemoryCategory::Count); ++Index)
+	{
+		PeakBytes[Index].store(CurrentBytes[Index].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+void FConvaihttpMemory::Dump(FOutputDevice& Ar)
+{
+#if CONVAIHTTP_MEMORY_STATS
+	Ar.Logf(TEXT("CONVAIHTTP memory (current / peak):"));
+	int64 TotalCurrentBytes = 0;
+	for (int32 Index = 0; Index < static_cast<int32>(EConvaihttpMemoryCategory::Count); ++Index)
+	{
+		const int64 Current = CurrentBytes[Index].load(std::memory_order_relaxed);
+		TotalCurrentBytes += Current;
+		Ar.Logf(TEXT("  %-16s %10.1f KB / %10.1f KB"), ConvaihttpMemory::LexToString(static_cast<EConvaihttpMemoryCategory>(Index)),
+			Current / 1024.0, PeakBytes[Index].load(std::memory_order_relaxed) / 1024.0);
+	}
+	Ar.Logf(TEXT("  %-16s %10.1f KB"), TEXT("Total"), TotalCurrentBytes / 1024.0);
+#else
+	Ar.Logf(TEXT("CONVAIHTTP memory stats are compiled out (CONVAIHTTP_MEMORY_STATS=0), use LLM tags under Convaihttp"));
+#endif
+}
@@ -0,0 +1,149 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/LowLevelMemTracker.h"
+#include <atomic>
+
+/** Account the memory of requests in FConvaihttpMemory. Costs an allocation size lookup per libcurl and OpenSSL allocation */
+#ifndef CONVAIHTTP_MEMORY_STATS
+	#define CONVAIHTTP_MEMORY_STATS !UE_BUILD_SHIPPING
+#endif
+
+/** LLM tags of the memory of the module, under Convaihttp */
+LLM_DECLARE_TAG(Convaihttp);
+LLM_DECLARE_TAG(Convaihttp_RequestPayload);
+LLM_DECLARE_TAG(Convaihttp_ResponsePayload);
+LLM_DECLARE_TAG(Convaihttp_Headers);
+LLM_DECLARE_TAG(Convaihttp_Curl);
+LLM_DECLARE_TAG(Convaihttp_OpenSSL);
+
+/**
+ * Categories of the memory of the module
+ */
+enum class EConvaihttpMemoryCategory : uint8
+{
+	/** Content of requests held until they are sent */
+	RequestPayload,
+	/** Content of responses accumulated in memory */
+	ResponsePayload,
+	/** Headers of requests and responses */
+	Headers,
+	/** Allocations of libcurl */
+	Curl,
+	/** Allocations of OpenSSL, where its memory functions are hooked */
+	OpenSSL,
+
+	Count
+};
+
+/**
+ * Current and peak bytes of each category of memory of the module, to find what holds memory when many requests are in
+ * flight. The same categories are LLM tags, so they also show in memory reports and Insights.
+ */
+class FConvaihttpMemory
+{
+public:
+	/** Add to, or remove from with a negative delta, the bytes of a category. Thread safe */
+	static void Add(EConvaihttpMemoryCategory Category, int64 DeltaBytes)
+	{
+#if CONVAIHTTP_MEMORY_STATS
+		const int32 Index = static_cast<int32>(Category);
+		const int64 Current = CurrentBytes[Index].fetch_add(DeltaBytes, std::memory_order_relaxed) + DeltaBytes;
+		int64 Peak = PeakBytes[Index].load(std::memory_order_relaxed);
+		while (Current > Peak && !PeakBytes[Index].compare_exchange_weak(Peak, Current, std::memory_order_relaxed))
+		{
+		}
+#endif
+	}
+
+	/** Account an allocation of the allocator made for a category, from the size the allocator reports */
+	static void AddAllocation(EConvaihttpMemoryCategory Category, void* Ptr)
+	{
+#if CONVAIHTTP_MEMORY_STATS
+		if (Ptr != nullptr)
+		{
+			Add(Category, static_cast<int64>(FMemory::GetAllocSize(Ptr)));
+		}
+#endif
+	}
+
+	/** Account an allocation about to be freed */
+	static void RemoveAllocation(EConvaihttpMemoryCategory Category, void* Ptr)
+	{
+#if CONVAIHTTP_MEMORY_STATS
+		if (Ptr != nullptr)
+		{
+			Add(Category, -static_cast<int64>(FMemory::GetAllocSize(Ptr)));
+		}
+#endif
+	}
+
+	/** @return bytes of a category currently held */
+	static int64 GetCurrentBytes(EConvaihttpMemoryCategory Category) { return CurrentBytes[static_cast<int32>(Category)].load(std::memory_order_relaxed); }
+
+	/** @return most bytes of a category held at once since the start, or the last reset of the peaks */
+	static int64 GetPeakBytes(EConvaihttpMemoryCategory Category) { return PeakBytes[static_cast<int32>(Category)].load(std::memory_order_relaxed); }
+
+	/** Set the peaks to the current values */
+	static void ResetPeaks();
+
+	/**
+	 * Print the current and peak bytes of each category
+	 *
+	 * @param Ar - output device to print to
+	 */
+	static void Dump(FOutputDevice& Ar);
+
+private:
+	static std::atomic<int64> CurrentBytes[static_cast<int32>(EConvaihttpMemoryCategory::Count)];
+	static std::atomic<int64> PeakBytes[static_cast<int32>(EConvaihttpMemoryCategory::Count)];
+};
+
+/**
+ * Bytes of a category held by one object, removed from the category when the object is destroyed
+ */
+class FConvaihttpTrackedMemory
+{
+public:
+	explicit FConvaihttpTrackedMemory(EConvaihttpMemoryCategory InCategory)
+		: Category(InCategory)
+	{
+	}
+
+	~FConvaihttpTrackedMemory()
+	{
+		Set(0);
+	}
+
+	FConvaihttpTrackedMemory(const FConvaihttpTrackedMemory&) = delete;
+	FConvaihttpTrackedMemory& operator=(const FConvaihttpTrackedMemory&) = delete;
+
+	/** Update the bytes held by the object. Not thread safe, the object is updated by one thread at a time */
+	void Set(int64 NewBytes)
+	{
+#if CONVAIHTTP_MEMORY_STATS
+		if (NewBytes != Bytes)
+		{
+			FConvaihttpMemory::Add(Category, NewBytes - Bytes);
+			Bytes = NewBytes;
+		}
+#endif
+	}
+
+private:
+	EConvaihttpMemoryCategory Category;
+	int64 Bytes = 0;
+};
+
+/** @return bytes allocated by a map of headers */
+inline int64 GetHeadersAllocatedSize(const TMap<FString, FString>& Headers)
+{
+	int64 Size = Headers.GetAllocatedSize();
+	for (const TPair<FString, FString>& Header : Headers)
+	{
+		Size += Header.Key.GetAllocatedSize() + Header.Value.GetAllocatedSize();
+	}
+	return Size;
+}
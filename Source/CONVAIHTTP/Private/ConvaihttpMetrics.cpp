@@ -0,0 +1,362 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "ConvaihttpMetrics.h"
+#include "Interfaces/IConvaihttpResponse.h"
+#include "PlatformConvaihttp.h"
+#include "Misc/OutputDevice.h"
+
+namespace ConvaihttpMetrics
+{
+	/** Raise an atomic to a value if it is below */
+	template <typename T>
+	void UpdateMax(std::atomic<T>& Max, T Value)
+	{
+		T Current = Max.load(std::memory_order_relaxed);
+		while (Value > Current && !Max.compare_exchange_weak(Current, Value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	FString GetHostKey(const FString& Url)
+	{
+		return FPlatformConvaihttp::GetUrlDomainAndPort(Url).ToLower();
+	}
+
+	double GetRatio(uint64 Numerator, uint64 Denominator)
+	{
+		return Denominator > 0 ? static_cast<double>(Numerator) / static_cast<double>(Denominator) : 0.0;
+	}
+}
+
+FConvaihttpLatencyHistogram::FConvaihttpLatencyHistogram()
+{
+	Reset();
+}
+
+void FConvaihttpLatencyHistogram::Record(double Seconds)
+{
+	const uint64 Microseconds = static_cast<uint64>(FMath::Max(Seconds, 0.0) * 1000000.0);
+	Buckets[GetBucketIndex(Microseconds)].fetch_add(1, std::memory_order_relaxed);
+	Count.fetch_add(1, std::memory_order_relaxed);
+	SumMicroseconds.fetch_add(Microseconds, std::memory_order_relaxed);
+	ConvaihttpMetrics::UpdateMax(MaxMicroseconds, Microseconds);
+}
+
+double FConvaihttpLatencyHistogram::GetPercentile(double Percentile) const
+{
+	const uint64 NumRecorded = GetCount();
+	if (NumRecorded == 0)
+	{
+		return 0.0;
+	}
+
+	const uint64 Rank = FMath::Clamp<uint64>(static_cast<uint64>(FMath::CeilToDouble(FMath::Clamp(Percentile, 0.0, 1.0) * static_cast<double>(NumRecorded))), 1, NumRecorded);
+	uint64 NumBelow = 0;
+	for (int32 BucketIndex = 0; BucketIndex < NumBuckets; ++BucketIndex)
+	{
+		NumBelow += Buckets[BucketIndex].load(std::memory_order_relaxed);
+		if (NumBelow >= Rank)
+		{
+			// The bucket bound can't be above the highest value actually recorded
+			const uint64 Microseconds = FMath::Min(GetBucketHighestMicroseconds(BucketIndex), MaxMicroseconds.load(std::memory_order_relaxed));
+			return static_cast<double>(Microseconds) / 1000000.0;
+		}
+	}
+	return GetMax();
+}
+
+double FConvaihttpLatencyHistogram::GetMean() const
+{
+	const uint64 NumRecorded = GetCount();
+	return NumRecorded > 0 ? static_cast<double>(SumMicroseconds.load(std::memory_order_relaxed)) / static_cast<double>(NumRecorded) / 1000000.0 : 0.0;
+}
+
+void FConvaihttpLatencyHistogram::Reset()
+{
+	for (std::atomic<uint64>& Bucket : Buckets)
+	{
+		Bucket.store(0, std::memory_order_relaxed);
+	}
+	Count.store(0, std::memory_order_relaxed);
+	SumMicroseconds.store(0, std::memory_order_relaxed);
+	MaxMicroseconds.store(0, std::memory_order_relaxed);
+}
+
+int32 FConvaihttpLatencyHistogram::GetBucketIndex(uint64 Microseconds)
+{
+	if (Microseconds < NumSubBuckets)
+	{
+		// The first range is exact
+		return static_cast<int32>(Microseconds);
+	}
+
+	// Range R >= 1 covers [NumSubBuckets << (R - 1), NumSubBuckets << R) in buckets of 1 << (R - 1)
+	const int32 HighestBit = static_cast<int32>(FMath::FloorLog2_64(Microseconds));
+	const int32 Range = HighestBit - SubBucketBits + 1;
+	if (Range >= NumRanges)
+	{
+		return NumBuckets - 1;
+	}
+	const int32 SubBucket = static_cast<int32>((Microseconds >> (HighestBit - SubBucketBits)) & (NumSubBuckets - 1));
+	return Range * NumSubBuckets + SubBucket;
+}
+
+uint64 FConvaihttpLatencyHistogram::GetBucketHighestMicroseconds(int32 BucketIndex)
+{
+	const int32 Range = BucketIndex >> SubBucketBits;
+	const int32 SubBucket = BucketIndex & (NumSubBuckets - 1);
+	if (Range == 0)
+	{
+		return static_cast<uint64>(SubBucket);
+	}
+	return (static_cast<uint64>(NumSubBuckets + SubBucket + 1) << (Range - 1)) - 1;
+}
+
+void FConvaihttpHostMetrics::Reset()
+{
+	NumRequests = 0;
+	NumSucceeded = 0;
+	NumFailed = 0;
+	NumTimeouts = 0;
+	NumRetries = 0;
+	NumTimedRequests = 0;
+	NumConnectionsReused = 0;
+	BytesSent = 0;
+	BytesReceived = 0;
+	QueueWaitLatency.Reset();
+	FirstByteLatency.Reset();
+	TotalLatency.Reset();
+}
+
+FConvaihttpMetrics& FConvaihttpMetrics::Get()
+{
+	static FConvaihttpMetrics Metrics;
+	return Metrics;
+}
+
+FConvaihttpMetrics::FConvaihttpMetrics()
+	: OtherHosts(TEXT("other"))
+{
+	for (std::atomic<FConvaihttpHostMetrics*>& Host : Hosts)
+	{
+		Host.store(nullptr);
+	}
+}
+
+FConvaihttpMetrics::~FConvaihttpMetrics()
+{
+	for (std::atomic<FConvaihttpHostMetrics*>& Host : Hosts)
+	{
+		delete Host.exchange(nullptr);
+	}
+}
+
+FConvaihttpHostMetrics& FConvaihttpMetrics::FindOrAddHost(const FString& Url)
+{
+	const FString HostKey = ConvaihttpMetrics::GetHostKey(Url);
+	const uint32 Hash = GetTypeHash(HostKey);
+
+	FConvaihttpHostMetrics* NewHost = nullptr;
+	for (int32 Probe = 0; Probe < MaxHosts; ++Probe)
+	{
+		std::atomic<FConvaihttpHostMetrics*>& Slot = Hosts[(Hash + Probe) % MaxHosts];
+		FConvaihttpHostMetrics* Host = Slot.load(std::memory_order_acquire);
+		if (Host == nullptr)
+		{
+			if (NewHost == nullptr)
+			{
+				NewHost = new FConvaihttpHostMetrics(HostKey);
+			}
+			if (Slot.compare_exchange_strong(Host, NewHost, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				return *NewHost;
+			}
+			// Another thread registered a host in the slot first, Host now points to it
+		}
+		if (Host->Host == HostKey)
+		{
+			delete NewHost;
+			return *Host;
+		}
+	}
+
+	delete NewHost;
+	return OtherHosts;
+}
+
+void FConvaihttpMetrics::RecordRequestCompleted(const IConvaihttpRequest& Request)
+{
+	FConvaihttpHostMetrics& Host = FindOrAddHost(Request.GetURL());
+	Host.NumRequests.fetch_add(1, std::memory_order_relaxed);
+	if (Request.GetStatus() == EConvaihttpRequestStatus::Succeeded)
+	{
+		Host.NumSucceeded.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		Host.NumFailed.fetch_add(1, std::memory_order_relaxed);
+	}
+	Host.BytesSent.fetch_add(Request.GetContentLength(), std::memory_order_relaxed);
+
+	const FConvaihttpResponsePtr Response = Request.GetResponse();
+	if (!Response.IsValid())
+	{
+		return;
+	}
+
+	Host.BytesReceived.fetch_add(Response->GetContentLength(), std::memory_order_relaxed);
+
+	const FConvaihttpResponseTimings Timings = Response->GetTimings();
+	if (Timings.bIsValid)
+	{
+		Host.NumTimedRequests.fetch_add(1, std::memory_order_relaxed);
+		if (Timings.bConnectionReused)
+		{
+			Host.NumConnectionsReused.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (Timings.QueueWaitSeconds >= 0.0)
+		{
+			Host.QueueWaitLatency.Record(Timings.QueueWaitSeconds);
+		}
+		if (Timings.FirstByteSeconds >= 0.0)
+		{
+			Host.FirstByteLatency.Record(Timings.FirstByteSeconds);
+		}
+		if (Timings.TotalSeconds >= 0.0)
+		{
+			Host.TotalLatency.Record(Timings.TotalSeconds);
+		}
+	}
+	else
+	{
+		// Implementations without timings still have the coarse elapsed time
+		Host.TotalLatency.Record(Request.GetElapsedTime());
+	}
+}
+
+void FConvaihttpMetrics::RecordRetry(const FString& Url)
+{
+	FindOrAddHost(Url).NumRetries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FConvaihttpMetrics::RecordTimeout(const FString& Url)
+{
+	FindOrAddHost(Url).NumTimeouts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FConvaihttpMetrics::SetQueueDepth(int32 NumQueued, int32 InNumRunning)
+{
+	QueueDepth.store(NumQueued, std::memory_order_relaxed);
+	NumRunning.store(InNumRunning, std::memory_order_relaxed);
+	ConvaihttpMetrics::UpdateMax(PeakQueueDepth, NumQueued);
+	ConvaihttpMetrics::UpdateMax(PeakNumRunning, InNumRunning);
+}
+
+void FConvaihttpMetrics::Reset()
+{
+	for (std::atomic<FConvaihttpHostMetrics*>& Host : Hosts)
+	{
+		if (FConvaihttpHostMetrics* HostMetrics = Host.load(std::memory_order_acquire))
+		{
+			HostMetrics->Reset();
+		}
+	}
+	OtherHosts.Reset();
+	PeakQueueDepth.store(QueueDepth.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	PeakNumRunning.store(NumRunning.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void FConvaihttpMetrics::ForEachHost(TFunctionRef<void(const FConvaihttpHostMetrics&)> Function) const
+{
+	for (const std::atomic<FConvaihttpHostMetrics*>& Host : Hosts)
+	{
+		if (const FConvaihttpHostMetrics* HostMetrics = Host.load(std::memory_order_acquire))
+		{
+			Function(*HostMetrics);
+		}
+	}
+	if (OtherHosts.NumRequests.load(std::memory_order_relaxed) > 0 || OtherHosts.NumRetries.load(std::memory_order_relaxed) > 0)
+	{
+		Function(OtherHosts);
+	}
+}
+
+void FConvaihttpMetrics::Dump(FOutputDevice& Ar) const
+{
+	Ar.Logf(TEXT("CONVAIHTTP stats: %d queued (peak %d), %d running (peak %d)"),
+		QueueDepth.load(std::memory_order_relaxed), PeakQueueDepth.load(std::memory_order_relaxed),
+		NumRunning.load(std::memory_order_relaxed), PeakNumRunning.load(std::memory_order_relaxed));
+
+	ForEachHost([&Ar](const FConvaihttpHostMetrics& Host)
+	{
+		Ar.Logf(TEXT("  %s: %llu requests (%llu ok, %llu failed, %llu timeouts, %llu retries), %.1f%% connections reused, %llu bytes sent, %llu bytes received"),
+			*Host.Host, Host.NumRequests.load(), Host.NumSucceeded.load(), Host.NumFailed.load(), Host.NumTimeouts.load(), Host.NumRetries.load(),
+			ConvaihttpMetrics::GetRatio(Host.NumConnectionsReused.load(), Host.NumTimedRequests.load()) * 100.0, Host.BytesSent.load(), Host.BytesReceived.load());
+
+		auto LogHistogram = [&Ar](const TCHAR* Name, const FConvaihttpLatencyHistogram& Histogram)
+		{
+			if (Histogram.GetCount() > 0)
+			{
+				Ar.Logf(TEXT("    %-10s mean %8.2fms  p50 %8.2fms  p90 %8.2fms  p99 %8.2fms  max %8.2fms"), Name,
+					Histogram.GetMean() * 1000.0, Histogram.GetPercentile(0.5) * 1000.0, Histogram.GetPercentile(0.9) * 1000.0,
+					Histogram.GetPercentile(0.99) * 1000.0, Histogram.GetMax() * 1000.0);
+			}
+		};
+		LogHistogram(TEXT("queue"), Host.QueueWaitLatency);
+		LogHistogram(TEXT("first byte"), Host.FirstByteLatency);
+		LogHistogram(TEXT("total"), Host.TotalLatency);
+	});
+}
+
+FString FConvaihttpMetrics::ExportCsv() const
+{
+	FString Csv(TEXT("host,requests,succeeded,failed,timeouts,retries,connection_reuse_ratio,bytes_sent,bytes_received,"
+		"queue_p50_ms,queue_p99_ms,ttfb_mean_ms,ttfb_p50_ms,ttfb_p90_ms,ttfb_p99_ms,ttfb_max_ms,total_mean_ms,total_p50_ms,total_p90_ms,total_p99_ms,total_max_ms\n"));
+
+	ForEachHost([&Csv](const FConvaihttpHostMetrics& Host)
+	{
+		const FConvaihttpLatencyHistogram& FirstByte = Host.FirstByteLatency;
+		const FConvaihttpLatencyHistogram& Total = Host.TotalLatency;
+		Csv += FString::Printf(TEXT("%s,%llu,%llu,%llu,%llu,%llu,%.4f,%llu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n"),
+			*Host.Host, Host.NumRequests.load(), Host.NumSucceeded.load(), Host.NumFailed.load(), Host.NumTimeouts.load(), Host.NumRetries.load(),
+			ConvaihttpMetrics::GetRatio(Host.NumConnectionsReused.load(), Host.NumTimedRequests.load()), Host.BytesSent.load(), Host.BytesReceived.load(),
+			Host.QueueWaitLatency.GetPercentile(0.5) * 1000.0, Host.QueueWaitLatency.GetPercentile(0.99) * 1000.0,
+			FirstByte.GetMean() * 1000.0, FirstByte.GetPercentile(0.5) * 1000.0, FirstByte.GetPercentile(0.9) * 1000.0, FirstByte.GetPercentile(0.99) * 1000.0, FirstByte.GetMax() * 1000.0,
+			Total.GetMean() * 1000.0, Total.GetPercentile(0.5) * 1000.0, Total.GetPercentile(0.9) * 1000.0, Total.GetPercentile(0.99) * 1000.0, Total.GetMax() * 1000.0);
+	});
+
+	return Csv;
+}
+
+FString FConvaihttpMetrics::ExportJson() const
+{
+	auto HistogramToJson = [](const FConvaihttpLatencyHistogram& Histogram)
+	{
+		return FString::Printf(TEXT("{\"count\":%llu,\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}"),
+			Histogram.GetCount(), Histogram.GetMean() * 1000.0, Histogram.GetPercentile(0.5) * 1000.0, Histogram.GetPercentile(0.9) * 1000.0,
+			Histogram.GetPercentile(0.99) * 1000.0, Histogram.GetMax() * 1000.0);
+	};
+
+	FString Json = FString::Printf(TEXT("{\"queued\":%d,\"peak_queued\":%d,\"running\":%d,\"peak_running\":%d,\"hosts\":["),
+		QueueDepth.load(std::memory_order_relaxed), PeakQueueDepth.load(std::memory_order_relaxed),
+		NumRunning.load(std::memory_order_relaxed), PeakNumRunning.load(std::memory_order_relaxed));
+
+	bool bFirstHost = true;
+	ForEachHost([&Json, &bFirstHost, &HistogramToJson](const FConvaihttpHostMetrics& Host)
+	{
+		if (!bFirstHost)
+		{
+			Json += TEXT(",");
+		}
+		bFirstHost = false;
+
+		Json += FString::Printf(TEXT("{\"host\":\"%s\",\"requests\":%llu,\"succeeded\":%llu,\"failed\":%llu,\"timeouts\":%llu,\"retries\":%llu,\"connection_reuse_ratio\":%.4f,\"bytes_sent\":%llu,\"bytes_received\":%llu,"),
+			*Host.Host.ReplaceCharWithEscapedChar(), Host.NumRequests.load(), Host.NumSucceeded.load(), Host.NumFailed.load(), Host.NumTimeouts.load(), Host.NumRetries.load(),
+			ConvaihttpMetrics::GetRatio(Host.NumConnectionsReused.load(), Host.NumTimedRequests.load()), Host.BytesSent.load(), Host.BytesReceived.load());
+		Json += FString::Printf(TEXT("\"queue_wait\":%s,\"first_byte\":%s,\"total\":%s}"),
+			*HistogramToJson(Host.QueueWaitLatency), *HistogramToJson(Host.FirstByteLatency), *HistogramToJson(Host.TotalLatency));
+	});
+
+	Json += TEXT("]}");
+	return Json;
+}
@@ -6,9 +6,19 @@
 #include "ConvaihttpManager.h"
 #include "Convaihttp.h"
 #include "NullConvaihttp.h"
+#include "SimulatedConvaihttp.h"
 #include "ConvaihttpTests.h"
+#include "ConvaihttpMetrics.h"
+#include "ConvaihttpMemory.h"
+#include "ConvaihttpSlowRequestSampler.h"
+#include "ConvaihttpTrace.h"
+#include "ConvaihttpTrafficCapture.h"
+#include "Curl/CurlConvaihttpManager.h"
+#include "Curl/CurlConvaihttpWebSocket.h"
 #include "Misc/CommandLine.h"
 #include "Misc/CoreDelegates.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
 
 DEFINE_LOG_CATEGORY(LogConvaihttp);
 
@@ -39,12 +49,15 @@ void FConvaihttpModule::UpdateConfigs()
 	GConfig->GetInt(TEXT("CONVAIHTTP"), TEXT("ConvaihttpMaxConnectionsPerServer"), ConvaihttpMaxConnectionsPerServer, GEngineIni);
 	GConfig->GetBool(TEXT("CONVAIHTTP"), TEXT("bEnableConvaihttp"), bEnableConvaihttp, GEngineIni);
 	GConfig->GetBool(TEXT("CONVAIHTTP"), TEXT("bUseNullConvaihttp"), bUseNullConvaihttp, GEngineIni);
+	GConfig->GetBool(TEXT("CONVAIHTTP"), TEXT("bUseSimulatedConvaihttp"), bUseSimulatedConvaihttp, GEngineIni);
 	GConfig->GetFloat(TEXT("CONVAIHTTP"), TEXT("ConvaihttpDelayTime"), ConvaihttpDelayTime, GEngineIni);
 	GConfig->GetFloat(TEXT("CONVAIHTTP"), TEXT("ConvaihttpThreadActiveFrameTimeInSeconds"), ConvaihttpThreadActiveFrameTimeInSeconds, GEngineIni);
 	GConfig->GetFloat(TEXT("CONVAIHTTP"), TEXT("ConvaihttpThreadActiveMinimumSleepTimeInSeconds"), ConvaihttpThreadActiveMinimumSleepTimeInSeconds, GEngineIni);
 	GConfig->GetFloat(TEXT("CONVAIHTTP"), TEXT("ConvaihttpThreadIdleFrameTimeInSeconds"), ConvaihttpThreadIdleFrameTimeInSeconds, GEngineIni);
 	GConfig->GetFloat(TEXT("CONVAIHTTP"), TEXT("ConvaihttpThreadIdleMinimumSleepTimeInSeconds"), ConvaihttpThreadIdleMinimumSleepTimeInSeconds, GEngineIni);
 
+	FSimulatedConvaihttpRequest::UpdateConfigs();
+
 	AllowedDomains.Empty();
 	GConfig->GetArray(TEXT("CONVAIHTTP"), TEXT("AllowedDomains"), AllowedDomains, GEngineIni);
 
@@ -66,6 +79,7 @@ void FConvaihttpModule::StartupModule()
 	ConvaihttpMaxConnectionsPerServer = 16;
 	bEnableConvaihttp = true;
 	bUseNullConvaihttp = false;
+	bUseSimulatedConvaihttp = false;
 	ConvaihttpDelayTime = 0;
 	ConvaihttpThreadActiveFrameTimeInSeconds = 1.0f / 200.0f; // 200Hz
 	ConvaihttpThreadActiveMinimumSleepTimeInSeconds = 0.0f;
@@ -121,6 +135,9 @@ void FConvaihttpModule::ShutdownModule()
 		ConvaihttpManager->Flush(EConvaihttpFlushReason::Shutdown);
 	}
 
+	// close the capture once the flushed requests are recorded
+	FConvaihttpTrafficCapture::Stop();
+
 	// at least on Linux, the code in CONVAIHTTP manager (e.g. request destructors) expects platform to be initialized yet
 	delete ConvaihttpManager;	// can be passed NULLs
 
@@ -130,34 +147,255 @@ void FConvaihttpModule::ShutdownModule()
 	Singleton = nullptr;
 }
 
+/** Save exported stats to the file given with File=, or print them */
+static void ExportStats(const FString& Stats, const TCHAR* Cmd, FOutputDevice& Ar)
+{
+	FString Filename;
+	if (FParse::Value(Cmd, TEXT("File="), Filename))
+	{
+		if (FFileHelper::SaveStringToFile(Stats, *Filename))
+		{
+			Ar.Logf(TEXT("CONVAIHTTP stats saved to %s"), *Filename);
+		}
+		else
+		{
+			Ar.Logf(TEXT("Failed to save CONVAIHTTP stats to %s"), *Filename);
+		}
+	}
+	else
+	{
+		Ar.Log(Stats);
+	}
+}
+
 bool FConvaihttpModule::HandleCONVAIHTTPCommand(const TCHAR* Cmd, FOutputDevice& Ar)
 {
 	if (FParse::Command(&Cmd, TEXT("TEST")))
 	{
-		int32 Iterations=1;
-		FString IterationsStr;
-		FParse::Token(Cmd, IterationsStr, true);
-		if (!IterationsStr.IsEmpty())
+		// Without a url the requests go to a loopback server started for the test
+		FConvaihttpLoadTest::FSettings Settings;
+		FParse::Value(Cmd, TEXT("Concurrency="), Settings.Concurrency);
+		FParse::Value(Cmd, TEXT("Rate="), Settings.RequestsPerSecond);
+		FParse::Value(Cmd, TEXT("Duration="), Settings.DurationSeconds);
+		FParse::Value(Cmd, TEXT("Requests="), Settings.MaxRequests);
+		FParse::Value(Cmd, TEXT("RequestSize="), Settings.RequestSize);
+		FParse::Value(Cmd, TEXT("ResponseSize="), Settings.ResponseSize);
+		FParse::Value(Cmd, TEXT("Url="), Settings.Url);
+		Settings.bHttp2 = FParse::Param(Cmd, TEXT("Http2"));
+		TSharedRef<FConvaihttpLoadTest> LoadTest = MakeShared<FConvaihttpLoadTest>(Settings);
+		if (!LoadTest->Run())
+		{
+			Ar.Logf(TEXT("Load test failed to start"));
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("SSEBENCH")))
+	{
+		// The stream is served by the simulated transport
+		FConvaihttpServerSentEventsBenchmark::FSettings Settings;
+		FParse::Value(Cmd, TEXT("Events="), Settings.NumEvents);
+		FParse::Value(Cmd, TEXT("DataSize="), Settings.EventDataSize);
+		FParse::Value(Cmd, TEXT("ChunkSize="), Settings.ChunkSize);
+		FParse::Value(Cmd, TEXT("Interval="), Settings.IntervalMs);
+		if (!MakeShared<FConvaihttpServerSentEventsBenchmark>(Settings)->Run())
+		{
+			Ar.Logf(TEXT("SSE benchmark failed to start"));
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("FRAMEBENCH")))
+	{
+		int32 NumMessages = 100000;
+		int32 ChunkSize = 16 * 1024;
+		FParse::Value(Cmd, TEXT("Messages="), NumMessages);
+		FParse::Value(Cmd, TEXT("ChunkSize="), ChunkSize);
+		FConvaihttpFrameDecoderBenchmark::Run(NumMessages, ChunkSize, Ar);
+	}
+	else if (FParse::Command(&Cmd, TEXT("RETRYBENCH")))
+	{
+		int32 NumEntries = 10000;
+		int32 NumUpdates = 100;
+		FParse::Value(Cmd, TEXT("Entries="), NumEntries);
+		FParse::Value(Cmd, TEXT("Updates="), NumUpdates);
+		FConvaihttpRetrySystemBenchmark::Run(NumEntries, NumUpdates, Ar);
+	}
+	else if (FParse::Command(&Cmd, TEXT("WSBENCH")))
+	{
+		// Without urls both endpoints are served by a loopback server
+		FString WebSocketUrl, PostUrl;
+		FParse::Value(Cmd, TEXT("WebSocketUrl="), WebSocketUrl);
+		FParse::Value(Cmd, TEXT("PostUrl="), PostUrl);
+		int32 NumRoundTrips = 100;
+		int32 MessageSize = 256;
+		FParse::Value(Cmd, TEXT("Count="), NumRoundTrips);
+		FParse::Value(Cmd, TEXT("Size="), MessageSize);
+		MakeShared<FConvaihttpWebSocketBenchmark>(WebSocketUrl, PostUrl, NumRoundTrips, MessageSize)->Run();
+	}
+	else if (FParse::Command(&Cmd, TEXT("SEGBENCH")))
+	{
+		// Without a url the resource is served by a loopback server throttling each connection to MBps=
+		FConvaihttpSegmentedDownloadBenchmark::FSettings Settings;
+		int32 SegmentSizeMB = 4;
+		int32 SizeMB = 32;
+		double MegabytesPerSecond = 4.0;
+		FParse::Value(Cmd, TEXT("Url="), Settings.Url);
+		FParse::Value(Cmd, TEXT("Segments="), Settings.MaxSegments);
+		FParse::Value(Cmd, TEXT("SegmentSizeMB="), SegmentSizeMB);
+		FParse::Value(Cmd, TEXT("SizeMB="), SizeMB);
+		FParse::Value(Cmd, TEXT("MBps="), MegabytesPerSecond);
+		Settings.SegmentSize = static_cast<uint64>(FMath::Max(SegmentSizeMB, 1)) * 1024 * 1024;
+		Settings.ResourceSize = static_cast<uint64>(FMath::Max(SizeMB, 1)) * 1024 * 1024;
+		Settings.BytesPerSecond = static_cast<int64>(MegabytesPerSecond * 1024.0 * 1024.0);
+		TSharedRef<FConvaihttpSegmentedDownloadBenchmark> Benchmark = MakeShared<FConvaihttpSegmentedDownloadBenchmark>(Settings);
+		if (!Benchmark->Run())
+		{
+			Ar.Logf(TEXT("Segmented download benchmark failed to start"));
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("STATS")))
+	{
+		FConvaihttpMetrics& Metrics = FConvaihttpMetrics::Get();
+		if (FParse::Command(&Cmd, TEXT("RESET")))
+		{
+			Metrics.Reset();
+		}
+		else if (FParse::Command(&Cmd, TEXT("CSV")))
+		{
+			ExportStats(Metrics.ExportCsv(), Cmd, Ar);
+		}
+		else if (FParse::Command(&Cmd, TEXT("JSON")))
+		{
+			ExportStats(Metrics.ExportJson(), Cmd, Ar);
+		}
+		else
+		{
+			Metrics.Dump(Ar);
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("SLOWDUMP")))
+	{
+		if (FParse::Command(&Cmd, TEXT("RESET")))
+		{
+			FConvaihttpSlowRequestSampler::Get().Reset();
+		}
+		else
+		{
+			FConvaihttpSlowRequestSampler::Get().Dump(Ar);
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("TRACE")))
+	{
+		if (FParse::Command(&Cmd, TEXT("START")))
+		{
+			FConvaihttpTrace::StartCapture();
+		}
+		else if (FParse::Command(&Cmd, TEXT("STOP")))
+		{
+			FConvaihttpTrace::StopCapture();
+		}
+		else if (FParse::Command(&Cmd, TEXT("DUMP")))
+		{
+			FString Filename;
+			if (!FParse::Value(Cmd, TEXT("File="), Filename))
+			{
+				Filename = FPaths::ProfilingDir() / FString::Printf(TEXT("ConvaihttpTrace-%s.json"), *FDateTime::Now().ToString());
+			}
+			if (FConvaihttpTrace::SaveChromeTrace(Filename))
+			{
+				Ar.Logf(TEXT("CONVAIHTTP trace saved to %s"), *Filename);
+			}
+			else
+			{
+				Ar.Logf(TEXT("Failed to save CONVAIHTTP trace to %s"), *Filename);
+			}
+		}
+		else
+		{
+			Ar.Logf(TEXT("Usage: CONVAIHTTP TRACE START|STOP|DUMP [File=<path>]. Capture is %s"), FConvaihttpTrace::IsCapturing() ? TEXT("running") : TEXT("stopped"));
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("CAPTURE")))
+	{
+		if (FParse::Command(&Cmd, TEXT("START")))
+		{
+			FString Filename;
+			if (!FParse::Value(Cmd, TEXT("File="), Filename))
+			{
+				Filename = FPaths::ProfilingDir() / FString::Printf(TEXT("ConvaihttpCapture-%s.bin"), *FDateTime::Now().ToString());
+			}
+			int64 MaxBodySize = 64 * 1024;
+			FParse::Value(Cmd, TEXT("MaxBodySize="), MaxBodySize);
+			const bool bCaptureBodies = FParse::Param(Cmd, TEXT("Bodies"));
+			const bool bStripQueryStrings = FParse::Param(Cmd, TEXT("StripQuery"));
+			if (!FConvaihttpTrafficCapture::Start(Filename, bCaptureBodies, MaxBodySize, bStripQueryStrings))
+			{
+				Ar.Logf(TEXT("Failed to capture CONVAIHTTP traffic to %s"), *Filename);
+			}
+		}
+		else if (FParse::Command(&Cmd, TEXT("STOP")))
 		{
-			Iterations = FCString::Atoi(*IterationsStr);
-		}		
-		FString Url;
-		FParse::Token(Cmd, Url, true);
-		if (Url.IsEmpty())
+			FConvaihttpTrafficCapture::Stop();
+		}
+		else
 		{
-			Url = TEXT("convaihttp://www.google.com");
-		}		
-		FConvaihttpTest* ConvaihttpTest = new FConvaihttpTest(TEXT("GET"),TEXT(""),Url,Iterations);
-		ConvaihttpTest->Run();
+			Ar.Logf(TEXT("Usage: CONVAIHTTP CAPTURE START [File=<path>] [-Bodies] [MaxBodySize=<bytes>] [-StripQuery] | STOP. Capture is %s"), FConvaihttpTrafficCapture::IsCapturing() ? TEXT("running") : TEXT("stopped"));
+		}
+	}
+	else if (FParse::Command(&Cmd, TEXT("REPLAY")))
+	{
+		// Without a url the requests go to the simulated transport when enabled, else to a loopback server
+		FConvaihttpTrafficReplay::FSettings Settings;
+		FParse::Value(Cmd, TEXT("File="), Settings.Filename);
+		FParse::Value(Cmd, TEXT("Speed="), Settings.Speed);
+		FParse::Value(Cmd, TEXT("Url="), Settings.Url);
+		if (Settings.Filename.IsEmpty())
+		{
+			Ar.Logf(TEXT("Usage: CONVAIHTTP REPLAY File=<path> [Speed=<factor>] [Url=<scheme://host:port>]"));
+		}
+		else
+		{
+			TSharedRef<FConvaihttpTrafficReplay> Replay = MakeShared<FConvaihttpTrafficReplay>(Settings);
+			if (!Replay->Run())
+			{
+				Ar.Logf(TEXT("Replay of %s failed to start"), *Settings.Filename);
+			}
+		}
 	}
 	else if (FParse::Command(&Cmd, TEXT("DUMPREQ")))
 	{
 		GetConvaihttpManager().DumpRequests(Ar);
 	}
+	else if (FParse::Command(&Cmd, TEXT("THREADSTATS")))
+	{
+		GetConvaihttpManager().DumpThreadStats(Ar);
+	}
+	else if (FParse::Command(&Cmd, TEXT("MEMSTATS")))
+	{
+		if (FParse::Command(&Cmd, TEXT("RESET")))
+		{
+			FConvaihttpMemory::ResetPeaks();
+		}
+		else
+		{
+			FConvaihttpMemory::Dump(Ar);
+		}
+	}
 	else if (FParse::Command(&Cmd, TEXT("FLUSH")))
 	{
 		GetConvaihttpManager().Flush(EConvaihttpFlushReason::Default);
 	}
+	else if (FParse::Command(&Cmd, TEXT("SIMULATE")))
+	{
+		// Requests created from now on are served by the simulated transport, see [CONVAIHTTP.SimulatedConvaihttp]
+		if (FParse::Command(&Cmd, TEXT("ON")))
+		{
+			FSimulatedConvaihttpRequest::UpdateConfigs();
+			ToggleSimulatedConvaihttp(true);
+		}
+		else if (FParse::Command(&Cmd, TEXT("OFF")))
+		{
+			ToggleSimulatedConvaihttp(false);
+		}
+		Ar.Logf(TEXT("Simulated CONVAIHTTP is %s"), IsSimulatedConvaihttpEnabled() ? TEXT("on") : TEXT("off"));
+	}
 #if !UE_BUILD_SHIPPING
 	else if (FParse::Command(&Cmd, TEXT("FILEUPLOAD")))
 	{
@@ -244,9 +482,29 @@ TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> FConvaihttpModule::CreateReq
 	{
 		return TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe>(new FNullConvaihttpRequest());
 	}
+	else if (bUseSimulatedConvaihttp && FPlatformConvaihttp::UsesThreadedConvaihttp())
+	{
+		// Simulated requests need the CONVAIHTTP thread, platforms without it keep their own implementation
+		return TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe>(new FSimulatedConvaihttpRequest());
+	}
 	else
 	{
 		// Create the platform specific Convaihttp request instance
 		return TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe>(FPlatformConvaihttp::ConstructRequest());
 	}
 }
+
+TSharedPtr<IConvaihttpWebSocket, ESPMode::ThreadSafe> FConvaihttpModule::CreateWebSocket(const FString& Url, const TArray<FString>& Protocols, const TMap<FString, FString>& UpgradeHeaders)
+{
+#if WITH_CURL_WEBSOCKETS
+	// Only the curl implementation supports WebSockets, and only when it is the one in use
+	if (!bUseNullConvaihttp && FCurlConvaihttpManager::IsInit() && FCurlConvaihttpWebSocket::IsSupported())
+	{
+		TSharedRef<FCurlConvaihttpWebSocket, ESPMode::ThreadSafe> WebSocket = MakeShareable(new FCurlConvaihttpWebSocket(Url, Protocols, UpgradeHeaders));
+		return WebSocket;
+	}
+#endif
+
+	UE_LOG(LogConvaihttp, Warning, TEXT("CreateWebSocket: WebSockets are not supported by this CONVAIHTTP implementation, can't connect to %s"), *Url);
+	return nullptr;
+}
@@ -7,7 +7,10 @@
 #include "ConvaihttpModule.h"
 #include "Convaihttp.h"
 #include "ConvaihttpManager.h"
+#include "ConvaihttpMetrics.h"
 #include "Stats/Stats.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/EngineVersionComparison.h"
 
 namespace FConvaihttpRetrySystem
 {
@@ -54,6 +57,291 @@ namespace FConvaihttpRetrySystem
 		}
 		return LockoutPeriod;
 	}
+
+	/**
+	 * Read the offset of the first byte of a partial response from its Content-Range header ("bytes 100-199/1000")
+	 * @return the offset, or -1 if there is no valid Content-Range
+	 */
+	static int64 ReadContentRangeStart(const FString& ContentRange)
+	{
+		FString Range;
+		if (!ContentRange.TrimStart().Split(TEXT(" "), nullptr, &Range) || Range.IsEmpty() || !FChar::IsDigit(Range[0]))
+		{
+			return -1;
+		}
+		return FCString::Atoi64(*Range);
+	}
+
+	/**
+	 * Response of a download that was resumed across attempts.
+	 * Holds the body received by all attempts, and otherwise looks like the last response, as if it had been a plain 200.
+	 */
+	class FResumedResponse : public IConvaihttpResponse
+	{
+	public:
+		FResumedResponse(const FConvaihttpResponseRef& InLastResponse, TArray64<uint8>&& InPayload)
+			: LastResponse(InLastResponse)
+			, Payload(MoveTemp(InPayload))
+		{
+		}
+
+		//~ Begin IConvaihttpBase Interface
+		virtual FString GetURL() const override { return LastResponse->GetURL(); }
+		virtual FString GetURLParameter(const FString& ParameterName) const override { return LastResponse->GetURLParameter(ParameterName); }
+		virtual FString GetHeader(const FString& HeaderName) const override
+		{
+			if (HeaderName.Equals(TEXT("Content-Range"), ESearchCase::IgnoreCase))
+			{
+				return FString();
+			}
+			if (HeaderName.Equals(TEXT("Content-Length"), ESearchCase::IgnoreCase))
+			{
+				return LexToString(Payload.Num());
+			}
+			return LastResponse->GetHeader(HeaderName);
+		}
+		virtual TArray64<FString> GetAllHeaders() const override
+		{
+			TArray64<FString> Headers = LastResponse->GetAllHeaders();
+			for (int64 Index = Headers.Num() - 1; Index >= 0; --Index)
+			{
+				if (Headers[Index].StartsWith(TEXT("Content-Range:"), ESearchCase::IgnoreCase))
+				{
+					Headers.RemoveAt(Index);
+				}
+				else if (Headers[Index].StartsWith(TEXT("Content-Length:"), ESearchCase::IgnoreCase))
+				{
+					Headers[Index] = FString::Printf(TEXT("Content-Length: %lld"), Payload.Num());
+				}
+			}
+			return Headers;
+		}
+		virtual FString GetContentType() const override { return LastResponse->GetContentType(); }
+		virtual uint64 GetContentLength() const override { return Payload.Num(); }
+		virtual const TArray64<uint8>& GetContent() const override { return Payload; }
+		//~ End IConvaihttpBase Interface
+
+		//~ Begin IConvaihttpResponse Interface
+		virtual int32 GetResponseCode() const override { return EConvaihttpResponseCodes::Ok; }
+		virtual FString GetContentAsString() const override
+		{
+			// Content is NOT null-terminated; we need to specify lengths here
+			FUTF8ToTCHAR TCHARData(reinterpret_cast<const ANSICHAR*>(Payload.GetData()), static_cast<int32>(Payload.Num()));
+			return FString(TCHARData.Length(), TCHARData.Get());
+		}
+		virtual TArray64<uint8> TakeContent() override { return MoveTemp(Payload); }
+		virtual FConvaihttpResponseTimings GetTimings() const override { return LastResponse->GetTimings(); }
+		//~ End IConvaihttpResponse Interface
+
+	private:
+		/** Response of the attempt that completed the download */
+		FConvaihttpResponseRef LastResponse;
+		/** Body received by all attempts */
+		TArray64<uint8> Payload;
+	};
+}
+
+int32 FConvaihttpRetrySystem::FRetryDomains::SelectDomain(bool& bOutIsProbe)
+{
+	bOutIsProbe = false;
+
+	FScopeLock Lock(&HealthCriticalSection);
+	const double NowAbsoluteSeconds = GetNowAbsoluteSeconds();
+	const int32 NumDomains = static_cast<int32>(Domains.Num());
+
+	// Recovering domains only come back once a probe succeeds, so they go first
+	TArray<int32, TInlineAllocator<16>> ClosedDomains;
+	bool bHasSamples = false;
+	for (int32 Index = 0; Index < NumDomains; ++Index)
+	{
+		if (TryAcquireProbeLocked(Index, NowAbsoluteSeconds))
+		{
+			bOutIsProbe = true;
+			return Index;
+		}
+		if (Health[Index].State == EDomainState::Closed)
+		{
+			ClosedDomains.Add(Index);
+			bHasSamples |= GetExpectedLatencyLocked(Index, NowAbsoluteSeconds) > 0.0f;
+		}
+	}
+
+	// Until some domain was measured there is nothing to compare, the active one is as good as any
+	if (!bSpreadFirstAttempts || !bHasSamples || ClosedDomains.Num() == 0)
+	{
+		return AcquireDomainLocked(ActiveIndex.Load(), bOutIsProbe, NowAbsoluteSeconds);
+	}
+	if (ClosedDomains.Num() == 1)
+	{
+		return ClosedDomains[0];
+	}
+
+	// Power of two choices
+	const int32 FirstChoice = SelectionRandomStream.RandHelper(ClosedDomains.Num());
+	int32 SecondChoice = SelectionRandomStream.RandHelper(ClosedDomains.Num() - 1);
+	if (SecondChoice >= FirstChoice)
+	{
+		++SecondChoice;
+	}
+	const int32 FirstIndex = ClosedDomains[FirstChoice];
+	const int32 SecondIndex = ClosedDomains[SecondChoice];
+	return GetExpectedLatencyLocked(SecondIndex, NowAbsoluteSeconds) < GetExpectedLatencyLocked(FirstIndex, NowAbsoluteSeconds) ? SecondIndex : FirstIndex;
+}
+
+int32 FConvaihttpRetrySystem::FRetryDomains::AcquireDomain(int32 PreferredIndex, bool& bOutIsProbe)
+{
+	bOutIsProbe = false;
+
+	FScopeLock Lock(&HealthCriticalSection);
+	return AcquireDomainLocked(PreferredIndex, bOutIsProbe, GetNowAbsoluteSeconds());
+}
+
+int32 FConvaihttpRetrySystem::FRetryDomains::AcquireDomainLocked(int32 PreferredIndex, bool& bOutIsProbe, double NowAbsoluteSeconds)
+{
+	const int32 NumDomains = static_cast<int32>(Domains.Num());
+
+	int32 SoonestIndex = PreferredIndex;
+	for (int32 Offset = 0; Offset < NumDomains; ++Offset)
+	{
+		const int32 Index = (PreferredIndex + Offset) % NumDomains;
+		bool bUseDomain = Health[Index].State == EDomainState::Closed;
+		if (!bUseDomain && TryAcquireProbeLocked(Index, NowAbsoluteSeconds))
+		{
+			bOutIsProbe = true;
+			bUseDomain = true;
+		}
+
+		if (bUseDomain)
+		{
+			if (Index != PreferredIndex)
+			{
+				// Move the requests that come next along too
+				ActiveIndex.CompareExchange(PreferredIndex, Index);
+			}
+			return Index;
+		}
+
+		if (Health[Index].State == EDomainState::Open && Health[Index].OpenEndTimeAbsoluteSeconds < Health[SoonestIndex].OpenEndTimeAbsoluteSeconds)
+		{
+			SoonestIndex = Index;
+		}
+	}
+
+	// Every domain is open, there is nothing better to do than try the one expected to recover first
+	return SoonestIndex;
+}
+
+bool FConvaihttpRetrySystem::FRetryDomains::TryAcquireProbeLocked(int32 Index, double NowAbsoluteSeconds)
+{
+	FDomainHealth& DomainHealth = Health[Index];
+	if (DomainHealth.State == EDomainState::Open && NowAbsoluteSeconds >= DomainHealth.OpenEndTimeAbsoluteSeconds)
+	{
+		DomainHealth.State = EDomainState::HalfOpen;
+		DomainHealth.bProbeInFlight = false;
+	}
+
+	if (DomainHealth.State != EDomainState::HalfOpen
+		|| (DomainHealth.bProbeInFlight && NowAbsoluteSeconds - DomainHealth.ProbeStartTimeAbsoluteSeconds < ProbeTimeoutSeconds))
+	{
+		return false;
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Probing %s to see whether it recovered"), *Domains[Index]);
+	DomainHealth.bProbeInFlight = true;
+	DomainHealth.ProbeStartTimeAbsoluteSeconds = NowAbsoluteSeconds;
+	return true;
+}
+
+float FConvaihttpRetrySystem::FRetryDomains::GetExpectedLatencyLocked(int32 Index, double NowAbsoluteSeconds) const
+{
+	const FDomainHealth& DomainHealth = Health[Index];
+	if (DomainHealth.LastSampleTimeAbsoluteSeconds == 0.0 || NowAbsoluteSeconds - DomainHealth.LastSampleTimeAbsoluteSeconds > LatencyMaxAgeSeconds)
+	{
+		// Unknown or stale, worth trying again to find out
+		return 0.0f;
+	}
+	// Failed attempts have to be made again, so a domain failing half of the time is as slow as one twice slower
+	return DomainHealth.LatencySeconds / FMath::Max(1.0f - DomainHealth.ErrorRate, 0.05f);
+}
+
+void FConvaihttpRetrySystem::FRetryDomains::ReportResult(int32 Index, bool bReachable, bool bWasProbe, bool bSucceeded, float LatencySeconds)
+{
+	FScopeLock Lock(&HealthCriticalSection);
+	if (!Health.IsValidIndex(Index))
+	{
+		return;
+	}
+
+	FDomainHealth& DomainHealth = Health[Index];
+	const double NowAbsoluteSeconds = GetNowAbsoluteSeconds();
+
+	if (DomainHealth.LastSampleTimeAbsoluteSeconds == 0.0)
+	{
+		DomainHealth.ErrorRate = bSucceeded ? 0.0f : 1.0f;
+		if (bReachable)
+		{
+			DomainHealth.LatencySeconds = LatencySeconds;
+		}
+	}
+	else
+	{
+		DomainHealth.ErrorRate += LatencySmoothing * ((bSucceeded ? 0.0f : 1.0f) - DomainHealth.ErrorRate);
+		if (bReachable)
+		{
+			DomainHealth.LatencySeconds += LatencySmoothing * (LatencySeconds - DomainHealth.LatencySeconds);
+		}
+	}
+	DomainHealth.LastSampleTimeAbsoluteSeconds = NowAbsoluteSeconds;
+
+	if (bReachable)
+	{
+		if (DomainHealth.State != EDomainState::Closed)
+		{
+			UE_LOG(LogConvaihttp, Log, TEXT("%s recovered, closing its circuit breaker"), *Domains[Index]);
+		}
+		DomainHealth.State = EDomainState::Closed;
+		DomainHealth.ConsecutiveFailures = 0;
+		DomainHealth.OpenSeconds = 0.0f;
+		DomainHealth.bProbeInFlight = false;
+		return;
+	}
+
+	if (bWasProbe || DomainHealth.State == EDomainState::HalfOpen)
+	{
+		// Still down, wait longer before the next probe
+		DomainHealth.OpenSeconds = FMath::Min(DomainHealth.OpenSeconds * 2.0f, MaxOpenSeconds);
+		OpenDomainLocked(Index, NowAbsoluteSeconds);
+	}
+	else if (DomainHealth.State == EDomainState::Closed && ++DomainHealth.ConsecutiveFailures >= FailureThreshold)
+	{
+		DomainHealth.OpenSeconds = OpenSeconds;
+		OpenDomainLocked(Index, NowAbsoluteSeconds);
+	}
+}
+
+void FConvaihttpRetrySystem::FRetryDomains::ReleaseProbe(int32 Index)
+{
+	FScopeLock Lock(&HealthCriticalSection);
+	if (Health.IsValidIndex(Index))
+	{
+		Health[Index].bProbeInFlight = false;
+	}
+}
+
+FConvaihttpRetrySystem::FRetryDomains::EDomainState FConvaihttpRetrySystem::FRetryDomains::GetDomainState(int32 Index) const
+{
+	FScopeLock Lock(&HealthCriticalSection);
+	return Health.IsValidIndex(Index) ? Health[Index].State : EDomainState::Closed;
+}
+
+void FConvaihttpRetrySystem::FRetryDomains::OpenDomainLocked(int32 Index, double NowAbsoluteSeconds)
+{
+	FDomainHealth& DomainHealth = Health[Index];
+	UE_LOG(LogConvaihttp, Warning, TEXT("%s is unreachable, skipping it for %.1fs"), *Domains[Index], DomainHealth.OpenSeconds);
+	DomainHealth.State = EDomainState::Open;
+	DomainHealth.OpenEndTimeAbsoluteSeconds = NowAbsoluteSeconds + DomainHealth.OpenSeconds;
+	DomainHealth.bProbeInFlight = false;
+	DomainHealth.ConsecutiveFailures = 0;
 }
 
 FConvaihttpRetrySystem::FRequest::FRequest(
@@ -98,25 +386,45 @@ bool FConvaihttpRetrySystem::FRequest::ProcessRequest()
 	TSharedRef<FRequest, ESPMode::ThreadSafe> RetryRequest = StaticCastSharedRef<FRequest>(AsShared());
 
 	OriginalUrl = ConvaihttpRequest->GetURL();
+	bCancelled = false;
 	if (RetryDomains.IsValid())
 	{
+		RetryDomainsIndex = RetryDomains->SelectDomain(bIsDomainProbe);
 		SetUrlFromRetryDomains();
 	}
 
+	ResetRangeResume();
+	ResumedResponse.Reset();
+	bCallerSetRange = !ConvaihttpRequest->GetHeader(TEXT("Range")).IsEmpty();
+
+	HedgeRequest.Reset();
+	if (HedgeLatencyPercentile > 0.0f)
+	{
+		RetryManager.HedgeBudgetTokens = FMath::Min(RetryManager.HedgeBudgetTokens + RetryManager.HedgeBudgetRatio, RetryManager.HedgeBudgetCapacity);
+	}
+	BeginAttempt();
+
 	ConvaihttpRequest->OnRequestProgress().BindThreadSafeSP(RetryRequest, &FConvaihttpRetrySystem::FRequest::ConvaihttpOnRequestProgress);
+	ConvaihttpRequest->OnProcessRequestComplete().BindThreadSafeSP(RetryRequest, &FConvaihttpRetrySystem::FRequest::ConvaihttpOnProcessRequestComplete);
 
 	return RetryManager.ProcessRequest(RetryRequest);
 }
 
-void FConvaihttpRetrySystem::FRequest::SetUrlFromRetryDomains()
+FString FConvaihttpRetrySystem::FRequest::GetUrlForRetryDomain(int32 DomainIndex) const
 {
 	check(RetryDomains.IsValid());
 	FString OriginalUrlDomainAndPort = FPlatformConvaihttp::GetUrlDomainAndPort(OriginalUrl);
-	if (!OriginalUrlDomainAndPort.IsEmpty())
+	if (OriginalUrlDomainAndPort.IsEmpty())
 	{
-		const FString Url(OriginalUrl.Replace(*OriginalUrlDomainAndPort, *RetryDomains->Domains[RetryDomainsIndex]));
-		ConvaihttpRequest->SetURL(Url);
+		return ConvaihttpRequest->GetURL();
 	}
+	return OriginalUrl.Replace(*OriginalUrlDomainAndPort, *RetryDomains->Domains[DomainIndex]);
+}
+
+void FConvaihttpRetrySystem::FRequest::SetUrlFromRetryDomains()
+{
+	check(RetryDomains.IsValid());
+	ConvaihttpRequest->SetURL(GetUrlForRetryDomain(RetryDomainsIndex));
 }
 
 void FConvaihttpRetrySystem::FRequest::MoveToNextRetryDomain()
@@ -130,24 +438,553 @@ void FConvaihttpRetrySystem::FRequest::MoveToNextRetryDomain()
 	SetUrlFromRetryDomains();
 }
 
+void FConvaihttpRetrySystem::FRequest::AcquireRetryDomain()
+{
+	check(RetryDomains.IsValid());
+	RetryDomainsIndex = RetryDomains->AcquireDomain(RetryDomainsIndex, bIsDomainProbe);
+	SetUrlFromRetryDomains();
+}
+
 void FConvaihttpRetrySystem::FRequest::CancelRequest() 
 { 
 	TSharedRef<FRequest, ESPMode::ThreadSafe> RetryRequest = StaticCastSharedRef<FRequest>(AsShared());
 
+	bCancelled = true;
+	if (HedgeRequest.IsValid())
+	{
+		FConvaihttpRequestPtr Hedge = MoveTemp(HedgeRequest);
+		if (RetryDomains.IsValid() && bHedgeIsDomainProbe)
+		{
+			RetryDomains->ReleaseProbe(HedgeDomainIndex);
+		}
+		bHedgeIsDomainProbe = false;
+		Hedge->CancelRequest();
+	}
 	RetryManager.CancelRequest(RetryRequest);
 }
 
+const FConvaihttpResponsePtr FConvaihttpRetrySystem::FRequest::GetResponse() const
+{
+	return ResumedResponse.IsValid() ? ResumedResponse : ConvaihttpRequest->GetResponse();
+}
+
+void FConvaihttpRetrySystem::FRequest::SetContent(const TArray64<uint8>& ContentPayload)
+{
+	ContentKind = EContentKind::InMemory;
+	SharedContent.Reset();
+	ConvaihttpRequest->SetContent(ContentPayload);
+}
+
+void FConvaihttpRetrySystem::FRequest::SetContent(TArray64<uint8>&& ContentPayload)
+{
+	ContentKind = EContentKind::InMemory;
+	SharedContent.Reset();
+	ConvaihttpRequest->SetContent(MoveTemp(ContentPayload));
+}
+
+void FConvaihttpRetrySystem::FRequest::SetContent(const FSharedBuffer& ContentPayload)
+{
+	ContentKind = EContentKind::SharedBuffer;
+	SharedContent = FCompositeBuffer(ContentPayload);
+	ConvaihttpRequest->SetContent(ContentPayload);
+}
+
+void FConvaihttpRetrySystem::FRequest::SetContent(const FCompositeBuffer& ContentPayload)
+{
+	ContentKind = EContentKind::SharedBuffer;
+	SharedContent = ContentPayload;
+	ConvaihttpRequest->SetContent(ContentPayload);
+}
+
+void FConvaihttpRetrySystem::FRequest::SetContentAsString(const FString& ContentString)
+{
+	ContentKind = EContentKind::InMemory;
+	SharedContent.Reset();
+	ConvaihttpRequest->SetContentAsString(ContentString);
+}
+
+bool FConvaihttpRetrySystem::FRequest::SetContentAsStreamedFile(const FString& Filename)
+{
+	if (!ConvaihttpRequest->SetContentAsStreamedFile(Filename))
+	{
+		return false;
+	}
+	ContentKind = EContentKind::Streamed;
+	SharedContent.Reset();
+	return true;
+}
+
+bool FConvaihttpRetrySystem::FRequest::SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream)
+{
+	if (!ConvaihttpRequest->SetContentFromStream(Stream))
+	{
+		return false;
+	}
+	ContentKind = EContentKind::Streamed;
+	SharedContent.Reset();
+	return true;
+}
+
+bool FConvaihttpRetrySystem::FRequest::SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source)
+{
+	if (!ConvaihttpRequest->SetContentFromSource(Source))
+	{
+		return false;
+	}
+	ContentKind = EContentKind::Streamed;
+	SharedContent.Reset();
+	return true;
+}
+
+bool FConvaihttpRetrySystem::FRequest::SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink)
+{
+	if (!ConvaihttpRequest->SetResponseBodyReceiveSink(Sink))
+	{
+		return false;
+	}
+	bHasResponseBodySink = true;
+	return true;
+}
+
+bool FConvaihttpRetrySystem::FRequest::SetResponseBodyReceiveStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream)
+{
+	if (!ConvaihttpRequest->SetResponseBodyReceiveStream(Stream))
+	{
+		return false;
+	}
+	bHasResponseBodySink = true;
+	return true;
+}
+
 void FConvaihttpRetrySystem::FRequest::ConvaihttpOnRequestProgress(FConvaihttpRequestPtr InConvaihttpRequest, uint64 BytesSent, uint64 BytesRcv)
 {
+	if (InConvaihttpRequest.Get() != &ConvaihttpRequest.Get())
+	{
+		// A hedge still racing the request, or the request a hedge won against
+		return;
+	}
+
+	if (!bFirstByteReceived && BytesRcv > 0)
+	{
+		bFirstByteReceived = true;
+		RetryManager.AddFirstByteLatencySample(static_cast<float>(FPlatformTime::Seconds() - AttemptStartTimeAbsoluteSeconds));
+	}
+
+	// A resumed download reports progress over the whole body
+	if (bRangeHeadersSet)
+	{
+		BytesRcv += PartialBody.Num();
+	}
 	OnRequestProgress().ExecuteIfBound(AsShared(), BytesSent, BytesRcv);
 }
 
+void FConvaihttpRetrySystem::FRequest::ConvaihttpOnProcessRequestComplete(FConvaihttpRequestPtr InConvaihttpRequest, FConvaihttpResponsePtr InConvaihttpResponse, bool bSucceeded)
+{
+	if (HedgeRequest.IsValid() && InConvaihttpRequest == HedgeRequest)
+	{
+		ConvaihttpOnHedgeComplete(InConvaihttpResponse, bSucceeded);
+		return;
+	}
+	if (InConvaihttpRequest.Get() != &ConvaihttpRequest.Get())
+	{
+		// The request a hedge won against, cancelled
+		return;
+	}
+
+	if (!bFirstByteReceived && InConvaihttpResponse.IsValid() && InConvaihttpResponse->GetResponseCode() > 0)
+	{
+		// The whole response arrived without a progress update in between
+		bFirstByteReceived = true;
+		RetryManager.AddFirstByteLatencySample(static_cast<float>(FPlatformTime::Seconds() - AttemptStartTimeAbsoluteSeconds));
+	}
+
+	ReportRetryDomainResult(RetryDomainsIndex, bIsDomainProbe, InConvaihttpRequest, InConvaihttpResponse, bSucceeded);
+	bIsDomainProbe = false;
+
+	// A hedge that completed in place of the failed request only won if it succeeded
+	if (bWaitingOnPromotedHedge)
+	{
+		bWaitingOnPromotedHedge = false;
+		if (bSucceeded && InConvaihttpResponse.IsValid() && InConvaihttpResponse->GetResponseCode() < EConvaihttpResponseCodes::ServerError)
+		{
+			RecordHedgeWin(*InConvaihttpRequest);
+		}
+	}
+
+	if (HedgeRequest.IsValid())
+	{
+		const bool bAttemptSucceeded = bSucceeded && InConvaihttpResponse.IsValid() && InConvaihttpResponse->GetResponseCode() < EConvaihttpResponseCodes::ServerError;
+		if (!bAttemptSucceeded && !bCancelled)
+		{
+			// The hedge may still make it, and completes the attempt in place of the request
+			UE_LOG(LogConvaihttp, Verbose, TEXT("%p: request failed while hedged, waiting for the hedge. URL: %s"), this, *HedgeRequest->GetURL());
+			PromoteHedge();
+			bWaitingOnPromotedHedge = true;
+			return;
+		}
+
+		// The request won, its hedge is cancelled
+		FConvaihttpRequestPtr Hedge = MoveTemp(HedgeRequest);
+		if (RetryDomains.IsValid() && bHedgeIsDomainProbe)
+		{
+			RetryDomains->ReleaseProbe(HedgeDomainIndex);
+		}
+		bHedgeIsDomainProbe = false;
+		Hedge->CancelRequest();
+	}
+
+	ResumedResponse.Reset();
+
+	// A body sink consumed what was received already, there is no partial body to resume
+	if (!bResumeDownloads || bCallerSetRange || bHasResponseBodySink || GetVerb() != TEXT("GET"))
+	{
+		return;
+	}
+
+	if (!InConvaihttpResponse.IsValid())
+	{
+		// Nothing was received this time, keep what previous attempts received for the next one
+		return;
+	}
+
+	const int32 ResponseCode = InConvaihttpResponse->GetResponseCode();
+	const bool bIsResumed = bRangeHeadersSet
+		&& ResponseCode == EConvaihttpResponseCodes::PartialContent
+		&& FConvaihttpRetrySystem::ReadContentRangeStart(InConvaihttpResponse->GetHeader(TEXT("Content-Range"))) == PartialBody.Num();
+
+	if (bSucceeded)
+	{
+		if (bIsResumed)
+		{
+			UE_LOG(LogConvaihttp, Log, TEXT("%p: resumed download completed after %lld bytes kept from previous attempts. URL: %s"), this, PartialBody.Num(), *GetURL());
+			PartialBody.Append(InConvaihttpResponse->TakeContent());
+			ResumedResponse = MakeShared<FConvaihttpRetrySystem::FResumedResponse, ESPMode::ThreadSafe>(InConvaihttpResponse.ToSharedRef(), MoveTemp(PartialBody));
+		}
+		ResetRangeResume();
+		return;
+	}
+
+	if (bIsResumed)
+	{
+		// Failed again, but further along
+		PartialBody.Append(InConvaihttpResponse->TakeContent());
+		return;
+	}
+
+	// A server that ignored If-Range sends the whole body again, which is only worth keeping if it can be resumed in turn
+	PartialBody.Reset();
+	PartialBodyValidator.Reset();
+	if (ResponseCode == EConvaihttpResponseCodes::Ok
+		&& InConvaihttpResponse->GetHeader(TEXT("Content-Range")).IsEmpty()
+		&& InConvaihttpResponse->GetHeader(TEXT("Accept-Ranges")).Contains(TEXT("bytes")))
+	{
+		// If-Range needs a strong validator, weak ETags can't be used
+		const FString ETag = InConvaihttpResponse->GetHeader(TEXT("ETag"));
+		PartialBodyValidator = (!ETag.IsEmpty() && !ETag.StartsWith(TEXT("W/"))) ? ETag : InConvaihttpResponse->GetHeader(TEXT("Last-Modified"));
+		if (!PartialBodyValidator.IsEmpty())
+		{
+			PartialBody = InConvaihttpResponse->TakeContent();
+		}
+	}
+}
+
+void FConvaihttpRetrySystem::FRequest::ReportRetryDomainResult(int32 DomainIndex, bool bWasProbe, FConvaihttpRequestPtr InConvaihttpRequest, FConvaihttpResponsePtr InConvaihttpResponse, bool bSucceeded)
+{
+	if (!RetryDomains.IsValid())
+	{
+		return;
+	}
+
+	if (bCancelled)
+	{
+		// A cancelled request tells nothing about the health of its domain
+		if (bWasProbe)
+		{
+			RetryDomains->ReleaseProbe(DomainIndex);
+		}
+		return;
+	}
+
+	// Any answer, even an error, means the domain is up. A response code tells us a status line was received
+	const int32 ResponseCode = InConvaihttpResponse.IsValid() ? InConvaihttpResponse->GetResponseCode() : 0;
+	const bool bReachable = bSucceeded || ResponseCode > 0;
+	const bool bDomainSucceeded = bReachable && ResponseCode < EConvaihttpResponseCodes::ServerError;
+	// The time to the first byte is that of the domain, the elapsed time also counts the queue and the size of the body
+	float LatencySeconds = InConvaihttpRequest.IsValid() ? InConvaihttpRequest->GetElapsedTime() : 0.0f;
+	if (InConvaihttpResponse.IsValid())
+	{
+		const FConvaihttpResponseTimings Timings = InConvaihttpResponse->GetTimings();
+		if (Timings.bIsValid && Timings.FirstByteSeconds >= 0.0)
+		{
+			LatencySeconds = static_cast<float>(Timings.FirstByteSeconds);
+		}
+		else if (Timings.bIsValid && Timings.TotalSeconds >= 0.0)
+		{
+			LatencySeconds = static_cast<float>(Timings.TotalSeconds);
+		}
+	}
+	RetryDomains->ReportResult(DomainIndex, bReachable, bWasProbe, bDomainSucceeded, LatencySeconds);
+}
+
+void FConvaihttpRetrySystem::FRequest::BeginAttempt()
+{
+	AttemptStartTimeAbsoluteSeconds = FPlatformTime::Seconds();
+	bFirstByteReceived = false;
+	bHedgeConsidered = false;
+	bWaitingOnPromotedHedge = false;
+}
+
+bool FConvaihttpRetrySystem::FRequest::CanHedge() const
+{
+	// Only requests the server is fine getting twice, whose body can be sent twice, and whose response the hedge can
+	// receive: the hedge has neither the upload source nor the body sink of the request. Ranges are part of a larger
+	// transfer, whose caller already spreads it over several requests
+	static const TSet<FName> IdempotentVerbs(TArray<FName>({ FName(TEXT("GET")), FName(TEXT("HEAD")), FName(TEXT("PUT")), FName(TEXT("DELETE")), FName(TEXT("OPTIONS")) }));
+	return IdempotentVerbs.Contains(FName(*GetVerb()))
+		&& ContentKind != EContentKind::Streamed
+		&& !bHasResponseBodySink
+		&& !bCallerSetRange
+		&& !bRangeHeadersSet;
+}
+
+void FConvaihttpRetrySystem::FRequest::StartHedge()
+{
+	TSharedRef<FRequest, ESPMode::ThreadSafe> RetryRequest = StaticCastSharedRef<FRequest>(AsShared());
+
+	FConvaihttpRequestRef Hedge = FConvaihttpModule::Get().CreateRequest();
+	HedgeDomainIndex = RetryDomainsIndex;
+	bHedgeIsDomainProbe = false;
+	if (RetryDomains.IsValid())
+	{
+		// Another domain is likely served by other instances than the slow one
+		HedgeDomainIndex = RetryDomains->AcquireDomain((RetryDomainsIndex + 1) % RetryDomains->Domains.Num(), bHedgeIsDomainProbe);
+		Hedge->SetURL(GetUrlForRetryDomain(HedgeDomainIndex));
+	}
+	else
+	{
+		Hedge->SetURL(ConvaihttpRequest->GetURL());
+	}
+	Hedge->SetVerb(ConvaihttpRequest->GetVerb());
+	for (const FString& Header : ConvaihttpRequest->GetAllHeaders())
+	{
+		FString HeaderName;
+		FString HeaderValue;
+		if (Header.Split(TEXT(":"), &HeaderName, &HeaderValue))
+		{
+			Hedge->SetHeader(HeaderName, HeaderValue.TrimStart());
+		}
+	}
+	if (ContentKind == EContentKind::SharedBuffer)
+	{
+		Hedge->SetContent(SharedContent);
+	}
+	else if (ConvaihttpRequest->GetContentLength() > 0)
+	{
+		Hedge->SetContent(ConvaihttpRequest->GetContent());
+	}
+	const TOptional<float> Timeout = ConvaihttpRequest->GetTimeout();
+	if (Timeout.IsSet())
+	{
+		Hedge->SetTimeout(Timeout.GetValue());
+	}
+	Hedge->OnRequestProgress().BindThreadSafeSP(RetryRequest, &FConvaihttpRetrySystem::FRequest::ConvaihttpOnRequestProgress);
+	Hedge->OnProcessRequestComplete().BindThreadSafeSP(RetryRequest, &FConvaihttpRetrySystem::FRequest::ConvaihttpOnProcessRequestComplete);
+
+	if (!Hedge->ProcessRequest())
+	{
+		if (RetryDomains.IsValid() && bHedgeIsDomainProbe)
+		{
+			RetryDomains->ReleaseProbe(HedgeDomainIndex);
+		}
+		bHedgeIsDomainProbe = false;
+		return;
+	}
+
+	HedgeRequest = Hedge;
+	++RetryManager.HedgeStats.NumHedges;
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: no response after %.3fs, hedging. URL: %s"), this, FPlatformTime::Seconds() - AttemptStartTimeAbsoluteSeconds, *Hedge->GetURL());
+}
+
+void FConvaihttpRetrySystem::FRequest::ConvaihttpOnHedgeComplete(FConvaihttpResponsePtr InConvaihttpResponse, bool bSucceeded)
+{
+	FConvaihttpRequestPtr Hedge = HedgeRequest;
+	const bool bHedgeSucceeded = bSucceeded && InConvaihttpResponse.IsValid() && InConvaihttpResponse->GetResponseCode() < EConvaihttpResponseCodes::ServerError;
+	if (!bHedgeSucceeded)
+	{
+		// The request may still make it
+		ReportRetryDomainResult(HedgeDomainIndex, bHedgeIsDomainProbe, Hedge, InConvaihttpResponse, bSucceeded);
+		bHedgeIsDomainProbe = false;
+		HedgeRequest.Reset();
+		return;
+	}
+
+	// The hedge won, the request it raced is cancelled and the hedge completes the attempt in its place
+	RecordHedgeWin(*Hedge);
+	TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> Loser = ConvaihttpRequest;
+	if (RetryDomains.IsValid() && bIsDomainProbe)
+	{
+		RetryDomains->ReleaseProbe(RetryDomainsIndex);
+	}
+	PromoteHedge();
+	Loser->CancelRequest();
+
+	ConvaihttpOnProcessRequestComplete(Hedge, InConvaihttpResponse, bSucceeded);
+}
+
+void FConvaihttpRetrySystem::FRequest::PromoteHedge()
+{
+	check(HedgeRequest.IsValid());
+	ConvaihttpRequest = HedgeRequest.ToSharedRef();
+	HedgeRequest.Reset();
+	RetryDomainsIndex = HedgeDomainIndex;
+	bIsDomainProbe = bHedgeIsDomainProbe;
+	bHedgeIsDomainProbe = false;
+	// The hedge was sent late, its latency isn't that of a whole attempt
+	bFirstByteReceived = true;
+}
+
+void FConvaihttpRetrySystem::FRequest::RecordHedgeWin(const IConvaihttpRequest& Hedge)
+{
+	++RetryManager.HedgeStats.NumWins;
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: hedge used, %llu of %llu hedges won. URL: %s"), this, RetryManager.HedgeStats.NumWins, RetryManager.HedgeStats.NumHedges, *Hedge.GetURL());
+}
+
+void FConvaihttpRetrySystem::FRequest::PrepareRangeResume()
+{
+	if (PartialBody.Num() > 0)
+	{
+		UE_LOG(LogConvaihttp, Log, TEXT("%p: resuming download from byte %lld. URL: %s"), this, PartialBody.Num(), *GetURL());
+		// If the resource changed since, If-Range makes the server send all of it instead of the range
+		ConvaihttpRequest->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=%lld-"), PartialBody.Num()));
+		ConvaihttpRequest->SetHeader(TEXT("If-Range"), PartialBodyValidator);
+		bRangeHeadersSet = true;
+	}
+	else if (bRangeHeadersSet)
+	{
+		// Empty values keep the headers from being sent
+		ConvaihttpRequest->SetHeader(TEXT("Range"), FString());
+		ConvaihttpRequest->SetHeader(TEXT("If-Range"), FString());
+		bRangeHeadersSet = false;
+	}
+}
+
+void FConvaihttpRetrySystem::FRequest::ResetRangeResume()
+{
+	PartialBody.Empty();
+	PartialBodyValidator.Reset();
+	if (bRangeHeadersSet)
+	{
+		ConvaihttpRequest->SetHeader(TEXT("Range"), FString());
+		ConvaihttpRequest->SetHeader(TEXT("If-Range"), FString());
+		bRangeHeadersSet = false;
+	}
+}
+
 FConvaihttpRetrySystem::FManager::FManager(const FRetryLimitCountSetting& InRetryLimitCountDefault, const FRetryTimeoutRelativeSecondsSetting& InRetryTimeoutRelativeSecondsDefault)
     : RandomFailureRate(FRandomFailureRateSetting())
     , RetryLimitCountDefault(InRetryLimitCountDefault)
 	, RetryTimeoutRelativeSecondsDefault(InRetryTimeoutRelativeSecondsDefault)
+	, RetryBudgetLastRefillAbsoluteSeconds(FPlatformTime::Seconds())
+	, LockoutRandomStream(static_cast<int32>(FPlatformTime::Cycles()))
 {}
 
+void FConvaihttpRetrySystem::FManager::SetRetryBudget(float RefillPerSecond, float Capacity)
+{
+	RetryBudgetRefillPerSecond = FMath::Max(RefillPerSecond, 0.0f);
+	RetryBudgetCapacity = FMath::Max(Capacity, 0.0f);
+	RetryBudgetTokens = RetryBudgetCapacity;
+	RetryBudgetLastRefillAbsoluteSeconds = FPlatformTime::Seconds();
+}
+
+void FConvaihttpRetrySystem::FManager::SetHedgeBudget(float Ratio, float Capacity)
+{
+	HedgeBudgetRatio = FMath::Max(Ratio, 0.0f);
+	HedgeBudgetCapacity = FMath::Max(Capacity, 0.0f);
+	HedgeBudgetTokens = HedgeBudgetCapacity;
+}
+
+void FConvaihttpRetrySystem::FManager::AddFirstByteLatencySample(float LatencySeconds)
+{
+	constexpr const int32 MaxFirstByteLatencySamples = 128;
+	if (FirstByteLatencySamples.Num() < MaxFirstByteLatencySamples)
+	{
+		FirstByteLatencySamples.Add(LatencySeconds);
+	}
+	else
+	{
+		FirstByteLatencySamples[NextFirstByteLatencySample] = LatencySeconds;
+		NextFirstByteLatencySample = (NextFirstByteLatencySample + 1) % MaxFirstByteLatencySamples;
+	}
+	bFirstByteLatencySamplesSorted = false;
+}
+
+TOptional<float> FConvaihttpRetrySystem::FManager::GetFirstByteLatencyPercentile(float Percentile)
+{
+	// A percentile of a handful of samples would hedge on noise
+	constexpr const int32 MinFirstByteLatencySamples = 20;
+	if (FirstByteLatencySamples.Num() < MinFirstByteLatencySamples)
+	{
+		return TOptional<float>();
+	}
+
+	if (!bFirstByteLatencySamplesSorted)
+	{
+		SortedFirstByteLatencySamples = FirstByteLatencySamples;
+		SortedFirstByteLatencySamples.Sort();
+		bFirstByteLatencySamplesSorted = true;
+	}
+	const int32 Index = FMath::Clamp(FMath::FloorToInt(Percentile * SortedFirstByteLatencySamples.Num()), 0, SortedFirstByteLatencySamples.Num() - 1);
+	return SortedFirstByteLatencySamples[Index];
+}
+
+void FConvaihttpRetrySystem::FManager::UpdateHedging(FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry, const double NowAbsoluteSeconds)
+{
+	FRequest& Request = *ConvaihttpRetryRequestEntry.Request;
+	if (Request.HedgeLatencyPercentile <= 0.0f || Request.bHedgeConsidered || Request.bFirstByteReceived || Request.HedgeRequest.IsValid())
+	{
+		return;
+	}
+
+	const TOptional<float> HedgeDelaySeconds = GetFirstByteLatencyPercentile(Request.HedgeLatencyPercentile);
+	if (!HedgeDelaySeconds.IsSet() || NowAbsoluteSeconds - Request.AttemptStartTimeAbsoluteSeconds < HedgeDelaySeconds.GetValue())
+	{
+		return;
+	}
+
+	// One hedge per attempt at most
+	Request.bHedgeConsidered = true;
+	if (!Request.CanHedge())
+	{
+		return;
+	}
+	if (HedgeBudgetTokens < 1.0f)
+	{
+		++HedgeStats.NumDenied;
+		return;
+	}
+
+	HedgeBudgetTokens -= 1.0f;
+	Request.StartHedge();
+}
+
+bool FConvaihttpRetrySystem::FManager::ConsumeRetryBudget(const double NowAbsoluteSeconds)
+{
+	if (RetryBudgetCapacity <= 0.0f)
+	{
+		return true;
+	}
+
+	RetryBudgetTokens = FMath::Min<double>(RetryBudgetTokens + (NowAbsoluteSeconds - RetryBudgetLastRefillAbsoluteSeconds) * RetryBudgetRefillPerSecond, RetryBudgetCapacity);
+	RetryBudgetLastRefillAbsoluteSeconds = NowAbsoluteSeconds;
+	if (RetryBudgetTokens < 1.0)
+	{
+		return false;
+	}
+
+	RetryBudgetTokens -= 1.0;
+	return true;
+}
+
 TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> FConvaihttpRetrySystem::FManager::CreateRequest(
 	const FRetryLimitCountSetting& InRetryLimitCountOverride,
 	const FRetryTimeoutRelativeSecondsSetting& InRetryTimeoutRelativeSecondsOverride,
@@ -239,32 +1076,24 @@ bool FConvaihttpRetrySystem::FManager::CanRetry(const FConvaihttpRetryRequestEnt
     return bResult;
 }
 
-bool FConvaihttpRetrySystem::FManager::HasTimedOut(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry, const double NowAbsoluteSeconds)
+TOptional<double> FConvaihttpRetrySystem::FManager::GetRetryTimeoutAbsoluteSeconds(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry)
 {
-    bool bResult = false;
-
-    bool bShouldTestRetryTimeout = false;
-    double RetryTimeoutAbsoluteSeconds = ConvaihttpRetryRequestEntry.RequestStartTimeAbsoluteSeconds;
+    TOptional<double> RetryTimeoutAbsoluteSeconds;
     if (ConvaihttpRetryRequestEntry.Request->RetryTimeoutRelativeSecondsOverride.IsSet())
     {
-        bShouldTestRetryTimeout = true;
-        RetryTimeoutAbsoluteSeconds += ConvaihttpRetryRequestEntry.Request->RetryTimeoutRelativeSecondsOverride.GetValue();
+        RetryTimeoutAbsoluteSeconds = ConvaihttpRetryRequestEntry.RequestStartTimeAbsoluteSeconds + ConvaihttpRetryRequestEntry.Request->RetryTimeoutRelativeSecondsOverride.GetValue();
     }
     else if (RetryTimeoutRelativeSecondsDefault.IsSet())
     {
-        bShouldTestRetryTimeout = true;
-        RetryTimeoutAbsoluteSeconds += RetryTimeoutRelativeSecondsDefault.GetValue();
-    }
-
-    if (bShouldTestRetryTimeout)
-    {
-        if (NowAbsoluteSeconds >= RetryTimeoutAbsoluteSeconds)
-        {
-            bResult = true;
-        }
+        RetryTimeoutAbsoluteSeconds = ConvaihttpRetryRequestEntry.RequestStartTimeAbsoluteSeconds + RetryTimeoutRelativeSecondsDefault.GetValue();
     }
+    return RetryTimeoutAbsoluteSeconds;
+}
 
-    return bResult;
+bool FConvaihttpRetrySystem::FManager::HasTimedOut(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry, const double NowAbsoluteSeconds)
+{
+    const TOptional<double> RetryTimeoutAbsoluteSeconds = GetRetryTimeoutAbsoluteSeconds(ConvaihttpRetryRequestEntry);
+    return RetryTimeoutAbsoluteSeconds.IsSet() && NowAbsoluteSeconds >= RetryTimeoutAbsoluteSeconds.GetValue();
 }
 
 float FConvaihttpRetrySystem::FManager::GetLockoutPeriodSeconds(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry)
@@ -286,11 +1115,13 @@ float FConvaihttpRetrySystem::FManager::GetLockoutPeriodSeconds(const FConvaihtt
 			const bool bSkipLockoutPeriod = (bFailedToConnect && bHasRetryDomains);
 			if (!bSkipLockoutPeriod)
 			{
-				constexpr const float LockoutPeriodMinimumSeconds = 5.0f;
-				constexpr const float LockoutPeriodEscalationSeconds = 2.5f;
+				// Exponential backoff with full jitter: a random lockout up to a ceiling doubling with each retry,
+				// so requests that failed together don't all come back together
+				constexpr const float LockoutPeriodBaseSeconds = 5.0f;
 				constexpr const float LockoutPeriodMaxSeconds = 30.0f;
-				LockoutPeriod = LockoutPeriodMinimumSeconds + LockoutPeriodEscalationSeconds * (ConvaihttpRetryRequestEntry.CurrentRetryCount - 1);
-				LockoutPeriod = FMath::Min(LockoutPeriod, LockoutPeriodMaxSeconds);
+				const uint32 Exponent = FMath::Min<uint32>(ConvaihttpRetryRequestEntry.CurrentRetryCount - 1, 16);
+				const float LockoutPeriodCeiling = FMath::Min(LockoutPeriodBaseSeconds * static_cast<float>(1 << Exponent), LockoutPeriodMaxSeconds);
+				LockoutPeriod = LockoutRandomStream.FRandRange(0.0f, LockoutPeriodCeiling);
 			}
 		}
 	}
@@ -309,11 +1140,24 @@ bool FConvaihttpRetrySystem::FManager::Update(uint32* FileCount, uint32* Failing
 
 	if (FileCount != nullptr)
 	{
-		*FileCount = RequestList.Num();
+		*FileCount = RequestList.Num() + LockoutHeap.Num();
 	}
 
 	const double NowAbsoluteSeconds = FPlatformTime::Seconds();
 
+	// Wake the entries whose lockout is over, or whose retry timeout was reached, the others aren't looked at
+	while (LockoutHeap.Num() > 0 && LockoutHeap.HeapTop().WakeTimeAbsoluteSeconds <= NowAbsoluteSeconds)
+	{
+		FConvaihttpRetryRequestEntry ConvaihttpRetryRequestEntry = LockoutHeap.HeapTop();
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+		LockoutHeap.HeapPopDiscard(FWakesEarlier(), false);
+#else
+		LockoutHeap.HeapPopDiscard(FWakesEarlier(), EAllowShrinking::No);
+#endif
+		RequestList.Add(MoveTemp(ConvaihttpRetryRequestEntry));
+	}
+	const int64 NumSleepingEntries = LockoutHeap.Num();
+
 	// Basic algorithm
 	// for each managed item
 	//    if the item hasn't timed out
@@ -414,7 +1258,16 @@ bool FConvaihttpRetrySystem::FManager::Update(uint32* FileCount, uint32* Failing
 					{
 						bIsGreen = false;
 
-						if (forceFail || (bShouldRetry && bCanRetry))
+						if ((forceFail || (bShouldRetry && bCanRetry)) && !ConsumeRetryBudget(NowAbsoluteSeconds))
+						{
+							UE_LOG(LogConvaihttp, Warning, TEXT("Retry budget exhausted on %s"), *(ConvaihttpRetryRequest->GetURL()));
+							if (FailedCount != nullptr)
+							{
+								++(*FailedCount);
+							}
+							ConvaihttpRetryRequest->Status = FConvaihttpRetrySystem::FRequest::EStatus::FailedRetry;
+						}
+						else if (forceFail || (bShouldRetry && bCanRetry))
 						{
 							float LockoutPeriod = GetLockoutPeriodSeconds(ConvaihttpRetryRequestEntry);
 
@@ -453,17 +1306,29 @@ bool FConvaihttpRetrySystem::FManager::Update(uint32* FileCount, uint32* Failing
 
 						ConvaihttpRetryRequest->Status = FConvaihttpRetrySystem::FRequest::EStatus::Succeeded;
 					}
+					else if (RequestStatus == EConvaihttpRequestStatus::Processing)
+					{
+						UpdateHedging(ConvaihttpRetryRequestEntry, NowAbsoluteSeconds);
+					}
 				}
 
 				if (ConvaihttpRetryRequest->Status == FConvaihttpRetrySystem::FRequest::EStatus::ProcessingLockout)
 				{
 					if (NowAbsoluteSeconds >= ConvaihttpRetryRequestEntry.LockoutEndTimeAbsoluteSeconds)
 					{
+						ConvaihttpRetryRequest->PrepareRangeResume();
+						if (ConvaihttpRetryRequest->RetryDomains.IsValid())
+						{
+							ConvaihttpRetryRequest->AcquireRetryDomain();
+						}
+						ConvaihttpRetryRequest->BeginAttempt();
+
 						// if this fails the ConvaihttpRequest's state will be failed which will cause the retry logic to kick(as expected)
 						bool success = ConvaihttpRetryRequest->ConvaihttpRequest->ProcessRequest();
 						if (success)
 						{
 							UE_LOG(LogConvaihttp, Warning, TEXT("Retry %d on %s"), ConvaihttpRetryRequestEntry.CurrentRetryCount + 1, *(ConvaihttpRetryRequest->GetURL()));
+							FConvaihttpMetrics::Get().RecordRetry(ConvaihttpRetryRequest->GetURL());
 
 							++ConvaihttpRetryRequestEntry.CurrentRetryCount;
 							ConvaihttpRetryRequest->Status = FRequest::EStatus::Processing;
@@ -523,12 +1388,28 @@ bool FConvaihttpRetrySystem::FManager::Update(uint32* FileCount, uint32* Failing
 		{
 			RequestList.RemoveAtSwap(index);
 		}
+		else if (ConvaihttpRetryRequest->Status == FConvaihttpRetrySystem::FRequest::EStatus::ProcessingLockout)
+		{
+			// Sleep in the heap until the lockout is over
+			const TOptional<double> RetryTimeoutAbsoluteSeconds = GetRetryTimeoutAbsoluteSeconds(ConvaihttpRetryRequestEntry);
+			ConvaihttpRetryRequestEntry.WakeTimeAbsoluteSeconds = RetryTimeoutAbsoluteSeconds.IsSet()
+				? FMath::Min(ConvaihttpRetryRequestEntry.LockoutEndTimeAbsoluteSeconds, RetryTimeoutAbsoluteSeconds.GetValue())
+				: ConvaihttpRetryRequestEntry.LockoutEndTimeAbsoluteSeconds;
+			LockoutHeap.HeapPush(MoveTemp(ConvaihttpRetryRequestEntry), FWakesEarlier());
+			RequestList.RemoveAtSwap(index);
+		}
 		else
 		{
 			++index;
 		}
 	}
 
+	if (FailingCount != nullptr)
+	{
+		// Entries that went into lockout during this update were counted above
+		*FailingCount += NumSleepingEntries;
+	}
+
 	return bIsGreen;
 }
 
@@ -536,6 +1417,8 @@ FConvaihttpRetrySystem::FManager::FConvaihttpRetryRequestEntry::FConvaihttpRetry
     : bShouldCancel(false)
     , CurrentRetryCount(0)
 	, RequestStartTimeAbsoluteSeconds(FPlatformTime::Seconds())
+	, LockoutEndTimeAbsoluteSeconds(0.0)
+	, WakeTimeAbsoluteSeconds(0.0)
 	, Request(InRequest)
 {}
 
@@ -569,6 +1452,23 @@ void FConvaihttpRetrySystem::FManager::CancelRequest(TSharedRef<FConvaihttpRetry
 			bFound = true;
 		}
 	}
+	// Wake it up if it is in lockout, so the next update sees it
+	for (int64 i = 0; i < LockoutHeap.Num(); ++i)
+	{
+		if (LockoutHeap[i].Request == ConvaihttpRetryRequest)
+		{
+			FConvaihttpRetryRequestEntry Entry = LockoutHeap[i];
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+			LockoutHeap.HeapRemoveAt(i, FWakesEarlier(), false);
+#else
+			LockoutHeap.HeapRemoveAt(i, FWakesEarlier(), EAllowShrinking::No);
+#endif
+			Entry.bShouldCancel = true;
+			RequestList.Add(MoveTemp(Entry));
+			bFound = true;
+			break;
+		}
+	}
 	// If we did not find the entry, likely auth failed for the request, in which case ProcessRequest does not get called.
 	// Adding it to the list and flagging as cancel will process it on next tick.
 	if (!bFound)
@@ -587,7 +1487,7 @@ void FConvaihttpRetrySystem::FManager::BlockUntilFlushed(float InTimeoutSec)
 	const float SleepInterval = 0.016;
 	float TimeElapsed = 0.0f;
 	uint32 FileCount, FailingCount, FailedCount, CompleteCount;
-	while (RequestList.Num() > 0 && TimeElapsed < InTimeoutSec)
+	while (RequestList.Num() + LockoutHeap.Num() > 0 && TimeElapsed < InTimeoutSec)
 	{
 		FConvaihttpModule::Get().GetConvaihttpManager().Tick(SleepInterval);
 		Update(&FileCount, &FailingCount, &FailedCount, &CompleteCount);
@@ -0,0 +1,650 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "ConvaihttpSegmentedDownload.h"
+#include "ConvaihttpModule.h"
+#include "Convaihttp.h"
+#include "GenericPlatform/ConvaihttpResponseBodySink.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/EngineVersionComparison.h"
+#include "Misc/ScopeLock.h"
+#include <atomic>
+
+/**
+ * Archive shared by the segments of a download, each writing at its own offset
+ */
+class FConvaihttpSharedOutputArchive
+{
+public:
+	explicit FConvaihttpSharedOutputArchive(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive)
+		: Archive(InArchive)
+	{
+	}
+
+	/** Write data at an offset. Called from thread pool threads */
+	bool Write(int64 Offset, const void* Data, int64 Size)
+	{
+		FScopeLock Lock(&CriticalSection);
+		Archive->Seek(Offset);
+		Archive->Serialize(const_cast<void*>(Data), Size);
+		return !Archive->IsError();
+	}
+
+	/** Flush the archive. Called from thread pool threads */
+	bool Flush()
+	{
+		FScopeLock Lock(&CriticalSection);
+		Archive->Flush();
+		return !Archive->IsError();
+	}
+
+	FString GetArchiveName() const
+	{
+		return Archive->GetArchiveName();
+	}
+
+private:
+	/** Archive the resource is written to */
+	TSharedRef<FArchive, ESPMode::ThreadSafe> Archive;
+	/** Serializes the seek and write of each segment */
+	FCriticalSection CriticalSection;
+};
+
+/**
+ * Archive writing a segment at its offset in the shared output
+ */
+class FConvaihttpSegmentArchive : public FArchive
+{
+public:
+	FConvaihttpSegmentArchive(TSharedRef<FConvaihttpSharedOutputArchive, ESPMode::ThreadSafe> InOutput, uint64 InOffset)
+		: Output(InOutput)
+		, Offset(InOffset)
+	{
+		SetIsSaving(true);
+		SetIsPersistent(true);
+	}
+
+	//~ Begin FArchive Interface
+	virtual void Serialize(void* Data, int64 Num) override
+	{
+		if (!Output->Write(Offset + Pos, Data, Num))
+		{
+			SetError();
+		}
+		Pos += Num;
+	}
+	virtual void Flush() override
+	{
+		if (!Output->Flush())
+		{
+			SetError();
+		}
+	}
+	virtual int64 Tell() override
+	{
+		return Pos;
+	}
+	virtual FString GetArchiveName() const override
+	{
+		return Output->GetArchiveName();
+	}
+	//~ End FArchive Interface
+
+private:
+	/** Output shared by the segments */
+	TSharedRef<FConvaihttpSharedOutputArchive, ESPMode::ThreadSafe> Output;
+	/** Offset of the segment in the output */
+	const uint64 Offset;
+	/** Number of bytes written */
+	int64 Pos = 0;
+};
+
+/**
+ * Response body sink receiving a segment at its offset, either directly in the preallocated buffer of the resource,
+ * or in the shared output archive through a write-behind archive sink.
+ * Refuses more data than the segment holds, so a server sending the wrong range can't write over other segments.
+ */
+class FConvaihttpSegmentBodySink
+	: public IConvaihttpResponseBodySink
+	, public TSharedFromThis<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe>
+{
+public:
+	/** Receive the segment in memory */
+	explicit FConvaihttpSegmentBodySink(FMutableMemoryView InDestination)
+		: Destination(InDestination)
+		, MaxSize(InDestination.GetSize())
+		, NumBytesWritten(0)
+	{
+	}
+
+	/** Receive the segment in the shared output archive */
+	FConvaihttpSegmentBodySink(TSharedRef<FConvaihttpSharedOutputArchive, ESPMode::ThreadSafe> InOutput, uint64 InOffset, uint64 InMaxSize)
+		: ArchiveSink(MakeShared<FConvaihttpArchiveBodySink, ESPMode::ThreadSafe>(MakeShared<FConvaihttpSegmentArchive, ESPMode::ThreadSafe>(InOutput, InOffset)))
+		, MaxSize(InMaxSize)
+		, NumBytesWritten(0)
+	{
+	}
+
+	/** @return number of bytes of the segment received */
+	uint64 GetNumBytesWritten() const
+	{
+		return NumBytesWritten.load();
+	}
+
+	/** @return true if writing to the archive failed */
+	bool HasFailed() const
+	{
+		return ArchiveSink.IsValid() && ArchiveSink->HasFailed();
+	}
+
+	//~ Begin IConvaihttpResponseBodySink Interface
+	virtual EConvaihttpBodySinkResult Write(FMemoryView Data) override
+	{
+		const uint64 Written = NumBytesWritten.load();
+		if (Written + Data.GetSize() > MaxSize)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpSegmentBodySink: received more than the %llu bytes of the segment"), MaxSize);
+			return EConvaihttpBodySinkResult::Failed;
+		}
+
+		if (ArchiveSink.IsValid())
+		{
+			if (!bReadyForDataCallbackSet)
+			{
+				// Pass the archive sink's wake up on to the transport
+				bReadyForDataCallbackSet = true;
+				ArchiveSink->SetReadyForDataCallback([WeakThis = TWeakPtr<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe>(AsShared())]()
+				{
+					if (TSharedPtr<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe> StrongThis = WeakThis.Pin())
+					{
+						StrongThis->NotifyReadyForData();
+					}
+				});
+			}
+
+			const EConvaihttpBodySinkResult Result = ArchiveSink->Write(Data);
+			if (Result != EConvaihttpBodySinkResult::Accepted)
+			{
+				return Result;
+			}
+		}
+		else
+		{
+			FMemory::Memcpy(static_cast<uint8*>(Destination.GetData()) + Written, Data.GetData(), Data.GetSize());
+		}
+
+		NumBytesWritten = Written + Data.GetSize();
+		return EConvaihttpBodySinkResult::Accepted;
+	}
+	virtual void Finish(bool bSucceeded) override
+	{
+		if (ArchiveSink.IsValid())
+		{
+			ArchiveSink->Finish(bSucceeded);
+		}
+	}
+	virtual bool IsFlushed() const override
+	{
+		return !ArchiveSink.IsValid() || ArchiveSink->IsFlushed();
+	}
+	//~ End IConvaihttpResponseBodySink Interface
+
+private:
+	/** Memory the segment is received in, when not written to an archive */
+	FMutableMemoryView Destination;
+	/** Write-behind sink, when written to an archive */
+	TSharedPtr<FConvaihttpArchiveBodySink, ESPMode::ThreadSafe> ArchiveSink;
+	/** Whether the archive sink's callback was set. Only accessed on the CONVAIHTTP thread */
+	bool bReadyForDataCallbackSet = false;
+	/** Size of the segment */
+	const uint64 MaxSize;
+	/** Number of bytes received */
+	std::atomic<uint64> NumBytesWritten;
+};
+
+namespace ConvaihttpSegmentedDownload
+{
+	/** @return true if a Content-Range header is that of a 416 giving the size of the resource as 0 */
+	static bool IsEmptyResourceContentRange(const FString& ContentRange)
+	{
+		FString Unit, Range;
+		return ContentRange.TrimStartAndEnd().Split(TEXT(" "), &Unit, &Range)
+			&& Unit.Equals(TEXT("bytes"), ESearchCase::IgnoreCase)
+			&& Range == TEXT("*/0");
+	}
+
+	/**
+	 * Parse a Content-Range header ("bytes 0-99/1000")
+	 * @return false if the header is missing or invalid, or doesn't give the size of the resource
+	 */
+	static bool ParseContentRange(const FString& ContentRange, uint64& OutStart, uint64& OutEnd, uint64& OutTotal)
+	{
+		FString Unit, Range, Start, End, Total;
+		if (!ContentRange.TrimStartAndEnd().Split(TEXT(" "), &Unit, &Range)
+			|| !Unit.Equals(TEXT("bytes"), ESearchCase::IgnoreCase)
+			|| !Range.Split(TEXT("/"), &Range, &Total)
+			|| !Range.Split(TEXT("-"), &Start, &End)
+			|| !Start.IsNumeric() || !End.IsNumeric() || !Total.IsNumeric())
+		{
+			return false;
+		}
+
+		OutStart = FCString::Strtoui64(*Start, nullptr, 10);
+		OutEnd = FCString::Strtoui64(*End, nullptr, 10);
+		OutTotal = FCString::Strtoui64(*Total, nullptr, 10);
+		return OutStart <= OutEnd && OutEnd < OutTotal;
+	}
+}
+
+FConvaihttpSegmentedDownload::FConvaihttpSegmentedDownload(const FString& InURL)
+	: URL(InURL)
+{
+}
+
+FConvaihttpSegmentedDownload::~FConvaihttpSegmentedDownload()
+{
+}
+
+void FConvaihttpSegmentedDownload::SetHeader(const FString& HeaderName, const FString& HeaderValue)
+{
+	Headers.Add(HeaderName, HeaderValue);
+}
+
+void FConvaihttpSegmentedDownload::SetOutputArchive(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive)
+{
+	OutputArchive = MakeShared<FConvaihttpSharedOutputArchive, ESPMode::ThreadSafe>(InArchive);
+}
+
+void FConvaihttpSegmentedDownload::SetMaxSegments(int32 InMaxSegments)
+{
+	MaxSegments = FMath::Max(InMaxSegments, 1);
+}
+
+void FConvaihttpSegmentedDownload::SetSegmentSize(uint64 InSegmentSize)
+{
+	SegmentSize = FMath::Max<uint64>(InSegmentSize, 64 * 1024);
+}
+
+void FConvaihttpSegmentedDownload::SetMaxSegmentRetries(int32 InMaxSegmentRetries)
+{
+	MaxSegmentRetries = FMath::Max(InMaxSegmentRetries, 0);
+}
+
+double FConvaihttpSegmentedDownload::GetElapsedTime() const
+{
+	if (StartTime == 0.0)
+	{
+		return 0.0;
+	}
+	return (bFinished ? EndTime : FPlatformTime::Seconds()) - StartTime;
+}
+
+bool FConvaihttpSegmentedDownload::Start()
+{
+	if (StartTime != 0.0)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpSegmentedDownload: download of %s was already started"), *URL);
+		return false;
+	}
+
+	StartTime = FPlatformTime::Seconds();
+	TargetSegmentsInFlight = FMath::Min(2, MaxSegments);
+
+	// The first segment finds out the size of the resource. Until then it can't be placed in memory, so it is received in
+	// the response, but it can already be written to the archive, where a server ignoring the range may send all of it
+	FirstRequest = CreateRangeRequest(0, SegmentSize - 1);
+	if (OutputArchive.IsValid())
+	{
+		FirstSink = MakeShared<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe>(OutputArchive.ToSharedRef(), 0, MAX_uint64);
+		FirstRequest->SetResponseBodyReceiveSink(FirstSink.ToSharedRef());
+	}
+	FirstRequest->OnProcessRequestComplete().BindThreadSafeSP(AsShared(), &FConvaihttpSegmentedDownload::OnFirstSegmentComplete);
+	if (!FirstRequest->ProcessRequest())
+	{
+		FirstRequest.Reset();
+		FirstSink.Reset();
+		return false;
+	}
+
+	SelfReference = AsShared();
+	return true;
+}
+
+void FConvaihttpSegmentedDownload::Cancel()
+{
+	if (StartTime != 0.0 && !bFailing && !bFinished)
+	{
+		Fail(TEXT("cancelled"));
+	}
+}
+
+FConvaihttpRequestRef FConvaihttpSegmentedDownload::CreateRangeRequest(uint64 Start, uint64 End) const
+{
+	FConvaihttpRequestRef Request = FConvaihttpModule::Get().CreateRequest();
+	Request->SetURL(URL);
+	Request->SetVerb(TEXT("GET"));
+	for (const TPair<FString, FString>& Header : Headers)
+	{
+		Request->SetHeader(Header.Key, Header.Value);
+	}
+	Request->SetHeader(TEXT("Range"), FString::Printf(TEXT("bytes=%llu-%llu"), Start, End));
+	if (!Validator.IsEmpty())
+	{
+		// If the resource changed, the server sends all of it instead of the range, which fails the segment.
+		// Only a strong ETag is sent: If-Range with a date is only reliable if the server's clock is
+		Request->SetHeader(TEXT("If-Range"), Validator);
+	}
+	return Request;
+}
+
+void FConvaihttpSegmentedDownload::OnFirstSegmentComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bRequestSucceeded)
+{
+	TSharedRef<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe> KeepAlive = AsShared();
+
+	FirstRequest.Reset();
+	TSharedPtr<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe> Sink = MoveTemp(FirstSink);
+
+	if (bFailing)
+	{
+		Finish(false);
+		return;
+	}
+
+	if (!bRequestSucceeded || !ConvaihttpResponse.IsValid() || (Sink.IsValid() && Sink->HasFailed()))
+	{
+		Fail(TEXT("first segment failed"));
+		return;
+	}
+
+	const int32 ResponseCode = ConvaihttpResponse->GetResponseCode();
+	const uint64 NumBytesReceived = Sink.IsValid() ? Sink->GetNumBytesWritten() : ConvaihttpResponse->GetContent().Num();
+	if (ResponseCode == EConvaihttpResponseCodes::Ok)
+	{
+		// The server ignored the range and sent the whole resource
+		const FString ContentLength = ConvaihttpResponse->GetHeader(TEXT("Content-Length"));
+		if (!ContentLength.IsEmpty() && FCString::Strtoui64(*ContentLength, nullptr, 10) != NumBytesReceived)
+		{
+			Fail(TEXT("received a different size than the Content-Length of the resource"));
+			return;
+		}
+
+		UE_LOG(LogConvaihttp, Log, TEXT("FConvaihttpSegmentedDownload: %s doesn't support ranges, received in one request"), *URL);
+		TotalSize = NumBytesReceived;
+		BytesReceived = NumBytesReceived;
+		if (!Sink.IsValid())
+		{
+			Content = ConvaihttpResponse->TakeContent();
+		}
+		Finish(true);
+		return;
+	}
+
+	if (ResponseCode == EConvaihttpResponseCodes::RangeNotSatisfiable
+		&& ConvaihttpSegmentedDownload::IsEmptyResourceContentRange(ConvaihttpResponse->GetHeader(TEXT("Content-Range"))))
+	{
+		// No range of an empty resource can be satisfied, there is nothing to download
+		UE_LOG(LogConvaihttp, Log, TEXT("FConvaihttpSegmentedDownload: %s is empty"), *URL);
+		Finish(true);
+		return;
+	}
+
+	uint64 RangeStart = 0, RangeEnd = 0, RangeTotal = 0;
+	if (ResponseCode != EConvaihttpResponseCodes::PartialContent
+		|| !ConvaihttpSegmentedDownload::ParseContentRange(ConvaihttpResponse->GetHeader(TEXT("Content-Range")), RangeStart, RangeEnd, RangeTotal)
+		|| RangeStart != 0
+		|| NumBytesReceived != RangeEnd + 1)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpSegmentedDownload: unexpected response to the first segment of %s, code %d, Content-Range: %s, %llu bytes"),
+			*URL, ResponseCode, *ConvaihttpResponse->GetHeader(TEXT("Content-Range")), NumBytesReceived);
+		Fail(TEXT("first segment failed"));
+		return;
+	}
+
+	TotalSize = RangeTotal;
+	BytesReceived = NumBytesReceived;
+
+	// If-Range needs a strong validator, weak ETags can't be used. Without one, segments are checked against Last-Modified
+	const FString ETag = ConvaihttpResponse->GetHeader(TEXT("ETag"));
+	if (!ETag.IsEmpty() && !ETag.StartsWith(TEXT("W/")))
+	{
+		Validator = ETag;
+	}
+	else
+	{
+		LastModified = ConvaihttpResponse->GetHeader(TEXT("Last-Modified"));
+	}
+	if (Validator.IsEmpty() && LastModified.IsEmpty())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpSegmentedDownload: %s has no validator, a change during the download can't be detected"), *URL);
+	}
+
+	if (!Sink.IsValid())
+	{
+		// Allocated once for the whole resource, and only resized here, before any segment writes in it
+		Content = ConvaihttpResponse->TakeContent();
+		Content.SetNumUninitialized(TotalSize, false);
+	}
+
+	// Queued in reverse, so popping takes the lowest offset first
+	const uint64 NumSegments = (TotalSize - BytesReceived + SegmentSize - 1) / SegmentSize;
+	PendingSegments.Reserve(static_cast<int32>(NumSegments));
+	for (uint64 Index = NumSegments; Index > 0; --Index)
+	{
+		FSegment& Segment = PendingSegments.AddDefaulted_GetRef();
+		Segment.Start = BytesReceived + (Index - 1) * SegmentSize;
+		Segment.End = FMath::Min(Segment.Start + SegmentSize, TotalSize) - 1;
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("FConvaihttpSegmentedDownload: downloading %llu bytes of %s in %llu more segments"), TotalSize, *URL, NumSegments);
+	ProgressDelegate.ExecuteIfBound(BytesReceived, TotalSize);
+
+	if (PendingSegments.Num() == 0)
+	{
+		Finish(true);
+		return;
+	}
+
+	WindowStartTime = FPlatformTime::Seconds();
+	StartSegments();
+}
+
+void FConvaihttpSegmentedDownload::StartSegments()
+{
+	while (ActiveSegments.Num() < TargetSegmentsInFlight && PendingSegments.Num() > 0)
+	{
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+		FSegment Segment = PendingSegments.Pop(false);
+#else
+		FSegment Segment = PendingSegments.Pop(EAllowShrinking::No);
+#endif
+		const uint64 Size = Segment.End - Segment.Start + 1;
+
+		FConvaihttpRequestRef Request = CreateRangeRequest(Segment.Start, Segment.End);
+		if (OutputArchive.IsValid())
+		{
+			Segment.Sink = MakeShared<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe>(OutputArchive.ToSharedRef(), Segment.Start, Size);
+		}
+		else
+		{
+			Segment.Sink = MakeShared<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe>(FMutableMemoryView(Content.GetData() + Segment.Start, Size));
+		}
+		Request->SetResponseBodyReceiveSink(Segment.Sink.ToSharedRef());
+		Request->OnProcessRequestComplete().BindThreadSafeSP(AsShared(), &FConvaihttpSegmentedDownload::OnSegmentComplete);
+		Segment.Request = Request;
+		Segment.StartTime = FPlatformTime::Seconds();
+
+		ActiveSegments.Add(MoveTemp(Segment));
+		if (!Request->ProcessRequest())
+		{
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+			ActiveSegments.Pop(false);
+#else
+			ActiveSegments.Pop(EAllowShrinking::No);
+#endif
+			Fail(TEXT("couldn't start a segment request"));
+			return;
+		}
+	}
+
+	PeakSegmentsInFlight = FMath::Max(PeakSegmentsInFlight, ActiveSegments.Num());
+}
+
+void FConvaihttpSegmentedDownload::OnSegmentComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bRequestSucceeded)
+{
+	TSharedRef<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe> KeepAlive = AsShared();
+
+	const int32 SegmentIndex = ActiveSegments.IndexOfByPredicate([&ConvaihttpRequest](const FSegment& Segment) { return Segment.Request == ConvaihttpRequest; });
+	if (SegmentIndex == INDEX_NONE)
+	{
+		return;
+	}
+	FSegment Segment = MoveTemp(ActiveSegments[SegmentIndex]);
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+	ActiveSegments.RemoveAtSwap(SegmentIndex, 1, false);
+#else
+	ActiveSegments.RemoveAtSwap(SegmentIndex, 1, EAllowShrinking::No);
+#endif
+	Segment.Request.Reset();
+	TSharedPtr<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe> Sink = MoveTemp(Segment.Sink);
+
+	if (bFailing)
+	{
+		if (ActiveSegments.Num() == 0 && !FirstRequest.IsValid() && !bFinished)
+		{
+			Finish(false);
+		}
+		return;
+	}
+
+	const int32 ResponseCode = ConvaihttpResponse.IsValid() ? ConvaihttpResponse->GetResponseCode() : 0;
+	if (ResponseCode == EConvaihttpResponseCodes::Ok || ResponseCode == EConvaihttpResponseCodes::PrecondFailed
+		|| (ResponseCode == EConvaihttpResponseCodes::PartialContent && !LastModified.IsEmpty() && ConvaihttpResponse->GetHeader(TEXT("Last-Modified")) != LastModified))
+	{
+		Fail(TEXT("the resource changed during the download"));
+		return;
+	}
+
+	// Only bytes from the range we asked for can be kept
+	uint64 RangeStart = 0, RangeEnd = 0, RangeTotal = 0;
+	const bool bIsExpectedRange = ResponseCode == EConvaihttpResponseCodes::PartialContent
+		&& ConvaihttpSegmentedDownload::ParseContentRange(ConvaihttpResponse->GetHeader(TEXT("Content-Range")), RangeStart, RangeEnd, RangeTotal)
+		&& RangeStart == Segment.Start && RangeEnd == Segment.End && RangeTotal == TotalSize
+		&& !Sink->HasFailed();
+
+	const uint64 Size = Segment.End - Segment.Start + 1;
+	const uint64 NumBytesWritten = bIsExpectedRange ? Sink->GetNumBytesWritten() : 0;
+	if (bRequestSucceeded && bIsExpectedRange && NumBytesWritten == Size)
+	{
+		BytesReceived += Size;
+		UpdateConcurrency(Size);
+		ProgressDelegate.ExecuteIfBound(BytesReceived, TotalSize);
+
+		if (PendingSegments.Num() == 0 && ActiveSegments.Num() == 0)
+		{
+			if (BytesReceived != TotalSize)
+			{
+				Fail(TEXT("received a different size than the resource"));
+				return;
+			}
+			Finish(true);
+			return;
+		}
+		StartSegments();
+		return;
+	}
+
+	if (Segment.NumRetries >= MaxSegmentRetries)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpSegmentedDownload: segment %llu-%llu of %s failed %d times, last code %d"), Segment.Start, Segment.End, *URL, Segment.NumRetries + 1, ResponseCode);
+		Fail(TEXT("a segment failed too many times"));
+		return;
+	}
+
+	// Ask again for what is missing
+	++Segment.NumRetries;
+	Segment.Start += NumBytesWritten;
+	BytesReceived += NumBytesWritten;
+	UE_LOG(LogConvaihttp, Log, TEXT("FConvaihttpSegmentedDownload: retrying bytes %llu-%llu of %s, code %d"), Segment.Start, Segment.End, *URL, ResponseCode);
+	PendingSegments.Push(MoveTemp(Segment));
+	StartSegments();
+}
+
+void FConvaihttpSegmentedDownload::UpdateConcurrency(uint64 SegmentBytes)
+{
+	// A window spans two rounds of segments at the current target, so each target is measured over enough transfers
+	WindowBytes += SegmentBytes;
+	++WindowSegments;
+	if (WindowSegments < TargetSegmentsInFlight * 2)
+	{
+		return;
+	}
+
+	const double Now = FPlatformTime::Seconds();
+	const double Throughput = WindowBytes / FMath::Max(Now - WindowStartTime, 0.001);
+	const int32 PreviousTarget = TargetSegmentsInFlight;
+	if (Throughput > BestThroughput * 1.1)
+	{
+		// Still improving, try one more
+		BestThroughput = Throughput;
+		TargetSegmentsInFlight = FMath::Min(TargetSegmentsInFlight + 1, MaxSegments);
+	}
+	else if (Throughput < BestThroughput * 0.9 && TargetSegmentsInFlight > 1)
+	{
+		// The last segment added made things worse
+		BestThroughput = Throughput;
+		--TargetSegmentsInFlight;
+	}
+
+	if (TargetSegmentsInFlight != PreviousTarget)
+	{
+		UE_LOG(LogConvaihttp, Verbose, TEXT("FConvaihttpSegmentedDownload: %.2f MB/s with %d segments in flight, now trying %d"), Throughput / (1024.0 * 1024.0), PreviousTarget, TargetSegmentsInFlight);
+	}
+
+	WindowStartTime = Now;
+	WindowBytes = 0;
+	WindowSegments = 0;
+}
+
+void FConvaihttpSegmentedDownload::Fail(const TCHAR* Reason)
+{
+	UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpSegmentedDownload: download of %s failed: %s"), *URL, Reason);
+
+	bFailing = true;
+	PendingSegments.Reset();
+
+	// Segments write in place, so the download only ends once none is in flight
+	TArray<FConvaihttpRequestPtr> RequestsToCancel;
+	for (const FSegment& Segment : ActiveSegments)
+	{
+		RequestsToCancel.Add(Segment.Request);
+	}
+	if (FirstRequest.IsValid())
+	{
+		RequestsToCancel.Add(FirstRequest);
+	}
+	for (const FConvaihttpRequestPtr& Request : RequestsToCancel)
+	{
+		Request->CancelRequest();
+	}
+
+	if (ActiveSegments.Num() == 0 && !FirstRequest.IsValid() && !bFinished)
+	{
+		Finish(false);
+	}
+}
+
+void FConvaihttpSegmentedDownload::Finish(bool bInSucceeded)
+{
+	bFinished = true;
+	bSucceeded = bInSucceeded;
+	EndTime = FPlatformTime::Seconds();
+
+	if (bSucceeded)
+	{
+		const double Elapsed = FMath::Max(EndTime - StartTime, 0.001);
+		UE_LOG(LogConvaihttp, Log, TEXT("FConvaihttpSegmentedDownload: downloaded %llu bytes of %s in %.2fs (%.2f MB/s), up to %d segments in flight"),
+			TotalSize, *URL, Elapsed, TotalSize / Elapsed / (1024.0 * 1024.0), PeakSegmentsInFlight);
+	}
+
+	CompleteDelegate.ExecuteIfBound(bSucceeded);
+	SelfReference.Reset();
+}
@@ -0,0 +1,193 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "ConvaihttpSlowRequestSampler.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/OutputDevice.h"
+#include "Misc/ScopeLock.h"
+
+namespace ConvaihttpSlowRequestSampler
+{
+	const TCHAR* LexToString(EConvaihttpVersion Version)
+	{
+		switch (Version)
+		{
+		case EConvaihttpVersion::Http1_0:	return TEXT("HTTP/1.0");
+		case EConvaihttpVersion::Http1_1:	return TEXT("HTTP/1.1");
+		case EConvaihttpVersion::Http2:		return TEXT("HTTP/2");
+		case EConvaihttpVersion::Http3:		return TEXT("HTTP/3");
+		default:							return TEXT("unknown");
+		}
+	}
+
+	/** Format a phase time, which is negative when the phase didn't happen */
+	FString FormatSeconds(double Seconds)
+	{
+		return Seconds >= 0.0 ? FString::Printf(TEXT("%.1fms"), Seconds * 1000.0) : FString(TEXT("-"));
+	}
+
+	void DumpSample(const FConvaihttpSlowRequestSample& Sample, FOutputDevice& Ar)
+	{
+		const FConvaihttpResponseTimings& Timings = Sample.Timings;
+		Ar.Logf(TEXT("  %s %s %s"), *Sample.Timestamp.ToString(), *Sample.Verb, *Sample.Url);
+		Ar.Logf(TEXT("    Status=%s Code=%d Total=%.1fms Sent=%llu Received=%llu"),
+			EConvaihttpRequestStatus::ToString(Sample.Status), Sample.ResponseCode, Sample.TotalSeconds * 1000.0, Sample.BytesSent, Sample.BytesReceived);
+		if (Timings.bIsValid)
+		{
+			Ar.Logf(TEXT("    Queue=%s DNS=%s Connect=%s TLS=%s PreTransfer=%s FirstByte=%s Redirects=%d (%s)"),
+				*FormatSeconds(Timings.QueueWaitSeconds), *FormatSeconds(Timings.NameLookupSeconds), *FormatSeconds(Timings.ConnectSeconds),
+				*FormatSeconds(Timings.TlsHandshakeSeconds), *FormatSeconds(Timings.PreTransferSeconds), *FormatSeconds(Timings.FirstByteSeconds),
+				Timings.NumRedirects, *FormatSeconds(Timings.RedirectSeconds));
+			Ar.Logf(TEXT("    Connection=%s Version=%s Remote=%s:%d LocalPort=%d"),
+				Timings.bConnectionReused ? TEXT("reused") : TEXT("new"), LexToString(Timings.Version),
+				Sample.RemoteAddress.IsEmpty() ? TEXT("?") : *Sample.RemoteAddress, Sample.RemotePort, Sample.LocalPort);
+		}
+		for (const FString& InfoMessage : Sample.InfoMessages)
+		{
+			Ar.Logf(TEXT("    | %s"), *InfoMessage);
+		}
+	}
+}
+
+FConvaihttpSlowRequestSampler& FConvaihttpSlowRequestSampler::Get()
+{
+	static FConvaihttpSlowRequestSampler Sampler;
+	return Sampler;
+}
+
+void FConvaihttpSlowRequestSampler::UpdateConfigs()
+{
+	double NewThresholdSeconds = ThresholdSeconds.load(std::memory_order_relaxed);
+	GConfig->GetDouble(TEXT("CONVAIHTTP"), TEXT("SlowRequestThresholdSeconds"), NewThresholdSeconds, GEngineIni);
+	ThresholdSeconds.store(NewThresholdSeconds, std::memory_order_relaxed);
+
+	FScopeLock Lock(&CriticalSection);
+	GConfig->GetInt(TEXT("CONVAIHTTP"), TEXT("SlowRequestSamplesPerWindow"), SamplesPerWindow, GEngineIni);
+	GConfig->GetDouble(TEXT("CONVAIHTTP"), TEXT("SlowRequestWindowSeconds"), WindowSeconds, GEngineIni);
+	GConfig->GetInt(TEXT("CONVAIHTTP"), TEXT("SlowRequestRingSize"), RingSize, GEngineIni);
+	SamplesPerWindow = FMath::Max(SamplesPerWindow, 1);
+	WindowSeconds = FMath::Max(WindowSeconds, 1.0);
+	RingSize = FMath::Max(RingSize, 1);
+
+	if (Ring.Num() > RingSize)
+	{
+		// Keep the newest samples, oldest first
+		TArray<FConvaihttpSlowRequestSample> NewRing;
+		for (int32 Index = Ring.Num() - RingSize; Index < Ring.Num(); ++Index)
+		{
+			NewRing.Add(MoveTemp(Ring[(RingHead + Index) % Ring.Num()]));
+		}
+		Ring = MoveTemp(NewRing);
+		RingHead = 0;
+	}
+}
+
+bool FConvaihttpSlowRequestSampler::ShouldSample(double TotalSeconds) const
+{
+	const double Threshold = ThresholdSeconds.load(std::memory_order_relaxed);
+	if (Threshold <= 0.0 || TotalSeconds < Threshold)
+	{
+		return false;
+	}
+	// A full window only takes requests slower than its fastest sample, until it ends
+	return TotalSeconds > WindowAdmissionSeconds.load(std::memory_order_relaxed)
+		|| FPlatformTime::Seconds() >= WindowEndTime.load(std::memory_order_relaxed);
+}
+
+void FConvaihttpSlowRequestSampler::AddSample(FConvaihttpSlowRequestSample&& Sample)
+{
+	FScopeLock Lock(&CriticalSection);
+	RotateWindow(FPlatformTime::Seconds());
+
+	if (WindowSamples.Num() < SamplesPerWindow)
+	{
+		WindowSamples.Add(MoveTemp(Sample));
+	}
+	else
+	{
+		int32 FastestIndex = 0;
+		for (int32 Index = 1; Index < WindowSamples.Num(); ++Index)
+		{
+			if (WindowSamples[Index].TotalSeconds < WindowSamples[FastestIndex].TotalSeconds)
+			{
+				FastestIndex = Index;
+			}
+		}
+		++NumDiscarded;
+		if (Sample.TotalSeconds <= WindowSamples[FastestIndex].TotalSeconds)
+		{
+			return;
+		}
+		WindowSamples[FastestIndex] = MoveTemp(Sample);
+	}
+
+	double AdmissionSeconds = 0.0;
+	if (WindowSamples.Num() >= SamplesPerWindow)
+	{
+		AdmissionSeconds = WindowSamples[0].TotalSeconds;
+		for (const FConvaihttpSlowRequestSample& WindowSample : WindowSamples)
+		{
+			AdmissionSeconds = FMath::Min(AdmissionSeconds, WindowSample.TotalSeconds);
+		}
+	}
+	WindowAdmissionSeconds.store(AdmissionSeconds, std::memory_order_relaxed);
+}
+
+void FConvaihttpSlowRequestSampler::RotateWindow(double Now)
+{
+	if (Now < WindowEndTime.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	// Samples of the window enter the ring in the order they completed
+	WindowSamples.Sort([](const FConvaihttpSlowRequestSample& A, const FConvaihttpSlowRequestSample& B) { return A.Timestamp < B.Timestamp; });
+	for (FConvaihttpSlowRequestSample& WindowSample : WindowSamples)
+	{
+		if (Ring.Num() < RingSize)
+		{
+			Ring.Add(MoveTemp(WindowSample));
+		}
+		else
+		{
+			Ring[RingHead] = MoveTemp(WindowSample);
+			RingHead = (RingHead + 1) % Ring.Num();
+		}
+	}
+	WindowSamples.Reset();
+
+	WindowAdmissionSeconds.store(0.0, std::memory_order_relaxed);
+	WindowEndTime.store(Now + WindowSeconds, std::memory_order_relaxed);
+}
+
+void FConvaihttpSlowRequestSampler::Reset()
+{
+	FScopeLock Lock(&CriticalSection);
+	WindowSamples.Reset();
+	Ring.Reset();
+	RingHead = 0;
+	NumDiscarded = 0;
+	WindowAdmissionSeconds.store(0.0, std::memory_order_relaxed);
+	WindowEndTime.store(0.0, std::memory_order_relaxed);
+}
+
+void FConvaihttpSlowRequestSampler::Dump(FOutputDevice& Ar)
+{
+	FScopeLock Lock(&CriticalSection);
+	RotateWindow(FPlatformTime::Seconds());
+
+	Ar.Logf(TEXT("CONVAIHTTP slow requests: threshold %.2fs, %d per %.0fs window, %d of %d kept, %llu discarded"),
+		ThresholdSeconds.load(std::memory_order_relaxed), SamplesPerWindow, WindowSeconds, Ring.Num(), RingSize, NumDiscarded);
+	for (int32 Index = 0; Index < Ring.Num(); ++Index)
+	{
+		ConvaihttpSlowRequestSampler::DumpSample(Ring[(RingHead + Index) % Ring.Num()], Ar);
+	}
+	if (WindowSamples.Num() > 0)
+	{
+		Ar.Logf(TEXT("Current window, %.0fs left:"), WindowEndTime.load(std::memory_order_relaxed) - FPlatformTime::Seconds());
+		for (const FConvaihttpSlowRequestSample& WindowSample : WindowSamples)
+		{
+			ConvaihttpSlowRequestSampler::DumpSample(WindowSample, Ar);
+		}
+	}
+}
@@ -2,58 +2,3231 @@
 
 #include "ConvaihttpTests.h"
 #include "ConvaihttpModule.h"
+#include "ConvaihttpManager.h"
 #include "Convaihttp.h"
+#include "GenericPlatform/ConvaihttpServerSentEvents.h"
+#include "GenericPlatform/ConvaihttpFrameDecoder.h"
+#include "GenericPlatform/ConvaihttpResponseBodySink.h"
+#include "ConvaihttpSegmentedDownload.h"
+#include "ConvaihttpRetrySystem.h"
+#include "ConvaihttpMetrics.h"
+#include "ConvaihttpTrafficCapture.h"
+#include "ConvaihttpRequestAdapter.h"
+#include "SimulatedConvaihttp.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+#include "Misc/EngineVersionComparison.h"
+#include "Misc/StringBuilder.h"
+#include "Misc/Base64.h"
+#include "Serialization/ArrayReader.h"
+#include "Serialization/ArrayWriter.h"
+#include "Misc/SecureHash.h"
+#include "Math/RandomStream.h"
+#include "HAL/RunnableThread.h"
+#if WITH_CURL
+#include "IPAddress.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "Curl/CurlConvaihttpManager.h"
+#endif
+#if WITH_CONVAIHTTP_NGHTTP2
+THIRD_PARTY_INCLUDES_START
+#include "nghttp2/nghttp2.h"
+THIRD_PARTY_INCLUDES_END
+#endif
 
-// FConvaihttpTest
+#if WITH_CURL
 
-FConvaihttpTest::FConvaihttpTest(const FString& InVerb, const FString& InPayload, const FString& InUrl, int32 InIterations)
-	: Verb(InVerb)
-	, Payload(InPayload)
-	, Url(InUrl)
-	, TestsToRun(InIterations)
+// FConvaihttpLoopbackServer
+
+#if WITH_CONVAIHTTP_NGHTTP2
+struct FConvaihttpLoopbackServer::FHttp2
+{
+	/** Create the session of a new connection, queueing the settings of the server */
+	static bool StartSession(FConvaihttpLoopbackServer& Server, FConnection& Connection)
+	{
+		nghttp2_session_callbacks* Callbacks = nullptr;
+		if (nghttp2_session_callbacks_new(&Callbacks) != 0)
+		{
+			return false;
+		}
+		nghttp2_session_callbacks_set_on_begin_headers_callback(Callbacks, &OnBeginHeaders);
+		nghttp2_session_callbacks_set_on_header_callback(Callbacks, &OnHeader);
+		nghttp2_session_callbacks_set_on_frame_recv_callback(Callbacks, &OnFrameRecv);
+		nghttp2_session_callbacks_set_on_stream_close_callback(Callbacks, &OnStreamClose);
+
+		Connection.Server = &Server;
+		const int Result = nghttp2_session_server_new(&Connection.Session, Callbacks, &Connection);
+		nghttp2_session_callbacks_del(Callbacks);
+		if (Result != 0)
+		{
+			Connection.Session = nullptr;
+			return false;
+		}
+
+		const nghttp2_settings_entry Settings[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 256 } };
+		return nghttp2_submit_settings(Connection.Session, NGHTTP2_FLAG_NONE, Settings, UE_ARRAY_COUNT(Settings)) == 0;
+	}
+
+	/** Hand the bytes received to the session, which answers the requests they complete */
+	static bool Receive(FConnection& Connection)
+	{
+		if (Connection.Received.Num() == 0)
+		{
+			return true;
+		}
+		const ssize_t Result = nghttp2_session_mem_recv(Connection.Session, Connection.Received.GetData(), Connection.Received.Num());
+		Connection.Received.Reset();
+		return Result >= 0;
+	}
+
+	/** Queue the frames the session has to send, and close the connection once the session is over */
+	static bool Produce(FConnection& Connection)
+	{
+		Connection.ToSend.Reset();
+		Connection.SendOffset = 0;
+
+		// Frames are gathered so small ones go out in one send
+		while (Connection.ToSend.Num() < 64 * 1024)
+		{
+			const uint8_t* Data = nullptr;
+			const ssize_t Size = nghttp2_session_mem_send(Connection.Session, &Data);
+			if (Size < 0)
+			{
+				return false;
+			}
+			if (Size == 0)
+			{
+				break;
+			}
+			Connection.ToSend.Append(Data, static_cast<int32>(Size));
+		}
+
+		if (Connection.ToSend.Num() == 0 && !nghttp2_session_want_read(Connection.Session) && !nghttp2_session_want_write(Connection.Session))
+		{
+			Connection.bCloseAfterSend = true;
+		}
+		return true;
+	}
+
+	static int OnBeginHeaders(nghttp2_session* Session, const nghttp2_frame* Frame, void* UserData)
+	{
+		if (Frame->hd.type == NGHTTP2_HEADERS && Frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+		{
+			static_cast<FConnection*>(UserData)->Streams.Add(Frame->hd.stream_id);
+		}
+		return 0;
+	}
+
+	static int OnHeader(nghttp2_session* Session, const nghttp2_frame* Frame, const uint8_t* Name, size_t NameLength, const uint8_t* Value, size_t ValueLength, uint8_t Flags, void* UserData)
+	{
+		FStream* Stream = Frame->hd.type == NGHTTP2_HEADERS ? static_cast<FConnection*>(UserData)->Streams.Find(Frame->hd.stream_id) : nullptr;
+		if (Stream == nullptr)
+		{
+			return 0;
+		}
+
+		const FString HeaderName(static_cast<int32>(NameLength), reinterpret_cast<const ANSICHAR*>(Name));
+		const FString HeaderValue(static_cast<int32>(ValueLength), reinterpret_cast<const ANSICHAR*>(Value));
+		if (HeaderName == TEXT(":method"))
+		{
+			Stream->Method = HeaderValue;
+		}
+		else if (HeaderName == TEXT(":path"))
+		{
+			Stream->Path = HeaderValue;
+		}
+		else if (HeaderName == TEXT("range"))
+		{
+			Stream->Range = HeaderValue;
+		}
+		return 0;
+	}
+
+	static int OnFrameRecv(nghttp2_session* Session, const nghttp2_frame* Frame, void* UserData)
+	{
+		// A request is answered once it is complete, body included
+		if ((Frame->hd.type == NGHTTP2_HEADERS || Frame->hd.type == NGHTTP2_DATA) && (Frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0)
+		{
+			FConnection& Connection = *static_cast<FConnection*>(UserData);
+			if (FStream* Stream = Connection.Streams.Find(Frame->hd.stream_id))
+			{
+				return SubmitResponse(Connection, Frame->hd.stream_id, *Stream);
+			}
+		}
+		return 0;
+	}
+
+	static int OnStreamClose(nghttp2_session* Session, int32_t StreamId, uint32_t ErrorCode, void* UserData)
+	{
+		static_cast<FConnection*>(UserData)->Streams.Remove(StreamId);
+		return 0;
+	}
+
+	static int SubmitResponse(FConnection& Connection, int32 StreamId, FStream& Stream)
+	{
+		Connection.Server->RecordRange(Stream.Range);
+		const FResponse Response = MakeResponse(Stream.Path, Stream.Range);
+		Stream.BodyRemaining = Stream.Method == TEXT("HEAD") ? 0 : Response.BodySize;
+		Stream.BodyOffset = Response.BodyOffset;
+
+		// nghttp2 copies the headers when the response is submitted
+		const FTCHARToUTF8 Status(*FString::FromInt(Response.StatusCode));
+		const FTCHARToUTF8 ContentLength(*LexToString(Response.BodySize));
+		const FTCHARToUTF8 ETag(*FString::Printf(TEXT("\"%lld\""), Response.ResourceSize));
+		const FTCHARToUTF8 ContentRange(*Response.ContentRange);
+		auto MakeHeader = [](const char* Name, const void* Value, int32 ValueLength)
+		{
+			return nghttp2_nv{ (uint8_t*)Name, (uint8_t*)Value, static_cast<size_t>(FCStringAnsi::Strlen(Name)), static_cast<size_t>(ValueLength), NGHTTP2_NV_FLAG_NONE };
+		};
+		TArray<nghttp2_nv, TInlineAllocator<6>> Headers;
+		Headers.Add(MakeHeader(":status", Status.Get(), Status.Length()));
+		Headers.Add(MakeHeader("content-type", "application/octet-stream", 24));
+		Headers.Add(MakeHeader("content-length", ContentLength.Get(), ContentLength.Length()));
+		Headers.Add(MakeHeader("accept-ranges", "bytes", 5));
+		Headers.Add(MakeHeader("etag", ETag.Get(), ETag.Length()));
+		if (!Response.ContentRange.IsEmpty())
+		{
+			Headers.Add(MakeHeader("content-range", ContentRange.Get(), ContentRange.Length()));
+		}
+
+		nghttp2_data_provider Body;
+		Body.source.ptr = nullptr;
+		Body.read_callback = &ReadBody;
+		if (nghttp2_submit_response(Connection.Session, StreamId, Headers.GetData(), Headers.Num(), Stream.BodyRemaining > 0 ? &Body : nullptr) != 0)
+		{
+			return NGHTTP2_ERR_CALLBACK_FAILURE;
+		}
+
+		Connection.Server->NumRequestsServed.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+
+	/** Fill a DATA frame of a response from ResponseFill */
+	static ssize_t ReadBody(nghttp2_session* Session, int32_t StreamId, uint8_t* Buffer, size_t Length, uint32_t* DataFlags, nghttp2_data_source* Source, void* UserData)
+	{
+		FConnection& Connection = *static_cast<FConnection*>(UserData);
+		FStream* Stream = Connection.Streams.Find(StreamId);
+		if (Stream == nullptr)
+		{
+			return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+		}
+
+		const TArray<uint8>& ResponseFill = Connection.Server->ResponseFill;
+		const int64 Size = FMath::Min3<int64>(Length, Stream->BodyRemaining, ResponseFill.Num() - 26);
+		FMemory::Memcpy(Buffer, ResponseFill.GetData() + Stream->BodyOffset % 26, Size);
+		Stream->BodyRemaining -= Size;
+		Stream->BodyOffset += Size;
+		if (Stream->BodyRemaining == 0)
+		{
+			*DataFlags |= NGHTTP2_DATA_FLAG_EOF;
+		}
+		return static_cast<ssize_t>(Size);
+	}
+};
+#endif
+
+FConvaihttpLoopbackServer::FConnection::~FConnection()
+{
+#if WITH_CONVAIHTTP_NGHTTP2
+	if (Session != nullptr)
+	{
+		nghttp2_session_del(Session);
+	}
+#endif
+}
+
+FConvaihttpLoopbackServer::~FConvaihttpLoopbackServer()
+{
+	Shutdown();
+}
+
+bool FConvaihttpLoopbackServer::Start(int64 InMaxBytesPerSecond, EProtocol InProtocol)
+{
+	MaxBytesPerSecond = FMath::Max<int64>(InMaxBytesPerSecond, 0);
+	Protocol = InProtocol;
+#if !WITH_CONVAIHTTP_NGHTTP2
+	if (Protocol == EProtocol::Http2)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Loopback server: HTTP/2 needs nghttp2, which this build doesn't link"));
+		return false;
+	}
+#endif
+
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	if (SocketSubsystem == nullptr)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Loopback server: no socket subsystem"));
+		return false;
+	}
+
+	TSharedRef<FInternetAddr> Address = SocketSubsystem->CreateInternetAddr();
+	Address->SetLoopbackAddress();
+	Address->SetPort(0);
+
+	ListenSocket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("ConvaihttpLoopbackServer"), Address->GetProtocolType());
+	if (ListenSocket == nullptr || !ListenSocket->SetNonBlocking(true) || !ListenSocket->Bind(*Address) || !ListenSocket->Listen(128))
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Loopback server: failed to listen on the loopback interface"));
+		DestroySocket(ListenSocket);
+		ListenSocket = nullptr;
+		return false;
+	}
+	Port = ListenSocket->GetPortNo();
+
+	// A whole number of alphabets, so any part of a body is a slice of the fill starting at its offset modulo 26
+	ResponseFill.SetNumUninitialized(26 * 2521);
+	for (int32 Index = 0; Index < ResponseFill.Num(); ++Index)
+	{
+		ResponseFill[Index] = static_cast<uint8>('a' + Index % 26);
+	}
+	bStopping = false;
+	Thread = FRunnableThread::Create(this, TEXT("ConvaihttpLoopbackServer"), 128 * 1024, TPri_Normal);
+	return Thread != nullptr;
+}
+
+void FConvaihttpLoopbackServer::Shutdown()
+{
+	if (Thread != nullptr)
+	{
+		Thread->Kill(true);
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	for (const TUniquePtr<FConnection>& Connection : Connections)
+	{
+		DestroySocket(Connection->Socket);
+	}
+	Connections.Reset();
+
+	DestroySocket(ListenSocket);
+	ListenSocket = nullptr;
+}
+
+FString FConvaihttpLoopbackServer::GetUrl() const
+{
+	return FString::Printf(TEXT("http://127.0.0.1:%d/"), Port);
+}
+
+TArray<FString> FConvaihttpLoopbackServer::GetRangesRequested() const
 {
-	
+	FScopeLock ScopeLock(&RangesRequestedCriticalSection);
+	return RangesRequested;
 }
 
-void FConvaihttpTest::Run(void)
+void FConvaihttpLoopbackServer::RecordRange(const FString& Range)
 {
-	UE_LOG(LogConvaihttp, Log, TEXT("Starting test [%s] Url=[%s]"), 
-		*Verb, *Url);
+	if (!Range.IsEmpty())
+	{
+		FScopeLock ScopeLock(&RangesRequestedCriticalSection);
+		RangesRequested.Add(Range);
+	}
+}
+
+void FConvaihttpLoopbackServer::Stop()
+{
+	bStopping = true;
+}
 
-	for (int Idx=0; Idx < TestsToRun; Idx++)
+uint32 FConvaihttpLoopbackServer::Run()
+{
+	while (!bStopping)
 	{
-		TSharedPtr<IConvaihttpRequest, ESPMode::ThreadSafe> Request = FConvaihttpModule::Get().CreateRequest();
-		Request->OnProcessRequestComplete().BindRaw(this, &FConvaihttpTest::RequestComplete);
-		Request->SetURL(Url);
-		if (Payload.Len() > 0)
+		bool bDidWork = false;
+
+		bool bHasPendingConnection = false;
+		while (ListenSocket->HasPendingConnection(bHasPendingConnection) && bHasPendingConnection)
 		{
-			Request->SetContentAsString(Payload);
+			FSocket* Socket = ListenSocket->Accept(TEXT("ConvaihttpLoopbackConnection"));
+			if (Socket == nullptr)
+			{
+				break;
+			}
+			Socket->SetNonBlocking(true);
+			Socket->SetNoDelay(true);
+			TUniquePtr<FConnection> Connection = MakeUnique<FConnection>();
+			Connection->Socket = Socket;
+			Connection->LastAllowanceTime = FPlatformTime::Seconds();
+			bDidWork = true;
+#if WITH_CONVAIHTTP_NGHTTP2
+			if (Protocol == EProtocol::Http2 && !FHttp2::StartSession(*this, *Connection))
+			{
+				UE_LOG(LogConvaihttp, Warning, TEXT("Loopback server: failed to start an HTTP/2 session"));
+				DestroySocket(Socket);
+				continue;
+			}
+#endif
+			Connections.Add(MoveTemp(Connection));
+		}
+
+		for (int32 Index = 0; Index < Connections.Num(); ++Index)
+		{
+			if (!ServeConnection(*Connections[Index], bDidWork))
+			{
+				DestroySocket(Connections[Index]->Socket);
+				Connections.RemoveAtSwap(Index);
+				--Index;
+			}
+		}
+
+		if (!bDidWork)
+		{
+			FPlatformProcess::SleepNoStats(0.0001f);
 		}
-		Request->SetVerb(Verb);
-		Request->ProcessRequest();
 	}
+	return 0;
 }
 
-void FConvaihttpTest::RequestComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded)
+bool FConvaihttpLoopbackServer::ServeConnection(FConnection& Connection, bool& bOutDidWork)
 {
-	if (!ConvaihttpResponse.IsValid())
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+	uint8 Buffer[16 * 1024];
+	for (;;)
+	{
+		int32 BytesRead = 0;
+		if (!Connection.Socket->Recv(Buffer, sizeof(Buffer), BytesRead))
+		{
+			if (SocketSubsystem->GetLastErrorCode() != SE_EWOULDBLOCK)
+			{
+				// Closed by the client
+				return false;
+			}
+			break;
+		}
+		if (BytesRead <= 0)
+		{
+			break;
+		}
+		Connection.Received.Append(Buffer, BytesRead);
+		bOutDidWork = true;
+	}
+
+#if WITH_CONVAIHTTP_NGHTTP2
+	if (Connection.Session != nullptr)
+	{
+		// The session answers each request from its callbacks as soon as it is complete
+		if (!FHttp2::Receive(Connection))
+		{
+			return false;
+		}
+	}
+	else
+#endif
+	if (Connection.bWebSocket)
 	{
-		UE_LOG(LogConvaihttp, Log, TEXT("Test failed. NULL response"));
+		EchoWebSocketFrames(Connection);
 	}
 	else
 	{
-		UE_LOG(LogConvaihttp, Log, TEXT("Completed test [%s] Url=[%s] Response=[%d] [%s]"), 
-			*ConvaihttpRequest->GetVerb(), 
-			*ConvaihttpRequest->GetURL(), 
-			ConvaihttpResponse->GetResponseCode(), 
-			*ConvaihttpResponse->GetContentAsString());
+		HandleRequest(Connection);
+	}
+
+	for (;;)
+	{
+#if WITH_CONVAIHTTP_NGHTTP2
+		// HTTP/2 frames are produced by the session as the previous ones go out
+		if (Connection.Session != nullptr && !Connection.IsSending() && !FHttp2::Produce(Connection))
+		{
+			return false;
+		}
+#endif
+		if (!Connection.IsSending())
+		{
+			break;
+		}
+
+		// The header goes first, then the body is sent from the fill without being copied
+		const bool bSendingHeader = Connection.SendOffset < Connection.ToSend.Num();
+		const uint8* Data = bSendingHeader ? Connection.ToSend.GetData() + Connection.SendOffset : ResponseFill.GetData() + Connection.BodyOffset % 26;
+		int32 Size = bSendingHeader ? Connection.ToSend.Num() - Connection.SendOffset : static_cast<int32>(FMath::Min<int64>(Connection.BodyRemaining, ResponseFill.Num() - 26));
+
+		if (MaxBytesPerSecond > 0)
+		{
+			// Token bucket allowing bursts of a tenth of a second, so the cap holds over any longer period
+			const double Now = FPlatformTime::Seconds();
+			const double MaxAllowance = FMath::Max(MaxBytesPerSecond * 0.1, 1500.0);
+			Connection.SendAllowance = FMath::Min(Connection.SendAllowance + (Now - Connection.LastAllowanceTime) * MaxBytesPerSecond, MaxAllowance);
+			Connection.LastAllowanceTime = Now;
+			Size = FMath::Min(Size, static_cast<int32>(Connection.SendAllowance));
+			if (Size <= 0)
+			{
+				break;
+			}
+		}
+
+		int32 BytesSent = 0;
+		if (!Connection.Socket->Send(Data, Size, BytesSent))
+		{
+			if (SocketSubsystem->GetLastErrorCode() != SE_EWOULDBLOCK)
+			{
+				return false;
+			}
+			break;
+		}
+		if (BytesSent <= 0)
+		{
+			break;
+		}
+		bOutDidWork = true;
+		Connection.SendAllowance -= BytesSent;
+
+		if (bSendingHeader)
+		{
+			Connection.SendOffset += BytesSent;
+			if (Connection.SendOffset == Connection.ToSend.Num())
+			{
+				Connection.ToSend.Reset();
+				Connection.SendOffset = 0;
+			}
+		}
+		else
+		{
+			Connection.BodyRemaining -= BytesSent;
+			Connection.BodyOffset += BytesSent;
+		}
+	}
+
+	return Connection.IsSending() || !Connection.bCloseAfterSend;
+}
+
+void FConvaihttpLoopbackServer::HandleRequest(FConnection& Connection)
+{
+	static const uint8 HeaderEnd[] = { '\r', '\n', '\r', '\n' };
+
+	// Requests are answered one at a time, as the body of a response is only known by its size while it is sent
+	if (Connection.bCloseAfterSend || Connection.IsSending())
+	{
+		return;
+	}
+
+	// Wait for the whole header block
+	int32 HeaderSize = INDEX_NONE;
+	for (int32 Index = 0; Index + 4 <= Connection.Received.Num(); ++Index)
+	{
+		if (FMemory::Memcmp(Connection.Received.GetData() + Index, HeaderEnd, 4) == 0)
+		{
+			HeaderSize = Index + 4;
+			break;
+		}
+	}
+	if (HeaderSize == INDEX_NONE)
+	{
+		return;
+	}
+
+	const FString Header(HeaderSize, reinterpret_cast<const ANSICHAR*>(Connection.Received.GetData()));
+	TArray<FString> Lines;
+	Header.ParseIntoArrayLines(Lines);
+	if (Lines.Num() == 0)
+	{
+		Connection.bCloseAfterSend = true;
+		return;
+	}
+
+	int64 ContentLength = 0;
+	bool bChunked = false;
+	FString Range;
+	FString WebSocketKey;
+	for (int32 LineIndex = 1; LineIndex < Lines.Num(); ++LineIndex)
+	{
+		FString Name, Value;
+		if (Lines[LineIndex].Split(TEXT(":"), &Name, &Value))
+		{
+			Value.TrimStartAndEndInline();
+			if (Name.Equals(TEXT("Content-Length"), ESearchCase::IgnoreCase))
+			{
+				ContentLength = FCString::Atoi64(*Value);
+			}
+			else if (Name.Equals(TEXT("Transfer-Encoding"), ESearchCase::IgnoreCase))
+			{
+				bChunked = Value.Equals(TEXT("chunked"), ESearchCase::IgnoreCase);
+			}
+			else if (Name.Equals(TEXT("Connection"), ESearchCase::IgnoreCase))
+			{
+				Connection.bCloseAfterSend = Value.Equals(TEXT("close"), ESearchCase::IgnoreCase);
+			}
+			else if (Name.Equals(TEXT("Range"), ESearchCase::IgnoreCase))
+			{
+				Range = Value;
+			}
+			else if (Name.Equals(TEXT("Sec-WebSocket-Key"), ESearchCase::IgnoreCase))
+			{
+				WebSocketKey = Value;
+			}
+		}
+	}
+
+	if (!WebSocketKey.IsEmpty())
+	{
+		// Upgrade, the accept key being the SHA-1 of the key and the GUID of the protocol
+		const FTCHARToUTF8 AcceptSource(*(WebSocketKey + TEXT("258EAFA5-E914-47DA-95CA-C5AB0DC85B11")));
+		uint8 AcceptHash[FSHA1::DigestSize];
+		FSHA1::HashBuffer(AcceptSource.Get(), AcceptSource.Length(), AcceptHash);
+		const FString ResponseHeader = FString::Printf(TEXT("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"),
+			*FBase64::Encode(AcceptHash, FSHA1::DigestSize));
+		const FTCHARToUTF8 ResponseHeaderUtf8(*ResponseHeader);
+		Connection.ToSend.Append(reinterpret_cast<const uint8*>(ResponseHeaderUtf8.Get()), ResponseHeaderUtf8.Length());
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+		Connection.Received.RemoveAt(0, HeaderSize, false);
+#else
+		Connection.Received.RemoveAt(0, HeaderSize, EAllowShrinking::No);
+#endif
+		Connection.bCloseAfterSend = false;
+		Connection.bWebSocket = true;
+		NumRequestsServed.fetch_add(1, std::memory_order_relaxed);
+		EchoWebSocketFrames(Connection);
+		return;
+	}
+
+	if (bChunked)
+	{
+		// Not needed by the load test, bodies are always sent with their length
+		static const ANSICHAR LengthRequired[] = "HTTP/1.1 411 Length Required\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		Connection.ToSend.Append(reinterpret_cast<const uint8*>(LengthRequired), UE_ARRAY_COUNT(LengthRequired) - 1);
+		Connection.bCloseAfterSend = true;
+		return;
+	}
+
+	// Wait for the whole body
+	if (Connection.Received.Num() < HeaderSize + ContentLength)
+	{
+		return;
+	}
+
+	// The request line is "<verb> <target> HTTP/1.1"
+	TArray<FString> RequestLine;
+	Lines[0].ParseIntoArrayWS(RequestLine);
+
+	if (RequestLine.Num() >= 2 && RequestLine[1].StartsWith(TEXT("/echo")))
+	{
+		// The body of the request is the body of the response
+		const FString ResponseHeader = FString::Printf(TEXT("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %lld\r\n%s\r\n"),
+			ContentLength, Connection.bCloseAfterSend ? TEXT("Connection: close\r\n") : TEXT(""));
+		const FTCHARToUTF8 ResponseHeaderUtf8(*ResponseHeader);
+		Connection.ToSend.Append(reinterpret_cast<const uint8*>(ResponseHeaderUtf8.Get()), ResponseHeaderUtf8.Length());
+		Connection.ToSend.Append(Connection.Received.GetData() + HeaderSize, static_cast<int32>(ContentLength));
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+		Connection.Received.RemoveAt(0, HeaderSize + ContentLength, false);
+#else
+		Connection.Received.RemoveAt(0, HeaderSize + ContentLength, EAllowShrinking::No);
+#endif
+		NumRequestsServed.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+	Connection.Received.RemoveAt(0, HeaderSize + ContentLength, false);
+#else
+	Connection.Received.RemoveAt(0, HeaderSize + ContentLength, EAllowShrinking::No);
+#endif
+	RecordRange(Range);
+	const FString Target = RequestLine.Num() >= 2 ? RequestLine[1] : FString();
+	const FResponse Response = MakeResponse(Target, MoveTemp(Range));
+
+	const TCHAR* StatusText = Response.StatusCode == 206 ? TEXT("Partial Content") : Response.StatusCode == 416 ? TEXT("Range Not Satisfiable") : TEXT("OK");
+	const FString ContentRange = Response.ContentRange.IsEmpty() ? FString() : FString::Printf(TEXT("Content-Range: %s\r\n"), *Response.ContentRange);
+	// The body is the same for a given size, so its size is a strong validator for If-Range
+	const FString ResponseHeader = FString::Printf(TEXT("HTTP/1.1 %d %s\r\nContent-Type: application/octet-stream\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\nETag: \"%lld\"\r\n%s%s\r\n"),
+		Response.StatusCode, StatusText, Response.BodySize, Response.ResourceSize, *ContentRange, Connection.bCloseAfterSend ? TEXT("Connection: close\r\n") : TEXT(""));
+	const FTCHARToUTF8 ResponseHeaderUtf8(*ResponseHeader);
+	Connection.ToSend.Append(reinterpret_cast<const uint8*>(ResponseHeaderUtf8.Get()), ResponseHeaderUtf8.Length());
+	Connection.BodyRemaining = RequestLine.Num() >= 1 && RequestLine[0] == TEXT("HEAD") ? 0 : Response.BodySize;
+	Connection.BodyOffset = Response.BodyOffset;
+
+	// The first response to reach the "failat" offset of its target is cut short there, as if the transfer dropped
+	const int32 FailAtIndex = Target.Find(TEXT("failat="));
+	if (FailAtIndex != INDEX_NONE && !FailedTargets.Contains(Target))
+	{
+		const int64 FailAt = FCString::Atoi64(*Target + FailAtIndex + 7);
+		if (FailAt >= Connection.BodyOffset && FailAt < Connection.BodyOffset + Connection.BodyRemaining)
+		{
+			FailedTargets.Add(Target);
+			Connection.BodyRemaining = FailAt - Connection.BodyOffset;
+			Connection.bCloseAfterSend = true;
+		}
+	}
+
+	NumRequestsServed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FConvaihttpLoopbackServer::EchoWebSocketFrames(FConnection& Connection)
+{
+	// Frames from a client are always masked: 2 bytes, the extended length if any, then the 4 byte mask and the payload
+	while (!Connection.bCloseAfterSend && Connection.Received.Num() >= 2)
+	{
+		const uint8* Frame = Connection.Received.GetData();
+		const uint8 FinAndOpcode = Frame[0];
+		const uint8 Opcode = FinAndOpcode & 0x0f;
+		int64 PayloadSize = Frame[1] & 0x7f;
+		int32 HeaderSize = 2;
+		if (PayloadSize == 126)
+		{
+			HeaderSize += 2;
+		}
+		else if (PayloadSize == 127)
+		{
+			HeaderSize += 8;
+		}
+		if (Connection.Received.Num() < HeaderSize + 4)
+		{
+			return;
+		}
+		if (HeaderSize > 2)
+		{
+			PayloadSize = 0;
+			for (int32 Index = 2; Index < HeaderSize; ++Index)
+			{
+				PayloadSize = (PayloadSize << 8) | Frame[Index];
+			}
+		}
+		const uint8* Mask = Frame + HeaderSize;
+		if (Connection.Received.Num() < HeaderSize + 4 + PayloadSize)
+		{
+			return;
+		}
+
+		// Answer pings with a pong, and everything else with the same frame, unmasked
+		uint8 ReplyHeader[10];
+		int32 ReplyHeaderSize = 2;
+		ReplyHeader[0] = Opcode == 0x9 ? (0x80 | 0xA) : FinAndOpcode;
+		if (PayloadSize < 126)
+		{
+			ReplyHeader[1] = static_cast<uint8>(PayloadSize);
+		}
+		else if (PayloadSize <= 0xffff)
+		{
+			ReplyHeader[1] = 126;
+			ReplyHeader[2] = static_cast<uint8>(PayloadSize >> 8);
+			ReplyHeader[3] = static_cast<uint8>(PayloadSize);
+			ReplyHeaderSize = 4;
+		}
+		else
+		{
+			ReplyHeader[1] = 127;
+			for (int32 Index = 0; Index < 8; ++Index)
+			{
+				ReplyHeader[2 + Index] = static_cast<uint8>(PayloadSize >> (8 * (7 - Index)));
+			}
+			ReplyHeaderSize = 10;
+		}
+
+		if (Opcode != 0xA)
+		{
+			Connection.ToSend.Append(ReplyHeader, ReplyHeaderSize);
+			const int32 PayloadOffset = Connection.ToSend.AddUninitialized(static_cast<int32>(PayloadSize));
+			const uint8* Payload = Mask + 4;
+			for (int64 Index = 0; Index < PayloadSize; ++Index)
+			{
+				Connection.ToSend[PayloadOffset + Index] = Payload[Index] ^ Mask[Index % 4];
+			}
+		}
+		// The close frame is echoed, which completes the close handshake
+		if (Opcode == 0x8)
+		{
+			Connection.bCloseAfterSend = true;
+		}
+
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+		Connection.Received.RemoveAt(0, static_cast<int32>(HeaderSize + 4 + PayloadSize), false);
+#else
+		Connection.Received.RemoveAt(0, static_cast<int32>(HeaderSize + 4 + PayloadSize), EAllowShrinking::No);
+#endif
+	}
+}
+
+FConvaihttpLoopbackServer::FResponse FConvaihttpLoopbackServer::MakeResponse(const FString& Target, FString Range)
+{
+	FResponse Response;
+
+	// The size of the response is in the query of the target
+	const int32 SizeIndex = Target.Find(TEXT("size="));
+	if (SizeIndex != INDEX_NONE)
+	{
+		Response.ResourceSize = FMath::Max<int64>(FCString::Atoi64(*Target + SizeIndex + 5), 0);
+	}
+	Response.BodySize = Response.ResourceSize;
+
+	// A single range of the body, "bytes=<first>-[<last>]", is answered with that part of it
+	FString RangeFirst, RangeLast;
+	if (!Target.Contains(TEXT("norange")) && Range.RemoveFromStart(TEXT("bytes=")) && !Range.Contains(TEXT(",")) && Range.Split(TEXT("-"), &RangeFirst, &RangeLast) && !RangeFirst.IsEmpty())
+	{
+		const int64 First = FCString::Atoi64(*RangeFirst);
+		const int64 Last = RangeLast.IsEmpty() ? Response.ResourceSize - 1 : FMath::Min(FCString::Atoi64(*RangeLast), Response.ResourceSize - 1);
+		if (First <= Last)
+		{
+			Response.StatusCode = 206;
+			Response.BodyOffset = First;
+			Response.ContentRange = FString::Printf(TEXT("bytes %lld-%lld/%lld"), First, Last, Response.ResourceSize);
+			Response.BodySize = Last - First + 1;
+		}
+		else
+		{
+			Response.StatusCode = 416;
+			Response.ContentRange = FString::Printf(TEXT("bytes */%lld"), Response.ResourceSize);
+			Response.BodySize = 0;
+		}
+	}
+
+	return Response;
+}
+
+void FConvaihttpLoopbackServer::DestroySocket(FSocket* Socket)
+{
+	if (Socket != nullptr)
+	{
+		Socket->Close();
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
 	}
-	
-	if ((--TestsToRun) <= 0)
+}
+
+#endif
+
+// FConvaihttpLoadTest
+
+FConvaihttpLoadTest::FConvaihttpLoadTest(const FSettings& InSettings)
+	: Settings(InSettings)
+{
+	Settings.Concurrency = FMath::Max(Settings.Concurrency, 1);
+	Settings.RequestsPerSecond = FMath::Max(Settings.RequestsPerSecond, 0.0);
+	Settings.DurationSeconds = FMath::Max(Settings.DurationSeconds, 0.0);
+	Settings.MaxRequests = FMath::Max(Settings.MaxRequests, 0);
+	Settings.RequestSize = FMath::Max(Settings.RequestSize, 0);
+	Settings.ResponseSize = FMath::Max(Settings.ResponseSize, 0);
+}
+
+FConvaihttpLoadTest::~FConvaihttpLoadTest()
+{
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+}
+
+bool FConvaihttpLoadTest::Run()
+{
+	RequestUrl = Settings.Url;
+	if (RequestUrl.IsEmpty() && FConvaihttpModule::Get().IsSimulatedConvaihttpEnabled())
 	{
-		ConvaihttpRequest->OnProcessRequestComplete().Unbind();
-		// Done with the test. Delegate should always gets called
-		delete this;
+		if (Settings.bHttp2)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("Load test: the simulated transport has no protocol, disable it to test HTTP/2"));
+			return false;
+		}
+		// The simulated transport answers with the size asked for, without sockets
+		RequestUrl = FString::Printf(TEXT("http://simulated.invalid/?size=%d"), Settings.ResponseSize);
 	}
+	else if (RequestUrl.IsEmpty())
+	{
+#if WITH_CURL
+		Server = MakeUnique<FConvaihttpLoopbackServer>();
+		if (!Server->Start(0, Settings.bHttp2 ? FConvaihttpLoopbackServer::EProtocol::Http2 : FConvaihttpLoopbackServer::EProtocol::Http1))
+		{
+			return false;
+		}
+		RequestUrl = FString::Printf(TEXT("%s?size=%d"), *Server->GetUrl(), Settings.ResponseSize);
+#else
+		UE_LOG(LogConvaihttp, Warning, TEXT("Load test: the loopback server needs curl, pass a url"));
+		return false;
+#endif
+	}
+
+	if (Settings.bHttp2)
+	{
+#if WITH_CONVAIHTTP_NGHTTP2
+		Http2Host = FPlatformConvaihttp::GetUrlDomainAndPort(RequestUrl);
+		FCurlConvaihttpManager::SetHttp2PriorKnowledge(Http2Host, true);
+#else
+		UE_LOG(LogConvaihttp, Warning, TEXT("Load test: HTTP/2 needs a libcurl built with nghttp2"));
+		return false;
+#endif
+	}
+
+	RequestBody.Init('x', Settings.RequestSize);
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Load test: %s%s, concurrency %d, %s, for %.1fs%s, request %d bytes"),
+		*RequestUrl, Settings.bHttp2 ? TEXT(" over h2c") : TEXT(""), Settings.Concurrency,
+		Settings.RequestsPerSecond > 0.0 ? *FString::Printf(TEXT("%.1f requests/s"), Settings.RequestsPerSecond) : TEXT("closed loop"),
+		Settings.DurationSeconds, Settings.MaxRequests > 0 ? *FString::Printf(TEXT(" or %d requests"), Settings.MaxRequests) : TEXT(""),
+		Settings.RequestSize);
+
+	SelfReference = AsShared();
+	StartTime = FPlatformTime::Seconds();
+	EndTime = StartTime + Settings.DurationSeconds;
+	StartThreadBusySeconds = FConvaihttpModule::Get().GetConvaihttpManager().GetThreadBusySeconds();
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateSP(this, &FConvaihttpLoadTest::Tick));
+
+	StartRequests();
+	return true;
+}
+
+bool FConvaihttpLoadTest::Tick(float DeltaTime)
+{
+	StartRequests();
+	return true;
+}
+
+void FConvaihttpLoadTest::StartRequests()
+{
+	const double Now = FPlatformTime::Seconds();
+	const bool bOver = Now >= EndTime || (Settings.MaxRequests > 0 && NumStarted >= Settings.MaxRequests);
+	if (bOver)
+	{
+		if (NumInFlight == 0 && SelfReference.IsValid())
+		{
+			Report();
+		}
+		return;
+	}
+
+	// Paced tests start the requests due by now, as long as there is room in flight
+	int32 NumDue = Settings.Concurrency - NumInFlight;
+	if (Settings.RequestsPerSecond > 0.0)
+	{
+		NumDue = FMath::Min(NumDue, static_cast<int32>((Now - StartTime) * Settings.RequestsPerSecond) + 1 - NumStarted);
+	}
+	if (Settings.MaxRequests > 0)
+	{
+		NumDue = FMath::Min(NumDue, Settings.MaxRequests - NumStarted);
+	}
+
+	for (int32 Index = 0; Index < NumDue; ++Index)
+	{
+		StartRequest();
+	}
+}
+
+void FConvaihttpLoadTest::StartRequest()
+{
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> Request = FConvaihttpModule::Get().CreateRequest();
+	Request->SetURL(RequestUrl);
+	if (RequestBody.Num() > 0)
+	{
+		Request->SetVerb(TEXT("POST"));
+		Request->SetHeader(TEXT("Content-Type"), TEXT("application/octet-stream"));
+		Request->SetContent(RequestBody);
+	}
+	else
+	{
+		Request->SetVerb(TEXT("GET"));
+	}
+	Request->OnProcessRequestComplete().BindSP(this, &FConvaihttpLoadTest::OnRequestComplete, FPlatformTime::Seconds());
+
+	++NumStarted;
+	++NumInFlight;
+	Request->ProcessRequest();
+
+	GameThreadCycles += FPlatformTime::Cycles64() - StartCycles;
+}
+
+void FConvaihttpLoadTest::OnRequestComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded, double RequestStartTime)
+{
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+
+	--NumInFlight;
+	if (bSucceeded && ConvaihttpResponse.IsValid() && EConvaihttpResponseCodes::IsOk(ConvaihttpResponse->GetResponseCode()))
+	{
+		++NumSucceeded;
+		NumBytesReceived += ConvaihttpResponse->GetContent().Num();
+		Latencies.Add(FPlatformTime::Seconds() - RequestStartTime);
+	}
+	else
+	{
+		++NumFailed;
+	}
+
+	GameThreadCycles += FPlatformTime::Cycles64() - StartCycles;
+
+	// Closed loop tests replace the request right away rather than on the next tick
+	StartRequests();
+}
+
+void FConvaihttpLoadTest::Report()
+{
+	const double Elapsed = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+	const double ThreadBusySeconds = FConvaihttpModule::Get().GetConvaihttpManager().GetThreadBusySeconds() - StartThreadBusySeconds;
+	const int32 NumCompleted = FMath::Max(NumSucceeded + NumFailed, 1);
+
+	Latencies.Sort();
+	auto GetPercentile = [this](double Percentile)
+	{
+		return Latencies.Num() > 0 ? Latencies[FMath::Min(Latencies.Num() - 1, static_cast<int32>(Latencies.Num() * Percentile))] * 1000.0 : 0.0;
+	};
+
+	Results.NumStarted = NumStarted;
+	Results.NumSucceeded = NumSucceeded;
+	Results.NumFailed = NumFailed;
+	Results.RequestsPerSecond = (NumSucceeded + NumFailed) / Elapsed;
+	Results.P50LatencyMs = GetPercentile(0.50);
+	Results.P95LatencyMs = GetPercentile(0.95);
+	Results.P99LatencyMs = GetPercentile(0.99);
+	Results.MaxLatencyMs = Latencies.Num() > 0 ? Latencies.Last() * 1000.0 : 0.0;
+	Results.ThreadCpuPerRequestUs = ThreadBusySeconds / NumCompleted * 1000000.0;
+	Results.GameThreadCpuPerRequestUs = FPlatformTime::ToSeconds64(GameThreadCycles) / NumCompleted * 1000000.0;
+	bComplete = true;
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Load test: %d requests, %d succeeded, %d failed in %.2fs: %.1f requests/s, %.2f MB/s received"),
+		NumStarted, NumSucceeded, NumFailed, Elapsed, Results.RequestsPerSecond, NumBytesReceived / Elapsed / (1024.0 * 1024.0));
+	UE_LOG(LogConvaihttp, Log, TEXT("Load test: latency p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms"),
+		Results.P50LatencyMs, Results.P95LatencyMs, Results.P99LatencyMs, Results.MaxLatencyMs);
+	UE_LOG(LogConvaihttp, Log, TEXT("Load test: CPU per request %.1f us on the CONVAIHTTP thread, %.1f us on the game thread"),
+		Results.ThreadCpuPerRequestUs, Results.GameThreadCpuPerRequestUs);
+
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	TickerHandle.Reset();
+#if WITH_CONVAIHTTP_NGHTTP2
+	if (!Http2Host.IsEmpty())
+	{
+		FCurlConvaihttpManager::SetHttp2PriorKnowledge(Http2Host, false);
+		Http2Host.Reset();
+	}
+#endif
+#if WITH_CURL
+	Server.Reset();
+#endif
+	SelfReference.Reset();
+}
+
+// FConvaihttpTrafficReplay
+
+namespace ConvaihttpTrafficReplay
+{
+	/** @return path of a url without its query, "/" if it has none */
+	FString GetUrlPath(const FString& Url)
+	{
+		const int32 SchemeEnd = Url.Find(TEXT("://"));
+		const int32 PathStart = Url.Find(TEXT("/"), ESearchCase::CaseSensitive, ESearchDir::FromStart, SchemeEnd != INDEX_NONE ? SchemeEnd + 3 : 0);
+		if (PathStart == INDEX_NONE)
+		{
+			return TEXT("/");
+		}
+		int32 QueryStart = INDEX_NONE;
+		Url.FindChar(TEXT('?'), QueryStart);
+		return QueryStart == INDEX_NONE || QueryStart < PathStart ? Url.Mid(PathStart) : Url.Mid(PathStart, QueryStart - PathStart);
+	}
+
+	/** @return query of a url, including the '?', empty if it has none */
+	FString GetUrlQuery(const FString& Url)
+	{
+		int32 QueryStart = INDEX_NONE;
+		return Url.FindChar(TEXT('?'), QueryStart) ? Url.Mid(QueryStart) : FString();
+	}
+
+	/** @return true if a captured header is sent again with the replayed request */
+	bool ShouldReplayHeader(const FString& Key, const TArray<FString>& RedactedHeaders)
+	{
+		// Redacted values would be sent as is
+		if (FConvaihttpTrafficCapture::IsRedactedHeader(Key, RedactedHeaders))
+		{
+			return false;
+		}
+
+		// The stand-in and the transport set these
+		static const TCHAR* SkippedHeaders[] = { TEXT("Host"), TEXT("Content-Length"), TEXT("Transfer-Encoding") };
+		for (const TCHAR* SkippedHeader : SkippedHeaders)
+		{
+			if (Key.Equals(SkippedHeader, ESearchCase::IgnoreCase))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+FConvaihttpTrafficReplay::FConvaihttpTrafficReplay(const FSettings& InSettings)
+	: Settings(InSettings)
+	, RedactedHeaders(FConvaihttpTrafficCapture::GetRedactedHeaders())
+{
+	Settings.Speed = FMath::Max(Settings.Speed, 0.001);
+	Settings.Url.RemoveFromEnd(TEXT("/"));
+}
+
+FConvaihttpTrafficReplay::~FConvaihttpTrafficReplay()
+{
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+}
+
+bool FConvaihttpTrafficReplay::Run()
+{
+	TArray<FConvaihttpCapturedRequest> Captured;
+	if (!FConvaihttpTrafficCapture::Load(Settings.Filename, Captured))
+	{
+		return false;
+	}
+	if (Captured.Num() == 0)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Replay: %s has no requests"), *Settings.Filename);
+		return false;
+	}
+
+	// Requests are recorded as they complete, replay them as they arrived
+	Captured.StableSort([](const FConvaihttpCapturedRequest& A, const FConvaihttpCapturedRequest& B) { return A.ArrivalSeconds < B.ArrivalSeconds; });
+
+	if (Settings.Url.IsEmpty())
+	{
+		bSimulated = FConvaihttpModule::Get().IsSimulatedConvaihttpEnabled();
+		if (bSimulated)
+		{
+			StandInUrl = TEXT("http://simulated.invalid");
+		}
+		else
+		{
+#if WITH_CURL
+			Server = MakeUnique<FConvaihttpLoopbackServer>();
+			if (!Server->Start())
+			{
+				return false;
+			}
+			StandInUrl = Server->GetUrl();
+			StandInUrl.RemoveFromEnd(TEXT("/"));
+#else
+			UE_LOG(LogConvaihttp, Warning, TEXT("Replay: the loopback server needs curl, enable the simulated transport or pass a url"));
+			return false;
+#endif
+		}
+	}
+
+	const double FirstArrivalSeconds = Captured[0].ArrivalSeconds;
+	Requests.Reserve(Captured.Num());
+	for (FConvaihttpCapturedRequest& Request : Captured)
+	{
+		Request.ArrivalSeconds -= FirstArrivalSeconds;
+		FReplayedRequest& Replayed = Requests.AddDefaulted_GetRef();
+		Replayed.Url = GetReplayUrl(Request);
+		Replayed.Captured = MoveTemp(Request);
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Replay: %d requests over %.1fs of %s, at %.2fx, against %s"),
+		Requests.Num(), Requests.Last().Captured.ArrivalSeconds, *Settings.Filename, Settings.Speed,
+		Settings.Url.IsEmpty() ? (bSimulated ? TEXT("the simulated transport") : *StandInUrl) : *Settings.Url);
+
+	SelfReference = AsShared();
+	StartTime = FPlatformTime::Seconds();
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateSP(this, &FConvaihttpTrafficReplay::Tick));
+
+	Tick(0.0f);
+	return true;
+}
+
+FString FConvaihttpTrafficReplay::GetReplayUrl(const FConvaihttpCapturedRequest& Captured) const
+{
+	const FString Path = ConvaihttpTrafficReplay::GetUrlPath(Captured.Url);
+	if (!Settings.Url.IsEmpty())
+	{
+		return Settings.Url + Path + ConvaihttpTrafficReplay::GetUrlQuery(Captured.Url);
+	}
+
+	// The stand-ins take what to answer from the query, so the captured one is dropped
+	FString Url = FString::Printf(TEXT("%s%s?size=%llu"), *StandInUrl, *Path, Captured.ResponseSize);
+	if (bSimulated)
+	{
+		if (Captured.ResponseCode > 0)
+		{
+			Url += FString::Printf(TEXT("&code=%d"), Captured.ResponseCode);
+		}
+		// The time to the first byte is the closest to how long the server took, without the transfer
+		const double ServerSeconds = Captured.FirstByteSeconds >= 0.0 ? Captured.FirstByteSeconds : Captured.DurationSeconds;
+		Url += FString::Printf(TEXT("&latency=%.0f"), ServerSeconds * 1000.0);
+		if (Captured.Status == EConvaihttpRequestStatus::Failed_ConnectionError)
+		{
+			Url += TEXT("&fail=connect");
+		}
+		else if (Captured.Status == EConvaihttpRequestStatus::Failed)
+		{
+			Url += TEXT("&fail=transfer");
+		}
+	}
+	return Url;
+}
+
+bool FConvaihttpTrafficReplay::Tick(float DeltaTime)
+{
+	const double Now = FPlatformTime::Seconds();
+	const double ReplaySeconds = (Now - StartTime) * Settings.Speed;
+	while (NextRequest < Requests.Num() && Requests[NextRequest].Captured.ArrivalSeconds <= ReplaySeconds)
+	{
+		StartRequest(NextRequest++, Now);
+	}
+
+	if (NextRequest == Requests.Num() && NumInFlight == 0 && SelfReference.IsValid())
+	{
+		Report();
+	}
+	return true;
+}
+
+void FConvaihttpTrafficReplay::StartRequest(int32 Index, double Now)
+{
+	FReplayedRequest& Replayed = Requests[Index];
+	const FConvaihttpCapturedRequest& Captured = Replayed.Captured;
+	Replayed.StartLagSeconds = Now - (StartTime + Captured.ArrivalSeconds / Settings.Speed);
+
+	TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> Request = FConvaihttpModule::Get().CreateRequest();
+	Request->SetURL(Replayed.Url);
+	if (!Captured.Verb.IsEmpty())
+	{
+		Request->SetVerb(Captured.Verb);
+	}
+	for (const FString& Header : Captured.RequestHeaders)
+	{
+		FString Key;
+		FString Value;
+		if (Header.Split(TEXT(":"), &Key, &Value) && ConvaihttpTrafficReplay::ShouldReplayHeader(Key.TrimEnd(), RedactedHeaders))
+		{
+			Request->SetHeader(Key.TrimEnd(), Value.TrimStart());
+		}
+	}
+	if (Captured.RequestBody.Num() > 0)
+	{
+		Request->SetContent(TArray64<uint8>(Captured.RequestBody));
+	}
+	else if (Captured.RequestSize > 0)
+	{
+		// Bodies weren't captured, send as many bytes
+		TArray64<uint8> Body;
+		Body.SetNumZeroed(Captured.RequestSize);
+		Request->SetContent(MoveTemp(Body));
+	}
+	Request->OnProcessRequestComplete().BindSP(this, &FConvaihttpTrafficReplay::OnRequestComplete, Index, Now);
+
+	++NumInFlight;
+	Request->ProcessRequest();
+}
+
+void FConvaihttpTrafficReplay::OnRequestComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded, int32 Index, double RequestStartTime)
+{
+	--NumInFlight;
+	FReplayedRequest& Replayed = Requests[Index];
+	Replayed.LatencySeconds = FPlatformTime::Seconds() - RequestStartTime;
+	Replayed.bSucceeded = bSucceeded;
+}
+
+void FConvaihttpTrafficReplay::Report()
+{
+	const double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+	int32 NumSucceeded = 0;
+	int32 NumCapturedSucceeded = 0;
+	double MaxStartLagSeconds = 0.0;
+	double TotalStartLagSeconds = 0.0;
+	TArray<double> CapturedLatencies;
+	TArray<double> ReplayLatencies;
+	CapturedLatencies.Reserve(Requests.Num());
+	ReplayLatencies.Reserve(Requests.Num());
+	for (const FReplayedRequest& Replayed : Requests)
+	{
+		NumSucceeded += Replayed.bSucceeded ? 1 : 0;
+		NumCapturedSucceeded += Replayed.Captured.Status == EConvaihttpRequestStatus::Succeeded ? 1 : 0;
+		MaxStartLagSeconds = FMath::Max(MaxStartLagSeconds, Replayed.StartLagSeconds);
+		TotalStartLagSeconds += Replayed.StartLagSeconds;
+		CapturedLatencies.Add(Replayed.Captured.DurationSeconds);
+		ReplayLatencies.Add(Replayed.LatencySeconds);
+	}
+	CapturedLatencies.Sort();
+	ReplayLatencies.Sort();
+	auto GetPercentile = [](const TArray<double>& Latencies, double Percentile)
+	{
+		return Latencies[FMath::Min(Latencies.Num() - 1, static_cast<int32>(Latencies.Num() * Percentile))] * 1000.0;
+	};
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Replay: %d requests in %.2fs (captured over %.2fs), %d succeeded (captured %d)"),
+		Requests.Num(), Elapsed, Requests.Last().Captured.ArrivalSeconds, NumSucceeded, NumCapturedSucceeded);
+	UE_LOG(LogConvaihttp, Log, TEXT("Replay: started behind schedule by %.3f ms on average, %.3f ms at most"),
+		TotalStartLagSeconds / Requests.Num() * 1000.0, MaxStartLagSeconds * 1000.0);
+	UE_LOG(LogConvaihttp, Log, TEXT("Replay: latency p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms"),
+		GetPercentile(ReplayLatencies, 0.50), GetPercentile(ReplayLatencies, 0.95), GetPercentile(ReplayLatencies, 0.99), ReplayLatencies.Last() * 1000.0);
+	UE_LOG(LogConvaihttp, Log, TEXT("Replay: captured latency p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms"),
+		GetPercentile(CapturedLatencies, 0.50), GetPercentile(CapturedLatencies, 0.95), GetPercentile(CapturedLatencies, 0.99), CapturedLatencies.Last() * 1000.0);
+
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	TickerHandle.Reset();
+#if WITH_CURL
+	Server.Reset();
+#endif
+	SelfReference.Reset();
+}
+
+// FConvaihttpServerSentEventsBenchmark
+
+FConvaihttpServerSentEventsBenchmark::FConvaihttpServerSentEventsBenchmark(const FSettings& InSettings)
+	: Settings(InSettings)
+{
+	Settings.NumEvents = FMath::Max(Settings.NumEvents, 1);
+	Settings.EventDataSize = FMath::Max(Settings.EventDataSize, 1);
+	Settings.ChunkSize = FMath::Max(Settings.ChunkSize, 1);
+	Settings.IntervalMs = FMath::Max(Settings.IntervalMs, 0.0);
+}
+
+bool FConvaihttpServerSentEventsBenchmark::Run()
+{
+	FSimulatedConvaihttpSettings StreamSettings;
+	StreamSettings.EventDataSize = Settings.EventDataSize;
+	StreamSize = StreamSettings.GetEventSize() * Settings.NumEvents;
+
+	// The first byte comes right away, so the time measured is the one spent streaming
+	const FString Url = FString::Printf(TEXT("http://simulated.invalid/events?event=%d&size=%lld&chunk=%d&interval=%f&latency=0"),
+		Settings.EventDataSize, StreamSize, Settings.ChunkSize, Settings.IntervalMs);
+
+	FConvaihttpModule& Module = FConvaihttpModule::Get();
+	bWasSimulated = Module.IsSimulatedConvaihttpEnabled();
+	Module.ToggleSimulatedConvaihttp(true);
+
+	EventStream = MakeShared<FConvaihttpServerSentEvents, ESPMode::ThreadSafe>(Url);
+	EventStream->SetAutoReconnect(false);
+	EventStream->OnEvent().BindSP(this, &FConvaihttpServerSentEventsBenchmark::OnEvent);
+	EventStream->OnClosed().BindSP(this, &FConvaihttpServerSentEventsBenchmark::OnClosed);
+
+	SelfReference = AsShared();
+	StartTime = FPlatformTime::Seconds();
+	if (!EventStream->Connect())
+	{
+		Module.ToggleSimulatedConvaihttp(bWasSimulated);
+		EventStream.Reset();
+		SelfReference.Reset();
+		return false;
+	}
+	return true;
+}
+
+void FConvaihttpServerSentEventsBenchmark::OnEvent(const FConvaihttpServerSentEvent& Event)
+{
+	++NumEventsReceived;
+	NumDataBytesReceived += Event.Data.Len();
+}
+
+void FConvaihttpServerSentEventsBenchmark::OnClosed(FConvaihttpResponsePtr Response, bool bSucceeded)
+{
+	const double Elapsed = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+	FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+
+	UE_LOG(LogConvaihttp, Log, TEXT("SSE benchmark: %lld/%d events, %lld data bytes from a %lld byte stream in %d byte chunks every %.1f ms%s"),
+		NumEventsReceived, Settings.NumEvents, NumDataBytesReceived, StreamSize, Settings.ChunkSize, Settings.IntervalMs, bSucceeded ? TEXT("") : TEXT(" (FAILED)"));
+	UE_LOG(LogConvaihttp, Log, TEXT("SSE benchmark: %.3f ms, %.1f MB/s, %.0f events/s"), Elapsed * 1000.0, StreamSize / Elapsed / (1024.0 * 1024.0), NumEventsReceived / Elapsed);
+
+	EventStream.Reset();
+	SelfReference.Reset();
+}
+
+// FConvaihttpFrameDecoderBenchmark
+
+void FConvaihttpFrameDecoderBenchmark::Run(int32 NumMessages, int32 ChunkSize, FOutputDevice& Ar)
+{
+	NumMessages = FMath::Max(NumMessages, 1);
+	ChunkSize = FMath::Max(ChunkSize, 1);
+
+	// Build the stream the stand-in server would send, with a fixed seed so runs are comparable
+	TArray64<uint8> Stream;
+	int64 NumMessageBytesSent = 0;
+	{
+		FRandomStream RandomStream(0x6772706);
+		auto AppendFrame = [&Stream](uint8 Flags, int64 Size, uint8 Fill)
+		{
+			const int64 FrameOffset = Stream.AddUninitialized(FConvaihttpLengthPrefixedFrameDecoder::PrefixSize + Size);
+			uint8* Frame = Stream.GetData() + FrameOffset;
+			Frame[0] = Flags;
+			Frame[1] = static_cast<uint8>(Size >> 24);
+			Frame[2] = static_cast<uint8>(Size >> 16);
+			Frame[3] = static_cast<uint8>(Size >> 8);
+			Frame[4] = static_cast<uint8>(Size);
+			FMemory::Memset(Frame + FConvaihttpLengthPrefixedFrameDecoder::PrefixSize, Fill, Size);
+		};
+
+		for (int32 MessageIndex = 0; MessageIndex < NumMessages; ++MessageIndex)
+		{
+			// 75% small messages, 20% medium, 5% large
+			const float Draw = RandomStream.GetFraction();
+			const int64 Size = Draw < 0.75f ? RandomStream.RandRange(0, 256)
+				: Draw < 0.95f ? RandomStream.RandRange(1024, 16 * 1024)
+				: RandomStream.RandRange(64 * 1024, 1024 * 1024);
+			AppendFrame(0, Size, static_cast<uint8>(MessageIndex));
+			NumMessageBytesSent += Size;
+		}
+
+		static const ANSICHAR TrailersPayload[] = "grpc-status: 0\r\ngrpc-message: OK\r\n";
+		const int64 TrailersOffset = Stream.Num();
+		AppendFrame(FConvaihttpLengthPrefixedFrameDecoder::TrailersFlag, sizeof(TrailersPayload) - 1, 0);
+		FMemory::Memcpy(Stream.GetData() + TrailersOffset + FConvaihttpLengthPrefixedFrameDecoder::PrefixSize, TrailersPayload, sizeof(TrailersPayload) - 1);
+	}
+
+	int64 NumMessagesReceived = 0;
+	int64 NumMessageBytesReceived = 0;
+	FConvaihttpLengthPrefixedFrameDecoder Decoder;
+	Decoder.SetMessageCallback([&NumMessagesReceived, &NumMessageBytesReceived](uint8 Flags, FMemoryView Message)
+	{
+		++NumMessagesReceived;
+		NumMessageBytesReceived += Message.GetSize();
+	});
+
+	const double StartTime = FPlatformTime::Seconds();
+	for (int64 Offset = 0; Offset < Stream.Num(); Offset += ChunkSize)
+	{
+		const int64 Size = FMath::Min<int64>(ChunkSize, Stream.Num() - Offset);
+		if (Decoder.Write(FMemoryView(Stream.GetData() + Offset, Size)) != EConvaihttpBodySinkResult::Accepted)
+		{
+			Ar.Logf(TEXT("Frame decoder benchmark: decoder failed at offset %lld"), Offset);
+			return;
+		}
+	}
+	Decoder.Finish(true);
+	const double Elapsed = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+
+	Ar.Logf(TEXT("Frame decoder benchmark: %lld/%d messages, %lld/%lld message bytes from a %lld byte stream in %d byte chunks, grpc-status=%s"),
+		NumMessagesReceived, NumMessages, NumMessageBytesReceived, NumMessageBytesSent, Stream.Num(), ChunkSize, *Decoder.GetTrailer(TEXT("grpc-status")));
+	Ar.Logf(TEXT("Frame decoder benchmark: %.3f ms, %.1f MB/s, %.0f messages/s, %.1f%% of message bytes copied to reassemble split messages"),
+		Elapsed * 1000.0, Stream.Num() / Elapsed / (1024.0 * 1024.0), NumMessagesReceived / Elapsed,
+		NumMessageBytesSent > 0 ? 100.0 * Decoder.GetNumBytesAssembled() / NumMessageBytesSent : 0.0);
+}
+
+// FConvaihttpRetrySystemBenchmark
+
+namespace ConvaihttpRetrySystemBenchmark
+{
+	/** Retry manager whose entries can be set up without sending their requests */
+	class FManager : public FConvaihttpRetrySystem::FManager
+	{
+	public:
+		FManager()
+			: FConvaihttpRetrySystem::FManager(FConvaihttpRetrySystem::FRetryLimitCountSetting(), FConvaihttpRetrySystem::FRetryTimeoutRelativeSecondsSetting())
+		{
+		}
+
+		/** Add an entry being processed, which every update looks at */
+		void AddProcessingEntry()
+		{
+			TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request = CreateRequest();
+			RequestList.Add(FConvaihttpRetryRequestEntry(Request));
+		}
+
+		/**
+		 * Add an entry in a lockout that won't be over before the benchmark is
+		 *
+		 * @param bLinearScan - keep it in a list every update walks, as before the lockout heap, rather than in the heap
+		 */
+		void AddLockoutEntry(double LockoutEndTimeAbsoluteSeconds, bool bLinearScan)
+		{
+			TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request = CreateRequest();
+			FConvaihttpRetryRequestEntry Entry(Request);
+			Entry.LockoutEndTimeAbsoluteSeconds = LockoutEndTimeAbsoluteSeconds;
+			Entry.WakeTimeAbsoluteSeconds = LockoutEndTimeAbsoluteSeconds;
+			if (bLinearScan)
+			{
+				LinearLockoutList.Add(MoveTemp(Entry));
+			}
+			else
+			{
+				LockoutHeap.HeapPush(MoveTemp(Entry), FWakesEarlier());
+			}
+		}
+
+		/** Update, then look at every entry of LinearLockoutList the way updates used to look at the entries in lockout */
+		void UpdateAll()
+		{
+			uint32 FailingCount = 0;
+			Update(nullptr, &FailingCount);
+
+			const double NowAbsoluteSeconds = FPlatformTime::Seconds();
+			for (const FConvaihttpRetryRequestEntry& Entry : LinearLockoutList)
+			{
+				const EConvaihttpRequestStatus::Type RequestStatus = Entry.Request->GetStatus();
+				if (!Entry.bShouldCancel && !HasTimedOut(Entry, NowAbsoluteSeconds) && RequestStatus != EConvaihttpRequestStatus::Processing)
+				{
+					if (NowAbsoluteSeconds >= Entry.LockoutEndTimeAbsoluteSeconds)
+					{
+						++NumLinearWakes;
+					}
+					++FailingCount;
+				}
+			}
+			NumFailing += FailingCount;
+		}
+
+		/** Entries in lockout walked by every update */
+		TArray<FConvaihttpRetryRequestEntry> LinearLockoutList;
+		/** Results of the updates, so they can't be optimized away */
+		uint64 NumLinearWakes = 0;
+		uint64 NumFailing = 0;
+	};
+
+	/** @return average time of an update, in seconds */
+	static double TimeUpdates(FManager& Manager, int32 NumUpdates)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < NumUpdates; ++Index)
+		{
+			Manager.UpdateAll();
+		}
+		return (FPlatformTime::Seconds() - StartTime) / NumUpdates;
+	}
+
+	/** @return average time of an update with 1% of the entries being processed, the rest in lockouts spread over the next minutes */
+	static double TimeMostlyLockoutUpdates(int32 NumEntries, int32 NumProcessing, int32 NumUpdates, bool bLinearScan)
+	{
+		FManager Manager;
+		// The same lockouts for both ways of keeping them
+		FRandomStream RandomStream(NumEntries);
+		const double Now = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < NumEntries; ++Index)
+		{
+			if (Index < NumProcessing)
+			{
+				Manager.AddProcessingEntry();
+			}
+			else
+			{
+				Manager.AddLockoutEntry(Now + 60.0 + RandomStream.FRandRange(0.0f, 240.0f), bLinearScan);
+			}
+		}
+		return TimeUpdates(Manager, NumUpdates);
+	}
+}
+
+void FConvaihttpRetrySystemBenchmark::Run(int32 NumEntries, int32 NumUpdates, FOutputDevice& Ar)
+{
+	NumEntries = FMath::Max(NumEntries, 1);
+	NumUpdates = FMath::Max(NumUpdates, 1);
+
+	double AllProcessingTime = 0.0;
+	{
+		ConvaihttpRetrySystemBenchmark::FManager Manager;
+		for (int32 Index = 0; Index < NumEntries; ++Index)
+		{
+			Manager.AddProcessingEntry();
+		}
+		AllProcessingTime = ConvaihttpRetrySystemBenchmark::TimeUpdates(Manager, NumUpdates);
+	}
+
+	const int32 NumProcessing = FMath::Max(NumEntries / 100, 1);
+	const double MostlyLockoutTime = ConvaihttpRetrySystemBenchmark::TimeMostlyLockoutUpdates(NumEntries, NumProcessing, NumUpdates, false);
+	const double MostlyLockoutLinearScanTime = ConvaihttpRetrySystemBenchmark::TimeMostlyLockoutUpdates(NumEntries, NumProcessing, NumUpdates, true);
+
+	Ar.Logf(TEXT("Retry system benchmark: %d requests, all processing: %.3f us per update"), NumEntries, AllProcessingTime * 1000000.0);
+	Ar.Logf(TEXT("Retry system benchmark: %d requests, %d processing and %d in lockout: %.3f us per update with the lockout heap, %.3f us with a linear scan (%.1fx)"),
+		NumEntries, NumProcessing, NumEntries - NumProcessing, MostlyLockoutTime * 1000000.0, MostlyLockoutLinearScanTime * 1000000.0,
+		MostlyLockoutLinearScanTime / FMath::Max(MostlyLockoutTime, 1e-9));
+}
+
+// FConvaihttpWebSocketBenchmark
+
+FConvaihttpWebSocketBenchmark::FConvaihttpWebSocketBenchmark(const FString& InWebSocketUrl, const FString& InPostUrl, int32 InNumRoundTrips, int32 InMessageSize)
+	: WebSocketUrl(InWebSocketUrl)
+	, PostUrl(InPostUrl)
+	, NumRoundTrips(FMath::Max(InNumRoundTrips, 1))
+{
+	FUniqueBuffer Payload = FUniqueBuffer::Alloc(FMath::Max(InMessageSize, 1));
+	uint8* PayloadBytes = static_cast<uint8*>(Payload.GetData());
+	for (uint64 Index = 0; Index < Payload.GetSize(); ++Index)
+	{
+		PayloadBytes[Index] = static_cast<uint8>('a' + (Index % 26));
+	}
+	Message = Payload.MoveToShared();
+}
+
+void FConvaihttpWebSocketBenchmark::Run()
+{
+	if (WebSocketUrl.IsEmpty() || PostUrl.IsEmpty())
+	{
+#if WITH_CURL
+		Server = MakeUnique<FConvaihttpLoopbackServer>();
+		if (!Server->Start())
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("WebSocket benchmark: failed to start the loopback server"));
+			Server.Reset();
+			return;
+		}
+		const FString ServerUrl = Server->GetUrl();
+		if (WebSocketUrl.IsEmpty())
+		{
+			WebSocketUrl = ServerUrl.Replace(TEXT("http://"), TEXT("ws://"));
+		}
+		if (PostUrl.IsEmpty())
+		{
+			PostUrl = ServerUrl + TEXT("echo");
+		}
+#else
+		UE_LOG(LogConvaihttp, Warning, TEXT("WebSocket benchmark: the loopback server needs curl, pass urls"));
+		return;
+#endif
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("WebSocket benchmark: %d round trips of %llu bytes, WebSocket=[%s] POST=[%s]"), NumRoundTrips, Message.GetSize(), *WebSocketUrl, *PostUrl);
+
+	SelfReference = AsShared();
+
+	WebSocket = FConvaihttpModule::Get().CreateWebSocket(WebSocketUrl);
+	if (!WebSocket.IsValid())
+	{
+		FinishWebSocketRun();
+		return;
+	}
+
+	WebSocket->OnConnected().BindSP(this, &FConvaihttpWebSocketBenchmark::OnWebSocketConnected);
+	WebSocket->OnConnectionError().BindSP(this, &FConvaihttpWebSocketBenchmark::OnWebSocketConnectionError);
+	WebSocket->OnClosed().BindSP(this, &FConvaihttpWebSocketBenchmark::OnWebSocketClosed);
+	WebSocket->OnBinaryMessage().BindSP(this, &FConvaihttpWebSocketBenchmark::OnWebSocketMessage);
+	WebSocket->Connect();
+}
+
+void FConvaihttpWebSocketBenchmark::OnWebSocketConnected()
+{
+	SendWebSocketMessage();
+}
+
+void FConvaihttpWebSocketBenchmark::OnWebSocketConnectionError(const FString& Error)
+{
+	UE_LOG(LogConvaihttp, Warning, TEXT("WebSocket benchmark: could not connect to %s. %s"), *WebSocketUrl, *Error);
+	FinishWebSocketRun();
+}
+
+void FConvaihttpWebSocketBenchmark::OnWebSocketClosed(int32 StatusCode, const FString& Reason, bool bWasClean)
+{
+	if (!bWebSocketRunOver)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("WebSocket benchmark: connection closed after %d round trips, status %d %s"), WebSocketRoundTrips.Num(), StatusCode, *Reason);
+		FinishWebSocketRun();
+	}
+}
+
+void FConvaihttpWebSocketBenchmark::OnWebSocketMessage(const FSharedBuffer& Data)
+{
+	const double RoundTrip = FPlatformTime::Seconds() - SendTime;
+	if (bWebSocketRunOver)
+	{
+		return;
+	}
+
+	// The first round trip is a warm-up
+	if (NumWebSocketMessagesReceived++ > 0)
+	{
+		WebSocketRoundTrips.Add(RoundTrip);
+	}
+
+	if (WebSocketRoundTrips.Num() < NumRoundTrips)
+	{
+		SendWebSocketMessage();
+	}
+	else
+	{
+		WebSocket->Close();
+		FinishWebSocketRun();
+	}
+}
+
+void FConvaihttpWebSocketBenchmark::SendWebSocketMessage()
+{
+	SendTime = FPlatformTime::Seconds();
+	WebSocket->Send(Message, true);
+}
+
+void FConvaihttpWebSocketBenchmark::FinishWebSocketRun()
+{
+	if (!bWebSocketRunOver)
+	{
+		bWebSocketRunOver = true;
+		SendPost();
+	}
+}
+
+void FConvaihttpWebSocketBenchmark::SendPost()
+{
+	TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> Request = FConvaihttpModule::Get().CreateRequest();
+	Request->SetURL(PostUrl);
+	Request->SetVerb(TEXT("POST"));
+	Request->SetHeader(TEXT("Content-Type"), TEXT("application/octet-stream"));
+	Request->SetContent(Message);
+	Request->OnProcessRequestComplete().BindSP(this, &FConvaihttpWebSocketBenchmark::OnPostComplete);
+
+	SendTime = FPlatformTime::Seconds();
+	Request->ProcessRequest();
+}
+
+void FConvaihttpWebSocketBenchmark::OnPostComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded)
+{
+	const double RoundTrip = FPlatformTime::Seconds() - SendTime;
+	if (!bSucceeded || !ConvaihttpResponse.IsValid())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("WebSocket benchmark: POST to %s failed after %d round trips"), *PostUrl, PostRoundTrips.Num());
+		Report();
+		return;
+	}
+
+	// The first round trip is a warm-up, and pays for the connection
+	if (NumPostsCompleted++ > 0)
+	{
+		PostRoundTrips.Add(RoundTrip);
+	}
+
+	if (PostRoundTrips.Num() < NumRoundTrips)
+	{
+		SendPost();
+	}
+	else
+	{
+		Report();
+	}
+}
+
+void FConvaihttpWebSocketBenchmark::Report()
+{
+	auto LogRoundTrips = [](const TCHAR* Name, TArray<double>& RoundTrips)
+	{
+		if (RoundTrips.Num() == 0)
+		{
+			UE_LOG(LogConvaihttp, Log, TEXT("WebSocket benchmark: %s: no round trips"), Name);
+			return;
+		}
+
+		RoundTrips.Sort();
+		double Total = 0.0;
+		for (double RoundTrip : RoundTrips)
+		{
+			Total += RoundTrip;
+		}
+		const double P50 = RoundTrips[RoundTrips.Num() / 2];
+		const double P99 = RoundTrips[FMath::Min(RoundTrips.Num() - 1, RoundTrips.Num() * 99 / 100)];
+		UE_LOG(LogConvaihttp, Log, TEXT("WebSocket benchmark: %s: %d round trips, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms"),
+			Name, RoundTrips.Num(), Total / RoundTrips.Num() * 1000.0, P50 * 1000.0, P99 * 1000.0, RoundTrips.Last() * 1000.0);
+	};
+
+	LogRoundTrips(TEXT("WebSocket"), WebSocketRoundTrips);
+	LogRoundTrips(TEXT("POST"), PostRoundTrips);
+
+	WebSocket.Reset();
+#if WITH_CURL
+	Server.Reset();
+#endif
+	SelfReference.Reset();
+}
+
+// FConvaihttpSegmentedDownloadBenchmark
+
+FConvaihttpSegmentedDownloadBenchmark::FConvaihttpSegmentedDownloadBenchmark(const FSettings& InSettings)
+	: Settings(InSettings)
+{
+	Settings.MaxSegments = FMath::Max(Settings.MaxSegments, 1);
+	Settings.SegmentSize = FMath::Max<uint64>(Settings.SegmentSize, 1);
+	Settings.BytesPerSecond = FMath::Max<int64>(Settings.BytesPerSecond, 0);
+}
+
+bool FConvaihttpSegmentedDownloadBenchmark::Run()
+{
+	Url = Settings.Url;
+	if (Url.IsEmpty())
+	{
+		// The simulated transport doesn't serve ranges
+		if (FConvaihttpModule::Get().IsSimulatedConvaihttpEnabled())
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("Segmented download benchmark: turn the simulated transport off, or pass a url"));
+			return false;
+		}
+#if WITH_CURL
+		Server = MakeUnique<FConvaihttpLoopbackServer>();
+		if (!Server->Start(Settings.BytesPerSecond))
+		{
+			return false;
+		}
+		Url = FString::Printf(TEXT("%s?size=%llu"), *Server->GetUrl(), Settings.ResourceSize);
+#else
+		UE_LOG(LogConvaihttp, Warning, TEXT("Segmented download benchmark: the loopback server needs curl, pass a url"));
+		return false;
+#endif
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Segmented download benchmark: %s, up to %d segments of %llu bytes%s"), *Url, Settings.MaxSegments, Settings.SegmentSize,
+		Settings.Url.IsEmpty() ? *FString::Printf(TEXT(", throttled to %.2f MB/s per connection"), Settings.BytesPerSecond / (1024.0 * 1024.0)) : TEXT(""));
+
+	SelfReference = AsShared();
+
+	TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> Request = FConvaihttpModule::Get().CreateRequest();
+	Request->SetURL(Url);
+	Request->SetVerb(TEXT("GET"));
+	Request->OnProcessRequestComplete().BindSP(this, &FConvaihttpSegmentedDownloadBenchmark::OnSingleStreamComplete);
+
+	StartTime = FPlatformTime::Seconds();
+	Request->ProcessRequest();
+	return true;
+}
+
+void FConvaihttpSegmentedDownloadBenchmark::OnSingleStreamComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded)
+{
+	SingleStreamTime = FPlatformTime::Seconds() - StartTime;
+	if (!bSucceeded || !ConvaihttpResponse.IsValid() || !EConvaihttpResponseCodes::IsOk(ConvaihttpResponse->GetResponseCode()))
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Segmented download benchmark: single stream download of %s failed"), *Url);
+#if WITH_CURL
+		Server.Reset();
+#endif
+		SelfReference.Reset();
+		return;
+	}
+	SingleStreamSize = ConvaihttpResponse->GetContent().Num();
+
+	SegmentedDownload = MakeShared<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe>(Url);
+	SegmentedDownload->SetMaxSegments(Settings.MaxSegments);
+	SegmentedDownload->SetSegmentSize(Settings.SegmentSize);
+	SegmentedDownload->OnComplete().BindSP(this, &FConvaihttpSegmentedDownloadBenchmark::OnSegmentedComplete);
+	if (!SegmentedDownload->Start())
+	{
+		OnSegmentedComplete(false);
+	}
+}
+
+void FConvaihttpSegmentedDownloadBenchmark::OnSegmentedComplete(bool bSucceeded)
+{
+	const double SingleStreamThroughput = SingleStreamSize / FMath::Max(SingleStreamTime, 0.001) / (1024.0 * 1024.0);
+	UE_LOG(LogConvaihttp, Log, TEXT("Segmented download benchmark: single stream: %llu bytes in %.2fs, %.2f MB/s"), SingleStreamSize, SingleStreamTime, SingleStreamThroughput);
+
+	if (bSucceeded)
+	{
+		const double SegmentedTime = SegmentedDownload->GetElapsedTime();
+		const double SegmentedThroughput = SegmentedDownload->GetTotalSize() / FMath::Max(SegmentedTime, 0.001) / (1024.0 * 1024.0);
+		UE_LOG(LogConvaihttp, Log, TEXT("Segmented download benchmark: segmented: %llu bytes in %.2fs, %.2f MB/s, up to %d segments in flight, %.2fx speedup%s"),
+			SegmentedDownload->GetTotalSize(), SegmentedTime, SegmentedThroughput, SegmentedDownload->GetPeakSegmentsInFlight(),
+			SingleStreamThroughput > 0.0 ? SegmentedThroughput / SingleStreamThroughput : 0.0,
+			SegmentedDownload->GetTotalSize() == SingleStreamSize ? TEXT("") : TEXT(" (SIZE MISMATCH)"));
+	}
+	else
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Segmented download benchmark: segmented download of %s failed"), *Url);
+	}
+
+	SegmentedDownload.Reset();
+#if WITH_CURL
+	Server.Reset();
+#endif
+	SelfReference.Reset();
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+// Load test automation
+
+#if UE_VERSION_OLDER_THAN(5, 5, 0)
+#define CONVAIHTTP_LOAD_TEST_FLAGS (EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+#else
+#define CONVAIHTTP_LOAD_TEST_FLAGS (EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+#endif
+
+namespace ConvaihttpLoadTestAutomation
+{
+	/**
+	 * Limits a load test must stay within. Read from [CONVAIHTTP.LoadTest.<Name>] in the engine ini, so slower machines
+	 * can relax them and faster ones tighten them to catch smaller regressions
+	 */
+	struct FThresholds
+	{
+		int32 MaxFailures = 0;
+		double MinRequestsPerSecond = 100.0;
+		/** Completion is delivered on the game thread tick, so latencies include up to a frame */
+		double MaxP99LatencyMs = 250.0;
+		double MaxThreadCpuPerRequestUs = 1000.0;
+		double MaxGameThreadCpuPerRequestUs = 500.0;
+
+		explicit FThresholds(const TCHAR* Name)
+		{
+			const FString Section = FString::Printf(TEXT("CONVAIHTTP.LoadTest.%s"), Name);
+			GConfig->GetInt(*Section, TEXT("MaxFailures"), MaxFailures, GEngineIni);
+			GConfig->GetDouble(*Section, TEXT("MinRequestsPerSecond"), MinRequestsPerSecond, GEngineIni);
+			GConfig->GetDouble(*Section, TEXT("MaxP99LatencyMs"), MaxP99LatencyMs, GEngineIni);
+			GConfig->GetDouble(*Section, TEXT("MaxThreadCpuPerRequestUs"), MaxThreadCpuPerRequestUs, GEngineIni);
+			GConfig->GetDouble(*Section, TEXT("MaxGameThreadCpuPerRequestUs"), MaxGameThreadCpuPerRequestUs, GEngineIni);
+		}
+	};
+
+	/** Runs a load test to completion over the following frames, then fails the test on any threshold it exceeds */
+	class FRunLoadTestCommand : public IAutomationLatentCommand
+	{
+	public:
+		FRunLoadTestCommand(FAutomationTestBase& InTest, const FConvaihttpLoadTest::FSettings& InSettings, bool bInSimulated, const TCHAR* InName)
+			: Test(InTest)
+			, Settings(InSettings)
+			, bSimulated(bInSimulated)
+			, Thresholds(InName)
+		{
+		}
+
+		virtual bool Update() override
+		{
+			if (!LoadTest.IsValid())
+			{
+				// Without a url the load test picks the simulated transport whenever it is on
+				FConvaihttpModule& Module = FConvaihttpModule::Get();
+				bWasSimulated = Module.IsSimulatedConvaihttpEnabled();
+				if (bSimulated)
+				{
+					FSimulatedConvaihttpRequest::UpdateConfigs();
+				}
+				Module.ToggleSimulatedConvaihttp(bSimulated);
+
+				LoadTest = MakeShared<FConvaihttpLoadTest>(Settings);
+				Deadline = FPlatformTime::Seconds() + Settings.DurationSeconds + 60.0;
+				if (!LoadTest->Run())
+				{
+					Module.ToggleSimulatedConvaihttp(bWasSimulated);
+					Test.AddError(TEXT("The load test failed to start"));
+					return true;
+				}
+				return false;
+			}
+
+			if (!LoadTest->IsComplete())
+			{
+				if (FPlatformTime::Seconds() < Deadline)
+				{
+					return false;
+				}
+				FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+				Test.AddError(TEXT("The load test didn't complete in time"));
+				return true;
+			}
+
+			FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+
+			const FConvaihttpLoadTest::FResults& Results = LoadTest->GetResults();
+			Test.AddInfo(FString::Printf(TEXT("%d requests, %.1f requests/s, p99 %.3f ms, %.1f us on the CONVAIHTTP thread and %.1f us on the game thread per request"),
+				Results.NumStarted, Results.RequestsPerSecond, Results.P99LatencyMs, Results.ThreadCpuPerRequestUs, Results.GameThreadCpuPerRequestUs));
+			Test.TestTrue(TEXT("Requests succeeded"), Results.NumSucceeded > 0);
+			Test.TestTrue(FString::Printf(TEXT("%d failed requests within %d"), Results.NumFailed, Thresholds.MaxFailures), Results.NumFailed <= Thresholds.MaxFailures);
+			Test.TestTrue(FString::Printf(TEXT("%.1f requests/s above %.1f"), Results.RequestsPerSecond, Thresholds.MinRequestsPerSecond), Results.RequestsPerSecond >= Thresholds.MinRequestsPerSecond);
+			Test.TestTrue(FString::Printf(TEXT("p99 latency %.3f ms within %.3f ms"), Results.P99LatencyMs, Thresholds.MaxP99LatencyMs), Results.P99LatencyMs <= Thresholds.MaxP99LatencyMs);
+			Test.TestTrue(FString::Printf(TEXT("%.1f us per request on the CONVAIHTTP thread within %.1f us"), Results.ThreadCpuPerRequestUs, Thresholds.MaxThreadCpuPerRequestUs), Results.ThreadCpuPerRequestUs <= Thresholds.MaxThreadCpuPerRequestUs);
+			Test.TestTrue(FString::Printf(TEXT("%.1f us per request on the game thread within %.1f us"), Results.GameThreadCpuPerRequestUs, Thresholds.MaxGameThreadCpuPerRequestUs), Results.GameThreadCpuPerRequestUs <= Thresholds.MaxGameThreadCpuPerRequestUs);
+			return true;
+		}
+
+	private:
+		FAutomationTestBase& Test;
+		FConvaihttpLoadTest::FSettings Settings;
+		bool bSimulated = false;
+		FThresholds Thresholds;
+		TSharedPtr<FConvaihttpLoadTest> LoadTest;
+		bool bWasSimulated = false;
+		double Deadline = 0.0;
+	};
+
+	/** @return settings of the load tests, a fixed number of requests in a closed loop */
+	FConvaihttpLoadTest::FSettings MakeSettings()
+	{
+		FConvaihttpLoadTest::FSettings Settings;
+		Settings.Concurrency = 16;
+		Settings.DurationSeconds = 60.0;
+		Settings.MaxRequests = 2000;
+		Settings.ResponseSize = 16 * 1024;
+		return Settings;
+	}
+}
+
+#if WITH_CURL
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpLoopbackLoadTest, "Convaihttp.LoadTest.Loopback", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpLoopbackLoadTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpLoadTestAutomation::FRunLoadTestCommand(*this, ConvaihttpLoadTestAutomation::MakeSettings(), false, TEXT("Loopback")));
+	return true;
+}
+#endif
+
+#if WITH_CONVAIHTTP_NGHTTP2
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpLoopbackHttp2LoadTest, "Convaihttp.LoadTest.LoopbackHttp2", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpLoopbackHttp2LoadTest::RunTest(const FString& Parameters)
+{
+	FConvaihttpLoadTest::FSettings Settings = ConvaihttpLoadTestAutomation::MakeSettings();
+	Settings.bHttp2 = true;
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpLoadTestAutomation::FRunLoadTestCommand(*this, Settings, false, TEXT("LoopbackHttp2")));
+	return true;
+}
+#endif
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpSimulatedLoadTest, "Convaihttp.LoadTest.Simulated", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpSimulatedLoadTest::RunTest(const FString& Parameters)
+{
+	// A millisecond of latency, whatever the simulated transport is configured with, so the thresholds hold everywhere
+	FConvaihttpLoadTest::FSettings Settings = ConvaihttpLoadTestAutomation::MakeSettings();
+	Settings.Url = FString::Printf(TEXT("http://simulated.invalid/?size=%d&latency=1"), Settings.ResponseSize);
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpLoadTestAutomation::FRunLoadTestCommand(*this, Settings, true, TEXT("Simulated")));
+	return true;
+}
+
+// Response body buffer
+
+namespace ConvaihttpResponseBodyBufferTest
+{
+	/** @return Size bytes counting up from First, so reordered or lost bytes show */
+	TArray<uint8> MakeData(uint8 First, int32 Size)
+	{
+		TArray<uint8> Data;
+		Data.SetNumUninitialized(Size);
+		for (int32 Index = 0; Index < Size; ++Index)
+		{
+			Data[Index] = static_cast<uint8>(First + Index);
+		}
+		return Data;
+	}
+
+	/** @return the next Size bytes read from the buffer, fewer if it has less */
+	TArray<uint8> ReadData(FConvaihttpResponseBodyBuffer& BodyBuffer, int32 Size)
+	{
+		TArray<uint8> Data;
+		Data.SetNumUninitialized(Size);
+		Data.SetNum(static_cast<int32>(BodyBuffer.Read(MakeMemoryView(Data))));
+		return Data;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpResponseBodyBufferTest, "Convaihttp.ResponseBodyBuffer", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpResponseBodyBufferTest::RunTest(const FString& Parameters)
+{
+	using namespace ConvaihttpResponseBodyBufferTest;
+
+	FConvaihttpResponseBodyBuffer BodyBuffer(16);
+	int32 NumResumes = 0;
+	BodyBuffer.SetReadyForDataCallback([&NumResumes]() { ++NumResumes; });
+
+	// Wrap-around: the second write starts at offset 12 of the ring and continues at its start
+	TestEqual(TEXT("First write accepted"), BodyBuffer.Write(MakeMemoryView(MakeData(0, 12))), EConvaihttpBodySinkResult::Accepted);
+	TestTrue(TEXT("First read"), ReadData(BodyBuffer, 8) == MakeData(0, 8));
+	TestEqual(TEXT("Wrapping write accepted"), BodyBuffer.Write(MakeMemoryView(MakeData(12, 10))), EConvaihttpBodySinkResult::Accepted);
+	TestEqual(TEXT("Bytes available across the wrap"), BodyBuffer.GetNumBytesAvailable(), uint64(14));
+	TestTrue(TEXT("Read across the wrap"), ReadData(BodyBuffer, 14) == MakeData(8, 14));
+	TestEqual(TEXT("Empty after reading everything"), BodyBuffer.GetNumBytesAvailable(), uint64(0));
+
+	// Full, then resume once drained to half the capacity
+	TestEqual(TEXT("Write filling the buffer accepted"), BodyBuffer.Write(MakeMemoryView(MakeData(22, 12))), EConvaihttpBodySinkResult::Accepted);
+	TestEqual(TEXT("Write past the capacity refused"), BodyBuffer.Write(MakeMemoryView(MakeData(34, 6))), EConvaihttpBodySinkResult::Full);
+	TestEqual(TEXT("Nothing consumed from the refused write"), BodyBuffer.GetNumBytesAvailable(), uint64(12));
+	ReadData(BodyBuffer, 2);
+	TestEqual(TEXT("Not resumed above half the capacity"), NumResumes, 0);
+	ReadData(BodyBuffer, 2);
+	TestEqual(TEXT("Resumed at half the capacity"), NumResumes, 1);
+	TestEqual(TEXT("Refused write accepted when offered again"), BodyBuffer.Write(MakeMemoryView(MakeData(34, 6))), EConvaihttpBodySinkResult::Accepted);
+	TestTrue(TEXT("Read after resuming"), ReadData(BodyBuffer, 16) == MakeData(26, 14));
+	TestEqual(TEXT("Resumed only once"), NumResumes, 1);
+
+	// A chunk bigger than the capacity overflows the empty buffer, which shrinks back once it's read
+	const TArray<uint8> Oversized = MakeData(40, 40);
+	TestEqual(TEXT("Oversized write accepted"), BodyBuffer.Write(MakeMemoryView(Oversized)), EConvaihttpBodySinkResult::Accepted);
+	TestEqual(TEXT("Buffer grown for the oversized write"), BodyBuffer.GetBufferSize(), uint64(40));
+	TestEqual(TEXT("Write behind the oversized chunk refused"), BodyBuffer.Write(MakeMemoryView(MakeData(80, 1))), EConvaihttpBodySinkResult::Full);
+	TestTrue(TEXT("First part of the oversized chunk"), ReadData(BodyBuffer, 30) == MakeData(40, 30));
+	TestEqual(TEXT("Buffer not shrunk while holding data"), BodyBuffer.GetBufferSize(), uint64(40));
+	TestTrue(TEXT("Rest of the oversized chunk"), ReadData(BodyBuffer, 30) == MakeData(70, 10));
+	TestEqual(TEXT("Buffer shrunk back to its capacity"), BodyBuffer.GetBufferSize(), uint64(16));
+	TestEqual(TEXT("Resumed after the oversized chunk"), NumResumes, 2);
+	TestEqual(TEXT("Write after shrinking accepted"), BodyBuffer.Write(MakeMemoryView(MakeData(80, 16))), EConvaihttpBodySinkResult::Accepted);
+	TestEqual(TEXT("Write past the restored capacity refused"), BodyBuffer.Write(MakeMemoryView(MakeData(96, 1))), EConvaihttpBodySinkResult::Full);
+	TestTrue(TEXT("Read after shrinking"), ReadData(BodyBuffer, 16) == MakeData(80, 16));
+
+	BodyBuffer.Finish(true);
+	TestTrue(TEXT("End of body once finished and drained"), BodyBuffer.IsEndOfBody());
+	TestTrue(TEXT("Succeeded"), BodyBuffer.HasSucceeded());
+	return true;
+}
+
+// Server-Sent Events parser
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpServerSentEventParserTest, "Convaihttp.ServerSentEvents.Parser", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpServerSentEventParserTest::RunTest(const FString& Parameters)
+{
+	auto WriteString = [](FConvaihttpServerSentEventParser& Parser, const ANSICHAR* String)
+	{
+		return Parser.Write(FMemoryView(String, FCStringAnsi::Strlen(String)));
+	};
+
+	{
+		// Lines split across writes, CRLF split across writes, comments and multi-line data
+		FConvaihttpServerSentEventParser Parser;
+		TestEqual(TEXT("Write accepted"), WriteString(Parser, ": keep-alive\r\nid: 7\r\nevent: delta\r\nda"), EConvaihttpBodySinkResult::Accepted);
+		TestEqual(TEXT("Write accepted"), WriteString(Parser, "ta: first\r"), EConvaihttpBodySinkResult::Accepted);
+		TestEqual(TEXT("Write accepted"), WriteString(Parser, "\ndata: second\n\n"), EConvaihttpBodySinkResult::Accepted);
+
+		FConvaihttpServerSentEvent Event;
+		if (TestTrue(TEXT("Event dispatched"), Parser.DequeueEvent(Event)))
+		{
+			TestEqual(TEXT("Event type"), Event.Event, FString(TEXT("delta")));
+			TestEqual(TEXT("Event id"), Event.Id, FString(TEXT("7")));
+			TestEqual(TEXT("Event data"), Event.Data, FString(TEXT("first\nsecond")));
+		}
+		TestFalse(TEXT("Single event dispatched"), Parser.DequeueEvent(Event));
+	}
+
+	{
+		// Data lines that never get dispatched fail the stream instead of growing without bound
+		FConvaihttpServerSentEventParser Parser;
+		TArray<uint8> Line;
+		const int64 LineDataSize = 1024 * 1024;
+		Line.Append(reinterpret_cast<const uint8*>("data: "), 6);
+		Line.AddUninitialized(static_cast<int32>(LineDataSize));
+		FMemory::Memset(Line.GetData() + 6, 'a', LineDataSize);
+		Line.Add('\n');
+
+		EConvaihttpBodySinkResult Result = EConvaihttpBodySinkResult::Accepted;
+		int64 NumLines = 0;
+		while (Result == EConvaihttpBodySinkResult::Accepted && NumLines <= FConvaihttpServerSentEventParser::MaxEventSize / LineDataSize)
+		{
+			Result = Parser.Write(MakeMemoryView(Line));
+			++NumLines;
+		}
+		TestEqual(TEXT("Stream failed past the largest event"), Result, EConvaihttpBodySinkResult::Failed);
+		TestEqual(TEXT("Stream failed on the line going past the largest event"), NumLines, FConvaihttpServerSentEventParser::MaxEventSize / (LineDataSize + 1) + 1);
+	}
+	return true;
+}
+
+#if WITH_CURL
+namespace ConvaihttpLoopbackTest
+{
+	/** @return the first Size bytes of any resource served by FConvaihttpLoopbackServer */
+	static TArray64<uint8> MakeBody(int64 Size)
+	{
+		TArray64<uint8> Body;
+		Body.SetNumUninitialized(Size);
+		for (int64 Index = 0; Index < Size; ++Index)
+		{
+			Body[Index] = static_cast<uint8>('a' + Index % 26);
+		}
+		return Body;
+	}
+}
+
+// Download resume
+
+namespace ConvaihttpResumeDownloadTest
+{
+	/** Size of the resource downloaded */
+	static constexpr int64 ResourceSize = 100000;
+	/** Offset the loopback server drops the first transfer at */
+	static constexpr int64 FailAt = 40000;
+
+	/** Download through the retry system, and what it completed with */
+	struct FDownload
+	{
+		TSharedPtr<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request;
+		bool bComplete = false;
+		bool bSucceeded = false;
+		TArray64<uint8> Body;
+	};
+
+	/**
+	 * Downloads a resource from a loopback server that drops the first transfer of it halfway, with and without resuming,
+	 * then checks that only the download resuming asked for the rest with a Range, and that both got the whole body
+	 */
+	class FRunDownloadsCommand : public IAutomationLatentCommand
+	{
+	public:
+		explicit FRunDownloadsCommand(FAutomationTestBase& InTest)
+			: Test(InTest)
+			, Manager(FConvaihttpRetrySystem::FRetryLimitCountSetting(2), FConvaihttpRetrySystem::FRetryTimeoutRelativeSecondsSetting())
+		{
+		}
+
+		virtual bool Update() override
+		{
+			if (!Resumed.Request.IsValid())
+			{
+				// Real requests to the loopback server, whatever the transport is configured with
+				FConvaihttpModule& Module = FConvaihttpModule::Get();
+				bWasSimulated = Module.IsSimulatedConvaihttpEnabled();
+				Module.ToggleSimulatedConvaihttp(false);
+
+				if (!Server.Start())
+				{
+					Module.ToggleSimulatedConvaihttp(bWasSimulated);
+					Test.AddError(TEXT("The loopback server failed to start"));
+					return true;
+				}
+				Deadline = FPlatformTime::Seconds() + 30.0;
+				// Each target is dropped once, so the downloads are told apart by their query
+				Start(Resumed, TEXT("resume"), true);
+				Start(Restarted, TEXT("restart"), false);
+				return false;
+			}
+
+			Manager.Update();
+			if (!Resumed.bComplete || !Restarted.bComplete)
+			{
+				if (!bTimedOut && FPlatformTime::Seconds() >= Deadline)
+				{
+					// Wait for the cancelled requests to complete, they refer to the manager
+					Test.AddError(TEXT("The downloads didn't complete in time"));
+					bTimedOut = true;
+					Resumed.Request->CancelRequest();
+					Restarted.Request->CancelRequest();
+				}
+				return false;
+			}
+
+			FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+			if (bTimedOut)
+			{
+				return true;
+			}
+
+			const TArray64<uint8> Expected = ConvaihttpLoopbackTest::MakeBody(ResourceSize);
+			const TArray<FString> Ranges = Server.GetRangesRequested();
+			Test.TestEqual(TEXT("Ranges requested"), Ranges.Num(), 1);
+			Test.TestTrue(TEXT("Rest of the body asked for"), Ranges.Contains(FString::Printf(TEXT("bytes=%lld-"), FailAt)));
+
+			Test.TestTrue(TEXT("Resumed download succeeded"), Resumed.bSucceeded);
+			Test.TestEqual(TEXT("Resumed download size"), Resumed.Body.Num(), ResourceSize);
+			Test.TestTrue(TEXT("Resumed download body"), Resumed.Body == Expected);
+			Test.TestTrue(TEXT("Restarted download succeeded"), Restarted.bSucceeded);
+			Test.TestTrue(TEXT("Restarted download body"), Restarted.Body == Expected);
+			return true;
+		}
+
+	private:
+		void Start(FDownload& Download, const TCHAR* Name, bool bResume)
+		{
+			Download.Request = Manager.CreateRequest();
+			Download.Request->SetURL(FString::Printf(TEXT("%s%s?size=%lld&failat=%lld"), *Server.GetUrl(), Name, ResourceSize, FailAt));
+			Download.Request->SetVerb(TEXT("GET"));
+			if (bResume)
+			{
+				Download.Request->SetResumeDownloads(true);
+			}
+			Download.Request->OnProcessRequestComplete().BindLambda([&Download](FConvaihttpRequestPtr Request, FConvaihttpResponsePtr Response, bool bSucceeded)
+			{
+				Download.bComplete = true;
+				Download.bSucceeded = bSucceeded && Response.IsValid();
+				if (Download.bSucceeded)
+				{
+					Download.Body = Response->GetContent();
+				}
+			});
+			if (!Download.Request->ProcessRequest())
+			{
+				Download.bComplete = true;
+			}
+		}
+
+		FAutomationTestBase& Test;
+		FConvaihttpLoopbackServer Server;
+		FConvaihttpRetrySystem::FManager Manager;
+		FDownload Resumed;
+		FDownload Restarted;
+		bool bWasSimulated = false;
+		bool bTimedOut = false;
+		double Deadline = 0.0;
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpResumeDownloadTest, "Convaihttp.RetrySystem.ResumeDownload", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpResumeDownloadTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpResumeDownloadTest::FRunDownloadsCommand(*this));
+	return true;
+}
+#endif
+
+// Segmented download
+
+#if WITH_CURL
+namespace ConvaihttpSegmentedDownloadTest
+{
+	/** Size of the segments, the smallest allowed */
+	static constexpr int64 SegmentSize = 64 * 1024;
+	/** Size of the resources downloaded in segments, a few and a partial one */
+	static constexpr int64 ResourceSize = 6 * SegmentSize + 1234;
+	/** Offset the loopback server drops a segment at, in the middle of the fourth one */
+	static constexpr int64 FailAt = 3 * SegmentSize + 5000;
+
+	/** Download of a resource, and how it completed */
+	struct FCase
+	{
+		const TCHAR* Name = nullptr;
+		/** Query of the resource, in addition to its size */
+		FString Query;
+		int64 Size = 0;
+		TSharedPtr<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe> Download;
+		bool bComplete = false;
+		bool bSucceeded = false;
+	};
+
+	/**
+	 * Downloads resources from a loopback server in segments: a plain one, one a segment of which is dropped halfway,
+	 * one served by a server ignoring ranges, and an empty one. Checks that each is received byte for byte, and that
+	 * the dropped segment was asked for again from where it stopped
+	 */
+	class FRunDownloadsCommand : public IAutomationLatentCommand
+	{
+	public:
+		explicit FRunDownloadsCommand(FAutomationTestBase& InTest)
+			: Test(InTest)
+		{
+			Cases.Add({ TEXT("segmented"), FString(), ResourceSize });
+			Cases.Add({ TEXT("retried"), FString::Printf(TEXT("&failat=%lld"), FailAt), ResourceSize });
+			Cases.Add({ TEXT("unranged"), TEXT("&norange"), ResourceSize });
+			Cases.Add({ TEXT("empty"), FString(), 0 });
+		}
+
+		virtual bool Update() override
+		{
+			if (!bStarted)
+			{
+				// Real requests to the loopback server, whatever the transport is configured with
+				FConvaihttpModule& Module = FConvaihttpModule::Get();
+				bWasSimulated = Module.IsSimulatedConvaihttpEnabled();
+				Module.ToggleSimulatedConvaihttp(false);
+				bStarted = true;
+
+				if (!Server.Start())
+				{
+					Module.ToggleSimulatedConvaihttp(bWasSimulated);
+					Test.AddError(TEXT("The loopback server failed to start"));
+					return true;
+				}
+				Deadline = FPlatformTime::Seconds() + 30.0;
+				for (FCase& Case : Cases)
+				{
+					Start(Case);
+				}
+				return false;
+			}
+
+			if (Cases.ContainsByPredicate([](const FCase& Case) { return !Case.bComplete; }))
+			{
+				if (!bTimedOut && FPlatformTime::Seconds() >= Deadline)
+				{
+					// Wait for the cancelled downloads to complete, they refer to the cases
+					Test.AddError(TEXT("The downloads didn't complete in time"));
+					bTimedOut = true;
+					for (FCase& Case : Cases)
+					{
+						Case.Download->Cancel();
+					}
+				}
+				return false;
+			}
+
+			FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+			if (bTimedOut)
+			{
+				return true;
+			}
+
+			for (const FCase& Case : Cases)
+			{
+				Test.TestTrue(FString::Printf(TEXT("%s download succeeded"), Case.Name), Case.bSucceeded);
+				Test.TestEqual(FString::Printf(TEXT("%s download size"), Case.Name), static_cast<int64>(Case.Download->GetTotalSize()), Case.Size);
+				Test.TestTrue(FString::Printf(TEXT("%s download body"), Case.Name), Case.Download->GetContent() == ConvaihttpLoopbackTest::MakeBody(Case.Size));
+			}
+			Test.TestTrue(TEXT("Segments in flight"), Cases[0].Download->GetPeakSegmentsInFlight() > 1);
+			Test.TestEqual(TEXT("Unranged download received in one request"), Cases[2].Download->GetPeakSegmentsInFlight(), 0);
+
+			// The dropped segment is asked for again from the first byte it is missing
+			const int64 FailedSegmentEnd = (FailAt / SegmentSize + 1) * SegmentSize - 1;
+			Test.TestTrue(TEXT("Dropped segment asked for again"), Server.GetRangesRequested().Contains(FString::Printf(TEXT("bytes=%lld-%lld"), FailAt, FailedSegmentEnd)));
+			return true;
+		}
+
+	private:
+		void Start(FCase& Case)
+		{
+			Case.Download = MakeShared<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe>(FString::Printf(TEXT("%s%s?size=%lld%s"), *Server.GetUrl(), Case.Name, Case.Size, *Case.Query));
+			Case.Download->SetSegmentSize(SegmentSize);
+			Case.Download->SetMaxSegments(4);
+			Case.Download->OnComplete().BindLambda([&Case](bool bSucceeded)
+			{
+				Case.bComplete = true;
+				Case.bSucceeded = bSucceeded;
+			});
+			if (!Case.Download->Start())
+			{
+				Case.bComplete = true;
+			}
+		}
+
+		FAutomationTestBase& Test;
+		FConvaihttpLoopbackServer Server;
+		/** Not resized once the downloads started, as their delegates refer to them */
+		TArray<FCase> Cases;
+		bool bStarted = false;
+		bool bWasSimulated = false;
+		bool bTimedOut = false;
+		double Deadline = 0.0;
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpSegmentedDownloadTest, "Convaihttp.SegmentedDownload", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpSegmentedDownloadTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpSegmentedDownloadTest::FRunDownloadsCommand(*this));
+	return true;
+}
+#endif
+
+// Retry domains
+
+namespace ConvaihttpRetryDomainsTest
+{
+	/** Retry domains on a clock the test moves, so no transition depends on how fast the test runs */
+	class FRetryDomains : public FConvaihttpRetrySystem::FRetryDomains
+	{
+	public:
+		explicit FRetryDomains(TArray64<FString>&& InDomains)
+			: FConvaihttpRetrySystem::FRetryDomains(MoveTemp(InDomains))
+		{
+		}
+
+		double NowAbsoluteSeconds = 1000.0;
+
+	protected:
+		virtual double GetNowAbsoluteSeconds() const override { return NowAbsoluteSeconds; }
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpRetryDomainsCircuitBreakerTest, "Convaihttp.RetrySystem.CircuitBreaker", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpRetryDomainsCircuitBreakerTest::RunTest(const FString& Parameters)
+{
+	using EDomainState = FConvaihttpRetrySystem::FRetryDomains::EDomainState;
+
+	ConvaihttpRetryDomainsTest::FRetryDomains Domains(TArray64<FString>({ TEXT("primary.invalid"), TEXT("secondary.invalid") }));
+	const float OpenSeconds = Domains.OpenSeconds;
+	bool bIsProbe = false;
+
+	// Closed -> Open once the threshold of unreachable attempts in a row is reached
+	for (int32 Attempt = 1; Attempt < Domains.FailureThreshold; ++Attempt)
+	{
+		Domains.ReportResult(0, false, false, false, 0.0f);
+	}
+	TestEqual(TEXT("Closed below the failure threshold"), Domains.GetDomainState(0), EDomainState::Closed);
+	Domains.ReportResult(0, true, false, true, 0.1f);
+	for (int32 Attempt = 1; Attempt < Domains.FailureThreshold; ++Attempt)
+	{
+		Domains.ReportResult(0, false, false, false, 0.0f);
+	}
+	TestEqual(TEXT("An answer resets the failures in a row"), Domains.GetDomainState(0), EDomainState::Closed);
+	Domains.ReportResult(0, false, false, false, 0.0f);
+	TestEqual(TEXT("Open at the failure threshold"), Domains.GetDomainState(0), EDomainState::Open);
+	TestEqual(TEXT("Open domain skipped"), Domains.AcquireDomain(0, bIsProbe), 1);
+	TestFalse(TEXT("Closed domain not probed"), bIsProbe);
+
+	// Open -> HalfOpen once the open period is over, admitting a single probe
+	Domains.NowAbsoluteSeconds += OpenSeconds * 0.5;
+	TestEqual(TEXT("Open domain skipped during its open period"), Domains.AcquireDomain(0, bIsProbe), 1);
+	Domains.NowAbsoluteSeconds += OpenSeconds * 0.5;
+	TestEqual(TEXT("Domain probed once its open period is over"), Domains.AcquireDomain(0, bIsProbe), 0);
+	TestTrue(TEXT("Attempt is the probe"), bIsProbe);
+	TestEqual(TEXT("Half-open while probed"), Domains.GetDomainState(0), EDomainState::HalfOpen);
+	TestEqual(TEXT("Single probe admitted"), Domains.AcquireDomain(0, bIsProbe), 1);
+	TestFalse(TEXT("Second attempt isn't a probe"), bIsProbe);
+	TestEqual(TEXT("Single probe admitted when selecting"), Domains.SelectDomain(bIsProbe), 1);
+	TestFalse(TEXT("Selected attempt isn't a probe"), bIsProbe);
+
+	// A probe cancelled before telling anything lets another request probe
+	Domains.ReleaseProbe(0);
+	TestEqual(TEXT("Released probe taken again"), Domains.AcquireDomain(0, bIsProbe), 0);
+	TestTrue(TEXT("Attempt after the release is the probe"), bIsProbe);
+
+	// Probe failure: HalfOpen -> Open, for twice as long
+	Domains.ReportResult(0, false, true, false, 0.0f);
+	TestEqual(TEXT("Reopened when the probe fails"), Domains.GetDomainState(0), EDomainState::Open);
+	Domains.NowAbsoluteSeconds += OpenSeconds;
+	TestEqual(TEXT("Reopened for longer"), Domains.AcquireDomain(0, bIsProbe), 1);
+	Domains.NowAbsoluteSeconds += OpenSeconds;
+	TestEqual(TEXT("Probed again after the longer open period"), Domains.AcquireDomain(0, bIsProbe), 0);
+	TestTrue(TEXT("Attempt after the longer open period is the probe"), bIsProbe);
+
+	// A probe that never reports back stops holding the domain after its timeout
+	Domains.NowAbsoluteSeconds += Domains.ProbeTimeoutSeconds;
+	TestEqual(TEXT("Stale probe replaced"), Domains.AcquireDomain(0, bIsProbe), 0);
+	TestTrue(TEXT("Attempt after a stale probe is the probe"), bIsProbe);
+
+	// Probe success: HalfOpen -> Closed
+	Domains.ReportResult(0, true, true, true, 0.1f);
+	TestEqual(TEXT("Closed when the probe succeeds"), Domains.GetDomainState(0), EDomainState::Closed);
+	TestEqual(TEXT("Closed domain used"), Domains.AcquireDomain(0, bIsProbe), 0);
+	TestFalse(TEXT("Closed domain used without probing"), bIsProbe);
+
+	// Closed again, it takes the whole threshold to open it, for the initial period
+	for (int32 Attempt = 0; Attempt < Domains.FailureThreshold; ++Attempt)
+	{
+		Domains.ReportResult(0, false, false, false, 0.0f);
+	}
+	TestEqual(TEXT("Open again at the failure threshold"), Domains.GetDomainState(0), EDomainState::Open);
+	Domains.NowAbsoluteSeconds += OpenSeconds;
+	TestEqual(TEXT("Open period back to its initial length"), Domains.AcquireDomain(0, bIsProbe), 0);
+	TestTrue(TEXT("Attempt after the initial open period is the probe"), bIsProbe);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpRetryDomainsSelectDomainTest, "Convaihttp.RetrySystem.SelectDomain", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpRetryDomainsSelectDomainTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumSelections = 300;
+	auto CountSelections = [](ConvaihttpRetryDomainsTest::FRetryDomains& Domains)
+	{
+		TArray<int32> Counts;
+		Counts.SetNumZeroed(static_cast<int32>(Domains.Domains.Num()));
+		for (int32 Selection = 0; Selection < NumSelections; ++Selection)
+		{
+			bool bIsProbe = false;
+			++Counts[Domains.SelectDomain(bIsProbe)];
+		}
+		return Counts;
+	};
+
+	{
+		// By default first attempts stay on the active domain, however fast the others are
+		ConvaihttpRetryDomainsTest::FRetryDomains Domains(TArray64<FString>({ TEXT("primary.invalid"), TEXT("secondary.invalid") }));
+		Domains.ReportResult(0, true, false, true, 0.5f);
+		Domains.ReportResult(1, true, false, true, 0.01f);
+		TestEqual(TEXT("First attempts on the active domain"), CountSelections(Domains)[0], NumSelections);
+	}
+
+	{
+		ConvaihttpRetryDomainsTest::FRetryDomains Domains(TArray64<FString>({ TEXT("slow.invalid"), TEXT("fast.invalid"), TEXT("medium.invalid") }));
+		Domains.bSpreadFirstAttempts = true;
+
+		// Nothing measured yet, nothing to compare
+		TestEqual(TEXT("Active domain until one has samples"), CountSelections(Domains)[0], NumSelections);
+
+		// Of two domains drawn the faster one is used, so the slowest never is, and the fastest is used the most
+		Domains.ReportResult(0, true, false, true, 0.5f);
+		Domains.ReportResult(1, true, false, true, 0.05f);
+		Domains.ReportResult(2, true, false, true, 0.1f);
+		TArray<int32> Counts = CountSelections(Domains);
+		TestEqual(TEXT("Slowest domain never used"), Counts[0], 0);
+		TestTrue(FString::Printf(TEXT("Fastest domain used the most (%d vs %d)"), Counts[1], Counts[2]), Counts[1] > Counts[2]);
+		TestTrue(TEXT("Other domains used too"), Counts[2] > 0);
+
+		// Errors make a domain as slow as the attempts it takes to succeed
+		for (int32 Attempt = 0; Attempt < 10; ++Attempt)
+		{
+			Domains.ReportResult(1, true, false, false, 0.05f);
+		}
+		Counts = CountSelections(Domains);
+		TestTrue(FString::Printf(TEXT("Failing domain used less (%d vs %d)"), Counts[1], Counts[2]), Counts[1] < Counts[2]);
+
+		// An unknown domain is worth measuring, it is used whenever drawn
+		Domains.NowAbsoluteSeconds += Domains.LatencyMaxAgeSeconds * 0.5;
+		Domains.ReportResult(1, true, false, true, 0.05f);
+		Domains.ReportResult(2, true, false, true, 0.1f);
+		Domains.NowAbsoluteSeconds += Domains.LatencyMaxAgeSeconds * 0.6;
+		Counts = CountSelections(Domains);
+		TestTrue(FString::Printf(TEXT("Domain with stale samples tried again (%d)"), Counts[0]), Counts[0] > NumSelections / 2);
+
+		// Once every sample is stale, back to the active domain
+		Domains.NowAbsoluteSeconds += Domains.LatencyMaxAgeSeconds;
+		TestEqual(TEXT("Active domain once all samples are stale"), CountSelections(Domains)[0], NumSelections);
+	}
+	return true;
+}
+
+// Hedging
+
+namespace ConvaihttpHedgingTest
+{
+	/** Enough first byte latency samples for hedging to start */
+	static constexpr int32 NumWarmUpRequests = 20;
+	/** Latency of the requests expected to be hedged, far above that of the warm up requests */
+	static constexpr int32 SlowLatencyMs = 500;
+
+	enum class EScenario
+	{
+		/** A request to a slow domain is hedged to a fast one, which wins */
+		SlowPrimary,
+		/** Requests that can't be sent or received twice are never hedged */
+		NeverHedged,
+		/** More requests than the budget allows */
+		Budget,
+	};
+
+	class FManager : public FConvaihttpRetrySystem::FManager
+	{
+	public:
+		FManager()
+			: FConvaihttpRetrySystem::FManager(FConvaihttpRetrySystem::FRetryLimitCountSetting(0), FConvaihttpRetrySystem::FRetryTimeoutRelativeSecondsSetting())
+		{
+		}
+
+		void EmptyHedgeBudget() { HedgeBudgetTokens = 0.0f; }
+		TOptional<float> GetHedgeDelaySeconds(float Percentile) { return GetFirstByteLatencyPercentile(Percentile); }
+	};
+
+	/** Request through the retry system, and what it completed with */
+	struct FResult
+	{
+		TSharedPtr<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request;
+		bool bComplete = false;
+		bool bSucceeded = false;
+		double CompleteTime = 0.0;
+		FString Url;
+	};
+
+	/** Collects the requests listed by FConvaihttpManager::DumpRequests() */
+	class FRequestListDevice : public FOutputDevice
+	{
+	public:
+		virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category) override
+		{
+			Text += V;
+			Text += TEXT("\n");
+		}
+
+		FString Text;
+	};
+
+	/**
+	 * Warms the first byte latencies of a retry manager up with fast requests over the simulated transport, then runs
+	 * the requests of a scenario whose latencies are scripted by url and checks the hedges they got
+	 */
+	class FRunCommand : public IAutomationLatentCommand
+	{
+	public:
+		FRunCommand(FAutomationTestBase& InTest, EScenario InScenario)
+			: Test(InTest)
+			, Scenario(InScenario)
+		{
+		}
+
+		virtual bool Update() override
+		{
+			const double Now = FPlatformTime::Seconds();
+			if (!bStarted)
+			{
+				bStarted = true;
+				FConvaihttpModule& Module = FConvaihttpModule::Get();
+				bWasSimulated = Module.IsSimulatedConvaihttpEnabled();
+				FSimulatedConvaihttpRequest::UpdateConfigs();
+				Module.ToggleSimulatedConvaihttp(true);
+
+				Deadline = Now + 30.0;
+				for (int32 Index = 0; Index < NumWarmUpRequests; ++Index)
+				{
+					Start(CreateRequest(TEXT("http://hedge.invalid/warmup?size=16&latency=5")));
+				}
+				return false;
+			}
+
+			Manager.Update();
+			if (bScenarioStarted && HedgeTime == 0.0 && Manager.GetHedgeStats().NumHedges > StatsBefore.NumHedges)
+			{
+				HedgeTime = Now;
+			}
+			if (Results.ContainsByPredicate([](const TSharedRef<FResult>& Result) { return !Result->bComplete; }))
+			{
+				if (!bTimedOut && Now >= Deadline)
+				{
+					// Wait for the cancelled requests to complete, they refer to the manager
+					Test.AddError(TEXT("The requests didn't complete in time"));
+					bTimedOut = true;
+					for (const TSharedRef<FResult>& Result : Results)
+					{
+						Result->Request->CancelRequest();
+					}
+				}
+				return false;
+			}
+
+			if (!bTimedOut && !bScenarioStarted)
+			{
+				bScenarioStarted = true;
+				StatsBefore = Manager.GetHedgeStats();
+				StartTime = Now;
+				StartScenario();
+				return false;
+			}
+
+			if (!bTimedOut && Scenario == EScenario::SlowPrimary && IsRequestListed(TEXT("slow.invalid")))
+			{
+				// The hedge won long before the primary would complete, unless it is cancelled
+				if (Now < Results.Last()->CompleteTime + 1.0)
+				{
+					return false;
+				}
+				Test.AddError(TEXT("The request the hedge won against wasn't cancelled"));
+			}
+
+			FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+			if (!bTimedOut)
+			{
+				Check();
+			}
+			return true;
+		}
+
+	private:
+		TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> CreateRequest(const FString& Url, const FConvaihttpRetrySystem::FRetryDomainsPtr& RetryDomains = FConvaihttpRetrySystem::FRetryDomainsPtr())
+		{
+			TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request = Manager.CreateRequest(
+				FConvaihttpRetrySystem::FRetryLimitCountSetting(),
+				FConvaihttpRetrySystem::FRetryTimeoutRelativeSecondsSetting(),
+				FConvaihttpRetrySystem::FRetryResponseCodes(),
+				FConvaihttpRetrySystem::FRetryVerbs(),
+				RetryDomains);
+			Request->SetURL(Url);
+			Request->SetVerb(TEXT("GET"));
+			return Request;
+		}
+
+		void Start(const TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe>& Request)
+		{
+			TSharedRef<FResult> Result = MakeShared<FResult>();
+			Result->Request = Request;
+			Results.Add(Result);
+			Request->OnProcessRequestComplete().BindLambda([Result](FConvaihttpRequestPtr InRequest, FConvaihttpResponsePtr Response, bool bSucceeded)
+			{
+				Result->bComplete = true;
+				Result->bSucceeded = bSucceeded && Response.IsValid() && EConvaihttpResponseCodes::IsOk(Response->GetResponseCode());
+				Result->CompleteTime = FPlatformTime::Seconds();
+				Result->Url = InRequest->GetURL();
+			});
+			if (!Request->ProcessRequest())
+			{
+				Result->bComplete = true;
+			}
+		}
+
+		void StartScenario()
+		{
+			const FString SlowUrl = FString::Printf(TEXT("http://hedge.invalid/slow?size=16&latency=%d"), SlowLatencyMs);
+			switch (Scenario)
+			{
+			case EScenario::SlowPrimary:
+			{
+				HedgeDelaySeconds = Manager.GetHedgeDelaySeconds(0.9f).Get(-1.0f);
+				const FConvaihttpRetrySystem::FRetryDomainsPtr RetryDomains = MakeShared<FConvaihttpRetrySystem::FRetryDomains, ESPMode::ThreadSafe>(
+					TArray64<FString>({ TEXT("slow.invalid"), TEXT("fast.invalid") }));
+				TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request = CreateRequest(
+					TEXT("http://slow.invalid/item?size=16&latency=5&latency@slow.invalid=3000"), RetryDomains);
+				Request->SetHedging(0.9f);
+				Start(Request);
+				break;
+			}
+			case EScenario::NeverHedged:
+			{
+				// Hedged, so the others had the time to be
+				TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Hedged = CreateRequest(SlowUrl);
+				Hedged->SetHedging(0.5f);
+				Start(Hedged);
+
+				TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Post = CreateRequest(SlowUrl);
+				Post->SetVerb(TEXT("POST"));
+				Post->SetContentAsString(TEXT("not idempotent"));
+				Post->SetHedging(0.5f);
+				Start(Post);
+
+				TSharedRef<FArrayReader, ESPMode::ThreadSafe> Upload = MakeShared<FArrayReader, ESPMode::ThreadSafe>();
+				Upload->SetNumZeroed(64);
+				TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Streamed = CreateRequest(SlowUrl);
+				Streamed->SetVerb(TEXT("PUT"));
+				Streamed->SetContentFromStream(Upload);
+				Streamed->SetHedging(0.5f);
+				Start(Streamed);
+
+				TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Sink = CreateRequest(SlowUrl);
+				Sink->SetResponseBodyReceiveStream(MakeShared<FArrayWriter, ESPMode::ThreadSafe>());
+				Sink->SetHedging(0.5f);
+				Start(Sink);
+
+				TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Range = CreateRequest(SlowUrl);
+				Range->SetHeader(TEXT("Range"), TEXT("bytes=0-7"));
+				Range->SetHedging(0.5f);
+				Start(Range);
+				break;
+			}
+			case EScenario::Budget:
+			{
+				// From an empty budget, only what the requests add to it
+				Manager.SetHedgeBudget(0.25f, 100.0f);
+				Manager.EmptyHedgeBudget();
+				for (int32 Index = 0; Index < 16; ++Index)
+				{
+					TSharedRef<FConvaihttpRetrySystem::FRequest, ESPMode::ThreadSafe> Request = CreateRequest(SlowUrl);
+					Request->SetHedging(0.5f);
+					Start(Request);
+				}
+				break;
+			}
+			}
+		}
+
+		bool IsRequestListed(const TCHAR* Host) const
+		{
+			FRequestListDevice RequestList;
+			FConvaihttpModule::Get().GetConvaihttpManager().DumpRequests(RequestList);
+			return RequestList.Text.Contains(Host);
+		}
+
+		void Check()
+		{
+			const FConvaihttpRetrySystem::FManager::FHedgeStats& Stats = Manager.GetHedgeStats();
+			const uint64 NumHedges = Stats.NumHedges - StatsBefore.NumHedges;
+			const uint64 NumWins = Stats.NumWins - StatsBefore.NumWins;
+			const uint64 NumDenied = Stats.NumDenied - StatsBefore.NumDenied;
+			for (int32 Index = NumWarmUpRequests; Index < Results.Num(); ++Index)
+			{
+				Test.TestTrue(FString::Printf(TEXT("Request %d succeeded"), Index - NumWarmUpRequests), Results[Index]->bSucceeded);
+			}
+
+			switch (Scenario)
+			{
+			case EScenario::SlowPrimary:
+			{
+				const FResult& Result = *Results.Last();
+				Test.TestEqual(TEXT("Hedges"), NumHedges, uint64(1));
+				Test.TestEqual(TEXT("Hedges won"), NumWins, uint64(1));
+				Test.TestTrue(TEXT("Hedge delay known"), HedgeDelaySeconds >= 0.0f);
+				Test.TestTrue(FString::Printf(TEXT("Hedged after the percentile delay (%.3fs >= %.3fs)"), HedgeTime - StartTime, HedgeDelaySeconds),
+					HedgeTime > 0.0 && HedgeTime - StartTime >= HedgeDelaySeconds);
+				Test.TestTrue(FString::Printf(TEXT("Completed before the primary could (%.3fs)"), Result.CompleteTime - StartTime), Result.CompleteTime - StartTime < 2.0);
+				Test.TestTrue(FString::Printf(TEXT("Completed by the hedge (%s)"), *Result.Url), Result.Url.Contains(TEXT("fast.invalid")));
+				break;
+			}
+			case EScenario::NeverHedged:
+				Test.TestEqual(TEXT("Hedges"), NumHedges, uint64(1));
+				Test.TestEqual(TEXT("Hedges denied"), NumDenied, uint64(0));
+				break;
+			case EScenario::Budget:
+				Test.TestEqual(TEXT("Hedges"), NumHedges, uint64(4));
+				Test.TestEqual(TEXT("Hedges denied"), NumDenied, uint64(12));
+				break;
+			}
+		}
+
+		FAutomationTestBase& Test;
+		EScenario Scenario;
+		FManager Manager;
+		TArray<TSharedRef<FResult>> Results;
+		FConvaihttpRetrySystem::FManager::FHedgeStats StatsBefore;
+		float HedgeDelaySeconds = -1.0f;
+		double StartTime = 0.0;
+		double HedgeTime = 0.0;
+		bool bStarted = false;
+		bool bScenarioStarted = false;
+		bool bWasSimulated = false;
+		bool bTimedOut = false;
+		double Deadline = 0.0;
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpHedgingSlowPrimaryTest, "Convaihttp.RetrySystem.Hedging.SlowPrimary", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpHedgingSlowPrimaryTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpHedgingTest::FRunCommand(*this, ConvaihttpHedgingTest::EScenario::SlowPrimary));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpHedgingNeverHedgedTest, "Convaihttp.RetrySystem.Hedging.NeverHedged", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpHedgingNeverHedgedTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpHedgingTest::FRunCommand(*this, ConvaihttpHedgingTest::EScenario::NeverHedged));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpHedgingBudgetTest, "Convaihttp.RetrySystem.Hedging.Budget", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpHedgingBudgetTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpHedgingTest::FRunCommand(*this, ConvaihttpHedgingTest::EScenario::Budget));
+	return true;
+}
+
+// Host throttle
+
+namespace ConvaihttpHostThrottleTest
+{
+	/** Request and what it completed with */
+	struct FResult
+	{
+		bool bComplete = false;
+		int32 ResponseCode = 0;
+		double StartTime = 0.0;
+		double CompleteTime = 0.0;
+	};
+
+	/**
+	 * Gets a 503 with Retry-After: 1 from a host over the simulated transport, then checks that the next request to the
+	 * host waits for the end of the throttle while a request to another host doesn't, and that the throttle is then forgotten
+	 */
+	class FRunCommand : public IAutomationLatentCommand
+	{
+	public:
+		explicit FRunCommand(FAutomationTestBase& InTest)
+			: Test(InTest)
+		{
+		}
+
+		virtual bool Update() override
+		{
+			const double Now = FPlatformTime::Seconds();
+			if (!bStarted)
+			{
+				bStarted = true;
+				FConvaihttpModule& Module = FConvaihttpModule::Get();
+				bWasSimulated = Module.IsSimulatedConvaihttpEnabled();
+				FSimulatedConvaihttpRequest::UpdateConfigs();
+				Module.ToggleSimulatedConvaihttp(true);
+
+				Deadline = Now + 30.0;
+				Start(TEXT("http://busy.invalid/throttled?size=16&latency=5&code=503"), Throttled);
+				return false;
+			}
+
+			if (Throttled.bComplete && !bThrottledHostRequested)
+			{
+				// Started once the manager read the Retry-After of the response, after its completion delegate
+				bThrottledHostRequested = true;
+				Start(TEXT("http://busy.invalid/item?size=16&latency=5"), ThrottledHost);
+				Start(TEXT("http://idle.invalid/item?size=16&latency=5"), OtherHost);
+				return false;
+			}
+
+			if (!Throttled.bComplete || !ThrottledHost.bComplete || !OtherHost.bComplete)
+			{
+				if (!bTimedOut && Now >= Deadline)
+				{
+					Test.AddError(TEXT("The requests didn't complete in time"));
+					bTimedOut = true;
+					for (const FConvaihttpRequestPtr& Request : Requests)
+					{
+						Request->CancelRequest();
+					}
+				}
+				return false;
+			}
+
+			// The throttle is forgotten on the manager tick that completed the last request
+			if (!bTimedOut && !bTicked)
+			{
+				bTicked = true;
+				return false;
+			}
+
+			FConvaihttpModule::Get().ToggleSimulatedConvaihttp(bWasSimulated);
+			if (bTimedOut)
+			{
+				return true;
+			}
+
+			Test.TestEqual(TEXT("Throttling response"), Throttled.ResponseCode, int32(EConvaihttpResponseCodes::ServiceUnavail));
+			Test.TestEqual(TEXT("Request to the throttled host"), ThrottledHost.ResponseCode, int32(EConvaihttpResponseCodes::Ok));
+			Test.TestEqual(TEXT("Request to another host"), OtherHost.ResponseCode, int32(EConvaihttpResponseCodes::Ok));
+			const double ThrottledHostSeconds = ThrottledHost.CompleteTime - Throttled.CompleteTime;
+			const double OtherHostSeconds = OtherHost.CompleteTime - OtherHost.StartTime;
+			Test.TestTrue(FString::Printf(TEXT("Throttled host held back for the Retry-After (%.3fs)"), ThrottledHostSeconds), ThrottledHostSeconds >= 0.9);
+			Test.TestTrue(FString::Printf(TEXT("Other host not held back (%.3fs)"), OtherHostSeconds), OtherHostSeconds < 0.5);
+			Test.TestFalse(TEXT("Throttle forgotten once over"), FConvaihttpModule::Get().GetConvaihttpManager().HasThrottledHosts());
+			return true;
+		}
+
+	private:
+		void Start(const TCHAR* Url, FResult& Result)
+		{
+			FConvaihttpRequestRef Request = FConvaihttpModule::Get().CreateRequest();
+			Requests.Add(Request);
+			Request->SetURL(Url);
+			Request->SetVerb(TEXT("GET"));
+			Request->OnProcessRequestComplete().BindLambda([&Result](FConvaihttpRequestPtr InRequest, FConvaihttpResponsePtr Response, bool bSucceeded)
+			{
+				Result.bComplete = true;
+				Result.ResponseCode = Response.IsValid() ? Response->GetResponseCode() : 0;
+				Result.CompleteTime = FPlatformTime::Seconds();
+			});
+			Result.StartTime = FPlatformTime::Seconds();
+			if (!Request->ProcessRequest())
+			{
+				Result.bComplete = true;
+			}
+		}
+
+		FAutomationTestBase& Test;
+		TArray<FConvaihttpRequestPtr> Requests;
+		FResult Throttled;
+		FResult ThrottledHost;
+		FResult OtherHost;
+		bool bStarted = false;
+		bool bThrottledHostRequested = false;
+		bool bTicked = false;
+		bool bWasSimulated = false;
+		bool bTimedOut = false;
+		double Deadline = 0.0;
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpHostThrottleTest, "Convaihttp.HostThrottle", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpHostThrottleTest::RunTest(const FString& Parameters)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(ConvaihttpHostThrottleTest::FRunCommand(*this));
+	return true;
+}
+
+// Latency histogram
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpLatencyHistogramTest, "Convaihttp.Metrics.LatencyHistogram", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpLatencyHistogramTest::RunTest(const FString& Parameters)
+{
+	using FHistogram = FConvaihttpLatencyHistogram;
+
+	// The first range counts each microsecond on its own, each range after it starts a new bucket at a power of two
+	for (uint64 Microseconds = 0; Microseconds < FHistogram::NumSubBuckets; ++Microseconds)
+	{
+		TestEqual(FString::Printf(TEXT("Bucket of %llu us"), Microseconds), FHistogram::GetBucketIndex(Microseconds), static_cast<int32>(Microseconds));
+		TestEqual(FString::Printf(TEXT("Highest of the bucket of %llu us"), Microseconds), FHistogram::GetBucketHighestMicroseconds(static_cast<int32>(Microseconds)), Microseconds);
+	}
+	for (int32 Range = 1; Range < FHistogram::NumRanges; ++Range)
+	{
+		const uint64 RangeStart = static_cast<uint64>(FHistogram::NumSubBuckets) << (Range - 1);
+		const uint64 BucketWidth = uint64(1) << (Range - 1);
+		const int32 FirstBucket = FHistogram::GetBucketIndex(RangeStart);
+		TestEqual(FString::Printf(TEXT("First bucket of range %d"), Range), FirstBucket, Range * FHistogram::NumSubBuckets);
+		TestEqual(FString::Printf(TEXT("Last bucket before range %d"), Range), FHistogram::GetBucketIndex(RangeStart - 1), FirstBucket - 1);
+		TestEqual(FString::Printf(TEXT("End of the range before %d"), Range), FHistogram::GetBucketHighestMicroseconds(FirstBucket - 1), RangeStart - 1);
+		TestEqual(FString::Printf(TEXT("Highest of the first bucket of range %d"), Range), FHistogram::GetBucketHighestMicroseconds(FirstBucket), RangeStart + BucketWidth - 1);
+		TestEqual(FString::Printf(TEXT("Second bucket of range %d"), Range), FHistogram::GetBucketIndex(RangeStart + BucketWidth), FirstBucket + 1);
+	}
+	const uint64 LastRangeEnd = static_cast<uint64>(FHistogram::NumSubBuckets) << (FHistogram::NumRanges - 1);
+	TestEqual(TEXT("Last bucket"), FHistogram::GetBucketIndex(LastRangeEnd - 1), FHistogram::NumBuckets - 1);
+	TestEqual(TEXT("Above the last range"), FHistogram::GetBucketIndex(LastRangeEnd * 4), FHistogram::NumBuckets - 1);
+
+	// Percentiles of latencies spread from a microsecond to minutes are above the exact ones by at most a bucket
+	{
+		FHistogram Histogram;
+		TestEqual(TEXT("Empty percentile"), Histogram.GetPercentile(0.5), 0.0);
+
+		FRandomStream RandomStream(0x4c617465);
+		TArray<uint64> Recorded;
+		for (int32 Index = 0; Index < 10000; ++Index)
+		{
+			const uint64 Microseconds = static_cast<uint64>(FMath::Pow(10.0, static_cast<double>(RandomStream.FRandRange(0.0f, 8.0f))));
+			Recorded.Add(Microseconds);
+			// Half a microsecond more, so the conversion to seconds and back doesn't round down
+			Histogram.Record((static_cast<double>(Microseconds) + 0.5) / 1000000.0);
+		}
+		Recorded.Sort();
+		TestEqual(TEXT("Count"), Histogram.GetCount(), static_cast<uint64>(Recorded.Num()));
+		TestEqual(TEXT("Max"), Histogram.GetMax(), static_cast<double>(Recorded.Last()) / 1000000.0);
+
+		for (const double Percentile : { 0.0, 0.1, 0.5, 0.9, 0.99, 0.999, 1.0 })
+		{
+			const int32 Rank = FMath::Clamp(FMath::CeilToInt(Percentile * Recorded.Num()), 1, Recorded.Num());
+			const double Exact = static_cast<double>(Recorded[Rank - 1]);
+			const double Measured = Histogram.GetPercentile(Percentile) * 1000000.0;
+			const double RelativeError = (Measured - Exact) / Exact;
+			TestTrue(FString::Printf(TEXT("p%g of %.0f us within a bucket (%.0f us, %.2f%%)"), Percentile * 100.0, Exact, Measured, RelativeError * 100.0),
+				RelativeError > -1e-9 && RelativeError <= 1.0 / FHistogram::NumSubBuckets);
+		}
+
+		Histogram.Reset();
+		TestEqual(TEXT("Count after reset"), Histogram.GetCount(), uint64(0));
+	}
+
+	// Hosts past the size of the table share the metrics of "other", hosts already registered are still found
+	{
+		FConvaihttpMetrics Metrics;
+		TSet<const FConvaihttpHostMetrics*> Registered;
+		for (int32 Index = 0; Index < FConvaihttpMetrics::MaxHosts; ++Index)
+		{
+			const FConvaihttpHostMetrics& Host = Metrics.FindOrAddHost(FString::Printf(TEXT("https://Host%d.invalid/path"), Index));
+			TestEqual(TEXT("Host registered"), Host.Host, FString::Printf(TEXT("host%d.invalid"), Index));
+			Registered.Add(&Host);
+		}
+		TestEqual(TEXT("Hosts registered apart"), Registered.Num(), FConvaihttpMetrics::MaxHosts);
+
+		FConvaihttpHostMetrics& Overflow = Metrics.FindOrAddHost(TEXT("https://overflow.invalid/"));
+		TestEqual(TEXT("Host past the table"), Overflow.Host, FString(TEXT("other")));
+		TestTrue(TEXT("Hosts past the table together"), &Metrics.FindOrAddHost(TEXT("https://overflow2.invalid/")) == &Overflow);
+		TestTrue(TEXT("Registered host found in a full table"), Registered.Contains(&Metrics.FindOrAddHost(TEXT("https://host0.invalid/other/path"))));
+
+		Metrics.RecordRetry(TEXT("https://overflow3.invalid/"));
+		TestEqual(TEXT("Retry counted under other"), Overflow.NumRetries.load(), uint64(1));
+		TestTrue(TEXT("Other exported"), Metrics.ExportCsv().Contains(TEXT("\nother,")));
+	}
+	return true;
+}
+
+// Traffic capture
+
+namespace ConvaihttpTrafficCaptureTest
+{
+	/** Request of a capture, whatever its transport: only its status is scripted */
+	class FRequest : public FConvaihttpRequestAdapterBase
+	{
+	public:
+		FRequest()
+			: FConvaihttpRequestAdapterBase(FConvaihttpModule::Get().CreateRequest())
+		{
+		}
+
+		virtual bool ProcessRequest() override { return false; }
+		virtual void CancelRequest() override {}
+		virtual EConvaihttpRequestStatus::Type GetStatus() const override { return EConvaihttpRequestStatus::Succeeded; }
+	};
+
+	/** Response of a capture */
+	class FResponse : public IConvaihttpResponse
+	{
+	public:
+		virtual FString GetURL() const override { return FString(); }
+		virtual FString GetURLParameter(const FString& ParameterName) const override { return FString(); }
+		virtual FString GetHeader(const FString& HeaderName) const override { return FString(); }
+		virtual TArray64<FString> GetAllHeaders() const override { return Headers; }
+		virtual FString GetContentType() const override { return TEXT("text/plain"); }
+		virtual uint64 GetContentLength() const override { return Content.Num(); }
+		virtual const TArray64<uint8>& GetContent() const override { return Content; }
+		virtual int32 GetResponseCode() const override { return EConvaihttpResponseCodes::Ok; }
+		virtual FString GetContentAsString() const override { return FString(); }
+
+		TArray64<FString> Headers;
+		TArray64<uint8> Content;
+	};
+
+	TArray64<uint8> MakeBody(int32 Size, uint8 Seed)
+	{
+		TArray64<uint8> Body;
+		for (int32 Index = 0; Index < Size; ++Index)
+		{
+			Body.Add(static_cast<uint8>(Seed + Index));
+		}
+		return Body;
+	}
+
+	/** Record a request with credentials in its headers, a body in the request and the response */
+	void Record(const FString& Url, const TArray64<uint8>& RequestBody, const TArray64<uint8>& ResponseBody)
+	{
+		FRequest Request;
+		Request.SetURL(Url);
+		Request.SetVerb(TEXT("POST"));
+		Request.SetHeader(TEXT("Authorization"), TEXT("Bearer secret-token"));
+		Request.SetHeader(TEXT("Accept"), TEXT("text/plain"));
+		Request.SetContent(RequestBody);
+
+		FResponse Response;
+		Response.Headers.Add(TEXT("Set-Cookie: session=secret-cookie"));
+		Response.Headers.Add(TEXT("Content-Type: text/plain"));
+		Response.Content = ResponseBody;
+
+		FConvaihttpTrafficCapture::Record(Request, FCompositeBuffer(FSharedBuffer::Clone(RequestBody.GetData(), RequestBody.Num())), &Response, FPlatformTime::Seconds());
+	}
+
+	/** @return the requests of a capture recorded by the test, without those of other traffic captured meanwhile */
+	TArray<FConvaihttpCapturedRequest> FilterRecorded(const TArray<FConvaihttpCapturedRequest>& Requests)
+	{
+		return Requests.FilterByPredicate([](const FConvaihttpCapturedRequest& Request) { return Request.Url.Contains(TEXT("capture.invalid")); });
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FConvaihttpTrafficCaptureTest, "Convaihttp.TrafficCapture", CONVAIHTTP_LOAD_TEST_FLAGS)
+
+bool FConvaihttpTrafficCaptureTest::RunTest(const FString& Parameters)
+{
+	using namespace ConvaihttpTrafficCaptureTest;
+
+	constexpr int64 MaxBodySize = 64;
+	const TArray64<uint8> SmallRequestBody = MakeBody(13, 1);
+	const TArray64<uint8> SmallResponseBody = MakeBody(32, 2);
+	const TArray64<uint8> LargeBody = MakeBody(MaxBodySize + 1, 3);
+	const FString Filename = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("ConvaihttpTrafficCapture.bin"));
+	const FString TruncatedFilename = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("ConvaihttpTrafficCaptureTruncated.bin"));
+
+	// Bodies up to the limit, without query strings
+	if (!TestTrue(TEXT("Capture started"), FConvaihttpTrafficCapture::Start(Filename, true, MaxBodySize, true)))
+	{
+		return false;
+	}
+	Record(TEXT("https://capture.invalid/small?token=query-secret"), SmallRequestBody, SmallResponseBody);
+	Record(TEXT("https://capture.invalid/large?token=query-secret"), LargeBody, LargeBody);
+	FConvaihttpTrafficCapture::Stop();
+	TestFalse(TEXT("Capture stopped"), FConvaihttpTrafficCapture::IsCapturing());
+
+	TArray<FConvaihttpCapturedRequest> AllRequests;
+	if (!TestTrue(TEXT("Capture loaded"), FConvaihttpTrafficCapture::Load(Filename, AllRequests)))
+	{
+		return false;
+	}
+	const TArray<FConvaihttpCapturedRequest> Requests = FilterRecorded(AllRequests);
+	if (!TestEqual(TEXT("Requests recorded"), Requests.Num(), 2))
+	{
+		return false;
+	}
+
+	const FConvaihttpCapturedRequest& Small = Requests[0];
+	TestEqual(TEXT("Verb"), Small.Verb, FString(TEXT("POST")));
+	TestEqual(TEXT("Query string stripped"), Small.Url, FString(TEXT("https://capture.invalid/small")));
+	TestTrue(TEXT("Arrival time"), Small.ArrivalSeconds >= 0.0);
+	TestTrue(TEXT("Duration"), Small.DurationSeconds >= 0.0);
+	TestEqual(TEXT("First byte time unknown"), Small.FirstByteSeconds, -1.0);
+	TestTrue(TEXT("Authorization redacted"), Small.RequestHeaders.Contains(TEXT("Authorization: <redacted>")));
+	TestTrue(TEXT("Other request headers kept"), Small.RequestHeaders.Contains(TEXT("Accept: text/plain")));
+	TestEqual(TEXT("Request size"), Small.RequestSize, uint64(SmallRequestBody.Num()));
+	TestTrue(TEXT("Request body"), Small.RequestBody == TArray<uint8>(SmallRequestBody.GetData(), static_cast<int32>(SmallRequestBody.Num())));
+	TestTrue(TEXT("Status"), Small.Status == EConvaihttpRequestStatus::Succeeded);
+	TestEqual(TEXT("Response code"), Small.ResponseCode, int32(EConvaihttpResponseCodes::Ok));
+	TestTrue(TEXT("Set-Cookie redacted"), Small.ResponseHeaders.Contains(TEXT("Set-Cookie: <redacted>")));
+	TestTrue(TEXT("Other response headers kept"), Small.ResponseHeaders.Contains(TEXT("Content-Type: text/plain")));
+	TestEqual(TEXT("Response size"), Small.ResponseSize, uint64(SmallResponseBody.Num()));
+	TestTrue(TEXT("Response body"), Small.ResponseBody == TArray<uint8>(SmallResponseBody.GetData(), static_cast<int32>(SmallResponseBody.Num())));
+	for (const FString& Header : Small.RequestHeaders)
+	{
+		TestFalse(FString::Printf(TEXT("No credentials in %s"), *Header), Header.Contains(TEXT("secret")));
+	}
+	for (const FString& Header : Small.ResponseHeaders)
+	{
+		TestFalse(FString::Printf(TEXT("No credentials in %s"), *Header), Header.Contains(TEXT("secret")));
+	}
+
+	const FConvaihttpCapturedRequest& Large = Requests[1];
+	TestEqual(TEXT("Query string stripped"), Large.Url, FString(TEXT("https://capture.invalid/large")));
+	TestEqual(TEXT("Size of the request body over the limit"), Large.RequestSize, uint64(LargeBody.Num()));
+	TestEqual(TEXT("Request body over the limit not recorded"), Large.RequestBody.Num(), 0);
+	TestEqual(TEXT("Size of the response body over the limit"), Large.ResponseSize, uint64(LargeBody.Num()));
+	TestEqual(TEXT("Response body over the limit not recorded"), Large.ResponseBody.Num(), 0);
+
+	// A capture cut in the middle of its last record, as when the process dies while capturing, keeps the records before it
+	TArray<uint8> FileData;
+	if (TestTrue(TEXT("Capture read"), FFileHelper::LoadFileToArray(FileData, *Filename)))
+	{
+		FileData.SetNum(FileData.Num() - 8);
+		TestTrue(TEXT("Truncated capture written"), FFileHelper::SaveArrayToFile(FileData, *TruncatedFilename));
+
+		TArray<FConvaihttpCapturedRequest> TruncatedRequests;
+		// The file reader complains about reading past the end before Load notices
+		AddExpectedError(TEXT("bytes remain"), EAutomationExpectedErrorFlags::Contains, 0);
+		AddExpectedError(TEXT("is truncated after"), EAutomationExpectedErrorFlags::Contains, 1);
+		TestTrue(TEXT("Truncated capture loaded"), FConvaihttpTrafficCapture::Load(TruncatedFilename, TruncatedRequests));
+		TestEqual(TEXT("Complete records of the truncated capture"), TruncatedRequests.Num(), AllRequests.Num() - 1);
+		for (int32 Index = 0; Index < TruncatedRequests.Num() && Index < AllRequests.Num(); ++Index)
+		{
+			TestEqual(TEXT("Record of the truncated capture"), TruncatedRequests[Index].Url, AllRequests[Index].Url);
+		}
+	}
+
+	// Without bodies and with query strings
+	if (TestTrue(TEXT("Capture started"), FConvaihttpTrafficCapture::Start(Filename, false, MaxBodySize, false)))
+	{
+		Record(TEXT("https://capture.invalid/small?token=query"), SmallRequestBody, SmallResponseBody);
+		FConvaihttpTrafficCapture::Stop();
+
+		AllRequests.Reset();
+		TestTrue(TEXT("Capture loaded"), FConvaihttpTrafficCapture::Load(Filename, AllRequests));
+		const TArray<FConvaihttpCapturedRequest> Unstripped = FilterRecorded(AllRequests);
+		if (TestEqual(TEXT("Requests recorded"), Unstripped.Num(), 1))
+		{
+			TestEqual(TEXT("Query string kept"), Unstripped[0].Url, FString(TEXT("https://capture.invalid/small?token=query")));
+			TestEqual(TEXT("Request size without bodies"), Unstripped[0].RequestSize, uint64(SmallRequestBody.Num()));
+			TestEqual(TEXT("Request body not recorded"), Unstripped[0].RequestBody.Num(), 0);
+			TestEqual(TEXT("Response body not recorded"), Unstripped[0].ResponseBody.Num(), 0);
+		}
+	}
+
+	IFileManager::Get().Delete(*Filename);
+	IFileManager::Get().Delete(*TruncatedFilename);
+	return true;
 }
 
+#endif
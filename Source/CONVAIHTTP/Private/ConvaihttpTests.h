@@ -4,42 +4,558 @@
 
 #include "CoreMinimal.h"
 #include "Interfaces/IConvaihttpRequest.h"
+#include "Interfaces/IConvaihttpWebSocket.h"
+#include "ConvaihttpTrafficCapture.h"
+#include "Containers/Ticker.h"
+#include "HAL/CriticalSection.h"
+#include "HAL/Runnable.h"
+#include <atomic>
+
+class FConvaihttpSegmentedDownload;
+class FConvaihttpServerSentEvents;
+struct FConvaihttpServerSentEvent;
+class FRunnableThread;
+class FSocket;
+
+#if WITH_CURL
+#if WITH_CONVAIHTTP_NGHTTP2
+struct nghttp2_session;
+#endif
+
+/**
+ * Minimal HTTP/1.1 server on the loopback interface, a stand-in for a real server in load tests, so they run offline
+ * and measure the client rather than the network. With nghttp2 it can speak HTTP/2 over cleartext instead, to clients
+ * that know it does (h2c with prior knowledge, see FCurlConvaihttpManager::SetHttp2PriorKnowledge).
+ * Serves any request with keep-alive, answering with as many bytes as the "size" query parameter asks for (e.g.
+ * /?size=1024) after reading the request body, the byte at offset N being 'a' + N % 26 so tests can check what they
+ * reassemble. Honors single byte ranges of that body, unless the query has "norange", so it can serve segmented
+ * downloads, and can cap the bandwidth of each connection like a throttling server. Over HTTP/1.1 it also echoes the
+ * body of requests to /echo, and the messages of WebSockets opened on any path, and drops the connection at the offset
+ * the "failat" query parameter gives, the first time a response to that target reaches it. Runs on its own thread,
+ * polling non-blocking sockets.
+ */
+class FConvaihttpLoopbackServer : public FRunnable
+{
+public:
+	/** Protocol the server speaks */
+	enum class EProtocol : uint8
+	{
+		Http1,
+		/** HTTP/2 over cleartext, without upgrade. Needs nghttp2 */
+		Http2,
+	};
+
+	FConvaihttpLoopbackServer() = default;
+	virtual ~FConvaihttpLoopbackServer();
+
+	/**
+	 * Listen on an ephemeral port of the loopback interface and start serving
+	 *
+	 * @param InMaxBytesPerSecond - most bytes each connection sends per second, 0 for no limit
+	 * @param InProtocol - protocol to speak
+	 * @return true if the server is listening
+	 */
+	bool Start(int64 InMaxBytesPerSecond = 0, EProtocol InProtocol = EProtocol::Http1);
+
+	/** Stop serving and close all the connections. Blocks until the thread has exited */
+	void Shutdown();
+
+	/** @return url of the root of the server */
+	FString GetUrl() const;
+
+	/** @return number of requests answered */
+	uint64 GetNumRequestsServed() const { return NumRequestsServed.load(std::memory_order_relaxed); }
+
+	/** @return values of the Range headers received, in the order the requests were answered */
+	TArray<FString> GetRangesRequested() const;
+
+	//~ Begin FRunnable Interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable Interface
+
+private:
+	/** Response to a request, its body being as many bytes of ResponseFill */
+	struct FResponse
+	{
+		int32 StatusCode = 200;
+		/** Size of the body sent */
+		int64 BodySize = 0;
+		/** Offset of the body in the resource */
+		int64 BodyOffset = 0;
+		/** Size of the whole resource, of which the body may be a range */
+		int64 ResourceSize = 0;
+		/** Value of the Content-Range header, empty if none */
+		FString ContentRange;
+	};
+
+#if WITH_CONVAIHTTP_NGHTTP2
+	/** Request received on an HTTP/2 stream, and the part of its response still to send */
+	struct FStream
+	{
+		FString Method;
+		FString Path;
+		FString Range;
+		int64 BodyRemaining = 0;
+		/** Offset in the resource of the next byte of the body to send */
+		int64 BodyOffset = 0;
+	};
+
+	/** Callbacks of the HTTP/2 sessions, defined with nghttp2 */
+	struct FHttp2;
+#endif
+
+	/** Connection of a client */
+	struct FConnection
+	{
+		~FConnection();
+
+		FSocket* Socket = nullptr;
+		/** Bytes received and not yet handled */
+		TArray<uint8> Received;
+		/** Header of the response being sent, or HTTP/2 frames, sent from SendOffset */
+		TArray<uint8> ToSend;
+		int32 SendOffset = 0;
+		/** Bytes of the body of the response being sent still to send, sent from ResponseFill after the header */
+		int64 BodyRemaining = 0;
+		/** Offset in the resource of the next byte of the body to send */
+		int64 BodyOffset = 0;
+		/** Close once the response is sent */
+		bool bCloseAfterSend = false;
+		/** Set once the connection was upgraded to a WebSocket, whose frames are then echoed */
+		bool bWebSocket = false;
+		/** Bytes the connection may send before being throttled, when the bandwidth is capped */
+		double SendAllowance = 0.0;
+		/** When SendAllowance was last topped up */
+		double LastAllowanceTime = 0.0;
+#if WITH_CONVAIHTTP_NGHTTP2
+		/** Server the connection belongs to, for the callbacks of the session */
+		FConvaihttpLoopbackServer* Server = nullptr;
+		/** Session when speaking HTTP/2 */
+		nghttp2_session* Session = nullptr;
+		/** Open streams by id */
+		TMap<int32, FStream> Streams;
+#endif
+
+		/** @return true while part of a response is still to be sent */
+		bool IsSending() const { return SendOffset < ToSend.Num() || BodyRemaining > 0; }
+	};
+
+	/**
+	 * Receive, answer and send on a connection
+	 *
+	 * @param Connection - connection to serve
+	 * @param bOutDidWork - set if anything was received or sent
+	 * @return false once the connection is closed
+	 */
+	bool ServeConnection(FConnection& Connection, bool& bOutDidWork);
+
+	/** Answer the next complete request received on a connection, once the previous response is sent */
+	void HandleRequest(FConnection& Connection);
+
+	/** Echo the complete WebSocket frames received on an upgraded connection, answering pings and the close frame */
+	void EchoWebSocketFrames(FConnection& Connection);
+
+	/**
+	 * Work out the response to a request
+	 *
+	 * @param Target - path and query of the request, the size of the resource being in the "size" parameter
+	 * @param Range - value of the Range header of the request, empty if none
+	 */
+	static FResponse MakeResponse(const FString& Target, FString Range);
+
+	/** Log the Range header of a request, if it has one */
+	void RecordRange(const FString& Range);
+
+	/** Close and destroy a socket */
+	void DestroySocket(FSocket* Socket);
+
+	FSocket* ListenSocket = nullptr;
+	FRunnableThread* Thread = nullptr;
+	/** Connections, at stable addresses the HTTP/2 sessions refer to */
+	TArray<TUniquePtr<FConnection>> Connections;
+	int32 Port = 0;
+	/** Most bytes each connection sends per second, 0 for no limit */
+	int64 MaxBytesPerSecond = 0;
+	EProtocol Protocol = EProtocol::Http1;
+	std::atomic<bool> bStopping{ false };
+	std::atomic<uint64> NumRequestsServed{ 0 };
+	/** Bytes the bodies of the responses are copied from, the alphabet over and over */
+	TArray<uint8> ResponseFill;
+	/** Targets whose response was already dropped at their "failat" offset */
+	TSet<FString> FailedTargets;
+	/** Values of the Range headers received */
+	TArray<FString> RangesRequested;
+	mutable FCriticalSection RangesRequestedCriticalSection;
+};
+#endif
+
+/**
+ * Load test of the request pipeline. Keeps up to Concurrency requests in flight, optionally paced to a request rate,
+ * for a duration or a number of requests, against a url or a FConvaihttpLoopbackServer started for the test, over
+ * HTTP/1.1 or h2c. With the simulated transport enabled (CONVAIHTTP SIMULATE ON) the requests are served in process instead.
+ * Reports throughput, latency percentiles, and the CPU time each request cost on the CONVAIHTTP and game threads.
+ * Keeps itself alive until the results are logged.
+ */
+class FConvaihttpLoadTest : public TSharedFromThis<FConvaihttpLoadTest>
+{
+public:
+	/** Parameters of a load test */
+	struct FSettings
+	{
+		/** Url to send the requests to, empty to start a loopback server, or to use the simulated transport when enabled */
+		FString Url;
+		/** Most requests in flight at once */
+		int32 Concurrency = 16;
+		/** Requests started per second, 0 to start one as soon as another completes */
+		double RequestsPerSecond = 0.0;
+		/** How long requests are started for */
+		double DurationSeconds = 10.0;
+		/** Most requests to start, 0 for no limit */
+		int32 MaxRequests = 0;
+		/** Size of the body of each request, sent as a POST when not 0 */
+		int32 RequestSize = 0;
+		/** Size of the body of each response, asked from the loopback server or the simulated transport */
+		int32 ResponseSize = 1024;
+		/** Speak HTTP/2 over cleartext with prior knowledge (h2c) to the url or the loopback server. Needs nghttp2 */
+		bool bHttp2 = false;
+	};
+
+	/** Results of a load test */
+	struct FResults
+	{
+		int32 NumStarted = 0;
+		int32 NumSucceeded = 0;
+		int32 NumFailed = 0;
+		double RequestsPerSecond = 0.0;
+		/** Latencies of the successful requests, in milliseconds */
+		double P50LatencyMs = 0.0;
+		double P95LatencyMs = 0.0;
+		double P99LatencyMs = 0.0;
+		double MaxLatencyMs = 0.0;
+		/** CPU time per completed request, in microseconds */
+		double ThreadCpuPerRequestUs = 0.0;
+		double GameThreadCpuPerRequestUs = 0.0;
+	};
+
+	explicit FConvaihttpLoadTest(const FSettings& InSettings);
+	~FConvaihttpLoadTest();
+
+	/**
+	 * Start the load test. Results are logged once the last request completes
+	 *
+	 * @return false if the test couldn't start
+	 */
+	bool Run();
+
+	/** @return true once the last request completed and the results are known */
+	bool IsComplete() const { return bComplete; }
+
+	/** @return results of the test, once complete */
+	const FResults& GetResults() const { return Results; }
+
+private:
+	bool Tick(float DeltaTime);
+	void StartRequests();
+	void StartRequest();
+	void OnRequestComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded, double StartTime);
+	void Report();
+
+	FSettings Settings;
+	FString RequestUrl;
+	TArray64<uint8> RequestBody;
+#if WITH_CURL
+	TUniquePtr<FConvaihttpLoopbackServer> Server;
+#endif
+	/** "host:port" spoken to with HTTP/2 prior knowledge for the test, empty if none */
+	FString Http2Host;
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	double StartTime = 0.0;
+	double EndTime = 0.0;
+	int32 NumInFlight = 0;
+	int32 NumStarted = 0;
+	int32 NumSucceeded = 0;
+	int32 NumFailed = 0;
+	uint64 NumBytesReceived = 0;
+	/** Time from ProcessRequest to the completion delegate of each successful request */
+	TArray<double> Latencies;
+	/** Time spent on the game thread starting requests and handling their completion */
+	uint64 GameThreadCycles = 0;
+	double StartThreadBusySeconds = 0.0;
+	FResults Results;
+	bool bComplete = false;
+
+	/** Keeps the test alive while it runs */
+	TSharedPtr<FConvaihttpLoadTest> SelfReference;
+};
+
+/**
+ * Replays a capture of FConvaihttpTrafficCapture: issues the same requests with their original inter-arrival times,
+ * optionally sped up, against a local stand-in for the servers. The stand-in is a url given for the replay, the
+ * simulated transport when enabled (which also reproduces the response codes, server latencies and failures of the
+ * capture), or else a FConvaihttpLoopbackServer. Reports how far behind schedule requests started, and the latencies
+ * of the replay next to the captured ones. Keeps itself alive until the results are logged.
+ */
+class FConvaihttpTrafficReplay : public TSharedFromThis<FConvaihttpTrafficReplay>
+{
+public:
+	/** Parameters of a replay */
+	struct FSettings
+	{
+		/** Capture to replay */
+		FString Filename;
+		/** Scheme, host and port to send the requests to, keeping their path and query. Empty for a local stand-in */
+		FString Url;
+		/** Factor the arrival times are divided by */
+		double Speed = 1.0;
+	};
+
+	explicit FConvaihttpTrafficReplay(const FSettings& InSettings);
+	~FConvaihttpTrafficReplay();
+
+	/**
+	 * Load the capture and start the replay. Results are logged once the last request completes
+	 *
+	 * @return false if the capture couldn't be loaded or the stand-in couldn't start
+	 */
+	bool Run();
+
+private:
+	/** Request of the capture and how its replay went */
+	struct FReplayedRequest
+	{
+		FConvaihttpCapturedRequest Captured;
+		/** Url the request is replayed at */
+		FString Url;
+		/** How long after its scheduled time the request started */
+		double StartLagSeconds = 0.0;
+		/** Time from ProcessRequest to the completion delegate, negative until completed */
+		double LatencySeconds = -1.0;
+		bool bSucceeded = false;
+	};
+
+	bool Tick(float DeltaTime);
+	void StartRequest(int32 Index, double Now);
+	void OnRequestComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded, int32 Index, double StartTime);
+	void Report();
+
+	/** @return url to replay a captured request at */
+	FString GetReplayUrl(const FConvaihttpCapturedRequest& Captured) const;
+
+	FSettings Settings;
+	/** Patterns of the headers the capture redacted, not sent again */
+	TArray<FString> RedactedHeaders;
+	/** Requests of the capture, by arrival */
+	TArray<FReplayedRequest> Requests;
+	/** Root of the stand-in server, when replaying against one */
+	FString StandInUrl;
+	bool bSimulated = false;
+#if WITH_CURL
+	TUniquePtr<FConvaihttpLoopbackServer> Server;
+#endif
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	double StartTime = 0.0;
+	int32 NextRequest = 0;
+	int32 NumInFlight = 0;
+
+	/** Keeps the replay alive while it runs */
+	TSharedPtr<FConvaihttpTrafficReplay> SelfReference;
+};
+
+/**
+ * Measures the throughput of Server-Sent Events end to end.
+ * The stream is served by the simulated transport in chunks of ChunkSize, every Interval if set, and goes through the
+ * CONVAIHTTP thread, the parser and the delivery of events on the game thread the same way a real stream does.
+ * The simulated transport is turned on for the duration of the benchmark.
+ */
+class FConvaihttpServerSentEventsBenchmark : public TSharedFromThis<FConvaihttpServerSentEventsBenchmark>
+{
+public:
+	/** Parameters of the benchmark */
+	struct FSettings
+	{
+		/** Number of events in the stream */
+		int32 NumEvents = 100000;
+		/** Size of the data of each event, split over lines of at most 128 bytes */
+		int32 EventDataSize = 256;
+		/** Size of each receive */
+		int32 ChunkSize = 16 * 1024;
+		/** Time between receives in milliseconds, 0 to stream as fast as possible */
+		double IntervalMs = 0.0;
+	};
+
+	explicit FConvaihttpServerSentEventsBenchmark(const FSettings& InSettings);
+
+	/**
+	 * Start the benchmark. Results are logged once the stream is over
+	 *
+	 * @return false if the benchmark couldn't start
+	 */
+	bool Run();
+
+private:
+	void OnEvent(const FConvaihttpServerSentEvent& Event);
+	void OnClosed(FConvaihttpResponsePtr Response, bool bSucceeded);
+
+	FSettings Settings;
+	TSharedPtr<FConvaihttpServerSentEvents, ESPMode::ThreadSafe> EventStream;
+	/** Whether the simulated transport was on before the benchmark */
+	bool bWasSimulated = false;
+
+	double StartTime = 0.0;
+	int64 StreamSize = 0;
+	int64 NumEventsReceived = 0;
+	int64 NumDataBytesReceived = 0;
+
+	/** Keeps the benchmark alive while it runs */
+	TSharedPtr<FConvaihttpServerSentEventsBenchmark> SelfReference;
+};
+
+/**
+ * Measures the throughput of the length-prefixed frame decoder.
+ * A stand-in for the server generates a gRPC-web style stream of messages of mixed sizes, mostly small with a few
+ * large ones, ending with a trailers frame. It is fed to the decoder in receive-sized chunks the same way the curl
+ * body callback does.
+ */
+class FConvaihttpFrameDecoderBenchmark
+{
+public:
+	/**
+	 * Run the benchmark and report the results
+	 *
+	 * @param NumMessages - number of messages in the stream
+	 * @param ChunkSize - size of each simulated receive
+	 * @param Ar - device the results are written to
+	 */
+	static void Run(int32 NumMessages, int32 ChunkSize, FOutputDevice& Ar);
+};
 
 /**
- * Test an Convaihttp request to a specified endpoint Url
+ * Measures the cost of updating the retry system with many requests in flight.
+ * Runs updates with every request being processed, then with nearly all of them in lockout, where an update only looks
+ * at the requests being processed, and on the same requests with the linear scan of the lockouts the heap replaced.
+ * The requests are never sent, so the benchmark doesn't need a server.
  */
-class FConvaihttpTest
+class FConvaihttpRetrySystemBenchmark
 {
 public:
+	/**
+	 * Run the benchmark and report the results
+	 *
+	 * @param NumEntries - number of requests managed by the retry system
+	 * @param NumUpdates - number of updates timed in each configuration
+	 * @param Ar - device the results are written to
+	 */
+	static void Run(int32 NumEntries, int32 NumUpdates, FOutputDevice& Ar);
+};
 
+/**
+ * Compares the round-trip latency of messages on a WebSocket against equivalent POSTs.
+ * Sends the same payload one message at a time to a WebSocket echo endpoint, then as sequential POSTs to an HTTP
+ * endpoint echoing the body, and logs the round-trip times of both. The first round trip of each is a warm-up
+ * that isn't counted. Without urls both endpoints are served by a FConvaihttpLoopbackServer, so it runs offline.
+ * Keeps itself alive until the results are logged.
+ */
+class FConvaihttpWebSocketBenchmark : public TSharedFromThis<FConvaihttpWebSocketBenchmark>
+{
+public:
 	/**
 	 * Constructor
 	 *
-	 * @param Verb - verb to use for request (GET,POST,DELETE,etc)
-	 * @param Payload - optional payload string
-	 * @param Url - url address to connect to
-	 * @param InIterations - total test iterations to run
+	 * @param InWebSocketUrl - ws:// or wss:// url of an endpoint echoing messages, empty to use a loopback server
+	 * @param InPostUrl - url of an endpoint answering POSTs with their body, empty to use a loopback server
+	 * @param InNumRoundTrips - number of round trips measured over each
+	 * @param InMessageSize - size of the payload
 	 */
-	FConvaihttpTest(const FString& InVerb, const FString& InPayload, const FString& InUrl, int32 InIterations);
+	FConvaihttpWebSocketBenchmark(const FString& InWebSocketUrl, const FString& InPostUrl, int32 InNumRoundTrips, int32 InMessageSize);
 
 	/**
-	 * Kick off the Convaihttp request for the test and wait for delegate to be called
+	 * Start the benchmark. Results are logged once both runs are over
 	 */
-	void Run(void);
+	void Run();
+
+private:
+	void OnWebSocketConnected();
+	void OnWebSocketConnectionError(const FString& Error);
+	void OnWebSocketClosed(int32 StatusCode, const FString& Reason, bool bWasClean);
+	void OnWebSocketMessage(const FSharedBuffer& Data);
+	void SendWebSocketMessage();
+	void FinishWebSocketRun();
+	void SendPost();
+	void OnPostComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded);
+	void Report();
+
+	FString WebSocketUrl;
+	FString PostUrl;
+	int32 NumRoundTrips;
+	FSharedBuffer Message;
+#if WITH_CURL
+	TUniquePtr<FConvaihttpLoopbackServer> Server;
+#endif
+
+	TSharedPtr<IConvaihttpWebSocket, ESPMode::ThreadSafe> WebSocket;
+	bool bWebSocketRunOver = false;
+	int32 NumWebSocketMessagesReceived = 0;
+	int32 NumPostsCompleted = 0;
+	double SendTime = 0.0;
+	TArray<double> WebSocketRoundTrips;
+	TArray<double> PostRoundTrips;
+
+	/** Keeps the benchmark alive while it runs */
+	TSharedPtr<FConvaihttpWebSocketBenchmark> SelfReference;
+};
+
+/**
+ * Compares downloading a large resource over a single GET against a segmented download of it.
+ * Run against a server throttling each connection, where the segmented download should get a multiple of the single
+ * stream throughput: by default a FConvaihttpLoopbackServer with a per connection bandwidth cap, so the results are
+ * reproducible offline. Keeps itself alive until the results are logged.
+ */
+class FConvaihttpSegmentedDownloadBenchmark : public TSharedFromThis<FConvaihttpSegmentedDownloadBenchmark>
+{
+public:
+	/** Parameters of the benchmark */
+	struct FSettings
+	{
+		/** Url of the resource, served with range support. Empty to serve it from a throttled loopback server */
+		FString Url;
+		/** Most segments in flight in the segmented download */
+		int32 MaxSegments = 8;
+		/** Size of each segment */
+		uint64 SegmentSize = 4 * 1024 * 1024;
+		/** Size of the resource served by the loopback server */
+		uint64 ResourceSize = 32 * 1024 * 1024;
+		/** Bandwidth cap of each connection to the loopback server, in bytes per second */
+		int64 BytesPerSecond = 4 * 1024 * 1024;
+	};
+
+	explicit FConvaihttpSegmentedDownloadBenchmark(const FSettings& InSettings);
 
 	/**
-	 * Delegate called when the request completes
+	 * Start the benchmark. Results are logged once both downloads are over
 	 *
-	 * @param ConvaihttpRequest - object that started/processed the request
-	 * @param ConvaihttpResponse - optional response object if request completed
-	 * @param bSucceeded - true if Url connection was made and response was received
+	 * @return false if the benchmark couldn't start
 	 */
-	void RequestComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded);
+	bool Run();
 
 private:
-	FString Verb;
-	FString Payload;
+	void OnSingleStreamComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bSucceeded);
+	void OnSegmentedComplete(bool bSucceeded);
+
+	FSettings Settings;
+	/** Url of the resource downloaded */
 	FString Url;
-	int32 TestsToRun;
-};
+#if WITH_CURL
+	TUniquePtr<FConvaihttpLoopbackServer> Server;
+#endif
+
+	double StartTime = 0.0;
+	double SingleStreamTime = 0.0;
+	uint64 SingleStreamSize = 0;
+	TSharedPtr<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe> SegmentedDownload;
 
+	/** Keeps the benchmark alive while it runs */
+	TSharedPtr<FConvaihttpSegmentedDownloadBenchmark> SelfReference;
+};
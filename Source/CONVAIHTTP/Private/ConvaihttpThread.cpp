@@ -10,7 +10,12 @@
 #include "Misc/Fork.h"
 #include "Misc/Parse.h"
 #include "ConvaihttpModule.h"
+#include "ConvaihttpManager.h"
+#include "ConvaihttpMetrics.h"
+#include "ConvaihttpTrace.h"
 #include "Convaihttp.h"
+#include "Misc/OutputDevice.h"
+#include "Misc/ScopeLock.h"
 #include "Stats/Stats.h"
 
 DECLARE_STATS_GROUP(TEXT("CONVAIHTTP Thread"), STATGROUP_CONVAIHTTPThread, STATCAT_Advanced);
@@ -20,6 +25,46 @@ DECLARE_CYCLE_STAT(TEXT("StartThreadedRequest"), STAT_CONVAIHTTPThread_StartThre
 DECLARE_CYCLE_STAT(TEXT("ConvaihttpThreadTick"), STAT_CONVAIHTTPThread_ConvaihttpThreadTick, STATGROUP_CONVAIHTTPThread);
 DECLARE_CYCLE_STAT(TEXT("IsThreadedRequestComplete"), STAT_CONVAIHTTPThread_IsThreadedRequestComplete, STATGROUP_CONVAIHTTPThread);
 DECLARE_CYCLE_STAT(TEXT("CompleteThreadedRequest"), STAT_CONVAIHTTPThread_CompleteThreadedRequest, STATGROUP_CONVAIHTTPThread);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("New requests"), STAT_CONVAIHTTPThread_NewRequests, STATGROUP_CONVAIHTTPThread);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Cancelled requests"), STAT_CONVAIHTTPThread_CancelledRequests, STATGROUP_CONVAIHTTPThread);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Rate limited requests"), STAT_CONVAIHTTPThread_RateLimitedRequests, STATGROUP_CONVAIHTTPThread);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Running requests"), STAT_CONVAIHTTPThread_RunningRequests, STATGROUP_CONVAIHTTPThread);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Completed requests"), STAT_CONVAIHTTPThread_CompletedRequests, STATGROUP_CONVAIHTTPThread);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Iterations per second"), STAT_CONVAIHTTPThread_IterationsPerSecond, STATGROUP_CONVAIHTTPThread);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Busy ratio"), STAT_CONVAIHTTPThread_BusyRatio, STATGROUP_CONVAIHTTPThread);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Max iteration ms"), STAT_CONVAIHTTPThread_MaxIterationMs, STATGROUP_CONVAIHTTPThread);
+
+namespace ConvaihttpThread
+{
+	/** Time spent in callbacks of requests on this thread, read around each tick of the CONVAIHTTP thread */
+	static thread_local uint64 CallbackCycles = 0;
+}
+
+void FConvaihttpThreadLoopStats::Accumulate(const FConvaihttpThreadLoopStats& Other)
+{
+	WindowSeconds += Other.WindowSeconds;
+	NumIterations += Other.NumIterations;
+	SchedulingSeconds += Other.SchedulingSeconds;
+	TransferSeconds += Other.TransferSeconds;
+	CallbackSeconds += Other.CallbackSeconds;
+	SleepSeconds += Other.SleepSeconds;
+	MaxIterationSeconds = FMath::Max(MaxIterationSeconds, Other.MaxIterationSeconds);
+	MaxNewRequests = FMath::Max(MaxNewRequests, Other.MaxNewRequests);
+	MaxCancelledRequests = FMath::Max(MaxCancelledRequests, Other.MaxCancelledRequests);
+	MaxRateLimitedRequests = FMath::Max(MaxRateLimitedRequests, Other.MaxRateLimitedRequests);
+	MaxRunningRequests = FMath::Max(MaxRunningRequests, Other.MaxRunningRequests);
+	MaxCompletedRequests = FMath::Max(MaxCompletedRequests, Other.MaxCompletedRequests);
+}
+
+FConvaihttpThread::FCallbackScope::FCallbackScope()
+	: StartCycles(FPlatformTime::Cycles64())
+{
+}
+
+FConvaihttpThread::FCallbackScope::~FCallbackScope()
+{
+	ConvaihttpThread::CallbackCycles += FPlatformTime::Cycles64() - StartCycles;
+}
 
 // FConvaihttpThread
 
@@ -81,20 +126,29 @@ void FConvaihttpThread::StopThread()
 
 void FConvaihttpThread::AddRequest(IConvaihttpThreadedRequest* Request)
 {
+	Request->SetThrottleHostKey(FConvaihttpManager::GetHostThrottleKey(Request->GetURL()));
+	NumNewThreadedRequests.fetch_add(1, std::memory_order_relaxed);
 	NewThreadedRequests.Enqueue(Request);
 }
 
 void FConvaihttpThread::CancelRequest(IConvaihttpThreadedRequest* Request)
 {
+	NumCancelledThreadedRequests.fetch_add(1, std::memory_order_relaxed);
 	CancelledThreadedRequests.Enqueue(Request);
 }
 
+void FConvaihttpThread::ThrottleHost(const FString& HostKey, double EndTimeAbsoluteSeconds)
+{
+	NewHostThrottles.Enqueue(TPair<FString, double>(HostKey, EndTimeAbsoluteSeconds));
+}
+
 void FConvaihttpThread::GetCompletedRequests(TArray64<IConvaihttpThreadedRequest*>& OutCompletedRequests)
 {
 	check(IsInGameThread());
 	IConvaihttpThreadedRequest* Request = nullptr;
 	while (CompletedThreadedRequests.Dequeue(Request))
 	{
+		NumCompletedThreadedRequests.fetch_sub(1, std::memory_order_relaxed);
 		OutCompletedRequests.Add(Request);
 	}
 }
@@ -102,6 +156,7 @@ void FConvaihttpThread::GetCompletedRequests(TArray64<IConvaihttpThreadedRequest
 bool FConvaihttpThread::Init()
 {
 	LastTime = FPlatformTime::Seconds();
+	CurrentLoopStatsStartTime = LastTime;
 	ExitRequest.Set(false);
 
 	UpdateConfigs();
@@ -138,6 +193,7 @@ uint32 FConvaihttpThread::Run()
 					double InnerLoopTime = InnerLoopEnd - InnerLoopBegin;
 					double InnerSleep = FMath::Max(ConvaihttpThreadActiveFrameTimeInSeconds - InnerLoopTime, ConvaihttpThreadActiveMinimumSleepTimeInSeconds);
 					FPlatformProcess::SleepNoStats(InnerSleep);
+					RecordSleep(FPlatformTime::Seconds() - InnerLoopEnd);
 				}
 				else
 				{
@@ -147,6 +203,7 @@ uint32 FConvaihttpThread::Run()
 			double OuterLoopTime = OuterLoopEnd - OuterLoopBegin;
 			double OuterSleep = FMath::Max(ConvaihttpThreadIdleFrameTimeInSeconds - OuterLoopTime, ConvaihttpThreadIdleMinimumSleepTimeInSeconds);
 			FPlatformProcess::SleepNoStats(OuterSleep);
+			RecordSleep(FPlatformTime::Seconds() - OuterLoopEnd);
 		}
 		else
 		{
@@ -180,6 +237,8 @@ void FConvaihttpThread::UpdateConfigs()
 		UE_LOG(LogConvaihttp, Warning, TEXT("RunningThreadedRequestLimit must be configured as a number greater than 0. Current value is %d."), RunningThreadedRequestLimit);
 		RunningThreadedRequestLimit = INT_MAX;
 	}
+	GConfig->GetDouble(TEXT("CONVAIHTTP.ConvaihttpThread"), TEXT("LoopStatsWindowSeconds"), LoopStatsWindowSeconds, GEngineIni);
+	LoopStatsWindowSeconds = FMath::Max(LoopStatsWindowSeconds, 1.0);
 }
 
 void FConvaihttpThread::ConvaihttpThreadTick(float DeltaSeconds)
@@ -200,6 +259,24 @@ void FConvaihttpThread::CompleteThreadedRequest(IConvaihttpThreadedRequest* Requ
 void FConvaihttpThread::Process(TArray64<IConvaihttpThreadedRequest*>& RequestsToCancel, TArray64<IConvaihttpThreadedRequest*>& RequestsToComplete)
 {
 	SCOPE_CYCLE_COUNTER(STAT_CONVAIHTTPThread_Process);
+	const uint64 ProcessStartCycles = FPlatformTime::Cycles64();
+
+	// Queue lengths as the iteration finds them
+	{
+		const int32 NumNew = NumNewThreadedRequests.load(std::memory_order_relaxed);
+		const int32 NumCancelled = NumCancelledThreadedRequests.load(std::memory_order_relaxed);
+		const int32 NumCompleted = NumCompletedThreadedRequests.load(std::memory_order_relaxed);
+		CurrentLoopStats.MaxNewRequests = FMath::Max(CurrentLoopStats.MaxNewRequests, NumNew);
+		CurrentLoopStats.MaxCancelledRequests = FMath::Max(CurrentLoopStats.MaxCancelledRequests, NumCancelled);
+		CurrentLoopStats.MaxRateLimitedRequests = FMath::Max(CurrentLoopStats.MaxRateLimitedRequests, static_cast<int32>(RateLimitedThreadedRequests.Num()));
+		CurrentLoopStats.MaxRunningRequests = FMath::Max(CurrentLoopStats.MaxRunningRequests, static_cast<int32>(RunningThreadedRequests.Num()));
+		CurrentLoopStats.MaxCompletedRequests = FMath::Max(CurrentLoopStats.MaxCompletedRequests, NumCompleted);
+		SET_DWORD_STAT(STAT_CONVAIHTTPThread_NewRequests, NumNew);
+		SET_DWORD_STAT(STAT_CONVAIHTTPThread_CancelledRequests, NumCancelled);
+		SET_DWORD_STAT(STAT_CONVAIHTTPThread_RateLimitedRequests, RateLimitedThreadedRequests.Num());
+		SET_DWORD_STAT(STAT_CONVAIHTTPThread_RunningRequests, RunningThreadedRequests.Num());
+		SET_DWORD_STAT(STAT_CONVAIHTTPThread_CompletedRequests, NumCompleted);
+	}
 
 	// cache all cancelled and new requests
 	{
@@ -208,13 +285,22 @@ void FConvaihttpThread::Process(TArray64<IConvaihttpThreadedRequest*>& RequestsT
 		RequestsToCancel.Reset();
 		while (CancelledThreadedRequests.Dequeue(Request))
 		{
+			NumCancelledThreadedRequests.fetch_sub(1, std::memory_order_relaxed);
 			RequestsToCancel.Add(Request);
 		}
 
 		while (NewThreadedRequests.Dequeue(Request))
 		{
+			NumNewThreadedRequests.fetch_sub(1, std::memory_order_relaxed);
 			RateLimitedThreadedRequests.Add(Request);
 		}
+
+		TPair<FString, double> HostThrottle;
+		while (NewHostThrottles.Dequeue(HostThrottle))
+		{
+			double& EndTimeAbsoluteSeconds = ThrottledHosts.FindOrAdd(MoveTemp(HostThrottle.Key), 0.0);
+			EndTimeAbsoluteSeconds = FMath::Max(EndTimeAbsoluteSeconds, HostThrottle.Value);
+		}
 	}
 
 	// Cancel any pending cancel requests
@@ -250,20 +336,37 @@ void FConvaihttpThread::Process(TArray64<IConvaihttpThreadedRequest*>& RequestsT
 	// We'll start rate limited requests until we hit the limit
 	// Tick new requests separately from existing RunningThreadedRequests so they get a chance 
 	// to send unaffected by possibly large ElapsedTime above
+	// Requests to a host throttled by Retry-After stay queued, in order, until the end of the throttle.
+	// Throttles that are over are forgotten first, so hosts aren't looked up at all once none is throttled
+	for (TMap<FString, double>::TIterator It(ThrottledHosts); It; ++It)
+	{
+		if (It.Value() <= AppTime)
+		{
+			It.RemoveCurrent();
+		}
+	}
 	int32 RunningThreadedRequestsCounter = RunningThreadedRequests.Num();
 	if (RunningThreadedRequestsCounter < RunningThreadedRequestLimit)
 	{
-		while(RunningThreadedRequestsCounter < RunningThreadedRequestLimit && RateLimitedThreadedRequests.Num())
+		const bool bHasThrottledHosts = ThrottledHosts.Num() > 0;
+		int64 QueueIndex = 0;
+		while(RunningThreadedRequestsCounter < RunningThreadedRequestLimit && QueueIndex < RateLimitedThreadedRequests.Num())
 		{
 			SCOPE_CYCLE_COUNTER(STAT_CONVAIHTTPThread_StartThreadedRequest);
 
-			IConvaihttpThreadedRequest* ReadyThreadedRequest = RateLimitedThreadedRequests[0];
-			RateLimitedThreadedRequests.RemoveAt(0);
+			IConvaihttpThreadedRequest* ReadyThreadedRequest = RateLimitedThreadedRequests[QueueIndex];
+			if (bHasThrottledHosts && ThrottledHosts.Contains(ReadyThreadedRequest->GetThrottleHostKey()))
+			{
+				++QueueIndex;
+				continue;
+			}
+			RateLimitedThreadedRequests.RemoveAt(QueueIndex);
 
 			if (StartThreadedRequest(ReadyThreadedRequest))
 			{
 				RunningThreadedRequestsCounter++;
 				RunningThreadedRequests.Add(ReadyThreadedRequest);
+				CONVAIHTTP_TRACE_EVENT(ReadyThreadedRequest, Admitted);
 				ReadyThreadedRequest->TickThreadedRequest(0.0f);
 				UE_LOG(LogConvaihttp, Verbose, TEXT("Started running threaded request (%p). Running threaded requests (%d) Rate limited threaded requests (%d)"), ReadyThreadedRequest, RunningThreadedRequests.Num(), RateLimitedThreadedRequests.Num());
 			}
@@ -274,12 +377,20 @@ void FConvaihttpThread::Process(TArray64<IConvaihttpThreadedRequest*>& RequestsT
 		}
 	}
 
+	uint64 TickCycles = 0;
+	uint64 TickCallbackCycles = 0;
 	{
 		SCOPE_CYCLE_COUNTER(STAT_CONVAIHTTPThread_ConvaihttpThreadTick);
 
+		const uint64 TickStartCycles = FPlatformTime::Cycles64();
+		const uint64 CallbackCyclesBeforeTick = ConvaihttpThread::CallbackCycles;
+
 		// Every valid request in RunningThreadedRequests gets at least two calls to ConvaihttpThreadTick
 		// Blocking loads still can affect things if the network stack can't keep its connections alive
 		ConvaihttpThreadTick(ElapsedTime);
+
+		TickCycles = FPlatformTime::Cycles64() - TickStartCycles;
+		TickCallbackCycles = FMath::Min(ConvaihttpThread::CallbackCycles - CallbackCyclesBeforeTick, TickCycles);
 	}
 
 	// Move any completed requests
@@ -298,6 +409,8 @@ void FConvaihttpThread::Process(TArray64<IConvaihttpThreadedRequest*>& RequestsT
 		}
 	}
 
+	FConvaihttpMetrics::Get().SetQueueDepth(static_cast<int32>(RateLimitedThreadedRequests.Num()), static_cast<int32>(RunningThreadedRequests.Num()));
+
 	if (RequestsToComplete.Num() > 0)
 	{
 		for (IConvaihttpThreadedRequest* Request : RequestsToComplete)
@@ -305,10 +418,83 @@ void FConvaihttpThread::Process(TArray64<IConvaihttpThreadedRequest*>& RequestsT
 			SCOPE_CYCLE_COUNTER(STAT_CONVAIHTTPThread_CompleteThreadedRequest);
 
 			CompleteThreadedRequest(Request);
+			CONVAIHTTP_TRACE_EVENT(Request, Completed);
+			NumCompletedThreadedRequests.fetch_add(1, std::memory_order_relaxed);
 			CompletedThreadedRequests.Enqueue(Request);
 		}
 		RequestsToComplete.Reset();
 	}
+
+	RecordIteration(FPlatformTime::Cycles64() - ProcessStartCycles, TickCycles, TickCallbackCycles);
+}
+
+void FConvaihttpThread::RecordIteration(uint64 ProcessCycles, uint64 TickCycles, uint64 CallbackCycles)
+{
+	BusyCycles.fetch_add(ProcessCycles, std::memory_order_relaxed);
+
+	const double ProcessSeconds = FPlatformTime::ToSeconds64(ProcessCycles);
+	const double TickSeconds = FPlatformTime::ToSeconds64(TickCycles);
+	const double CallbackSeconds = FPlatformTime::ToSeconds64(CallbackCycles);
+
+	++CurrentLoopStats.NumIterations;
+	CurrentLoopStats.SchedulingSeconds += FMath::Max(ProcessSeconds - TickSeconds, 0.0);
+	CurrentLoopStats.TransferSeconds += TickSeconds - CallbackSeconds;
+	CurrentLoopStats.CallbackSeconds += CallbackSeconds;
+	CurrentLoopStats.MaxIterationSeconds = FMath::Max(CurrentLoopStats.MaxIterationSeconds, ProcessSeconds);
+
+	const double Now = FPlatformTime::Seconds();
+	if (CurrentLoopStatsStartTime <= 0.0)
+	{
+		// Ticked manually, without Init
+		CurrentLoopStatsStartTime = Now;
+	}
+	else if (Now - CurrentLoopStatsStartTime >= LoopStatsWindowSeconds)
+	{
+		CurrentLoopStats.WindowSeconds = Now - CurrentLoopStatsStartTime;
+
+		SET_FLOAT_STAT(STAT_CONVAIHTTPThread_IterationsPerSecond, static_cast<float>(CurrentLoopStats.NumIterations / CurrentLoopStats.WindowSeconds));
+		SET_FLOAT_STAT(STAT_CONVAIHTTPThread_BusyRatio, static_cast<float>(CurrentLoopStats.GetBusyRatio()));
+		SET_FLOAT_STAT(STAT_CONVAIHTTPThread_MaxIterationMs, static_cast<float>(CurrentLoopStats.MaxIterationSeconds * 1000.0));
+
+		{
+			FScopeLock Lock(&LoopStatsCriticalSection);
+			LastLoopStats = CurrentLoopStats;
+			TotalLoopStats.Accumulate(CurrentLoopStats);
+		}
+
+		CurrentLoopStats = FConvaihttpThreadLoopStats();
+		CurrentLoopStatsStartTime = Now;
+	}
+}
+
+void FConvaihttpThread::RecordSleep(double Seconds)
+{
+	CurrentLoopStats.SleepSeconds += Seconds;
+}
+
+void FConvaihttpThread::DumpLoopStats(FOutputDevice& Ar) const
+{
+	FScopeLock Lock(&LoopStatsCriticalSection);
+
+	auto DumpWindow = [&Ar](const TCHAR* Name, const FConvaihttpThreadLoopStats& Stats)
+	{
+		if (Stats.WindowSeconds <= 0.0)
+		{
+			Ar.Logf(TEXT("  %s: no complete window yet"), Name);
+			return;
+		}
+		const double ToPercent = 100.0 / Stats.WindowSeconds;
+		Ar.Logf(TEXT("  %s (%.0fs): %.1f iterations/s, busy %.1f%% (scheduling %.1f%%, transfer %.1f%%, callbacks %.1f%%), sleeping %.1f%%, max iteration %.2fms"),
+			Name, Stats.WindowSeconds, Stats.NumIterations / Stats.WindowSeconds, Stats.GetBusyRatio() * 100.0,
+			Stats.SchedulingSeconds * ToPercent, Stats.TransferSeconds * ToPercent, Stats.CallbackSeconds * ToPercent, Stats.SleepSeconds * ToPercent,
+			Stats.MaxIterationSeconds * 1000.0);
+		Ar.Logf(TEXT("    max queues: new %d, cancelled %d, rate limited %d, running %d, completed %d"),
+			Stats.MaxNewRequests, Stats.MaxCancelledRequests, Stats.MaxRateLimitedRequests, Stats.MaxRunningRequests, Stats.MaxCompletedRequests);
+	};
+
+	Ar.Logf(TEXT("CONVAIHTTP thread loop, RunningThreadedRequestLimit %d:"), RunningThreadedRequestLimit);
+	DumpWindow(TEXT("Last window"), LastLoopStats);
+	DumpWindow(TEXT("Since start"), TotalLoopStats);
 }
 
 void FConvaihttpThread::Stop()
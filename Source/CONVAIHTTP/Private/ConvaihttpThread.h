@@ -8,9 +8,46 @@
 #include "ConvaiThreadSafeCounter.h"
 #include "Misc/SingleThreadRunnable.h"
 #include "Containers/Queue.h"
+#include <atomic>
 
 class IConvaihttpThreadedRequest;
 
+/**
+ * Accounting of the iterations of the CONVAIHTTP thread loop over a window of time
+ */
+struct FConvaihttpThreadLoopStats
+{
+	/** Length of the window */
+	double WindowSeconds = 0.0;
+	/** Number of calls to Process */
+	uint64 NumIterations = 0;
+	/** Time spent moving requests between queues, starting, ticking and completing them */
+	double SchedulingSeconds = 0.0;
+	/** Time spent by the transfer implementation (e.g. curl_multi_perform), without the callbacks of the requests */
+	double TransferSeconds = 0.0;
+	/** Time spent in the callbacks of the requests (e.g. libcurl header and body callbacks) */
+	double CallbackSeconds = 0.0;
+	/** Time spent sleeping between iterations */
+	double SleepSeconds = 0.0;
+	/** Longest call to Process */
+	double MaxIterationSeconds = 0.0;
+	/** Highest lengths of the queues seen at the start of an iteration */
+	int32 MaxNewRequests = 0;
+	int32 MaxCancelledRequests = 0;
+	int32 MaxRateLimitedRequests = 0;
+	int32 MaxRunningRequests = 0;
+	int32 MaxCompletedRequests = 0;
+
+	/** @return the share of the window the thread was working rather than sleeping, in [0,1] */
+	double GetBusyRatio() const
+	{
+		return WindowSeconds > 0.0 ? FMath::Min((SchedulingSeconds + TransferSeconds + CallbackSeconds) / WindowSeconds, 1.0) : 0.0;
+	}
+
+	/** Add the accounting of another window */
+	void Accumulate(const FConvaihttpThreadLoopStats& Other);
+};
+
 /**
  * Manages Convaihttp thread
  * Assumes any requests entering the system will remain valid (not deleted) until they exit the system
@@ -51,6 +88,14 @@ public:
 	 */
 	void CancelRequest(IConvaihttpThreadedRequest* Request);
 
+	/**
+	 * Hold back the requests to a host that didn't start yet until the end of its throttle. Called on non-CONVAIHTTP thread.
+	 *
+	 * @param HostKey - host to throttle, as returned by FConvaihttpManager::GetHostThrottleKey()
+	 * @param EndTimeAbsoluteSeconds - time requests to the host may start again, from FPlatformTime::Seconds()
+	 */
+	void ThrottleHost(const FString& HostKey, double EndTimeAbsoluteSeconds);
+
 	/** 
 	 * Get completed requests.  Clears internal arrays.  Called on non-CONVAIHTTP thread.
 	 *
@@ -74,6 +119,30 @@ public:
 	 */
 	virtual void UpdateConfigs();
 
+	/**
+	 * Print the accounting of the thread loop: the last complete window, and everything since the thread started.
+	 * Called on non-CONVAIHTTP thread.
+	 *
+	 * @param Ar - output device to print to
+	 */
+	void DumpLoopStats(FOutputDevice& Ar) const;
+
+	/** @return time the thread spent working rather than sleeping since it started, in cycles. Thread safe */
+	uint64 GetBusyCycles() const { return BusyCycles.load(std::memory_order_relaxed); }
+
+	/**
+	 * Scope accounting the time of a callback of a request, such as a libcurl callback, to the thread loop.
+	 * Cheap enough for every callback, and harmless outside of the CONVAIHTTP thread.
+	 */
+	struct FCallbackScope
+	{
+		FCallbackScope();
+		~FCallbackScope();
+
+	private:
+		uint64 StartCycles;
+	};
+
 protected:
 
 	/**
@@ -110,6 +179,12 @@ protected:
 
 	void Process(TArray64<IConvaihttpThreadedRequest*>& RequestsToCancel, TArray64<IConvaihttpThreadedRequest*>& RequestsToComplete);
 
+	/** Account for one call to Process, and publish the window when it is over. Called on the CONVAIHTTP thread */
+	void RecordIteration(uint64 ProcessCycles, uint64 TickCycles, uint64 CallbackCycles);
+
+	/** Account for a sleep between iterations. Called on the CONVAIHTTP thread */
+	void RecordSleep(double Seconds);
+
 	/** signal request to stop and exit thread */
 	FConvaiThreadSafeCounter ExitRequest;
 
@@ -137,6 +212,19 @@ protected:
 	 */
 	TQueue<IConvaihttpThreadedRequest*, EQueueMode::Mpsc> CancelledThreadedRequests;
 
+	/**
+	 * Throttles of hosts, as host key and end time, waiting to be applied on the convaihttp thread.
+	 * Added to on (any) non-CONVAIHTTP thread, processed then cleared on CONVAIHTTP thread.
+	 */
+	TQueue<TPair<FString, double>, EQueueMode::Mpsc> NewHostThrottles;
+
+	/**
+	 * End time of the throttle of each host whose requests are held back in RateLimitedThreadedRequests, the snapshot
+	 * of those of FConvaihttpManager the thread reads without locking. Expired throttles are removed, so it is empty
+	 * when no host is throttled. Only accessed on the CONVAIHTTP thread.
+	 */
+	TMap<FString, double> ThrottledHosts;
+
 	/**
 	 * Threaded requests that are ready to run, but waiting due to the running request limit (not in any of the other lists, except potentially CancelledThreadedRequests).
 	 * Only accessed on the CONVAIHTTP thread.
@@ -168,4 +256,26 @@ private:
 
 	/** Limit for threaded convaihttp requests running at the same time. If not specified through configuration values, there will be no limit */
 	int32 RunningThreadedRequestLimit = INT_MAX;
+
+	/** Number of requests in NewThreadedRequests */
+	std::atomic<int32> NumNewThreadedRequests{ 0 };
+	/** Number of requests in CancelledThreadedRequests */
+	std::atomic<int32> NumCancelledThreadedRequests{ 0 };
+	/** Number of requests in CompletedThreadedRequests */
+	std::atomic<int32> NumCompletedThreadedRequests{ 0 };
+
+	/** Length of a window of LoopStats, from [CONVAIHTTP.ConvaihttpThread] LoopStatsWindowSeconds */
+	double LoopStatsWindowSeconds = 10.0;
+	/** Accounting of the current window. Only accessed on the CONVAIHTTP thread */
+	FConvaihttpThreadLoopStats CurrentLoopStats;
+	/** Start of the current window. Only accessed on the CONVAIHTTP thread */
+	double CurrentLoopStatsStartTime = 0.0;
+	/** Critical section for accessing LastLoopStats and TotalLoopStats */
+	mutable FCriticalSection LoopStatsCriticalSection;
+	/** Accounting of the last complete window */
+	FConvaihttpThreadLoopStats LastLoopStats;
+	/** Accounting of all the windows since the thread started */
+	FConvaihttpThreadLoopStats TotalLoopStats;
+	/** Time spent in Process since the thread started */
+	std::atomic<uint64> BusyCycles{ 0 };
 };
@@ -0,0 +1,248 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "ConvaihttpTrace.h"
+#include "Interfaces/IConvaihttpRequest.h"
+#include "HAL/PlatformTLS.h"
+#include "Misc/FileHelper.h"
+#include "Misc/ScopeLock.h"
+#include "Trace/Trace.inl"
+#include "Convaihttp.h"
+
+#if UE_TRACE_ENABLED
+UE_TRACE_CHANNEL_DEFINE(ConvaihttpChannel)
+
+UE_TRACE_EVENT_BEGIN(Convaihttp, RequestQueued)
+	UE_TRACE_EVENT_FIELD(uint64, Cycle)
+	UE_TRACE_EVENT_FIELD(uint64, RequestId)
+	UE_TRACE_EVENT_FIELD(UE::Trace::WideString, Verb)
+	UE_TRACE_EVENT_FIELD(UE::Trace::WideString, Url)
+UE_TRACE_EVENT_END()
+
+UE_TRACE_EVENT_BEGIN(Convaihttp, RequestEvent)
+	UE_TRACE_EVENT_FIELD(uint64, Cycle)
+	UE_TRACE_EVENT_FIELD(uint64, RequestId)
+	UE_TRACE_EVENT_FIELD(uint64, Value)
+	UE_TRACE_EVENT_FIELD(uint32, ThreadId)
+	UE_TRACE_EVENT_FIELD(uint8, Type)
+UE_TRACE_EVENT_END()
+#endif
+
+std::atomic<bool> FConvaihttpTrace::bCapturing(false);
+
+namespace ConvaihttpTrace
+{
+	/** Event recorded by a capture */
+	struct FCapturedEvent
+	{
+		uint64 RequestId;
+		uint64 Cycles;
+		uint64 Value;
+		uint32 ThreadId;
+		EConvaihttpTraceEvent Type;
+		/** Index of the name of the request in FCapture::Names, for Queued events */
+		int32 NameIndex;
+	};
+
+	/** Events of the running or last capture */
+	struct FCapture
+	{
+		FCriticalSection CriticalSection;
+		TArray<FCapturedEvent> Events;
+		TArray<FString> Names;
+		uint64 StartCycles = 0;
+		uint64 NumDroppedEvents = 0;
+	};
+
+	/** Most events kept by a capture, about 40MB */
+	static constexpr int32 MaxCapturedEvents = 1024 * 1024;
+
+	FCapture& GetCapture()
+	{
+		static FCapture Capture;
+		return Capture;
+	}
+
+	const TCHAR* LexToString(EConvaihttpTraceEvent Type)
+	{
+		switch (Type)
+		{
+		case EConvaihttpTraceEvent::Queued:		return TEXT("queued");
+		case EConvaihttpTraceEvent::Admitted:	return TEXT("admitted");
+		case EConvaihttpTraceEvent::Connected:	return TEXT("connected");
+		case EConvaihttpTraceEvent::FirstByte:	return TEXT("first byte");
+		case EConvaihttpTraceEvent::BodyChunk:	return TEXT("body chunk");
+		case EConvaihttpTraceEvent::Completed:	return TEXT("completed");
+		case EConvaihttpTraceEvent::Delivered:	return TEXT("delivered");
+		}
+		return TEXT("unknown");
+	}
+}
+
+void FConvaihttpTrace::Event(const IConvaihttpRequest* Request, EConvaihttpTraceEvent Type, uint64 Value, uint64 Cycles)
+{
+	const uint64 RequestId = reinterpret_cast<UPTRINT>(Request);
+	const uint32 ThreadId = FPlatformTLS::GetCurrentThreadId();
+
+#if UE_TRACE_ENABLED
+	if (UE_TRACE_CHANNELEXPR_IS_ENABLED(ConvaihttpChannel))
+	{
+		if (Type == EConvaihttpTraceEvent::Queued)
+		{
+			const FString Verb = Request->GetVerb();
+			const FString Url = Request->GetURL();
+			UE_TRACE_LOG(Convaihttp, RequestQueued, ConvaihttpChannel)
+				<< RequestQueued.Cycle(Cycles)
+				<< RequestQueued.RequestId(RequestId)
+				<< RequestQueued.Verb(*Verb, Verb.Len())
+				<< RequestQueued.Url(*Url, Url.Len());
+		}
+		UE_TRACE_LOG(Convaihttp, RequestEvent, ConvaihttpChannel)
+			<< RequestEvent.Cycle(Cycles)
+			<< RequestEvent.RequestId(RequestId)
+			<< RequestEvent.Value(Value)
+			<< RequestEvent.ThreadId(ThreadId)
+			<< RequestEvent.Type(static_cast<uint8>(Type));
+	}
+#endif
+
+	if (!IsCapturing())
+	{
+		return;
+	}
+
+	// Built outside of the lock
+	FString Name;
+	if (Type == EConvaihttpTraceEvent::Queued)
+	{
+		Name = FString::Printf(TEXT("%s %s"), *Request->GetVerb(), *Request->GetURL());
+	}
+
+	ConvaihttpTrace::FCapture& Capture = ConvaihttpTrace::GetCapture();
+	FScopeLock Lock(&Capture.CriticalSection);
+	if (Capture.Events.Num() >= ConvaihttpTrace::MaxCapturedEvents)
+	{
+		++Capture.NumDroppedEvents;
+		return;
+	}
+
+	int32 NameIndex = INDEX_NONE;
+	if (Type == EConvaihttpTraceEvent::Queued)
+	{
+		NameIndex = Capture.Names.Add(MoveTemp(Name));
+	}
+	Capture.Events.Add({ RequestId, Cycles, Value, ThreadId, Type, NameIndex });
+}
+
+void FConvaihttpTrace::StartCapture()
+{
+	ConvaihttpTrace::FCapture& Capture = ConvaihttpTrace::GetCapture();
+	{
+		FScopeLock Lock(&Capture.CriticalSection);
+		Capture.Events.Reset();
+		Capture.Names.Reset();
+		Capture.NumDroppedEvents = 0;
+		Capture.StartCycles = FPlatformTime::Cycles64();
+	}
+	bCapturing = true;
+	UE_LOG(LogConvaihttp, Log, TEXT("CONVAIHTTP trace capture started"));
+}
+
+void FConvaihttpTrace::StopCapture()
+{
+	bCapturing = false;
+
+	ConvaihttpTrace::FCapture& Capture = ConvaihttpTrace::GetCapture();
+	FScopeLock Lock(&Capture.CriticalSection);
+	UE_LOG(LogConvaihttp, Log, TEXT("CONVAIHTTP trace capture stopped, %d events captured, %llu dropped"), Capture.Events.Num(), Capture.NumDroppedEvents);
+}
+
+FString FConvaihttpTrace::ExportChromeTrace()
+{
+	ConvaihttpTrace::FCapture& Capture = ConvaihttpTrace::GetCapture();
+	FScopeLock Lock(&Capture.CriticalSection);
+
+	constexpr int32 NumSteps = static_cast<int32>(EConvaihttpTraceEvent::Delivered) + 1;
+
+	/** Lifecycle of one request, shown as one row */
+	struct FRow
+	{
+		FString Name;
+		uint64 StepCycles[NumSteps] = {};
+		TArray<TPair<uint64, uint64>> Chunks;
+	};
+
+	// A request object sent again starts a new row when it is queued again
+	TArray<FRow> Rows;
+	TMap<uint64, int32> RequestRows;
+	for (const ConvaihttpTrace::FCapturedEvent& Event : Capture.Events)
+	{
+		int32* RowIndex = RequestRows.Find(Event.RequestId);
+		if (RowIndex == nullptr || Event.Type == EConvaihttpTraceEvent::Queued)
+		{
+			FRow& NewRow = Rows.AddDefaulted_GetRef();
+			NewRow.Name = Event.NameIndex != INDEX_NONE ? Capture.Names[Event.NameIndex] : FString::Printf(TEXT("%p (queued before the capture)"), reinterpret_cast<void*>(Event.RequestId));
+			RowIndex = &RequestRows.Add(Event.RequestId, Rows.Num() - 1);
+		}
+
+		FRow& Row = Rows[*RowIndex];
+		if (Event.Type == EConvaihttpTraceEvent::BodyChunk)
+		{
+			Row.Chunks.Emplace(Event.Cycles, Event.Value);
+		}
+		else
+		{
+			Row.StepCycles[static_cast<int32>(Event.Type)] = Event.Cycles;
+		}
+	}
+
+	const double MicrosecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000000.0;
+	auto ToTimestamp = [&Capture, MicrosecondsPerCycle](uint64 Cycles)
+	{
+		return (static_cast<double>(Cycles) - static_cast<double>(Capture.StartCycles)) * MicrosecondsPerCycle;
+	};
+
+	TArray<FString> TraceEvents;
+	for (int32 RowIndex = 0; RowIndex < Rows.Num(); ++RowIndex)
+	{
+		const FRow& Row = Rows[RowIndex];
+		TraceEvents.Add(FString::Printf(TEXT("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}"), RowIndex, *Row.Name.ReplaceCharWithEscapedChar()));
+		TraceEvents.Add(FString::Printf(TEXT("{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}"), RowIndex, RowIndex));
+
+		// Each phase runs from its step to the next step that happened
+		for (int32 Step = 0; Step < NumSteps - 1; ++Step)
+		{
+			if (Row.StepCycles[Step] == 0 || Step == static_cast<int32>(EConvaihttpTraceEvent::BodyChunk))
+			{
+				continue;
+			}
+			int32 NextStep = Step + 1;
+			while (NextStep < NumSteps && (Row.StepCycles[NextStep] == 0 || NextStep == static_cast<int32>(EConvaihttpTraceEvent::BodyChunk)))
+			{
+				++NextStep;
+			}
+			if (NextStep == NumSteps)
+			{
+				break;
+			}
+
+			const double Begin = ToTimestamp(Row.StepCycles[Step]);
+			const double End = ToTimestamp(Row.StepCycles[NextStep]);
+			TraceEvents.Add(FString::Printf(TEXT("{\"name\":\"%s\",\"cat\":\"convaihttp\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}"),
+				ConvaihttpTrace::LexToString(static_cast<EConvaihttpTraceEvent>(Step)), RowIndex, Begin, FMath::Max(End - Begin, 0.0)));
+		}
+
+		for (const TPair<uint64, uint64>& Chunk : Row.Chunks)
+		{
+			TraceEvents.Add(FString::Printf(TEXT("{\"name\":\"body chunk\",\"cat\":\"convaihttp\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"bytes\":%llu}}"),
+				RowIndex, ToTimestamp(Chunk.Key), Chunk.Value));
+		}
+	}
+
+	return FString::Printf(TEXT("{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%llu},\"traceEvents\":[\n%s\n]}"),
+		Capture.NumDroppedEvents, *FString::Join(TraceEvents, TEXT(",\n")));
+}
+
+bool FConvaihttpTrace::SaveChromeTrace(const FString& Filename)
+{
+	return FFileHelper::SaveStringToFile(ExportChromeTrace(), *Filename, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
@@ -0,0 +1,375 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "ConvaihttpTrafficCapture.h"
+#include "Convaihttp.h"
+#include "Async/Async.h"
+#include "Containers/Queue.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/ScopeLock.h"
+#include "Serialization/MemoryWriter.h"
+
+std::atomic<bool> FConvaihttpTrafficCapture::bCapturing(false);
+
+namespace ConvaihttpTrafficCapture
+{
+	/** Identifies a capture file, and the version of its format */
+	static const uint32 Magic = 0x43485443; // "CTHC"
+	static const uint32 Version = 1;
+
+	/** Records are written to the file once this many bytes are buffered */
+	static const int64 FlushSize = 256 * 1024;
+
+	/** State of the capture in progress, guarded by Lock */
+	struct FState
+	{
+		FCriticalSection Lock;
+		/** Written by the writer task only, outside of Lock. Closed once the writer is done */
+		TUniquePtr<FArchive> File;
+		TArray<uint8> Buffer;
+		/** Full buffers waiting for the writer */
+		TQueue<TArray<uint8>> PendingWrites;
+		/** Whether a writer task is running, and its completion */
+		bool bWriterRunning = false;
+		TFuture<void> Writer;
+		/** Set once writing to the file failed, to only warn once */
+		bool bWriteFailed = false;
+		double StartTimeAbsoluteSeconds = 0.0;
+		bool bCaptureBodies = false;
+		int64 MaxBodySize = 0;
+		bool bStripQueryStrings = false;
+		/** Patterns of the headers whose values are not recorded, shared with records being built */
+		TSharedPtr<const TArray<FString>, ESPMode::ThreadSafe> RedactedHeaders;
+		int32 NumRecords = 0;
+	};
+
+	FState& GetState()
+	{
+		static FState State;
+		return State;
+	}
+
+	/** Append headers as "Key: Value", replacing the values of the redacted ones */
+	void CopyHeaders(const TArray64<FString>& Headers, const TArray<FString>& RedactedHeaders, TArray<FString>& OutHeaders)
+	{
+		OutHeaders.Reserve(Headers.Num());
+		for (const FString& Header : Headers)
+		{
+			FString Key;
+			FString Value;
+			if (Header.Split(TEXT(":"), &Key, &Value) && FConvaihttpTrafficCapture::IsRedactedHeader(Key.TrimEnd(), RedactedHeaders))
+			{
+				OutHeaders.Emplace(Key + TEXT(": <redacted>"));
+			}
+			else
+			{
+				OutHeaders.Add(Header);
+			}
+		}
+	}
+
+	/** Copy a body when it is held in memory and no larger than the limit */
+	void CopyBody(const FCompositeBuffer& Body, int64 MaxBodySize, TArray<uint8>& OutBody)
+	{
+		const uint64 Size = Body.GetSize();
+		if (Size > 0 && Size <= static_cast<uint64>(MaxBodySize))
+		{
+			OutBody.SetNumUninitialized(static_cast<int32>(Size));
+			Body.CopyTo(FMutableMemoryView(OutBody.GetData(), Size));
+		}
+	}
+
+	void CopyBody(const TArray64<uint8>& Body, int64 MaxBodySize, TArray<uint8>& OutBody)
+	{
+		if (Body.Num() > 0 && Body.Num() <= MaxBodySize)
+		{
+			OutBody.Append(Body.GetData(), static_cast<int32>(Body.Num()));
+		}
+	}
+
+	/** Write the pending buffers to the file, on a thread pool thread */
+	void WritePending(FState& State)
+	{
+		for (;;)
+		{
+			TArray<uint8> Data;
+			bool bDequeued = false;
+			{
+				FScopeLock ScopeLock(&State.Lock);
+				bDequeued = State.PendingWrites.Dequeue(Data);
+			}
+
+			if (bDequeued)
+			{
+				State.File->Serialize(Data.GetData(), Data.Num());
+				continue;
+			}
+
+			State.File->Flush();
+
+			// Only stop once the queue is still empty after the flush, so no other writer touches the file meanwhile
+			FScopeLock ScopeLock(&State.Lock);
+			if (State.File->IsError() && !State.bWriteFailed)
+			{
+				State.bWriteFailed = true;
+				UE_LOG(LogConvaihttp, Warning, TEXT("Failed to write the traffic capture to %s"), *State.File->GetArchiveName());
+			}
+			if (State.PendingWrites.IsEmpty())
+			{
+				State.bWriterRunning = false;
+				return;
+			}
+		}
+	}
+
+	/** Hand the buffered records to the writer, so the game thread never waits on the disk. Lock must be held */
+	void FlushBuffer(FState& State)
+	{
+		if (!State.File.IsValid() || State.Buffer.Num() == 0)
+		{
+			State.Buffer.Reset();
+			return;
+		}
+
+		State.PendingWrites.Enqueue(MoveTemp(State.Buffer));
+		State.Buffer.Reset();
+		if (!State.bWriterRunning)
+		{
+			State.bWriterRunning = true;
+			State.Writer = Async(EAsyncExecution::ThreadPool, [&State]()
+			{
+				WritePending(State);
+			});
+		}
+	}
+}
+
+TArray<FString> FConvaihttpTrafficCapture::GetRedactedHeaders()
+{
+	TArray<FString> RedactedHeaders;
+	if (GConfig)
+	{
+		GConfig->GetArray(TEXT("CONVAIHTTP.TrafficCapture"), TEXT("RedactedHeaders"), RedactedHeaders, GEngineIni);
+	}
+	if (RedactedHeaders.Num() == 0)
+	{
+		RedactedHeaders = { TEXT("Authorization"), TEXT("Proxy-Authorization"), TEXT("Cookie"), TEXT("Set-Cookie"), TEXT("Api-Key"), TEXT("*-Api-Key") };
+	}
+	return RedactedHeaders;
+}
+
+bool FConvaihttpTrafficCapture::IsRedactedHeader(const FString& Key, const TArray<FString>& RedactedHeaders)
+{
+	for (const FString& Pattern : RedactedHeaders)
+	{
+		if (Key.MatchesWildcard(Pattern, ESearchCase::IgnoreCase))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+FArchive& operator<<(FArchive& Ar, FConvaihttpCapturedRequest& Request)
+{
+	uint8 Status = static_cast<uint8>(Request.Status);
+	Ar << Request.ArrivalSeconds;
+	Ar << Request.DurationSeconds;
+	Ar << Request.FirstByteSeconds;
+	Ar << Request.Verb;
+	Ar << Request.Url;
+	Ar << Request.RequestHeaders;
+	Ar << Request.RequestSize;
+	Ar << Request.RequestBody;
+	Ar << Status;
+	Ar << Request.ResponseCode;
+	Ar << Request.ResponseHeaders;
+	Ar << Request.ResponseSize;
+	Ar << Request.ResponseBody;
+	Request.Status = static_cast<EConvaihttpRequestStatus::Type>(Status);
+	return Ar;
+}
+
+bool FConvaihttpTrafficCapture::Start(const FString& Filename, bool bCaptureBodies, int64 MaxBodySize, bool bStripQueryStrings)
+{
+	Stop();
+
+	TUniquePtr<FArchive> File(IFileManager::Get().CreateFileWriter(*Filename));
+	if (!File.IsValid())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Couldn't open %s to capture traffic"), *Filename);
+		return false;
+	}
+
+	uint32 Magic = ConvaihttpTrafficCapture::Magic;
+	uint32 Version = ConvaihttpTrafficCapture::Version;
+	*File << Magic;
+	*File << Version;
+
+	ConvaihttpTrafficCapture::FState& State = ConvaihttpTrafficCapture::GetState();
+	FScopeLock ScopeLock(&State.Lock);
+	State.File = MoveTemp(File);
+	State.Buffer.Reset();
+	State.bWriteFailed = false;
+	State.StartTimeAbsoluteSeconds = FPlatformTime::Seconds();
+	State.bCaptureBodies = bCaptureBodies;
+	State.MaxBodySize = FMath::Clamp<int64>(MaxBodySize, 0, MAX_int32);
+	State.bStripQueryStrings = bStripQueryStrings;
+	State.RedactedHeaders = MakeShared<const TArray<FString>, ESPMode::ThreadSafe>(GetRedactedHeaders());
+	State.NumRecords = 0;
+	bCapturing.store(true, std::memory_order_relaxed);
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Capturing traffic to %s%s%s"), *Filename, bCaptureBodies ? TEXT(" with bodies") : TEXT(""), bStripQueryStrings ? TEXT(" without query strings") : TEXT(""));
+	return true;
+}
+
+void FConvaihttpTrafficCapture::Stop()
+{
+	ConvaihttpTrafficCapture::FState& State = ConvaihttpTrafficCapture::GetState();
+	TFuture<void> Writer;
+	{
+		FScopeLock ScopeLock(&State.Lock);
+		if (!State.File.IsValid())
+		{
+			return;
+		}
+
+		bCapturing.store(false, std::memory_order_relaxed);
+		ConvaihttpTrafficCapture::FlushBuffer(State);
+		Writer = MoveTemp(State.Writer);
+	}
+
+	// The file is closed once the writer has drained everything queued
+	if (Writer.IsValid())
+	{
+		Writer.Wait();
+	}
+
+	FScopeLock ScopeLock(&State.Lock);
+	State.File->Close();
+	State.File.Reset();
+	State.Buffer.Empty();
+	State.RedactedHeaders.Reset();
+
+	UE_LOG(LogConvaihttp, Log, TEXT("Captured %d requests over %.1fs"), State.NumRecords, FPlatformTime::Seconds() - State.StartTimeAbsoluteSeconds);
+}
+
+void FConvaihttpTrafficCapture::Record(const IConvaihttpRequest& Request, const FCompositeBuffer& RequestBody, const IConvaihttpResponse* Response, double QueuedTimeAbsoluteSeconds)
+{
+	if (!IsCapturing())
+	{
+		return;
+	}
+
+	ConvaihttpTrafficCapture::FState& State = ConvaihttpTrafficCapture::GetState();
+	bool bCaptureBodies = false;
+	int64 MaxBodySize = 0;
+	bool bStripQueryStrings = false;
+	TSharedPtr<const TArray<FString>, ESPMode::ThreadSafe> RedactedHeaders;
+	double StartTimeAbsoluteSeconds = 0.0;
+	{
+		FScopeLock ScopeLock(&State.Lock);
+		if (!State.File.IsValid())
+		{
+			return;
+		}
+		bCaptureBodies = State.bCaptureBodies;
+		MaxBodySize = State.MaxBodySize;
+		bStripQueryStrings = State.bStripQueryStrings;
+		RedactedHeaders = State.RedactedHeaders;
+		StartTimeAbsoluteSeconds = State.StartTimeAbsoluteSeconds;
+	}
+
+	// Requests queued before the capture started arrive at its start
+	const double NowSeconds = FPlatformTime::Seconds();
+	const double QueuedSeconds = QueuedTimeAbsoluteSeconds > 0.0 ? QueuedTimeAbsoluteSeconds : NowSeconds;
+
+	FConvaihttpCapturedRequest Captured;
+	Captured.ArrivalSeconds = FMath::Max(QueuedSeconds - StartTimeAbsoluteSeconds, 0.0);
+	Captured.DurationSeconds = NowSeconds - QueuedSeconds;
+	Captured.Verb = Request.GetVerb();
+	Captured.Url = Request.GetURL();
+	if (bStripQueryStrings)
+	{
+		// Query strings can carry tokens and personal data, keep the path for replay
+		int32 QueryStart = INDEX_NONE;
+		if (Captured.Url.FindChar(TEXT('?'), QueryStart))
+		{
+			Captured.Url.LeftInline(QueryStart);
+		}
+	}
+	ConvaihttpTrafficCapture::CopyHeaders(Request.GetAllHeaders(), *RedactedHeaders, Captured.RequestHeaders);
+	Captured.RequestSize = Request.GetContentLength();
+	// Only the body handed in is copied, GetContent() would flatten shared buffers and can't read streamed payloads
+	if (bCaptureBodies && Captured.RequestSize <= static_cast<uint64>(MaxBodySize))
+	{
+		ConvaihttpTrafficCapture::CopyBody(RequestBody, MaxBodySize, Captured.RequestBody);
+	}
+	Captured.Status = Request.GetStatus();
+
+	if (Response != nullptr)
+	{
+		const FConvaihttpResponseTimings Timings = Response->GetTimings();
+		if (Timings.bIsValid)
+		{
+			Captured.FirstByteSeconds = Timings.FirstByteSeconds;
+		}
+		Captured.ResponseCode = Response->GetResponseCode();
+		ConvaihttpTrafficCapture::CopyHeaders(Response->GetAllHeaders(), *RedactedHeaders, Captured.ResponseHeaders);
+		Captured.ResponseSize = Response->GetContentLength();
+		// The payload is only complete on success, and empty when the body went to a stream or sink
+		if (bCaptureBodies && Captured.Status == EConvaihttpRequestStatus::Succeeded && Captured.ResponseSize <= static_cast<uint64>(MaxBodySize))
+		{
+			ConvaihttpTrafficCapture::CopyBody(Response->GetContent(), MaxBodySize, Captured.ResponseBody);
+		}
+	}
+
+	FScopeLock ScopeLock(&State.Lock);
+	if (!State.File.IsValid())
+	{
+		return;
+	}
+	FMemoryWriter Writer(State.Buffer);
+	Writer.Seek(State.Buffer.Num());
+	Writer << Captured;
+	++State.NumRecords;
+	if (State.Buffer.Num() >= ConvaihttpTrafficCapture::FlushSize)
+	{
+		ConvaihttpTrafficCapture::FlushBuffer(State);
+	}
+}
+
+bool FConvaihttpTrafficCapture::Load(const FString& Filename, TArray<FConvaihttpCapturedRequest>& OutRequests)
+{
+	TUniquePtr<FArchive> File(IFileManager::Get().CreateFileReader(*Filename));
+	if (!File.IsValid())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Couldn't open capture %s"), *Filename);
+		return false;
+	}
+
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	*File << Magic;
+	*File << Version;
+	if (Magic != ConvaihttpTrafficCapture::Magic || Version != ConvaihttpTrafficCapture::Version)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%s isn't a capture of version %u"), *Filename, ConvaihttpTrafficCapture::Version);
+		return false;
+	}
+
+	while (!File->AtEnd() && !File->IsError())
+	{
+		FConvaihttpCapturedRequest Captured;
+		*File << Captured;
+		if (File->IsError())
+		{
+			// A capture that wasn't stopped ends with a partial record
+			UE_LOG(LogConvaihttp, Warning, TEXT("Capture %s is truncated after %d requests"), *Filename, OutRequests.Num());
+			break;
+		}
+		OutRequests.Add(MoveTemp(Captured));
+	}
+	return true;
+}
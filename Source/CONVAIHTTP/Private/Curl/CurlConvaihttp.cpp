@@ -7,11 +7,17 @@
 #include "Misc/App.h"
 #include "ConvaihttpModule.h"
 #include "Convaihttp.h"
+#include "ConvaihttpMetrics.h"
+#include "ConvaihttpSlowRequestSampler.h"
+#include "ConvaihttpTrace.h"
+#include "ConvaihttpTrafficCapture.h"
 #include "Misc/EngineVersion.h"
 #include "Misc/Paths.h"
 #include "Curl/CurlConvaihttpManager.h"
+#include "ConvaihttpThread.h"
 #include "Misc/ScopeLock.h"
 #include "HAL/FileManager.h"
+#include "GenericPlatform/ConvaihttpUploadSource.h"
 #include "Internationalization/Regex.h"
 
 #if WITH_SSL
@@ -78,6 +84,8 @@ FCurlConvaihttpRequest::FCurlConvaihttpRequest()
 	,	LastReportedBytesRead(0)
 	,	LastReportedBytesSent(0)
 	,   LeastRecentlyCachedInfoMessageIndex(0)
+	,	PausedDirections(0)
+	,	ResumeRequestedDirections(MakeShared<std::atomic<int32>, ESPMode::ThreadSafe>(0))
 {
 	checkf(FCurlConvaihttpManager::IsInit(), TEXT("Curl request was created while the library is shutdown"));
 
@@ -313,6 +321,7 @@ void FCurlConvaihttpRequest::SetURL(const FString& InURL)
 
 void FCurlConvaihttpRequest::SetContent(const TArray64<uint8>& ContentPayload)
 {
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
 	SetContent(CopyTemp(ContentPayload));
 }
 
@@ -324,10 +333,33 @@ void FCurlConvaihttpRequest::SetContent(TArray64<uint8>&& ContentPayload)
 		return;
 	}
 
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
+	RequestPayloadMemory.Set(ContentPayload.GetAllocatedSize());
 	RequestPayload = MakeUnique<FCH_RequestPayloadInMemory>(MoveTemp(ContentPayload));
 	bIsRequestPayloadSeekable = true;
 }
 
+void FCurlConvaihttpRequest::SetContent(const FSharedBuffer& ContentPayload)
+{
+	SetContent(FCompositeBuffer(ContentPayload));
+}
+
+void FCurlConvaihttpRequest::SetContent(const FCompositeBuffer& ContentPayload)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FCurlConvaihttpRequest::SetContent() - attempted to set content on a request that is inflight"));
+		return;
+	}
+
+	// The buffer is immutable, so it can be referenced for the lifetime of the request (and rewound by seek) without a copy
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
+	// An owned buffer may be shared with the caller, it is counted while the request holds it
+	RequestPayloadMemory.Set(ContentPayload.GetSize());
+	RequestPayload = MakeUnique<FCH_RequestPayloadInSharedBuffer>(ContentPayload.MakeOwned());
+	bIsRequestPayloadSeekable = true;
+}
+
 void FCurlConvaihttpRequest::SetContentAsString(const FString& ContentString)
 {
 	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
@@ -336,10 +368,12 @@ void FCurlConvaihttpRequest::SetContentAsString(const FString& ContentString)
 		return;
 	}
 
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
 	uint64 Utf8Length = FTCHARToUTF8_Convert::ConvertedLength(*ContentString, ContentString.Len());
 	TArray64<uint8> Buffer;
 	Buffer.SetNumUninitialized(Utf8Length);
 	FTCHARToUTF8_Convert::Convert((UTF8CHAR*)Buffer.GetData(), Buffer.Num(), *ContentString, ContentString.Len());
+	RequestPayloadMemory.Set(Buffer.GetAllocatedSize());
 	RequestPayload = MakeUnique<FCH_RequestPayloadInMemory>(MoveTemp(Buffer));
 	bIsRequestPayloadSeekable = true;
 }
@@ -354,17 +388,21 @@ bool FCurlConvaihttpRequest::SetContentAsStreamedFile(const FString& Filename)
 		return false;
 	}
 
-	FArchive* File = IFileManager::Get().CreateFileReader(*Filename);
-	if (File)
+	// Prefetch ahead of libcurl so the read callback only copies, instead of blocking the CONVAIHTTP thread on disk IO
+	TSharedRef<FConvaihttpAsyncFileUploadSource, ESPMode::ThreadSafe> Source = MakeShared<FConvaihttpAsyncFileUploadSource, ESPMode::ThreadSafe>(Filename);
+	if (Source->IsValid())
 	{
-		RequestPayload = MakeUnique<FCH_RequestPayloadInFileStream>(MakeShareable(File));
+		RequestPayloadMemory.Set(0);
+		RequestPayload = MakeUnique<FCH_RequestPayloadFromSource>(Source);
+		bIsRequestPayloadSeekable = true;
 	}
 	else
 	{
 		UE_LOG(LogConvaihttp, Warning, TEXT("FCurlConvaihttpRequest::SetContentAsStreamedFile Failed to open %s for reading"), *Filename);
+		RequestPayloadMemory.Set(0);
 		RequestPayload.Reset();
+		bIsRequestPayloadSeekable = false;
 	}
-	bIsRequestPayloadSeekable = false;
 	return RequestPayload.IsValid();
 }
 
@@ -378,11 +416,42 @@ bool FCurlConvaihttpRequest::SetContentFromStream(TSharedRef<FArchive, ESPMode::
 		return false;
 	}
 
+	RequestPayloadMemory.Set(0);
 	RequestPayload = MakeUnique<FCH_RequestPayloadInFileStream>(Stream);
 	bIsRequestPayloadSeekable = false;
 	return true;
 }
 
+bool FCurlConvaihttpRequest::SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source)
+{
+	UE_LOG(LogConvaihttp, Verbose, TEXT("FCurlConvaihttpRequest::SetContentFromSource() - %llu bytes"), Source->GetContentLength());
+
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FCurlConvaihttpRequest::SetContentFromSource() - attempted to set content on a request that is inflight"));
+		return false;
+	}
+
+	RequestPayloadMemory.Set(0);
+	RequestPayload = MakeUnique<FCH_RequestPayloadFromSource>(Source);
+	bIsRequestPayloadSeekable = RequestPayload->IsSeekable();
+	return true;
+}
+
+bool FCurlConvaihttpRequest::SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink)
+{
+	UE_LOG(LogConvaihttp, Verbose, TEXT("FCurlConvaihttpRequest::SetResponseBodyReceiveSink()"));
+
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FCurlConvaihttpRequest::SetResponseBodyReceiveSink() - attempted to set the response body sink on a request that is inflight"));
+		return false;
+	}
+
+	ResponseBodySink = Sink;
+	return true;
+}
+
 void FCurlConvaihttpRequest::SetHeader(const FString& HeaderName, const FString& HeaderValue)
 {
 	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
@@ -391,7 +460,9 @@ void FCurlConvaihttpRequest::SetHeader(const FString& HeaderName, const FString&
 		return;
 	}
 
+	LLM_SCOPE_BYTAG(Convaihttp_Headers);
 	Headers.Add(HeaderName, HeaderValue);
+	HeadersMemory.Set(GetHeadersAllocatedSize(Headers));
 }
 
 void FCurlConvaihttpRequest::AppendToHeader(const FString& HeaderName, const FString& AdditionalHeaderValue)
@@ -416,6 +487,14 @@ void FCurlConvaihttpRequest::AppendToHeader(const FString& HeaderName, const FSt
 	}
 }
 
+void FCurlConvaihttpRequest::RemoveHeader(const FString& HeaderName)
+{
+	if (Headers.Remove(HeaderName) > 0)
+	{
+		HeadersMemory.Set(GetHeadersAllocatedSize(Headers));
+	}
+}
+
 FString FCurlConvaihttpRequest::GetVerb() const
 {
 	return Verb;
@@ -424,6 +503,7 @@ FString FCurlConvaihttpRequest::GetVerb() const
 size_t FCurlConvaihttpRequest::StaticUploadCallback(void* Ptr, size_t SizeInBlocks, size_t BlockSizeInBytes, void* UserData)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpRequest_StaticUploadCallback);
+	FConvaihttpThread::FCallbackScope CallbackScope;
 	check(Ptr);
 	check(UserData);
 
@@ -435,6 +515,7 @@ size_t FCurlConvaihttpRequest::StaticUploadCallback(void* Ptr, size_t SizeInBloc
 int FCurlConvaihttpRequest::StaticSeekCallback(void* UserData, curl_off_t Offset, int Origin)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpRequest_StaticSeekCallback);
+	FConvaihttpThread::FCallbackScope CallbackScope;
 	check(UserData);
 
 	// dispatch
@@ -445,6 +526,7 @@ int FCurlConvaihttpRequest::StaticSeekCallback(void* UserData, curl_off_t Offset
 size_t FCurlConvaihttpRequest::StaticReceiveResponseHeaderCallback(void* Ptr, size_t SizeInBlocks, size_t BlockSizeInBytes, void* UserData)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpRequest_StaticReceiveResponseHeaderCallback);
+	FConvaihttpThread::FCallbackScope CallbackScope;
 	check(Ptr);
 	check(UserData);
 
@@ -456,6 +538,7 @@ size_t FCurlConvaihttpRequest::StaticReceiveResponseHeaderCallback(void* Ptr, si
 size_t FCurlConvaihttpRequest::StaticReceiveResponseBodyCallback(void* Ptr, size_t SizeInBlocks, size_t BlockSizeInBytes, void* UserData)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpRequest_StaticReceiveResponseBodyCallback);
+	FConvaihttpThread::FCallbackScope CallbackScope;
 	check(Ptr);
 	check(UserData);
 
@@ -467,6 +550,7 @@ size_t FCurlConvaihttpRequest::StaticReceiveResponseBodyCallback(void* Ptr, size
 size_t FCurlConvaihttpRequest::StaticDebugCallback(CURL * Handle, curl_infotype DebugInfoType, char * DebugInfo, size_t DebugInfoSize, void* UserData)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpRequest_StaticDebugCallback);
+	FConvaihttpThread::FCallbackScope CallbackScope;
 	check(Handle);
 	check(UserData);
 
@@ -481,11 +565,17 @@ size_t FCurlConvaihttpRequest::ReceiveResponseHeaderCallback(void* Ptr, size_t S
 	check(Response.IsValid());
 	
 	TimeSinceLastResponse = 0.0f;
+	if (!bTracedFirstByte && FConvaihttpTrace::IsEnabled())
+	{
+		TraceFirstByte();
+	}
 	if (Response.IsValid())
 	{
 		uint32 HeaderSize = SizeInBlocks * BlockSizeInBytes;
 		if (HeaderSize > 0 && HeaderSize <= CURL_MAX_HTTP_HEADER)
 		{
+			LLM_SCOPE_BYTAG(Convaihttp_Headers);
+
 			TArray64<char> AnsiHeader;
 			AnsiHeader.AddUninitialized(HeaderSize + 1);
 
@@ -508,7 +598,16 @@ size_t FCurlConvaihttpRequest::ReceiveResponseHeaderCallback(void* Ptr, size_t S
 					//Store the content length so OnRequestProgress() delegates have something to work with
 					if (HeaderKey == TEXT("Content-Length"))
 					{
-						Response->ContentLength = FCString::Atoi(*HeaderValue);
+						Response->ContentLength = FCString::Atoi64(*HeaderValue);
+
+						// Size the payload up front so the body is received without reallocating (capped in case the header is bogus)
+						if (!ResponseBodySink.IsValid())
+						{
+							static constexpr uint64 MaxPayloadPreallocation = 64 * 1024 * 1024;
+							LLM_SCOPE_BYTAG(Convaihttp_ResponsePayload);
+							Response->Payload.Reserve(FMath::Min(Response->ContentLength, MaxPayloadPreallocation));
+							Response->PayloadMemory.Set(Response->Payload.GetAllocatedSize());
+						}
 					}
 					Response->NewlyReceivedHeaders.Enqueue(TPair<FString, FString>(MoveTemp(HeaderKey), MoveTemp(HeaderValue)));
 				}
@@ -553,9 +652,35 @@ size_t FCurlConvaihttpRequest::ReceiveResponseBodyCallback(void* Ptr, size_t Siz
 			);
 
 		// note that we can be passed 0 bytes if file transmitted has 0 length
-		if (SizeToDownload > 0)
+		CONVAIHTTP_TRACE_EVENT(this, BodyChunk, SizeToDownload);
+
+		if (SizeToDownload > 0 && ResponseBodySink.IsValid() && HasSuccessfulResponseCode())
 		{
-			Response->Payload.AddUninitialized(SizeToDownload);
+			// Clear before writing, so a notification that races with this write is not lost
+			ResumeRequestedDirections->fetch_and(~CURLPAUSE_RECV);
+
+			switch (ResponseBodySink->Write(FMemoryView(Ptr, SizeToDownload)))
+			{
+			case EConvaihttpBodySinkResult::Accepted:
+				Response->TotalBytesRead.Add(SizeToDownload);
+				return SizeToDownload;
+			case EConvaihttpBodySinkResult::Full:
+				// libcurl keeps the data and hands it to us again once we unpause
+				UE_LOG(LogConvaihttp, VeryVerbose, TEXT("%p: ReceiveResponseBodyCallback: response body sink is full, pausing download"), this);
+				PausedDirections |= CURLPAUSE_RECV;
+				return CURL_WRITEFUNC_PAUSE;
+			default:
+				UE_LOG(LogConvaihttp, Warning, TEXT("%p: ReceiveResponseBodyCallback: response body sink failed, aborting"), this);
+				return 0;
+			}
+		}
+		else if (SizeToDownload > 0)
+		{
+			{
+				LLM_SCOPE_BYTAG(Convaihttp_ResponsePayload);
+				Response->Payload.AddUninitialized(SizeToDownload);
+				Response->PayloadMemory.Set(Response->Payload.GetAllocatedSize());
+			}
 
 			// save
 			FMemory::Memcpy(static_cast<uint8*>(Response->Payload.GetData()) + Response->TotalBytesRead.GetValue(), Ptr, SizeToDownload);
@@ -578,15 +703,31 @@ size_t FCurlConvaihttpRequest::UploadCallback(void* Ptr, size_t SizeInBlocks, si
 
 	size_t MaxBufferSize = SizeInBlocks * BlockSizeInBytes;
 	size_t SizeAlreadySent = static_cast<size_t>(BytesSent.GetValue());
+
+	// Clear before reading, so a notification that races with this read is not lost
+	ResumeRequestedDirections->fetch_and(~CURLPAUSE_SEND);
+
 	size_t SizeSentThisTime = RequestPayload->FillOutputBuffer(Ptr, MaxBufferSize, SizeAlreadySent);
+	if (SizeSentThisTime == FCH_RequestPayload::FillError)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: UploadCallback: failed to read the request payload after %llu bytes, aborting"), this, static_cast<uint64>(SizeAlreadySent));
+		return CURL_READFUNC_ABORT;
+	}
+	if (SizeSentThisTime == FCH_RequestPayload::FillPending)
+	{
+		// Don't block the CONVAIHTTP thread waiting for the payload, the data available callback will resume us
+		UE_LOG(LogConvaihttp, VeryVerbose, TEXT("%p: UploadCallback: payload not ready after %llu bytes, pausing upload"), this, static_cast<uint64>(SizeAlreadySent));
+		PausedDirections |= CURLPAUSE_SEND;
+		return CURL_READFUNC_PAUSE;
+	}
 	BytesSent.Add(SizeSentThisTime);
 	TotalBytesSent.Add(SizeSentThisTime);
 
-	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: UploadCallback: %d bytes out of %d sent (%d bytes total sent). (SizeInBlocks=%d, BlockSizeInBytes=%d, SizeToSendThisTime=%d (<-this will get returned from the callback))"),
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: UploadCallback: %lld bytes out of %llu sent (%lld bytes total sent). (SizeInBlocks=%d, BlockSizeInBytes=%d, SizeToSendThisTime=%d (<-this will get returned from the callback))"),
 		this,
-		static_cast< int32 >(BytesSent.GetValue()),
+		BytesSent.GetValue(),
 		RequestPayload->GetContentLength(),
-		static_cast< int32 >(TotalBytesSent.GetValue()),
+		TotalBytesSent.GetValue(),
 		static_cast< int32 >(SizeInBlocks),
 		static_cast< int32 >(BlockSizeInBytes),
 		static_cast< int32 >(SizeSentThisTime)
@@ -763,6 +904,12 @@ bool FCurlConvaihttpRequest::SetupRequest()
 		UE_LOG(LogConvaihttp, Log, TEXT("Cannot process CONVAIHTTP request: URL is empty"));
 		return false;
 	}
+	// A sink holding part of the body of a previous attempt can't take another one
+	else if (ResponseBodySink.IsValid() && !ResponseBodySink->Restart())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("ProcessRequest failed. The response body sink can't take another body. %p"), this);
+		return false;
+	}
 
 	// set up request
 
@@ -785,7 +932,7 @@ bool FCurlConvaihttpRequest::SetupRequest()
 	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: URL='%s'"), this, *URL);
 	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: Verb='%s'"), this, *Verb);
 	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: Custom headers are %s"), this, Headers.Num() ? TEXT("present") : TEXT("NOT present"));
-	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: Payload size=%d"), this, RequestPayload->GetContentLength());
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: Payload size=%llu"), this, RequestPayload->GetContentLength());
 
 	if (GetHeader(TEXT("User-Agent")).IsEmpty())
 	{
@@ -793,7 +940,17 @@ bool FCurlConvaihttpRequest::SetupRequest()
 	}
 
 	// content-length should be present convaihttp://www.w3.org/Protocols/rfc2616/rfc2616-sec4.html#sec4.4
-	if (GetHeader(TEXT("Content-Length")).IsEmpty())
+	// unless the body is still being produced, in which case it is sent chunked and its end marks the end of the body
+	if (!RequestPayload->HasKnownContentLength())
+	{
+		if (!GetHeader(TEXT("Content-Length")).IsEmpty())
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: Removing Content-Length header, the payload size is not known up front"), this);
+			RemoveHeader(TEXT("Content-Length"));
+		}
+		SetHeader(TEXT("Transfer-Encoding"), TEXT("chunked"));
+	}
+	else if (GetHeader(TEXT("Content-Length")).IsEmpty())
 	{
 		SetHeader(TEXT("Content-Length"), FString::Printf(TEXT("%lld"), RequestPayload->GetContentLength()));
 	}
@@ -822,6 +979,11 @@ bool FCurlConvaihttpRequest::SetupRequestConvaihttpThread()
 
 		curl_easy_setopt(EasyHandle, CURLOPT_URL, TCHAR_TO_ANSI(*URL));
 
+#if WITH_CONVAIHTTP_NGHTTP2
+		// Reset on every run, the url may have changed since the last one
+		curl_easy_setopt(EasyHandle, CURLOPT_HTTP_VERSION, static_cast<long>(FCurlConvaihttpManager::UsesHttp2PriorKnowledge(URL) ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_NONE));
+#endif
+
 		if (!FCurlConvaihttpManager::CurlRequestOptions.LocalHostAddr.IsEmpty())
 		{
 			// Set the local address to use for making these requests
@@ -830,6 +992,9 @@ bool FCurlConvaihttpRequest::SetupRequestConvaihttpThread()
 
 		bool bUseReadFunction = false;
 
+		// -1 lets libcurl send the body chunked, ending it when the read callback returns 0
+		const curl_off_t PayloadSize = RequestPayload->HasKnownContentLength() ? static_cast<curl_off_t>(RequestPayload->GetContentLength()) : -1;
+
 		// set up verb (note that Verb is expected to be uppercase only)
 		if (Verb == TEXT("POST"))
 		{
@@ -838,11 +1003,11 @@ bool FCurlConvaihttpRequest::SetupRequestConvaihttpThread()
 			check(!GetHeader(TEXT("Content-Type")).IsEmpty() || RequestPayload->CH_IsURLEncoded());
 			curl_easy_setopt(EasyHandle, CURLOPT_POST, 1L);
 			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDS, NULL);
-			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(RequestPayload->GetContentLength()));
+			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE_LARGE, PayloadSize);
 #if WITH_CURL_XCURL
-			curl_easy_setopt(EasyHandle, CURLOPT_INFILESIZE, RequestPayload->GetContentLength());
+			curl_easy_setopt(EasyHandle, CURLOPT_INFILESIZE, static_cast<long>(PayloadSize));
 #else
-			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE, RequestPayload->GetContentLength());
+			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE, static_cast<long>(PayloadSize));
 #endif
 			bUseReadFunction = true;
 		}
@@ -850,7 +1015,7 @@ bool FCurlConvaihttpRequest::SetupRequestConvaihttpThread()
 		{
 			curl_easy_setopt(EasyHandle, CURLOPT_UPLOAD, 1L);
 			//curl_easy_setopt(EasyHandle, CURLOPT_INFILESIZE_LARGE, RequestPayload->GetContentLength());
-			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(RequestPayload->GetContentLength()));
+			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE_LARGE, PayloadSize);
 
 			if (Verb != TEXT("PUT"))
 			{
@@ -876,7 +1041,7 @@ bool FCurlConvaihttpRequest::SetupRequestConvaihttpThread()
 
 			curl_easy_setopt(EasyHandle, CURLOPT_POST, 1L);
 			curl_easy_setopt(EasyHandle, CURLOPT_CUSTOMREQUEST, "DELETE");
-			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE_LARGE , RequestPayload->GetContentLength());
+			curl_easy_setopt(EasyHandle, CURLOPT_POSTFIELDSIZE_LARGE , PayloadSize);
 			bUseReadFunction = true;
 		}
 		else
@@ -885,12 +1050,29 @@ bool FCurlConvaihttpRequest::SetupRequestConvaihttpThread()
 			UE_DEBUG_BREAK();
 		}
 		
+		PausedDirections = 0;
+		ResumeRequestedDirections->store(0);
+
 		if (bUseReadFunction)
 		{
 			BytesSent.Reset();
 			TotalBytesSent.Reset();
 			curl_easy_setopt(EasyHandle, CURLOPT_READDATA, this);
 			curl_easy_setopt(EasyHandle, CURLOPT_READFUNCTION, StaticUploadCallback);
+
+			RequestPayload->SetDataAvailableCallback([ResumeRequestedDirections = ResumeRequestedDirections]()
+			{
+				ResumeRequestedDirections->fetch_or(CURLPAUSE_SEND);
+			});
+		}
+
+		bResponseBodySinkFinished = false;
+		if (ResponseBodySink.IsValid())
+		{
+			ResponseBodySink->SetReadyForDataCallback([ResumeRequestedDirections = ResumeRequestedDirections]()
+			{
+				ResumeRequestedDirections->fetch_or(CURLPAUSE_RECV);
+			});
 		}
 
 		// set up header function to receive response headers
@@ -1028,6 +1210,9 @@ bool FCurlConvaihttpRequest::ProcessRequest()
 		QUICK_SCOPE_CYCLE_COUNTER(STAT_CurlConvaihttpAddThreadedRequest);
 		// Mark as in-flight to prevent overlapped requests using the same object
 		CompletionStatus = EConvaihttpRequestStatus::Processing;
+		QueuedTimeAbsoluteSeconds = FPlatformTime::Seconds();
+		StartedTimeAbsoluteSeconds = 0.0;
+		CONVAIHTTP_TRACE_EVENT(this, Queued);
 		// Add to global list while being processed so that the ref counted request does not get deleted
 		FConvaihttpModule::Get().GetConvaihttpManager().AddThreadedRequest(SharedThis(this));
 
@@ -1043,6 +1228,8 @@ bool FCurlConvaihttpRequest::StartThreadedRequest()
 	ElapsedTime = 0.0f;
 	TimeSinceLastResponse = 0.0f;
 	bAnyConvaihttpActivity = false;
+	StartedTimeAbsoluteSeconds = FPlatformTime::Seconds();
+	bTracedFirstByte = false;
 	
 	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: request (easy handle:%p) has started threaded processing"), this, EasyHandle);
 
@@ -1058,16 +1245,20 @@ bool FCurlConvaihttpRequest::IsThreadedRequestComplete()
 {
 	if (bCanceled)
 	{
+		FinishResponseBodySink(false);
 		return true;
 	}
 	
-	if (bCurlRequestCompleted && ElapsedTime >= FConvaihttpModule::Get().GetConvaihttpDelayTime())
+	if (bCurlRequestCompleted)
 	{
-		return true;
+		// Only complete once the sink is done with the body, without counting the wait towards the timeout
+		const bool bSinkFlushed = FinishResponseBodySink(CurlCompletionResult == CURLE_OK && HasSuccessfulResponseCode());
+		return bSinkFlushed && ElapsedTime >= FConvaihttpModule::Get().GetConvaihttpDelayTime();
 	}
 
 	if (CurlAddToMultiResult != CURLM_OK)
 	{
+		FinishResponseBodySink(false);
 		return true;
 	}
 
@@ -1080,6 +1271,8 @@ bool FCurlConvaihttpRequest::IsThreadedRequestComplete()
 	if (bTimedOut)
 	{
 		UE_LOG(LogConvaihttp, Warning, TEXT("%p: CONVAIHTTP request timed out after %0.2f seconds URL=%s"), this, TimeSinceLastResponse, *GetURL());
+		FConvaihttpMetrics::Get().RecordTimeout(GetURL());
+		FinishResponseBodySink(false);
 		return true;
 	}
 
@@ -1089,7 +1282,60 @@ bool FCurlConvaihttpRequest::IsThreadedRequestComplete()
 void FCurlConvaihttpRequest::TickThreadedRequest(float DeltaSeconds)
 {
 	ElapsedTime += DeltaSeconds;
-	TimeSinceLastResponse += DeltaSeconds;
+
+	// A transfer we paused ourselves is waiting on this side of the connection, so it doesn't count towards the timeout
+	if (PausedDirections == 0)
+	{
+		TimeSinceLastResponse += DeltaSeconds;
+	}
+
+	ResumePausedTransfer();
+}
+
+void FCurlConvaihttpRequest::ResumePausedTransfer()
+{
+	if (PausedDirections == 0 || bCurlRequestCompleted)
+	{
+		return;
+	}
+
+	const int32 DirectionsToResume = PausedDirections & ResumeRequestedDirections->load();
+	if (DirectionsToResume != 0)
+	{
+		QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpRequest_ResumePausedTransfer);
+
+		ResumeRequestedDirections->fetch_and(~DirectionsToResume);
+		PausedDirections &= ~DirectionsToResume;
+		UE_LOG(LogConvaihttp, VeryVerbose, TEXT("%p: resuming transfer (resumed directions 0x%x, still paused 0x%x)"), this, DirectionsToResume, PausedDirections);
+
+		// May call back into the read/write callbacks, which can pause again
+		const CURLcode PauseResult = curl_easy_pause(EasyHandle, PausedDirections);
+		if (PauseResult != CURLE_OK)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: failed to resume transfer, libcurl error: %d (%s)"), this, (int32)PauseResult, ANSI_TO_TCHAR(curl_easy_strerror(PauseResult)));
+		}
+	}
+}
+
+bool FCurlConvaihttpRequest::HasSuccessfulResponseCode() const
+{
+	long ConvaihttpCode = 0;
+	return CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_RESPONSE_CODE, &ConvaihttpCode) && EConvaihttpResponseCodes::IsOk(ConvaihttpCode);
+}
+
+bool FCurlConvaihttpRequest::FinishResponseBodySink(bool bSucceeded)
+{
+	if (!ResponseBodySink.IsValid())
+	{
+		return true;
+	}
+
+	if (!bResponseBodySinkFinished)
+	{
+		bResponseBodySinkFinished = true;
+		ResponseBodySink->Finish(bSucceeded);
+	}
+	return ResponseBodySink->IsFlushed();
 }
 
 void FCurlConvaihttpRequest::CancelRequest()
@@ -1174,23 +1420,180 @@ void FCurlConvaihttpRequest::BroadcastNewlyReceivedHeaders()
 			const FString& HeaderKey = NewHeader.Key;
 			const FString& HeaderValue = NewHeader.Value;
 
-			FString NewValue;
-			FString* PreviousValue = Response->Headers.Find(HeaderKey);
-			if (PreviousValue != nullptr && !PreviousValue->IsEmpty())
 			{
-				constexpr const int32 SeparatorLength = 2; // Length of ", "
-				NewValue = MoveTemp(*PreviousValue);
-				NewValue.Reserve(NewValue.Len() + SeparatorLength + HeaderValue.Len());
-				NewValue += TEXT(", ");
+				LLM_SCOPE_BYTAG(Convaihttp_Headers);
+				FString NewValue;
+				FString* PreviousValue = Response->Headers.Find(HeaderKey);
+				if (PreviousValue != nullptr && !PreviousValue->IsEmpty())
+				{
+					constexpr const int32 SeparatorLength = 2; // Length of ", "
+					NewValue = MoveTemp(*PreviousValue);
+					NewValue.Reserve(NewValue.Len() + SeparatorLength + HeaderValue.Len());
+					NewValue += TEXT(", ");
+				}
+				NewValue += HeaderValue;
+				Response->Headers.Add(HeaderKey, MoveTemp(NewValue));
+				Response->HeadersMemory.Set(GetHeadersAllocatedSize(Response->Headers));
 			}
-			NewValue += HeaderValue;
-			Response->Headers.Add(HeaderKey, MoveTemp(NewValue));
 
 			OnHeaderReceived().ExecuteIfBound(SharedThis(this), NewHeader.Key, NewHeader.Value);
 		}
 	}
 }
 
+namespace
+{
+	/**
+	 * Read a time from libcurl
+	 *
+	 * @return the time in seconds, or -1 if libcurl doesn't know it
+	 */
+	double GetCurlTimeSeconds(CURL* EasyHandle, CURLINFO Info)
+	{
+		curl_off_t Microseconds = 0;
+		if (CURLE_OK == curl_easy_getinfo(EasyHandle, Info, &Microseconds) && Microseconds > 0)
+		{
+			return static_cast<double>(Microseconds) / 1000000.0;
+		}
+		return -1.0;
+	}
+}
+
+void FCurlConvaihttpRequest::TraceFirstByte()
+{
+	bTracedFirstByte = true;
+
+	const uint64 NowCycles = FPlatformTime::Cycles64();
+	const double NowSeconds = FPlatformTime::Seconds();
+
+	// libcurl only knows when the connection was made relative to the start of the transfer, a reused connection counts as made at the start
+	if (StartedTimeAbsoluteSeconds > 0.0)
+	{
+		const double ConnectSeconds = FMath::Max(GetCurlTimeSeconds(EasyHandle, CURLINFO_CONNECT_TIME_T), 0.0);
+		const double SecondsSinceConnected = FMath::Clamp(NowSeconds - (StartedTimeAbsoluteSeconds + ConnectSeconds), 0.0, NowSeconds - StartedTimeAbsoluteSeconds);
+		const uint64 CyclesSinceConnected = static_cast<uint64>(SecondsSinceConnected / FPlatformTime::GetSecondsPerCycle64());
+		FConvaihttpTrace::Event(this, EConvaihttpTraceEvent::Connected, 0, NowCycles - FMath::Min(CyclesSinceConnected, NowCycles));
+	}
+	FConvaihttpTrace::Event(this, EConvaihttpTraceEvent::FirstByte, 0, NowCycles);
+}
+
+void FCurlConvaihttpRequest::SampleIfSlow()
+{
+	const FConvaihttpResponseTimings& Timings = Response->Timings;
+	// Time spent queued counts, waiting for a slot to send the request is a large part of tail latency
+	const double TransferSeconds = Timings.bIsValid && Timings.TotalSeconds >= 0.0 ? Timings.TotalSeconds : ElapsedTime;
+	const double QueueWaitSeconds = Timings.bIsValid ? FMath::Max(Timings.QueueWaitSeconds, 0.0) : 0.0;
+	const double TotalSeconds = QueueWaitSeconds + TransferSeconds;
+	FConvaihttpSlowRequestSampler& Sampler = FConvaihttpSlowRequestSampler::Get();
+	if (!Sampler.ShouldSample(TotalSeconds))
+	{
+		return;
+	}
+
+	FConvaihttpSlowRequestSample Sample;
+	Sample.Timestamp = FDateTime::UtcNow();
+	Sample.Verb = GetVerb();
+	Sample.Url = GetURL();
+	Sample.Status = CompletionStatus;
+	Sample.ResponseCode = Response->ConvaihttpCode;
+	Sample.TotalSeconds = TotalSeconds;
+	Sample.Timings = Timings;
+	Sample.BytesSent = BytesSent.GetValue();
+	Sample.BytesReceived = Response->TotalBytesRead.GetValue();
+
+	char* PrimaryIp = nullptr;
+	if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_PRIMARY_IP, &PrimaryIp) && PrimaryIp != nullptr)
+	{
+		Sample.RemoteAddress = ANSI_TO_TCHAR(PrimaryIp);
+	}
+	long Port = 0;
+	if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_PRIMARY_PORT, &Port))
+	{
+		Sample.RemotePort = static_cast<int32>(Port);
+	}
+	if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_LOCAL_PORT, &Port))
+	{
+		Sample.LocalPort = static_cast<int32>(Port);
+	}
+
+	{
+		const FScopeLock CacheLock(&InfoMessageCacheCriticalSection);
+		for (int32 i = 0; i < InfoMessageCache.Num(); ++i)
+		{
+			const FString& InfoMessage = InfoMessageCache[(LeastRecentlyCachedInfoMessageIndex + i) % InfoMessageCache.Num()];
+			if (InfoMessage.Len() > 0)
+			{
+				Sample.InfoMessages.Add(InfoMessage);
+			}
+		}
+	}
+
+	Sampler.AddSample(MoveTemp(Sample));
+}
+
+void FCurlConvaihttpRequest::ReadResponseTimings()
+{
+	FConvaihttpResponseTimings& Timings = Response->Timings;
+	Timings = FConvaihttpResponseTimings();
+	Timings.bIsValid = true;
+
+	if (QueuedTimeAbsoluteSeconds > 0.0 && StartedTimeAbsoluteSeconds >= QueuedTimeAbsoluteSeconds)
+	{
+		Timings.QueueWaitSeconds = StartedTimeAbsoluteSeconds - QueuedTimeAbsoluteSeconds;
+	}
+
+	// The _T variants are in microseconds, and don't lose precision like the double ones
+	Timings.NameLookupSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_NAMELOOKUP_TIME_T);
+	Timings.ConnectSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_CONNECT_TIME_T);
+	Timings.TlsHandshakeSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_APPCONNECT_TIME_T);
+	Timings.PreTransferSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_PRETRANSFER_TIME_T);
+	Timings.FirstByteSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_STARTTRANSFER_TIME_T);
+	Timings.TotalSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_TOTAL_TIME_T);
+	Timings.RedirectSeconds = GetCurlTimeSeconds(EasyHandle, CURLINFO_REDIRECT_TIME_T);
+
+	long NumRedirects = 0;
+	if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_REDIRECT_COUNT, &NumRedirects))
+	{
+		Timings.NumRedirects = static_cast<int32>(NumRedirects);
+	}
+
+	// No new connection was needed if one was reused
+	long NumConnects = 0;
+	if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_NUM_CONNECTS, &NumConnects))
+	{
+		Timings.bConnectionReused = NumConnects == 0 && Response->ConvaihttpCode > 0;
+	}
+
+	long ConvaihttpVersion = CURL_HTTP_VERSION_NONE;
+	if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_HTTP_VERSION, &ConvaihttpVersion))
+	{
+		switch (ConvaihttpVersion)
+		{
+		case CURL_HTTP_VERSION_1_0:
+			Timings.Version = EConvaihttpVersion::Http1_0;
+			break;
+		case CURL_HTTP_VERSION_1_1:
+			Timings.Version = EConvaihttpVersion::Http1_1;
+			break;
+		case CURL_HTTP_VERSION_2_0:
+			Timings.Version = EConvaihttpVersion::Http2;
+			break;
+#if LIBCURL_VERSION_NUM >= 0x074200
+		case CURL_HTTP_VERSION_3:
+			Timings.Version = EConvaihttpVersion::Http3;
+			break;
+#endif
+		default:
+			Timings.Version = EConvaihttpVersion::Unknown;
+			break;
+		}
+	}
+
+	UE_LOG(LogConvaihttp, VeryVerbose, TEXT("%p: timings: queue %.3fs, dns %.3fs, connect %.3fs, tls %.3fs, pretransfer %.3fs, first byte %.3fs, total %.3fs, redirect %.3fs (%d), reused %d"),
+		this, Timings.QueueWaitSeconds, Timings.NameLookupSeconds, Timings.ConnectSeconds, Timings.TlsHandshakeSeconds, Timings.PreTransferSeconds,
+		Timings.FirstByteSeconds, Timings.TotalSeconds, Timings.RedirectSeconds, Timings.NumRedirects, Timings.bConnectionReused ? 1 : 0);
+}
+
 void FCurlConvaihttpRequest::FinishedRequest()
 {
 	check(IsInGameThread());
@@ -1224,6 +1627,8 @@ void FCurlConvaihttpRequest::FinishedRequest()
 				Response->ContentLength = Response->TotalBytesRead.GetValue();
 			}
 
+			ReadResponseTimings();
+
 			if (Response->ConvaihttpCode <= 0 && URL.StartsWith(TEXT("Convaihttp"), ESearchCase::IgnoreCase))
 			{
 				UE_LOG(LogConvaihttp, Warning, TEXT("%p: invalid CONVAIHTTP response code received. URL: %s, CONVAIHTTP code: %d, content length: %d, actual payload size: %d"),
@@ -1232,6 +1637,19 @@ void FCurlConvaihttpRequest::FinishedRequest()
 			}
 		}
 	}
+	else if (Response.IsValid())
+	{
+		// A transfer we stopped (e.g. timed out) may still have received a status line, which tells what its partial body is
+		long ConvaihttpCode = 0;
+		if (CURLE_OK == curl_easy_getinfo(EasyHandle, CURLINFO_RESPONSE_CODE, &ConvaihttpCode))
+		{
+			Response->ConvaihttpCode = ConvaihttpCode;
+		}
+		if (StartedTimeAbsoluteSeconds > 0.0)
+		{
+			ReadResponseTimings();
+		}
+	}
 	
 	// if just finished, mark as stopped async processing
 	if (Response.IsValid())
@@ -1282,6 +1700,11 @@ void FCurlConvaihttpRequest::FinishedRequest()
 		CompletionStatus = EConvaihttpRequestStatus::Succeeded;
 		// Broadcast any headers we haven't broadcast yet
 		BroadcastNewlyReceivedHeaders();
+		SampleIfSlow();
+		if (FConvaihttpTrafficCapture::IsCapturing())
+		{
+			FConvaihttpTrafficCapture::Record(*this, RequestPayload.IsValid() ? RequestPayload->GetContentView() : FCompositeBuffer(), Response.Get(), QueuedTimeAbsoluteSeconds);
+		}
 		// Call delegate with valid request/response objects
 		OnProcessRequestComplete().ExecuteIfBound(SharedThis(this),Response,true);
 	}
@@ -1342,6 +1765,14 @@ void FCurlConvaihttpRequest::FinishedRequest()
 				CompletionStatus = EConvaihttpRequestStatus::Failed_ConnectionError;
 			}
 		}
+		if (Response.IsValid())
+		{
+			SampleIfSlow();
+		}
+		if (FConvaihttpTrafficCapture::IsCapturing())
+		{
+			FConvaihttpTrafficCapture::Record(*this, RequestPayload.IsValid() ? RequestPayload->GetContentView() : FCompositeBuffer(), Response.Get(), QueuedTimeAbsoluteSeconds);
+		}
 		// Call delegate with failure
 		OnProcessRequestComplete().ExecuteIfBound(SharedThis(this), Response, false);
 
@@ -1450,4 +1881,24 @@ FString FCurlConvaihttpResponse::GetContentAsString() const
 	return FString(TCHARData.Length(), TCHARData.Get());
 }
 
+TArray64<uint8> FCurlConvaihttpResponse::TakeContent()
+{
+	if (!bIsReady)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Can't take payload. Response still processing. %p"), &Request);
+		return TArray64<uint8>();
+	}
+	PayloadMemory.Set(0);
+	return MoveTemp(Payload);
+}
+
+FConvaihttpResponseTimings FCurlConvaihttpResponse::GetTimings() const
+{
+	if (!bIsReady)
+	{
+		return FConvaihttpResponseTimings();
+	}
+	return Timings;
+}
+
 #endif //WITH_CURL
@@ -7,8 +7,10 @@
 #include "IConvaihttpThreadedRequest.h"
 #include "Containers/Queue.h"
 #include "GenericPlatform/ConvaihttpRequestPayload.h"
+#include "ConvaihttpMemory.h"
 #include "HAL/ThreadSafeBool.h"
 #include "ConvaiThreadSafeCounter.h"
+#include <atomic>
 class FCurlConvaihttpResponse;
 
 #if WITH_CURL
@@ -53,7 +55,10 @@ namespace
 	*/
 	void* CurlMalloc(size_t Size)
 	{
-		return FMemory::Malloc(Size);
+		LLM_SCOPE_BYTAG(Convaihttp_Curl);
+		void* Return = FMemory::Malloc(Size);
+		FConvaihttpMemory::AddAllocation(EConvaihttpMemoryCategory::Curl, Return);
+		return Return;
 	}
 
 	/**
@@ -63,6 +68,7 @@ namespace
 	*/
 	void CurlFree(void* Ptr)
 	{
+		FConvaihttpMemory::RemoveAllocation(EConvaihttpMemoryCategory::Curl, Ptr);
 		FMemory::Free(Ptr);
 	}
 
@@ -79,7 +85,11 @@ namespace
 
 		if (Size)
 		{
+			LLM_SCOPE_BYTAG(Convaihttp_Curl);
+			FConvaihttpMemory::RemoveAllocation(EConvaihttpMemoryCategory::Curl, Ptr);
 			Return = FMemory::Realloc(Ptr, Size);
+			// A failed realloc leaves the old allocation in place
+			FConvaihttpMemory::AddAllocation(EConvaihttpMemoryCategory::Curl, Return ? Return : Ptr);
 		}
 
 		return Return;
@@ -98,7 +108,7 @@ namespace
 		if (ZeroTerminatedString)
 		{
 			SIZE_T StrLen = FCStringAnsi::Strlen(ZeroTerminatedString);
-			Copy = reinterpret_cast<char*>(FMemory::Malloc(StrLen + 1));
+			Copy = reinterpret_cast<char*>(CurlMalloc(StrLen + 1));
 			if (Copy)
 			{
 				FCStringAnsi::Strcpy(Copy, StrLen, ZeroTerminatedString);
@@ -121,7 +131,7 @@ namespace
 		const size_t Size = NumElems * ElemSize;
 		if (Size)
 		{
-			Return = FMemory::Malloc(Size);
+			Return = CurlMalloc(Size);
 
 			if (Return)
 			{
@@ -159,9 +169,13 @@ public:
 	virtual void SetURL(const FString& InURL) override;
 	virtual void SetContent(const TArray64<uint8>& ContentPayload) override;
 	virtual void SetContent(TArray64<uint8>&& ContentPayload) override;
+	virtual void SetContent(const FSharedBuffer& ContentPayload) override;
+	virtual void SetContent(const FCompositeBuffer& ContentPayload) override;
 	virtual void SetContentAsString(const FString& ContentString) override;
 	virtual bool SetContentAsStreamedFile(const FString& Filename) override;
 	virtual bool SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override;
+	virtual bool SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source) override;
+	virtual bool SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink) override;
 	virtual void SetHeader(const FString& HeaderName, const FString& HeaderValue) override;
 	virtual void AppendToHeader(const FString& HeaderName, const FString& AdditionalHeaderValue) override;
 	virtual bool ProcessRequest() override;
@@ -179,12 +193,28 @@ public:
 	virtual void TickThreadedRequest(float DeltaSeconds) override;
 	//~ End IConvaihttpRequestThreaded Interface
 
+	/**
+	 * Perform the game-thread setup of the request
+	 *
+	 * @return true if the request was successfully setup
+	 */
+	virtual bool SetupRequest();
+
 	/**
 	 * Perform the convaihttp-thread setup of the request
 	 *
 	 * @return true if the request was successfully setup
 	 */
-	bool SetupRequestConvaihttpThread();
+	virtual bool SetupRequestConvaihttpThread();
+
+	/**
+	 * Whether the easy handle must stay in the curl multi once its transfer is done, because the request keeps using
+	 * the connection (CURLOPT_CONNECT_ONLY). It is then removed when the request completes.
+	 */
+	virtual bool KeepsConnectionAfterTransfer() const
+	{
+		return false;
+	}
 
 	/**
 	 * Returns libcurl's easy handle - needed for CONVAIHTTP manager.
@@ -337,19 +367,27 @@ private:
 	 */
 	size_t DebugCallback(CURL * Handle, curl_infotype DebugInfoType, char * DebugInfo, size_t DebugInfoSize);
 
-	/**
-	 * Perform the game-thread setup of the request
-	 *
-	 * @return true if the request was successfully setup
-	 */
-	bool SetupRequest();
-
 	/**
 	 * Process state for a finished request that no longer needs to be ticked
 	 * Calls the completion delegate
 	 */
 	void FinishedRequest();
 
+	/**
+	 * Read the timings of the transfer from libcurl into the response
+	 */
+	void ReadResponseTimings();
+
+	/**
+	 * Trace the first byte of the response, and the connection to the host from the timings of libcurl
+	 */
+	void TraceFirstByte();
+
+	/**
+	 * Offer the diagnostics of the request to the slow request sampler if it took long enough
+	 */
+	void SampleIfSlow();
+
 	/**
 	 * Trigger the request progress delegate if progress has changed
 	 */
@@ -360,8 +398,24 @@ private:
 
 	/** Combine a header's key/value in the format "Key: Value" */
 	static FString CombineHeaderKeyValue(const FString& HeaderKey, const FString& HeaderValue);
+
+	/** Unpause any direction of the transfer whose producer or consumer signalled it can make progress. Called on the CONVAIHTTP thread */
+	void ResumePausedTransfer();
+
+	/** @return true if the response received so far has a 2xx code, whose body goes to the response body sink. Called on the CONVAIHTTP thread */
+	bool HasSuccessfulResponseCode() const;
+
+	/**
+	 * Tell the response body sink the transfer is over, if it wasn't already. Called on the CONVAIHTTP thread
+	 *
+	 * @return true if there is no sink, or it is done with the body
+	 */
+	bool FinishResponseBodySink(bool bSucceeded);
 	
-private:
+protected:
+
+	/** Remove a header, keeping HeadersMemory in step with Headers */
+	void RemoveHeader(const FString& HeaderName);
 
 	/** Pointer to an easy handle specific to this request */
 	CURL *			EasyHandle;	
@@ -387,12 +441,26 @@ private:
 	TUniquePtr<FCH_RequestPayload> RequestPayload;
 	/** Is the request payload seekable? */
 	bool bIsRequestPayloadSeekable = false;
+	/** Optional consumer of the response body. When set, the body isn't accumulated in the response */
+	TSharedPtr<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> ResponseBodySink;
+	/** Set once ResponseBodySink was told the transfer is over. Only accessed on the CONVAIHTTP thread */
+	bool bResponseBodySinkFinished = false;
 	/** Current status of request being processed */
 	EConvaihttpRequestStatus::Type CompletionStatus;
 	/** Mapping of header section to values. */
 	TMap<FString, FString> Headers;
+	/** Memory held by Headers */
+	FConvaihttpTrackedMemory HeadersMemory{ EConvaihttpMemoryCategory::Headers };
+	/** Memory held by RequestPayload */
+	FConvaihttpTrackedMemory RequestPayloadMemory{ EConvaihttpMemoryCategory::RequestPayload };
 	/** Total elapsed time in seconds since the start of the request */
 	float ElapsedTime;
+	/** Time the request was queued for the CONVAIHTTP thread */
+	double QueuedTimeAbsoluteSeconds = 0.0;
+	/** Time the CONVAIHTTP thread started the request, written on the CONVAIHTTP thread before the request is added to the multi */
+	double StartedTimeAbsoluteSeconds = 0.0;
+	/** Set once the first byte of the response was traced. Only accessed on the CONVAIHTTP thread */
+	bool bTracedFirstByte = false;
 	/** Elapsed time since the last received CONVAIHTTP response. */
 	float TimeSinceLastResponse;
 	/** Have we had any CONVAIHTTP activity with the host? Sending headers, SSL handshake, etc */
@@ -413,6 +481,10 @@ private:
 	FCriticalSection InfoMessageCacheCriticalSection;
 	/** Cache of info messages from libcurl */
 	TArray<FString, TFixedAllocator<NumberOfInfoMessagesToCache>> InfoMessageCache;
+	/** Directions (CURLPAUSE_SEND / CURLPAUSE_RECV) libcurl has paused because a callback returned a pause code. Only accessed on the CONVAIHTTP thread */
+	int32 PausedDirections;
+	/** Directions that can make progress again. Shared with the payload and response consumers, which may set it from any thread */
+	TSharedRef<std::atomic<int32>, ESPMode::ThreadSafe> ResumeRequestedDirections;
 };
 
 /**
@@ -443,6 +515,8 @@ public:
 	//~ Begin IConvaihttpResponse Interface
 	virtual int32 GetResponseCode() const override;
 	virtual FString GetContentAsString() const override;
+	virtual TArray64<uint8> TakeContent() override;
+	virtual FConvaihttpResponseTimings GetTimings() const override;
 	//~ End IConvaihttpResponse Interface
 
 	/**
@@ -461,10 +535,14 @@ private:
 
 	/** BYTE array to fill in as the response is read via didReceiveData */
 	TArray64<uint8> Payload;
+	/** Memory held by Payload */
+	FConvaihttpTrackedMemory PayloadMemory{ EConvaihttpMemoryCategory::ResponsePayload };
 	/** Caches how many bytes of the response we've read so far */
 	FConvaiThreadSafeCounter TotalBytesRead;
 	/** Cached key/value header pairs. Parsed once request completes. Only accessible on the game thread. */
 	TMap<FString, FString> Headers;
+	/** Memory held by Headers */
+	FConvaihttpTrackedMemory HeadersMemory{ EConvaihttpMemoryCategory::Headers };
 	/** Newly received headers we need to inform listeners about */
 	TQueue<TPair<FString, FString>> NewlyReceivedHeaders;
 	/** Cached code from completed response */
@@ -475,6 +553,8 @@ private:
 	int32 volatile bIsReady;
 	/** True if the response was successfully received/processed */
 	int32 volatile bSucceeded;
+	/** Timings of the transfer, read from libcurl once it is over */
+	FConvaihttpResponseTimings Timings;
 };
 
 #endif //WITH_CURL
@@ -14,6 +14,7 @@
 #include "Misc/LocalTimestampDirectoryVisitor.h"
 #include "Misc/Paths.h"
 #include "Misc/Fork.h"
+#include "Misc/ScopeRWLock.h"
 
 #include "Curl/CurlConvaihttpThread.h"
 #include "Curl/CurlConvaihttp.h"
@@ -41,6 +42,8 @@ CURLSH* FCurlConvaihttpManager::GShareHandle = nullptr;
 #endif
 
 FCurlConvaihttpManager::FCurlRequestOptions FCurlConvaihttpManager::CurlRequestOptions;
+FRWLock FCurlConvaihttpManager::Http2PriorKnowledgeHostsLock;
+TSet<FString> FCurlConvaihttpManager::Http2PriorKnowledgeHosts;
 
 // set functions that will init the memory
 namespace CH_LibCryptoMemHooks
@@ -53,10 +56,12 @@ namespace CH_LibCryptoMemHooks
 	/** This malloc will init the memory, keeping valgrind happy */
 	void* MallocWithInit(size_t Size, const char* File, int Line)
 	{
+		LLM_SCOPE_BYTAG(Convaihttp_OpenSSL);
 		void* Result = FMemory::Malloc(Size);
 		if (LIKELY(Result))
 		{
 			FMemory::Memzero(Result, Size);
+			FConvaihttpMemory::AddAllocation(EConvaihttpMemoryCategory::OpenSSL, Result);
 		}
 
 		return Result;
@@ -65,12 +70,18 @@ namespace CH_LibCryptoMemHooks
 	/** This realloc will init the memory, keeping valgrind happy */
 	void* ReallocWithInit(void* Ptr, const size_t Size, const char* File, int Line)
 	{
+		LLM_SCOPE_BYTAG(Convaihttp_OpenSSL);
 		size_t CurrentUsableSize = FMemory::GetAllocSize(Ptr);
 		void* Result = FMemory::Realloc(Ptr, Size);
 		if (LIKELY(Result) && CurrentUsableSize < Size)
 		{
 			FMemory::Memzero(reinterpret_cast<uint8 *>(Result) + CurrentUsableSize, Size - CurrentUsableSize);
 		}
+		if (LIKELY(Result) || Size == 0)
+		{
+			FConvaihttpMemory::Add(EConvaihttpMemoryCategory::OpenSSL, -static_cast<int64>(CurrentUsableSize));
+			FConvaihttpMemory::AddAllocation(EConvaihttpMemoryCategory::OpenSSL, Result);
+		}
 
 		return Result;
 	}
@@ -78,6 +89,7 @@ namespace CH_LibCryptoMemHooks
 	/** This realloc will init the memory, keeping valgrind happy */
 	void Free(void* Ptr, const char* File, int Line)
 	{
+		FConvaihttpMemory::RemoveAllocation(EConvaihttpMemoryCategory::OpenSSL, Ptr);
 		return FMemory::Free(Ptr);
 	}
 
@@ -115,6 +127,25 @@ bool FCurlConvaihttpManager::IsInit()
 	return GMultiHandle != nullptr;
 }
 
+void FCurlConvaihttpManager::SetHttp2PriorKnowledge(const FString& HostAndPort, bool bEnabled)
+{
+	FRWScopeLock ScopeLock(Http2PriorKnowledgeHostsLock, SLT_Write);
+	if (bEnabled)
+	{
+		Http2PriorKnowledgeHosts.Add(HostAndPort);
+	}
+	else
+	{
+		Http2PriorKnowledgeHosts.Remove(HostAndPort);
+	}
+}
+
+bool FCurlConvaihttpManager::UsesHttp2PriorKnowledge(const FString& Url)
+{
+	FRWScopeLock ScopeLock(Http2PriorKnowledgeHostsLock, SLT_ReadOnly);
+	return Http2PriorKnowledgeHosts.Num() > 0 && Http2PriorKnowledgeHosts.Contains(FPlatformConvaihttp::GetUrlDomainAndPort(Url));
+}
+
 void FCurlConvaihttpManager::InitCurl()
 {
 	if (IsInit())
@@ -258,6 +289,13 @@ void FCurlConvaihttpManager::InitCurl()
 	
 	GConfig->GetBool(TEXT("CONVAIHTTP.Curl"), TEXT("bAllowSeekFunction"), CurlRequestOptions.bAllowSeekFunction, GEngineIni);
 
+	TArray<FString> ConfigHttp2PriorKnowledgeHosts;
+	GConfig->GetArray(TEXT("CONVAIHTTP.Curl"), TEXT("Http2PriorKnowledgeHosts"), ConfigHttp2PriorKnowledgeHosts, GEngineIni);
+	for (const FString& HostAndPort : ConfigHttp2PriorKnowledgeHosts)
+	{
+		SetHttp2PriorKnowledge(HostAndPort, true);
+	}
+
 	CurlRequestOptions.MaxHostConnections = FConvaihttpModule::Get().GetConvaihttpMaxConnectionsPerServer();
 	if (CurlRequestOptions.MaxHostConnections > 0)
 	{
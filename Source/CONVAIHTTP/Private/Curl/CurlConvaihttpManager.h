@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "ConvaihttpManager.h"
+#include "HAL/CriticalSection.h"
 
 class FConvaihttpThread;
 
@@ -61,6 +62,19 @@ public:
 	}
 	CurlRequestOptions;
 
+	/**
+	 * Speak HTTP/2 over cleartext to a server without asking it to upgrade (h2c with prior knowledge), for local servers
+	 * known to support it, e.g. the loopback server of the load tests. Hosts are also read from [CONVAIHTTP.Curl]
+	 * Http2PriorKnowledgeHosts. Needs a libcurl built with nghttp2
+	 *
+	 * @param HostAndPort - "host:port" of the server
+	 * @param bEnabled - whether requests to it use HTTP/2 with prior knowledge
+	 */
+	static void SetHttp2PriorKnowledge(const FString& HostAndPort, bool bEnabled);
+
+	/** @return true if requests to a url are sent with HTTP/2 with prior knowledge */
+	static bool UsesHttp2PriorKnowledge(const FString& Url);
+
 	//~ Begin ConvaihttpManager Interface
 	virtual void OnBeforeFork() override;
 	virtual void OnAfterFork() override;
@@ -72,6 +86,11 @@ public:
 protected:
 	virtual FConvaihttpThread* CreateConvaihttpThread() override;
 	//~ End ConvaihttpManager Interface
+
+private:
+	/** Hosts set with SetHttp2PriorKnowledge, read from the CONVAIHTTP thread */
+	static FRWLock Http2PriorKnowledgeHostsLock;
+	static TSet<FString> Http2PriorKnowledgeHosts;
 };
 
 #endif //WITH_CURL 
@@ -17,7 +17,8 @@ void FCurlConvaihttpThread::ConvaihttpThreadTick(float DeltaSeconds)
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpThread_ConvaihttpThreadTick);
 	check(FCurlConvaihttpManager::IsInit());
 
-	if (RunningThreadedRequests.Num() > 0)
+	// Simulated requests run alongside, only the requests added to the multi handle are transferred by libcurl
+	if (HandlesToRequests.Num() > 0)
 	{
 		int RunningRequests = -1;
 		{
@@ -27,7 +28,7 @@ void FCurlConvaihttpThread::ConvaihttpThreadTick(float DeltaSeconds)
 
 		// read more info if number of requests changed or if there's zero running
 		// (note that some requests might have never be "running" from libcurl's point of view)
-		if (RunningRequests == 0 || RunningRequests != RunningThreadedRequests.Num())
+		if (RunningRequests == 0 || RunningRequests != HandlesToRequests.Num())
 		{
 			for (;;)
 			{
@@ -44,7 +45,6 @@ void FCurlConvaihttpThread::ConvaihttpThreadTick(float DeltaSeconds)
 				if (Message->msg == CURLMSG_DONE)
 				{
 					CURL* CompletedHandle = Message->easy_handle;
-					curl_multi_remove_handle(FCurlConvaihttpManager::GMultiHandle, CompletedHandle);
 
 					IConvaihttpThreadedRequest** Request = HandlesToRequests.Find(CompletedHandle);
 					if (Request)
@@ -54,10 +54,20 @@ void FCurlConvaihttpThread::ConvaihttpThreadTick(float DeltaSeconds)
 
 						UE_LOG(LogConvaihttp, Verbose, TEXT("Request %p (easy handle:%p) has completed (code:%d) and has been marked as such"), CurlRequest, CompletedHandle, (int32)Message->data.result);
 
+						// libcurl closes a connect-only connection when its handle leaves the multi, so those are removed in CompleteThreadedRequest instead
+						if (CurlRequest->KeepsConnectionAfterTransfer())
+						{
+							ConnectOnlyHandles.Add(CompletedHandle);
+						}
+						else
+						{
+							curl_multi_remove_handle(FCurlConvaihttpManager::GMultiHandle, CompletedHandle);
+						}
 						HandlesToRequests.Remove(CompletedHandle);
 					}
 					else
 					{
+						curl_multi_remove_handle(FCurlConvaihttpManager::GMultiHandle, CompletedHandle);
 						UE_LOG(LogConvaihttp, Warning, TEXT("Could not find mapping for completed request (easy handle: %p)"), CompletedHandle);
 					}
 				}
@@ -70,9 +80,14 @@ void FCurlConvaihttpThread::ConvaihttpThreadTick(float DeltaSeconds)
 
 bool FCurlConvaihttpThread::StartThreadedRequest(IConvaihttpThreadedRequest* Request)
 {
+	if (Request->IsSimulated())
+	{
+		return FConvaihttpThread::StartThreadedRequest(Request);
+	}
+
 	FCurlConvaihttpRequest* CurlRequest = static_cast<FCurlConvaihttpRequest*>(Request);
 	CURL* EasyHandle = CurlRequest->GetEasyHandle();
-	ensure(!HandlesToRequests.Contains(EasyHandle));
+	ensure(!HandlesToRequests.Contains(EasyHandle) && !ConnectOnlyHandles.Contains(EasyHandle));
 
 	if (!CurlRequest->SetupRequestConvaihttpThread())
 	{
@@ -96,13 +111,17 @@ bool FCurlConvaihttpThread::StartThreadedRequest(IConvaihttpThreadedRequest* Req
 
 void FCurlConvaihttpThread::CompleteThreadedRequest(IConvaihttpThreadedRequest* Request)
 {
+	if (Request->IsSimulated())
+	{
+		return;
+	}
+
 	FCurlConvaihttpRequest* CurlRequest = static_cast<FCurlConvaihttpRequest*>(Request);
 	CURL* EasyHandle = CurlRequest->GetEasyHandle();
 
-	if (HandlesToRequests.Find(EasyHandle))
+	if (HandlesToRequests.Remove(EasyHandle) > 0 || ConnectOnlyHandles.Remove(EasyHandle) > 0)
 	{
 		curl_multi_remove_handle(FCurlConvaihttpManager::GMultiHandle, EasyHandle);
-		HandlesToRequests.Remove(EasyHandle);
 	}
 }
 
@@ -52,6 +52,12 @@ protected:
 
 	/** Mapping of libcurl easy handles to CONVAIHTTP requests */
 	TMap<CURL*, IConvaihttpThreadedRequest*> HandlesToRequests;
+
+	/**
+	 * Easy handles of connect-only transfers that are over, left in the multi handle so libcurl keeps their connection
+	 * until the request completes. Kept out of HandlesToRequests, which must only count transfers libcurl is running
+	 */
+	TSet<CURL*> ConnectOnlyHandles;
 };
 
 
@@ -0,0 +1,546 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "Curl/CurlConvaihttpWebSocket.h"
+
+#if WITH_CURL_WEBSOCKETS
+#include "Convaihttp.h"
+#include "Stats/Stats.h"
+
+namespace CurlConvaihttpWebSocket
+{
+	/** Size received at once when the size of the next frame isn't known yet */
+	static constexpr int64 ReceiveBlockSize = 4096;
+	/** Largest size received at once, so a huge frame doesn't reserve all its memory before it arrives */
+	static constexpr int64 MaxReceiveSize = 16 * 1024 * 1024;
+	/** Longest close reason allowed, to fit a control frame */
+	static constexpr int32 MaxCloseReasonLength = 123;
+	/** Close status code reported when the connection is lost without a close frame */
+	static constexpr int32 AbnormalClosureStatusCode = 1006;
+	/** Close status code reported when the peer's close frame has no status */
+	static constexpr int32 NoStatusReceivedStatusCode = 1005;
+}
+
+FCurlConvaihttpWebSocket::FCurlConvaihttpWebSocket(const FString& InURL, const TArray<FString>& InProtocols, const TMap<FString, FString>& InUpgradeHeaders)
+	: Protocols(InProtocols)
+{
+	SetURL(InURL);
+	SetVerb(TEXT("GET"));
+	for (const TPair<FString, FString>& Header : InUpgradeHeaders)
+	{
+		SetHeader(Header.Key, Header.Value);
+	}
+	if (Protocols.Num() > 0)
+	{
+		SetHeader(TEXT("Sec-WebSocket-Protocol"), FString::Join(Protocols, TEXT(", ")));
+	}
+}
+
+FCurlConvaihttpWebSocket::~FCurlConvaihttpWebSocket()
+{
+}
+
+bool FCurlConvaihttpWebSocket::IsSupported()
+{
+	// Builds of libcurl without WebSocket support still export curl_ws_recv/curl_ws_send, so check what this one can do
+	static const bool bIsSupported = []()
+	{
+		const curl_version_info_data* VersionInfo = curl_version_info(CURLVERSION_NOW);
+		if (VersionInfo && VersionInfo->protocols)
+		{
+			for (const char* const* Protocol = VersionInfo->protocols; *Protocol; ++Protocol)
+			{
+				if (FCStringAnsi::Stricmp(*Protocol, "ws") == 0)
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}();
+	return bIsSupported;
+}
+
+void FCurlConvaihttpWebSocket::Connect()
+{
+	check(IsInGameThread());
+
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: Connect() called on a WebSocket that is already connecting or connected"), this);
+		return;
+	}
+
+	bConnected = false;
+	bCloseQueued = false;
+	bClosedDelivered = false;
+
+	if (!ProcessRequest())
+	{
+		bClosedDelivered = true;
+		ConnectionErrorDelegate.ExecuteIfBound(TEXT("Could not start the handshake"));
+	}
+}
+
+void FCurlConvaihttpWebSocket::Close(int32 StatusCode, const FString& Reason)
+{
+	check(IsInGameThread());
+
+	if (bCloseQueued || bClosedDelivered || CompletionStatus != EConvaihttpRequestStatus::Processing)
+	{
+		return;
+	}
+
+	if (!bConnected)
+	{
+		// Still in the handshake, there is no connection to close yet
+		CancelRequest();
+		return;
+	}
+
+	bCloseQueued = true;
+
+	FTCHARToUTF8 ReasonUtf8(*Reason);
+	const int32 ReasonLength = FMath::Min(ReasonUtf8.Length(), CurlConvaihttpWebSocket::MaxCloseReasonLength);
+	if (ReasonLength < ReasonUtf8.Length())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket close reason truncated to %d bytes"), this, ReasonLength);
+	}
+
+	// Status code in network order, followed by the reason
+	FUniqueBuffer Payload = FUniqueBuffer::Alloc(2 + ReasonLength);
+	uint8* PayloadBytes = static_cast<uint8*>(Payload.GetData());
+	PayloadBytes[0] = static_cast<uint8>((StatusCode >> 8) & 0xff);
+	PayloadBytes[1] = static_cast<uint8>(StatusCode & 0xff);
+	FMemory::Memcpy(PayloadBytes + 2, ReasonUtf8.Get(), ReasonLength);
+
+	OutgoingFrames.Enqueue(FOutgoingFrame{ Payload.MoveToShared(), CURLWS_CLOSE });
+}
+
+bool FCurlConvaihttpWebSocket::IsConnected() const
+{
+	return bConnected;
+}
+
+void FCurlConvaihttpWebSocket::Send(const FString& Message)
+{
+	FTCHARToUTF8 MessageUtf8(*Message);
+	Send(FSharedBuffer::Clone(MessageUtf8.Get(), MessageUtf8.Length()), false);
+}
+
+void FCurlConvaihttpWebSocket::Send(FSharedBuffer Data, bool bIsBinary)
+{
+	if (bCloseQueued)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket message of %llu bytes dropped, Close() was already called"), this, Data.GetSize());
+		return;
+	}
+
+	OutgoingFrames.Enqueue(FOutgoingFrame{ Data.MakeOwned(), static_cast<uint32>(bIsBinary ? CURLWS_BINARY : CURLWS_TEXT) });
+}
+
+void FCurlConvaihttpWebSocket::SetPingInterval(float IntervalSeconds)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: SetPingInterval() called on a WebSocket that is already connecting or connected"), this);
+		return;
+	}
+
+	PingIntervalSeconds = FMath::Max(IntervalSeconds, 0.0f);
+}
+
+bool FCurlConvaihttpWebSocket::SetupRequest()
+{
+	if (!FCurlConvaihttpRequest::SetupRequest())
+	{
+		return false;
+	}
+
+	// The handshake has no body, don't announce one. Headers are only modified on the game thread
+	RemoveHeader(TEXT("Content-Length"));
+	return true;
+}
+
+bool FCurlConvaihttpWebSocket::SetupRequestConvaihttpThread()
+{
+	if (!FCurlConvaihttpRequest::SetupRequestConvaihttpThread())
+	{
+		return false;
+	}
+
+	// Stop once the upgrade is done and leave the connection to curl_ws_recv/curl_ws_send
+	curl_easy_setopt(EasyHandle, CURLOPT_CONNECT_ONLY, 2L);
+
+	bHandshakeChecked = false;
+	bSocketClosed = false;
+	bCloseSent = false;
+	bWritingFrame = false;
+	CurrentFrame = FOutgoingFrame();
+	CurrentFrameOffset = 0;
+	IncomingMessage.Reset();
+	bReceivingMessage = false;
+	IncomingControlFrame.Reset();
+	FrameBytesLeft = 0;
+	TimeSinceLastPing = 0.0f;
+	TimeSinceLastReceive = 0.0f;
+	TimeSinceCloseSent = 0.0f;
+
+	return true;
+}
+
+void FCurlConvaihttpWebSocket::TickThreadedRequest(float DeltaSeconds)
+{
+	FCurlConvaihttpRequest::TickThreadedRequest(DeltaSeconds);
+
+	if (!bCurlRequestCompleted || bCanceled || bSocketClosed)
+	{
+		return;
+	}
+
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpWebSocket_TickThreadedRequest);
+
+	if (!bHandshakeChecked)
+	{
+		CheckHandshake();
+	}
+	if (!bSocketClosed)
+	{
+		ReceiveFrames();
+	}
+	if (!bSocketClosed)
+	{
+		SendQueuedFrames();
+	}
+	if (!bSocketClosed)
+	{
+		CheckKeepAlive(DeltaSeconds);
+	}
+}
+
+bool FCurlConvaihttpWebSocket::IsThreadedRequestComplete()
+{
+	if (!bCurlRequestCompleted || bCanceled)
+	{
+		// Handshake still running, which times out like any other request
+		return FCurlConvaihttpRequest::IsThreadedRequestComplete();
+	}
+
+	return bSocketClosed;
+}
+
+void FCurlConvaihttpWebSocket::CheckHandshake()
+{
+	bHandshakeChecked = true;
+
+	long ResponseCode = 0;
+	curl_easy_getinfo(EasyHandle, CURLINFO_RESPONSE_CODE, &ResponseCode);
+
+	if (CurlCompletionResult != CURLE_OK || ResponseCode != 101)
+	{
+		FEvent Event;
+		Event.Type = EEventType::ConnectionError;
+		Event.Text = CurlCompletionResult != CURLE_OK
+			? FString::Printf(TEXT("libcurl error: %d (%s)"), (int32)CurlCompletionResult, ANSI_TO_TCHAR(curl_easy_strerror(CurlCompletionResult)))
+			: FString::Printf(TEXT("Server answered the handshake with %d"), (int32)ResponseCode);
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket handshake with %s failed. %s"), this, *URL, *Event.Text);
+
+		Events.Enqueue(MoveTemp(Event));
+		bSocketClosed = true;
+		return;
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("%p: WebSocket connected to %s"), this, *URL);
+
+	FEvent Event;
+	Event.Type = EEventType::Connected;
+	Events.Enqueue(MoveTemp(Event));
+}
+
+void FCurlConvaihttpWebSocket::ReceiveFrames()
+{
+	for (int32 FrameIndex = 0; FrameIndex < MaxFramesReceivedPerTick; ++FrameIndex)
+	{
+		// Receive straight into the tail of the message being assembled, which is the buffer handed to the game thread.
+		// Once the start of a frame told us its size, reserve exactly what is left of it
+		const int64 ReceiveSize = FrameBytesLeft > 0 ? FMath::Min(FrameBytesLeft, CurlConvaihttpWebSocket::MaxReceiveSize) : CurlConvaihttpWebSocket::ReceiveBlockSize;
+		const int64 MessageSize = IncomingMessage.Num();
+		IncomingMessage.Reserve(MessageSize + ReceiveSize);
+		IncomingMessage.SetNumUninitialized(MessageSize + ReceiveSize, false);
+
+		size_t ReceivedSize = 0;
+		const curl_ws_frame* Frame = nullptr;
+		const CURLcode Result = curl_ws_recv(EasyHandle, IncomingMessage.GetData() + MessageSize, static_cast<size_t>(ReceiveSize), &ReceivedSize, &Frame);
+		IncomingMessage.SetNumUninitialized(MessageSize + (Result == CURLE_OK ? static_cast<int64>(ReceivedSize) : 0), false);
+
+		if (Result == CURLE_AGAIN)
+		{
+			// Nothing more to read for now
+			break;
+		}
+		if (Result != CURLE_OK || !Frame)
+		{
+			// CURLE_GOT_NOTHING is the peer closing the connection without a close frame
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket receive failed, libcurl error: %d (%s)"), this, (int32)Result, ANSI_TO_TCHAR(curl_easy_strerror(Result)));
+			CloseConnection(CurlConvaihttpWebSocket::AbnormalClosureStatusCode, FString(), false);
+			return;
+		}
+
+		TimeSinceLastReceive = 0.0f;
+		FrameBytesLeft = static_cast<int64>(Frame->bytesleft);
+
+		if (Frame->flags & (CURLWS_PING | CURLWS_PONG | CURLWS_CLOSE))
+		{
+			// Control frames may come between the fragments of a message, so move them out of it
+			IncomingControlFrame.Append(IncomingMessage.GetData() + MessageSize, static_cast<int32>(ReceivedSize));
+			IncomingMessage.SetNumUninitialized(MessageSize, false);
+
+			if (FrameBytesLeft == 0)
+			{
+				ProcessControlFrame(Frame->flags, MakeMemoryView(IncomingControlFrame.GetData(), IncomingControlFrame.Num()));
+				IncomingControlFrame.Reset();
+				if (bSocketClosed)
+				{
+					return;
+				}
+			}
+			continue;
+		}
+
+		if (!bReceivingMessage)
+		{
+			bReceivingMessage = true;
+			bIncomingMessageIsBinary = (Frame->flags & CURLWS_BINARY) != 0;
+		}
+
+		if (FrameBytesLeft == 0 && (Frame->flags & CURLWS_CONT) == 0)
+		{
+			// Small messages were received in a full block, don't hand the slack over with them
+			if (IncomingMessage.Num() < CurlConvaihttpWebSocket::ReceiveBlockSize)
+			{
+				IncomingMessage.Shrink();
+			}
+
+			FEvent Event;
+			Event.Type = bIncomingMessageIsBinary ? EEventType::BinaryMessage : EEventType::TextMessage;
+			Event.Data = MakeSharedBufferFromArray(MoveTemp(IncomingMessage));
+			Events.Enqueue(MoveTemp(Event));
+
+			IncomingMessage = TArray64<uint8>();
+			bReceivingMessage = false;
+		}
+	}
+}
+
+void FCurlConvaihttpWebSocket::ProcessControlFrame(uint32 Flags, FMemoryView Payload)
+{
+	// libcurl answers pings itself, and any frame received already counted as the peer being alive
+	if ((Flags & CURLWS_CLOSE) == 0)
+	{
+		return;
+	}
+
+	int32 StatusCode = CurlConvaihttpWebSocket::NoStatusReceivedStatusCode;
+	FString Reason;
+	if (Payload.GetSize() >= 2)
+	{
+		const uint8* PayloadBytes = static_cast<const uint8*>(Payload.GetData());
+		StatusCode = (static_cast<int32>(PayloadBytes[0]) << 8) | PayloadBytes[1];
+
+		FUTF8ToTCHAR ReasonConverter(reinterpret_cast<const ANSICHAR*>(PayloadBytes + 2), static_cast<int32>(Payload.GetSize() - 2));
+		Reason = FString(ReasonConverter.Length(), ReasonConverter.Get());
+	}
+
+	// Answer with the same status to complete the close handshake, unless we already sent ours.
+	// A close frame can't be written in the middle of another frame, the peer then just sees the connection drop
+	if (!bCloseSent && !bWritingFrame)
+	{
+		uint8 Answer[2] = { static_cast<uint8>((StatusCode >> 8) & 0xff), static_cast<uint8>(StatusCode & 0xff) };
+		const size_t AnswerSize = StatusCode == CurlConvaihttpWebSocket::NoStatusReceivedStatusCode ? 0 : sizeof(Answer);
+		size_t SentSize = 0;
+		curl_ws_send(EasyHandle, Answer, AnswerSize, &SentSize, 0, CURLWS_CLOSE);
+		bCloseSent = true;
+	}
+
+	CloseConnection(StatusCode, Reason, true);
+}
+
+void FCurlConvaihttpWebSocket::SendQueuedFrames()
+{
+	for (;;)
+	{
+		if (!bWritingFrame)
+		{
+			if (bCloseSent || !OutgoingFrames.Dequeue(CurrentFrame))
+			{
+				break;
+			}
+			bWritingFrame = true;
+			CurrentFrameOffset = 0;
+		}
+
+		// Written from the caller's buffer, libcurl only copies it into its send buffer
+		const FMemoryView Remaining = CurrentFrame.Data.GetView().RightChop(CurrentFrameOffset);
+		size_t SentSize = 0;
+		const CURLcode Result = curl_ws_send(EasyHandle, Remaining.GetData(), static_cast<size_t>(Remaining.GetSize()), &SentSize, 0, CurrentFrame.Flags);
+		if (Result == CURLE_AGAIN)
+		{
+			// Socket buffer full, carry on next tick with the same data
+			break;
+		}
+		if (Result != CURLE_OK)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket send failed, libcurl error: %d (%s)"), this, (int32)Result, ANSI_TO_TCHAR(curl_easy_strerror(Result)));
+			CloseConnection(CurlConvaihttpWebSocket::AbnormalClosureStatusCode, FString(), false);
+			return;
+		}
+
+		CurrentFrameOffset += SentSize;
+		if (CurrentFrameOffset >= CurrentFrame.Data.GetSize())
+		{
+			if (CurrentFrame.Flags & CURLWS_CLOSE)
+			{
+				// Nothing can be sent after our close frame, wait for the peer's answer
+				bCloseSent = true;
+				TimeSinceCloseSent = 0.0f;
+			}
+			CurrentFrame = FOutgoingFrame();
+			bWritingFrame = false;
+		}
+	}
+}
+
+void FCurlConvaihttpWebSocket::CheckKeepAlive(float DeltaSeconds)
+{
+	TimeSinceLastReceive += DeltaSeconds;
+
+	if (bCloseSent)
+	{
+		TimeSinceCloseSent += DeltaSeconds;
+		if (TimeSinceCloseSent >= CloseTimeoutSeconds)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket peer did not answer our close frame within %.1f seconds"), this, CloseTimeoutSeconds);
+			CloseConnection(CurlConvaihttpWebSocket::AbnormalClosureStatusCode, FString(), false);
+		}
+		return;
+	}
+
+	if (PingIntervalSeconds <= 0.0f)
+	{
+		return;
+	}
+
+	if (TimeSinceLastReceive >= 2.0f * PingIntervalSeconds)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket peer silent for %.1f seconds despite pings, dropping the connection"), this, TimeSinceLastReceive);
+		CloseConnection(CurlConvaihttpWebSocket::AbnormalClosureStatusCode, FString(), false);
+		return;
+	}
+
+	TimeSinceLastPing += DeltaSeconds;
+
+	// A ping can't be written in the middle of another frame, it goes out once that one is done
+	if (TimeSinceLastPing >= PingIntervalSeconds && !bWritingFrame)
+	{
+		size_t SentSize = 0;
+		const CURLcode Result = curl_ws_send(EasyHandle, "", 0, &SentSize, 0, CURLWS_PING);
+		if (Result == CURLE_OK)
+		{
+			TimeSinceLastPing = 0.0f;
+		}
+		else if (Result != CURLE_AGAIN)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: WebSocket ping failed, libcurl error: %d (%s)"), this, (int32)Result, ANSI_TO_TCHAR(curl_easy_strerror(Result)));
+			CloseConnection(CurlConvaihttpWebSocket::AbnormalClosureStatusCode, FString(), false);
+		}
+	}
+}
+
+void FCurlConvaihttpWebSocket::CloseConnection(int32 StatusCode, const FString& Reason, bool bWasClean)
+{
+	if (bSocketClosed)
+	{
+		return;
+	}
+
+	bSocketClosed = true;
+	UE_LOG(LogConvaihttp, Log, TEXT("%p: WebSocket to %s closed, status %d, clean %d"), this, *URL, StatusCode, bWasClean ? 1 : 0);
+
+	FEvent Event;
+	Event.Type = EEventType::Closed;
+	Event.Text = Reason;
+	Event.StatusCode = StatusCode;
+	Event.bWasClean = bWasClean;
+	Events.Enqueue(MoveTemp(Event));
+}
+
+void FCurlConvaihttpWebSocket::Tick(float DeltaSeconds)
+{
+	FCurlConvaihttpRequest::Tick(DeltaSeconds);
+	DeliverEvents();
+}
+
+void FCurlConvaihttpWebSocket::FinishRequest()
+{
+	FCurlConvaihttpRequest::FinishRequest();
+
+	// Deliver what arrived since the last tick, then make sure the owner hears the socket is gone
+	DeliverEvents();
+	if (!bClosedDelivered)
+	{
+		bClosedDelivered = true;
+		if (bConnected)
+		{
+			bConnected = false;
+			ClosedDelegate.ExecuteIfBound(CurlConvaihttpWebSocket::AbnormalClosureStatusCode, FString(), false);
+		}
+		else
+		{
+			ConnectionErrorDelegate.ExecuteIfBound(bCanceled ? TEXT("Canceled") : TEXT("Connection failed"));
+		}
+	}
+
+	// The CONVAIHTTP thread is done with the socket, drop whatever it didn't get to send
+	FOutgoingFrame UnsentFrame;
+	while (OutgoingFrames.Dequeue(UnsentFrame))
+	{
+	}
+}
+
+void FCurlConvaihttpWebSocket::DeliverEvents()
+{
+	check(IsInGameThread());
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FCurlConvaihttpWebSocket_DeliverEvents);
+
+	FEvent Event;
+	while (Events.Dequeue(Event))
+	{
+		switch (Event.Type)
+		{
+		case EEventType::Connected:
+			bConnected = true;
+			ConnectedDelegate.ExecuteIfBound();
+			break;
+		case EEventType::ConnectionError:
+			bClosedDelivered = true;
+			ConnectionErrorDelegate.ExecuteIfBound(Event.Text);
+			break;
+		case EEventType::TextMessage:
+			if (MessageDelegate.IsBound())
+			{
+				FUTF8ToTCHAR MessageConverter(static_cast<const ANSICHAR*>(Event.Data.GetData()), static_cast<int32>(Event.Data.GetSize()));
+				MessageDelegate.Execute(FString(MessageConverter.Length(), MessageConverter.Get()));
+			}
+			break;
+		case EEventType::BinaryMessage:
+			BinaryMessageDelegate.ExecuteIfBound(Event.Data);
+			break;
+		case EEventType::Closed:
+			bConnected = false;
+			bClosedDelivered = true;
+			ClosedDelegate.ExecuteIfBound(Event.StatusCode, Event.Text, Event.bWasClean);
+			break;
+		}
+	}
+}
+
+#endif // WITH_CURL_WEBSOCKETS
@@ -0,0 +1,190 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Curl/CurlConvaihttp.h"
+#include "Interfaces/IConvaihttpWebSocket.h"
+#include "Containers/Queue.h"
+
+// curl_ws_recv/curl_ws_send appeared in libcurl 7.86.0, and are compiled out of builds without WebSocket support
+#if WITH_CURL && !WITH_CURL_XCURL && defined(LIBCURL_VERSION_NUM) && !defined(CURL_DISABLE_WEBSOCKETS)
+	#if LIBCURL_VERSION_NUM >= 0x075600
+		#define WITH_CURL_WEBSOCKETS 1
+	#endif
+#endif
+#ifndef WITH_CURL_WEBSOCKETS
+	#define WITH_CURL_WEBSOCKETS 0
+#endif
+
+#if WITH_CURL_WEBSOCKETS
+
+/**
+ * Curl implementation of a WebSocket.
+ *
+ * The opening handshake is a regular request on the curl multi handle of the CONVAIHTTP thread, made in connect-only mode
+ * so libcurl keeps the upgraded connection for us once it is over. The request then stays in the threaded request list
+ * for the lifetime of the socket: the CONVAIHTTP thread polls it for frames each time it ticks threaded requests,
+ * writes the queued messages, and keeps it alive with pings. Received messages are assembled directly in the buffer
+ * handed to the game thread, which delivers them in batches when the request is ticked.
+ */
+class FCurlConvaihttpWebSocket : public FCurlConvaihttpRequest, public IConvaihttpWebSocket
+{
+public:
+	/** How long to wait for the peer to answer our close frame before dropping the connection */
+	static constexpr float CloseTimeoutSeconds = 5.0f;
+	/** Most frames received in one tick, so a fast peer can't keep the CONVAIHTTP thread from other requests */
+	static constexpr int32 MaxFramesReceivedPerTick = 1024;
+
+	/**
+	 * Constructor
+	 *
+	 * @param InURL - ws:// or wss:// URL to connect to
+	 * @param InProtocols - subprotocols to offer in the handshake, may be empty
+	 * @param InUpgradeHeaders - additional headers sent with the handshake
+	 */
+	FCurlConvaihttpWebSocket(const FString& InURL, const TArray<FString>& InProtocols, const TMap<FString, FString>& InUpgradeHeaders);
+
+	/**
+	 * Destructor
+	 */
+	virtual ~FCurlConvaihttpWebSocket();
+
+	/** @return true if the libcurl we are running with was built with WebSocket support */
+	static bool IsSupported();
+
+	//~ Begin IConvaihttpWebSocket Interface
+	virtual void Connect() override;
+	virtual void Close(int32 StatusCode, const FString& Reason) override;
+	virtual bool IsConnected() const override;
+	virtual void Send(const FString& Message) override;
+	virtual void Send(FSharedBuffer Data, bool bIsBinary) override;
+	virtual void SetPingInterval(float IntervalSeconds) override;
+	virtual FConvaihttpWebSocketConnectedDelegate& OnConnected() override { return ConnectedDelegate; }
+	virtual FConvaihttpWebSocketConnectionErrorDelegate& OnConnectionError() override { return ConnectionErrorDelegate; }
+	virtual FConvaihttpWebSocketClosedDelegate& OnClosed() override { return ClosedDelegate; }
+	virtual FConvaihttpWebSocketMessageDelegate& OnMessage() override { return MessageDelegate; }
+	virtual FConvaihttpWebSocketBinaryMessageDelegate& OnBinaryMessage() override { return BinaryMessageDelegate; }
+	//~ End IConvaihttpWebSocket Interface
+
+	//~ Begin IConvaihttpRequest Interface
+	virtual void Tick(float DeltaSeconds) override;
+	//~ End IConvaihttpRequest Interface
+
+	//~ Begin IConvaihttpRequestThreaded Interface
+	virtual void FinishRequest() override;
+	virtual bool IsThreadedRequestComplete() override;
+	virtual void TickThreadedRequest(float DeltaSeconds) override;
+	//~ End IConvaihttpRequestThreaded Interface
+
+	//~ Begin FCurlConvaihttpRequest Interface
+	virtual bool SetupRequest() override;
+	virtual bool SetupRequestConvaihttpThread() override;
+	virtual bool KeepsConnectionAfterTransfer() const override { return true; }
+	//~ End FCurlConvaihttpRequest Interface
+
+private:
+	/** What happened on the CONVAIHTTP thread, for the game thread to deliver */
+	enum class EEventType : uint8
+	{
+		Connected,
+		ConnectionError,
+		TextMessage,
+		BinaryMessage,
+		Closed
+	};
+
+	struct FEvent
+	{
+		EEventType Type;
+		/** Message received */
+		FSharedBuffer Data;
+		/** Error, or close reason */
+		FString Text;
+		/** Close status code */
+		int32 StatusCode = 0;
+		/** Whether the close handshake completed */
+		bool bWasClean = false;
+	};
+
+	struct FOutgoingFrame
+	{
+		/** Payload of the frame */
+		FSharedBuffer Data;
+		/** CURLWS_* flags of the frame */
+		uint32 Flags = 0;
+	};
+
+	/** Check the result of the opening handshake once curl is done with it. Called on the CONVAIHTTP thread */
+	void CheckHandshake();
+	/** Receive every frame available on the connection. Called on the CONVAIHTTP thread */
+	void ReceiveFrames();
+	/** Handle a ping, pong or close frame. Called on the CONVAIHTTP thread */
+	void ProcessControlFrame(uint32 Flags, FMemoryView Payload);
+	/** Write queued frames until the socket would block. Called on the CONVAIHTTP thread */
+	void SendQueuedFrames();
+	/** Send pings, and give up on a peer that stopped answering them or our close frame. Called on the CONVAIHTTP thread */
+	void CheckKeepAlive(float DeltaSeconds);
+	/** Mark the socket closed and queue the notification. Called on the CONVAIHTTP thread */
+	void CloseConnection(int32 StatusCode, const FString& Reason, bool bWasClean);
+	/** Deliver the events queued by the CONVAIHTTP thread. Called on the game thread */
+	void DeliverEvents();
+
+	/** Subprotocols offered in the handshake */
+	TArray<FString> Protocols;
+	/** Ping interval, 0 if disabled */
+	float PingIntervalSeconds = 0.0f;
+
+	/** Frames queued by the game thread, in order */
+	TQueue<FOutgoingFrame, EQueueMode::Mpsc> OutgoingFrames;
+	/** Events queued by the CONVAIHTTP thread, in order */
+	TQueue<FEvent, EQueueMode::Spsc> Events;
+
+	// Only accessed on the game thread
+
+	/** Set between delivering the connected and closed events */
+	bool bConnected = false;
+	/** Set once Close() queued our close frame, after which nothing more may be sent */
+	bool bCloseQueued = false;
+	/** Set once OnClosed() or OnConnectionError() was called */
+	bool bClosedDelivered = false;
+
+	// Only accessed on the CONVAIHTTP thread
+
+	/** Set once the handshake result was checked */
+	bool bHandshakeChecked = false;
+	/** Set once the connection is over, letting the request complete */
+	bool bSocketClosed = false;
+	/** Set once our close frame was written */
+	bool bCloseSent = false;
+	/** Frame being written, if the last write would have blocked */
+	FOutgoingFrame CurrentFrame;
+	/** Whether CurrentFrame is being written */
+	bool bWritingFrame = false;
+	/** Amount of CurrentFrame already written */
+	uint64 CurrentFrameOffset = 0;
+	/** Data message being assembled, received directly in place */
+	TArray64<uint8> IncomingMessage;
+	/** Whether IncomingMessage is a binary message */
+	bool bIncomingMessageIsBinary = false;
+	/** Whether a data message is being assembled */
+	bool bReceivingMessage = false;
+	/** Control frame being received, moved out of the message it was interleaved with */
+	TArray<uint8, TInlineAllocator<128>> IncomingControlFrame;
+	/** Bytes left of the frame being received */
+	int64 FrameBytesLeft = 0;
+	/** Time since the last ping was sent */
+	float TimeSinceLastPing = 0.0f;
+	/** Time since anything was received */
+	float TimeSinceLastReceive = 0.0f;
+	/** Time since our close frame was written */
+	float TimeSinceCloseSent = 0.0f;
+
+	FConvaihttpWebSocketConnectedDelegate ConnectedDelegate;
+	FConvaihttpWebSocketConnectionErrorDelegate ConnectionErrorDelegate;
+	FConvaihttpWebSocketClosedDelegate ClosedDelegate;
+	FConvaihttpWebSocketMessageDelegate MessageDelegate;
+	FConvaihttpWebSocketBinaryMessageDelegate BinaryMessageDelegate;
+};
+
+#endif // WITH_CURL_WEBSOCKETS
@@ -0,0 +1,204 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "GenericPlatform/ConvaihttpFrameDecoder.h"
+#include "Convaihttp.h"
+#include "Misc/ScopeLock.h"
+
+FConvaihttpLengthPrefixedFrameDecoder::FConvaihttpLengthPrefixedFrameDecoder(uint32 InMaxMessageSize)
+	: MaxMessageSize(InMaxMessageSize)
+	, NumBytesAssembled(0)
+	, bReceivedTrailers(false)
+	, bFinished(false)
+	, bTruncated(false)
+{
+}
+
+FConvaihttpLengthPrefixedFrameDecoder::~FConvaihttpLengthPrefixedFrameDecoder()
+{
+}
+
+void FConvaihttpLengthPrefixedFrameDecoder::SetMessageCallback(TFunction<void(uint8, FMemoryView)> InCallback)
+{
+	MessageCallback = MoveTemp(InCallback);
+}
+
+bool FConvaihttpLengthPrefixedFrameDecoder::DequeueFrame(FConvaihttpDecodedFrame& OutFrame)
+{
+	return Frames.Dequeue(OutFrame);
+}
+
+bool FConvaihttpLengthPrefixedFrameDecoder::HasReceivedTrailers() const
+{
+	return bReceivedTrailers.load();
+}
+
+FString FConvaihttpLengthPrefixedFrameDecoder::GetTrailer(const FString& Name) const
+{
+	FScopeLock Lock(&TrailersCriticalSection);
+	const FString* Value = Trailers.Find(Name);
+	return Value ? *Value : FString();
+}
+
+TMap<FString, FString> FConvaihttpLengthPrefixedFrameDecoder::GetAllTrailers() const
+{
+	FScopeLock Lock(&TrailersCriticalSection);
+	return Trailers;
+}
+
+bool FConvaihttpLengthPrefixedFrameDecoder::IsFinished() const
+{
+	return bFinished.load();
+}
+
+bool FConvaihttpLengthPrefixedFrameDecoder::WasTruncated() const
+{
+	return bTruncated.load();
+}
+
+uint64 FConvaihttpLengthPrefixedFrameDecoder::GetNumBytesAssembled() const
+{
+	return NumBytesAssembled.load();
+}
+
+EConvaihttpBodySinkResult FConvaihttpLengthPrefixedFrameDecoder::Write(FMemoryView Data)
+{
+	const uint8* Ptr = static_cast<const uint8*>(Data.GetData());
+	const uint8* const End = Ptr + Data.GetSize();
+
+	while (Ptr < End)
+	{
+		if (PrefixBytesReceived < PrefixSize)
+		{
+			const int32 PrefixBytesToCopy = static_cast<int32>(FMath::Min<int64>(PrefixSize - PrefixBytesReceived, End - Ptr));
+			FMemory::Memcpy(Prefix + PrefixBytesReceived, Ptr, PrefixBytesToCopy);
+			PrefixBytesReceived += PrefixBytesToCopy;
+			Ptr += PrefixBytesToCopy;
+			if (PrefixBytesReceived < PrefixSize)
+			{
+				// The rest of the prefix comes with the next receive
+				break;
+			}
+
+			MessageLength = (static_cast<uint32>(Prefix[1]) << 24) | (static_cast<uint32>(Prefix[2]) << 16) | (static_cast<uint32>(Prefix[3]) << 8) | static_cast<uint32>(Prefix[4]);
+			if (MessageLength > MaxMessageSize)
+			{
+				UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpLengthPrefixedFrameDecoder: message of %u bytes is larger than the %u byte limit, failing the stream"), MessageLength, MaxMessageSize);
+				return EConvaihttpBodySinkResult::Failed;
+			}
+		}
+
+		const int64 Available = End - Ptr;
+		if (PendingMessage.Num() == 0 && Available >= MessageLength)
+		{
+			// Common case, the whole message is in this receive and is handed over where it is
+			DispatchFrame(Prefix[0], FMemoryView(Ptr, MessageLength), nullptr);
+			Ptr += MessageLength;
+		}
+		else
+		{
+			if (PendingMessage.Num() == 0 && Available > 0)
+			{
+				PendingMessage.Reserve(MessageLength);
+			}
+
+			const int64 BytesToCopy = FMath::Min<int64>(MessageLength - PendingMessage.Num(), Available);
+			PendingMessage.Append(Ptr, BytesToCopy);
+			NumBytesAssembled += BytesToCopy;
+			Ptr += BytesToCopy;
+			if (PendingMessage.Num() < MessageLength)
+			{
+				// The rest of the message comes with the next receive
+				break;
+			}
+
+			DispatchFrame(Prefix[0], MakeMemoryView(PendingMessage.GetData(), PendingMessage.Num()), &PendingMessage);
+			PendingMessage.Reset();
+		}
+
+		PrefixBytesReceived = 0;
+		MessageLength = 0;
+	}
+
+	return EConvaihttpBodySinkResult::Accepted;
+}
+
+void FConvaihttpLengthPrefixedFrameDecoder::Finish(bool bSucceeded)
+{
+	if (PrefixBytesReceived > 0)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpLengthPrefixedFrameDecoder: stream ended in the middle of a frame, %lld of %u message bytes received"), PendingMessage.Num(), MessageLength);
+		bTruncated = true;
+	}
+
+	PendingMessage.Empty();
+	PrefixBytesReceived = 0;
+	MessageLength = 0;
+	bFinished = true;
+}
+
+void FConvaihttpLengthPrefixedFrameDecoder::DispatchFrame(uint8 Flags, FMemoryView Message, TArray64<uint8>* OwnedMessage)
+{
+	if (Flags & TrailersFlag)
+	{
+		ParseTrailers(Message);
+		return;
+	}
+
+	if (MessageCallback)
+	{
+		MessageCallback(Flags, Message);
+		return;
+	}
+
+	// An assembled message is handed over with its buffer, only one received in place needs copying out of the transport's buffer
+	FConvaihttpDecodedFrame Frame;
+	Frame.Flags = Flags;
+	Frame.Message = OwnedMessage ? MakeSharedBufferFromArray(MoveTemp(*OwnedMessage)) : FSharedBuffer::Clone(Message);
+	Frames.Enqueue(MoveTemp(Frame));
+}
+
+void FConvaihttpLengthPrefixedFrameDecoder::ParseTrailers(FMemoryView Payload)
+{
+	const ANSICHAR* Ptr = static_cast<const ANSICHAR*>(Payload.GetData());
+	const ANSICHAR* const End = Ptr + Payload.GetSize();
+
+	TMap<FString, FString> NewTrailers;
+	while (Ptr < End)
+	{
+		const ANSICHAR* LineEnd = Ptr;
+		while (LineEnd < End && *LineEnd != '\r' && *LineEnd != '\n')
+		{
+			++LineEnd;
+		}
+
+		const ANSICHAR* Colon = Ptr;
+		while (Colon < LineEnd && *Colon != ':')
+		{
+			++Colon;
+		}
+		if (Colon < LineEnd)
+		{
+			const ANSICHAR* Value = Colon + 1;
+			while (Value < LineEnd && (*Value == ' ' || *Value == '\t'))
+			{
+				++Value;
+			}
+
+			FUTF8ToTCHAR NameConverter(Ptr, static_cast<int32>(Colon - Ptr));
+			FUTF8ToTCHAR ValueConverter(Value, static_cast<int32>(LineEnd - Value));
+			NewTrailers.Add(FString(NameConverter.Length(), NameConverter.Get()).TrimStartAndEnd(), FString(ValueConverter.Length(), ValueConverter.Get()).TrimEnd());
+		}
+
+		Ptr = LineEnd;
+		while (Ptr < End && (*Ptr == '\r' || *Ptr == '\n'))
+		{
+			++Ptr;
+		}
+	}
+
+	{
+		FScopeLock Lock(&TrailersCriticalSection);
+		Trailers.Append(MoveTemp(NewTrailers));
+	}
+	bReceivedTrailers = true;
+}
@@ -3,6 +3,38 @@
 #include "GenericPlatform/ConvaihttpRequestImpl.h"
 #include "Stats/Stats.h"
 #include "Convaihttp.h"
+#include "GenericPlatform/ConvaihttpResponseBodySink.h"
+
+void FConvaihttpRequestImpl::SetContent(const FSharedBuffer& ContentPayload)
+{
+	SetContent(FCompositeBuffer(ContentPayload));
+}
+
+void FConvaihttpRequestImpl::SetContent(const FCompositeBuffer& ContentPayload)
+{
+	// Implementations that can't reference shared buffers directly get a flattened copy
+	TArray64<uint8> Buffer;
+	Buffer.SetNumUninitialized(ContentPayload.GetSize());
+	ContentPayload.CopyTo(FMutableMemoryView(Buffer.GetData(), Buffer.Num()));
+	SetContent(MoveTemp(Buffer));
+}
+
+bool FConvaihttpRequestImpl::SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source)
+{
+	UE_LOG(LogConvaihttp, Warning, TEXT("SetContentFromSource() is not supported by this CONVAIHTTP implementation"));
+	return false;
+}
+
+bool FConvaihttpRequestImpl::SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink)
+{
+	UE_LOG(LogConvaihttp, Warning, TEXT("SetResponseBodyReceiveSink() is not supported by this CONVAIHTTP implementation"));
+	return false;
+}
+
+bool FConvaihttpRequestImpl::SetResponseBodyReceiveStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream)
+{
+	return SetResponseBodyReceiveSink(MakeShared<FConvaihttpArchiveBodySink, ESPMode::ThreadSafe>(Stream));
+}
 
 FConvaihttpRequestCompleteDelegate& FConvaihttpRequestImpl::OnProcessRequestComplete()
 {
@@ -3,9 +3,17 @@
 #include "GenericPlatform/ConvaihttpRequestPayload.h"
 #include "GenericPlatform/GenericPlatformFile.h"
 #include "GenericPlatform/GenericPlatformConvaihttp.h"
+#include "GenericPlatform/ConvaihttpUploadSource.h"
 #include "HAL/PlatformFileManager.h"
+#include "Misc/ScopeLock.h"
+#include "Convaihttp.h"
 
 bool FGenericPlatformConvaihttp::CH_IsURLEncoded(const TArray64<uint8>& Payload)
+{
+	return CH_IsURLEncoded(FMemoryView(Payload.GetData(), Payload.Num()));
+}
+
+bool FGenericPlatformConvaihttp::CH_IsURLEncoded(FMemoryView Payload)
 {
 	static char AllowedChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_.~";
 	static bool bTableFilled = false;
@@ -23,63 +31,82 @@ bool FGenericPlatformConvaihttp::CH_IsURLEncoded(const TArray64<uint8>& Payload)
 		bTableFilled = true;
 	}
 
-	const int32 Num = Payload.Num();
-	for (int32 Idx = 0; Idx < Num; ++Idx)
+	const uint8* Data = static_cast<const uint8*>(Payload.GetData());
+	const uint64 Num = Payload.GetSize();
+	for (uint64 Idx = 0; Idx < Num; ++Idx)
 	{
-		if (!AllowedTable[Payload[Idx]])
+		if (!AllowedTable[Data[Idx]])
 			return false;
 	}
 
 	return true;
 }
 
-FCH_RequestPayloadInFileStream::FCH_RequestPayloadInFileStream(TSharedRef<FArchive, ESPMode::ThreadSafe> InFile) : File(InFile)
+FCH_RequestPayloadFromSource::FCH_RequestPayloadFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> InSource) : Source(InSource)
 {
 }
 
-FCH_RequestPayloadInFileStream::~FCH_RequestPayloadInFileStream()
+FCH_RequestPayloadFromSource::~FCH_RequestPayloadFromSource()
 {
 }
 
-uint64 FCH_RequestPayloadInFileStream::GetContentLength() const
+uint64 FCH_RequestPayloadFromSource::GetContentLength() const
 {
-	return static_cast<int32>(File->TotalSize());
+	return Source->GetContentLength();
 }
 
-const TArray64<uint8>& FCH_RequestPayloadInFileStream::GetContent() const
+const TArray64<uint8>& FCH_RequestPayloadFromSource::GetContent() const
 {
 	ensureMsgf(false, TEXT("GetContent() on a streaming request payload is not allowed"));
 	static const TArray64<uint8> NotSupported;
 	return NotSupported;
 }
 
-bool FCH_RequestPayloadInFileStream::CH_IsURLEncoded() const
+bool FCH_RequestPayloadFromSource::CH_IsURLEncoded() const
 {
-	// Assume that files are not URL encoded, because they probably aren't.
-	// This implies that POST requests with streamed files will need the caller to set a Content-Type.
+	// Assume that streamed sources are not URL encoded, because they probably aren't.
+	// This implies that POST requests with streamed sources will need the caller to set a Content-Type.
 	return false;
 }
 
-size_t FCH_RequestPayloadInFileStream::FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent)
+bool FCH_RequestPayloadFromSource::IsSeekable() const
 {
-	return FillOutputBuffer(TArray64<uint8>(static_cast<uint8*>(OutputBuffer), MaxOutputBufferSize), SizeAlreadySent);
+	return Source->IsSeekable();
 }
 
-size_t FCH_RequestPayloadInFileStream::FillOutputBuffer(TArray64<uint8> OutputBuffer, size_t SizeAlreadySent)
+bool FCH_RequestPayloadFromSource::HasKnownContentLength() const
 {
-	const size_t ContentLength = static_cast<size_t>(GetContentLength());
-	check(SizeAlreadySent <= ContentLength);
-	const size_t SizeToSend = ContentLength - SizeAlreadySent;
-	const size_t SizeToSendThisTime = FMath::Min(SizeToSend, static_cast<size_t>(OutputBuffer.Num()));
-	if (SizeToSendThisTime != 0)
+	return Source->HasKnownContentLength();
+}
+
+size_t FCH_RequestPayloadFromSource::FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent)
+{
+	// The source writes straight into the caller's buffer
+	const uint64 SizeSentThisTime = Source->Read(FMutableMemoryView(OutputBuffer, MaxOutputBufferSize), SizeAlreadySent);
+	if (SizeSentThisTime == IConvaihttpUploadSource::ReadError)
 	{
-		if (File->Tell() != SizeAlreadySent)
-		{
-			File->Seek(SizeAlreadySent);
-		}
-		File->Serialize(OutputBuffer.GetData(), static_cast<int64>(SizeToSendThisTime));
+		return FillError;
 	}
-	return SizeToSendThisTime;
+	if (SizeSentThisTime == IConvaihttpUploadSource::ReadPending)
+	{
+		return FillPending;
+	}
+	check(SizeSentThisTime <= MaxOutputBufferSize);
+	return static_cast<size_t>(SizeSentThisTime);
+}
+
+void FCH_RequestPayloadFromSource::SetDataAvailableCallback(TFunction<void()> Callback)
+{
+	Source->SetDataAvailableCallback(MoveTemp(Callback));
+}
+
+FCH_RequestPayloadInFileStream::FCH_RequestPayloadInFileStream(TSharedRef<FArchive, ESPMode::ThreadSafe> InFile)
+	: FCH_RequestPayloadFromSource(MakeShared<FConvaihttpArchiveUploadSource, ESPMode::ThreadSafe>(InFile))
+{
+}
+
+FCH_RequestPayloadInFileStream::~FCH_RequestPayloadInFileStream()
+{
 }
 
 FCH_RequestPayloadInMemory::FCH_RequestPayloadInMemory(const TArray64<uint8>& Array) : Buffer(Array)
@@ -104,11 +131,21 @@ const TArray64<uint8>& FCH_RequestPayloadInMemory::GetContent() const
 	return Buffer;
 }
 
+FCompositeBuffer FCH_RequestPayloadInMemory::GetContentView() const
+{
+	return FCompositeBuffer(FSharedBuffer::MakeView(Buffer.GetData(), Buffer.Num()));
+}
+
 bool FCH_RequestPayloadInMemory::CH_IsURLEncoded() const
 {
 	return FGenericPlatformConvaihttp::CH_IsURLEncoded(Buffer);
 }
 
+bool FCH_RequestPayloadInMemory::IsSeekable() const
+{
+	return true;
+}
+
 size_t FCH_RequestPayloadInMemory::FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent)
 {
 	const size_t ContentLength = static_cast<size_t>(Buffer.Num());
@@ -121,18 +158,65 @@ size_t FCH_RequestPayloadInMemory::FillOutputBuffer(void* OutputBuffer, size_t M
 		FMemory::Memcpy(OutputBuffer, Buffer.GetData() + SizeAlreadySent, SizeToSendThisTime);
 	}
 	return SizeToSendThisTime;
-	//return FillOutputBuffer(TArray64<uint8>(static_cast<uint8*>(OutputBuffer), MaxOutputBufferSize), SizeAlreadySent);
 }
 
-size_t FCH_RequestPayloadInMemory::FillOutputBuffer(TArray64<uint8> OutputBuffer, size_t SizeAlreadySent)
+FCH_RequestPayloadInSharedBuffer::FCH_RequestPayloadInSharedBuffer(const FCompositeBuffer& InBuffer) : Buffer(InBuffer)
 {
-	const size_t ContentLength = static_cast<size_t>(Buffer.Num());
+}
+
+FCH_RequestPayloadInSharedBuffer::~FCH_RequestPayloadInSharedBuffer()
+{
+}
+
+uint64 FCH_RequestPayloadInSharedBuffer::GetContentLength() const
+{
+	return Buffer.GetSize();
+}
+
+const TArray64<uint8>& FCH_RequestPayloadInSharedBuffer::GetContent() const
+{
+	// Callers that need a contiguous array pay for one copy, the upload itself never does
+	const FScopeLock FlattenedContentLock(&FlattenedContentCriticalSection);
+	if (FlattenedContent.Num() != static_cast<int64>(Buffer.GetSize()))
+	{
+		UE_LOG(LogConvaihttp, Verbose, TEXT("GetContent() is flattening a shared buffer payload of %llu bytes"), Buffer.GetSize());
+		FlattenedContent.SetNumUninitialized(Buffer.GetSize());
+		Buffer.CopyTo(FMutableMemoryView(FlattenedContent.GetData(), FlattenedContent.Num()));
+	}
+	return FlattenedContent;
+}
+
+FCompositeBuffer FCH_RequestPayloadInSharedBuffer::GetContentView() const
+{
+	return Buffer;
+}
+
+bool FCH_RequestPayloadInSharedBuffer::CH_IsURLEncoded() const
+{
+	for (const FSharedBuffer& Segment : Buffer.GetSegments())
+	{
+		if (!FGenericPlatformConvaihttp::CH_IsURLEncoded(Segment.GetView()))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FCH_RequestPayloadInSharedBuffer::IsSeekable() const
+{
+	return true;
+}
+
+size_t FCH_RequestPayloadInSharedBuffer::FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent)
+{
+	const size_t ContentLength = static_cast<size_t>(Buffer.GetSize());
 	check(SizeAlreadySent <= ContentLength);
 	const size_t SizeToSend = ContentLength - SizeAlreadySent;
-	const size_t SizeToSendThisTime = FMath::Min(SizeToSend, static_cast<size_t>(OutputBuffer.Num()));
+	const size_t SizeToSendThisTime = FMath::Min(SizeToSend, MaxOutputBufferSize);
 	if (SizeToSendThisTime != 0)
 	{
-		FMemory::Memcpy(OutputBuffer.GetData(), Buffer.GetData() + SizeAlreadySent, SizeToSendThisTime);
+		Buffer.CopyTo(FMutableMemoryView(OutputBuffer, SizeToSendThisTime), SizeAlreadySent);
 	}
 	return SizeToSendThisTime;
 }
@@ -0,0 +1,295 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "GenericPlatform/ConvaihttpResponseBodySink.h"
+#include "Convaihttp.h"
+#include "Async/Async.h"
+
+FConvaihttpArchiveBodySink::FConvaihttpArchiveBodySink(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive, uint64 InMaxQueuedBytes)
+	: Archive(InArchive)
+	, MaxQueuedBytes(InMaxQueuedBytes)
+	, bFailed(false)
+{
+}
+
+FConvaihttpArchiveBodySink::~FConvaihttpArchiveBodySink()
+{
+}
+
+bool FConvaihttpArchiveBodySink::HasFailed() const
+{
+	return bFailed.load();
+}
+
+EConvaihttpBodySinkResult FConvaihttpArchiveBodySink::Write(FMemoryView Data)
+{
+	if (bFailed.load())
+	{
+		return EConvaihttpBodySinkResult::Failed;
+	}
+
+	FScopeLock Lock(&QueueCriticalSection);
+
+	// Always accept something when the queue is empty, or a chunk bigger than the limit would never be written
+	if (QueuedBytes > 0 && QueuedBytes + Data.GetSize() > MaxQueuedBytes)
+	{
+		return EConvaihttpBodySinkResult::Full;
+	}
+
+	QueuedChunks.Enqueue(TArray64<uint8>(static_cast<const uint8*>(Data.GetData()), Data.GetSize()));
+	QueuedBytes += Data.GetSize();
+	bReceivedData = true;
+	StartWriterLocked();
+
+	return EConvaihttpBodySinkResult::Accepted;
+}
+
+void FConvaihttpArchiveBodySink::Finish(bool bSucceeded)
+{
+	UE_LOG(LogConvaihttp, Verbose, TEXT("FConvaihttpArchiveBodySink: finishing %s (succeeded=%d)"), *Archive->GetArchiveName(), bSucceeded ? 1 : 0);
+
+	FScopeLock Lock(&QueueCriticalSection);
+	if (!bFinishRequested)
+	{
+		bFinishRequested = true;
+		// Start the writer even with nothing queued, it flushes the archive
+		StartWriterLocked();
+	}
+}
+
+bool FConvaihttpArchiveBodySink::IsFlushed() const
+{
+	FScopeLock Lock(&QueueCriticalSection);
+	return bFlushed;
+}
+
+bool FConvaihttpArchiveBodySink::Restart()
+{
+	FScopeLock Lock(&QueueCriticalSection);
+	// The archive can't be truncated, so a new body would be appended to the part already written
+	if (bReceivedData || bWriterRunning || bFailed.load())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpArchiveBodySink: can't restart, %s already holds part of a body"), *Archive->GetArchiveName());
+		return false;
+	}
+
+	bFinishRequested = false;
+	bFlushed = false;
+	return true;
+}
+
+void FConvaihttpArchiveBodySink::StartWriterLocked()
+{
+	if (!bWriterRunning)
+	{
+		bWriterRunning = true;
+		Async(EAsyncExecution::ThreadPool, [StrongThis = AsShared()]()
+		{
+			StrongThis->WriteQueuedData();
+		});
+	}
+}
+
+void FConvaihttpArchiveBodySink::WriteQueuedData()
+{
+	for (;;)
+	{
+		TArray64<uint8> Chunk;
+		{
+			FScopeLock Lock(&QueueCriticalSection);
+			if (!QueuedChunks.Dequeue(Chunk))
+			{
+				if (!bFinishRequested)
+				{
+					bWriterRunning = false;
+					return;
+				}
+				break;
+			}
+		}
+
+		if (!bFailed.load())
+		{
+			Archive->Serialize(Chunk.GetData(), Chunk.Num());
+			if (Archive->IsError())
+			{
+				UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpArchiveBodySink: failed to write %lld bytes to %s"), Chunk.Num(), *Archive->GetArchiveName());
+				bFailed = true;
+			}
+		}
+
+		{
+			FScopeLock Lock(&QueueCriticalSection);
+			QueuedBytes -= Chunk.Num();
+		}
+
+		// Resume the transfer if it was waiting on us. On failure this lets it find out and abort
+		NotifyReadyForData();
+	}
+
+	// Everything was written and no more is coming
+	if (!bFailed.load())
+	{
+		Archive->Flush();
+		if (Archive->IsError())
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpArchiveBodySink: failed to flush %s"), *Archive->GetArchiveName());
+			bFailed = true;
+		}
+	}
+
+	FScopeLock Lock(&QueueCriticalSection);
+	bWriterRunning = false;
+	bFlushed = true;
+}
+
+FConvaihttpResponseBodyBuffer::FConvaihttpResponseBodyBuffer(uint64 InCapacity)
+	: Capacity(FMath::Max<uint64>(InCapacity, 1))
+{
+	Buffer.SetNumUninitialized(Capacity);
+}
+
+FConvaihttpResponseBodyBuffer::~FConvaihttpResponseBodyBuffer()
+{
+}
+
+uint64 FConvaihttpResponseBodyBuffer::Read(FMutableMemoryView Destination)
+{
+	uint64 SizeRead = 0;
+	bool bResumeWriter = false;
+	{
+		FScopeLock Lock(&BufferCriticalSection);
+
+		const uint64 RingSize = Buffer.Num();
+		SizeRead = FMath::Min<uint64>(Destination.GetSize(), NumBytesUsed);
+
+		// Copy in up to two parts when the data wraps around the end of the ring
+		const uint64 FirstPartSize = FMath::Min(SizeRead, RingSize - ReadOffset);
+		Destination = Destination.CopyFrom(FMemoryView(Buffer.GetData() + ReadOffset, FirstPartSize));
+		Destination.CopyFrom(FMemoryView(Buffer.GetData(), SizeRead - FirstPartSize));
+
+		ReadOffset = (ReadOffset + SizeRead) % RingSize;
+		NumBytesUsed -= SizeRead;
+		if (NumBytesUsed == 0)
+		{
+			ReadOffset = 0;
+			// Give back the memory of an oversized chunk once it's drained
+			if (RingSize > Capacity)
+			{
+				Buffer.SetNumUninitialized(Capacity);
+				Buffer.Shrink();
+			}
+		}
+
+		// Wait for some room before resuming, so the transfer isn't paused and resumed for every few bytes read
+		if (bWriterWaiting && NumBytesUsed <= Capacity / 2)
+		{
+			bWriterWaiting = false;
+			bResumeWriter = true;
+		}
+	}
+
+	if (bResumeWriter)
+	{
+		NotifyReadyForData();
+	}
+	return SizeRead;
+}
+
+uint64 FConvaihttpResponseBodyBuffer::GetNumBytesAvailable() const
+{
+	FScopeLock Lock(&BufferCriticalSection);
+	return NumBytesUsed;
+}
+
+uint64 FConvaihttpResponseBodyBuffer::GetBufferSize() const
+{
+	FScopeLock Lock(&BufferCriticalSection);
+	return Buffer.Num();
+}
+
+bool FConvaihttpResponseBodyBuffer::IsEndOfBody() const
+{
+	FScopeLock Lock(&BufferCriticalSection);
+	return bFinished && NumBytesUsed == 0;
+}
+
+bool FConvaihttpResponseBodyBuffer::HasSucceeded() const
+{
+	FScopeLock Lock(&BufferCriticalSection);
+	return bFinished && bSucceeded;
+}
+
+void FConvaihttpResponseBodyBuffer::SetDataAvailableCallback(TFunction<void()> InCallback)
+{
+	FScopeLock Lock(&BufferCriticalSection);
+	DataAvailableCallback = MoveTemp(InCallback);
+}
+
+EConvaihttpBodySinkResult FConvaihttpResponseBodyBuffer::Write(FMemoryView Data)
+{
+	TFunction<void()> Callback;
+	{
+		FScopeLock Lock(&BufferCriticalSection);
+
+		if (NumBytesUsed + Data.GetSize() > Capacity)
+		{
+			if (NumBytesUsed > 0)
+			{
+				bWriterWaiting = true;
+				return EConvaihttpBodySinkResult::Full;
+			}
+
+			// Never refuse data when empty, or a chunk bigger than the buffer would stall the transfer forever.
+			// The ring overflows to hold it, and Read() shrinks it back to Capacity once it's drained.
+			Buffer.SetNumUninitialized(Data.GetSize());
+			ReadOffset = 0;
+		}
+
+		const uint64 RingSize = Buffer.Num();
+		const uint64 WriteOffset = (ReadOffset + NumBytesUsed) % RingSize;
+		const uint64 FirstPartSize = FMath::Min(Data.GetSize(), RingSize - WriteOffset);
+		FMemory::Memcpy(Buffer.GetData() + WriteOffset, Data.GetData(), FirstPartSize);
+		FMemory::Memcpy(Buffer.GetData(), static_cast<const uint8*>(Data.GetData()) + FirstPartSize, Data.GetSize() - FirstPartSize);
+		NumBytesUsed += Data.GetSize();
+		bReceivedData = true;
+
+		Callback = DataAvailableCallback;
+	}
+
+	if (Callback)
+	{
+		Callback();
+	}
+	return EConvaihttpBodySinkResult::Accepted;
+}
+
+void FConvaihttpResponseBodyBuffer::Finish(bool bInSucceeded)
+{
+	TFunction<void()> Callback;
+	{
+		FScopeLock Lock(&BufferCriticalSection);
+		bFinished = true;
+		bSucceeded = bInSucceeded;
+		Callback = DataAvailableCallback;
+	}
+
+	if (Callback)
+	{
+		Callback();
+	}
+}
+
+bool FConvaihttpResponseBodyBuffer::Restart()
+{
+	FScopeLock Lock(&BufferCriticalSection);
+	// The consumer may already have read part of the previous body
+	if (bReceivedData)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpResponseBodyBuffer: can't restart, part of a body was already received"));
+		return false;
+	}
+
+	bFinished = false;
+	bSucceeded = false;
+	return true;
+}
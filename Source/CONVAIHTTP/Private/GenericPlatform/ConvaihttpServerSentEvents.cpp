@@ -0,0 +1,490 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "GenericPlatform/ConvaihttpServerSentEvents.h"
+#include "Interfaces/IConvaihttpResponse.h"
+#include "ConvaihttpModule.h"
+#include "Convaihttp.h"
+#include "Misc/ScopeLock.h"
+
+namespace ConvaihttpServerSentEvents
+{
+	/** Compare a field name received on the stream with an ANSI literal */
+	template <int32 N>
+	static bool FieldNameEquals(const uint8* Name, int64 NameLength, const ANSICHAR (&Literal)[N])
+	{
+		return NameLength == N - 1 && FMemory::Memcmp(Name, Literal, N - 1) == 0;
+	}
+
+	/** Find the first occurrence of Byte, or return nullptr */
+	static const uint8* FindByte(const uint8* Data, int64 Length, uint8 Byte)
+	{
+		for (const uint8* const End = Data + Length; Data < End; ++Data)
+		{
+			if (*Data == Byte)
+			{
+				return Data;
+			}
+		}
+		return nullptr;
+	}
+
+	/** Convert part of the stream to a string */
+	static FString Utf8ToString(const uint8* Data, int64 Length)
+	{
+		FUTF8ToTCHAR Converted(reinterpret_cast<const ANSICHAR*>(Data), static_cast<int32>(Length));
+		return FString(Converted.Length(), Converted.Get());
+	}
+}
+
+// FConvaihttpServerSentEventParser
+
+FConvaihttpServerSentEventParser::FConvaihttpServerSentEventParser()
+	: ReconnectionTimeMs(-1)
+	, bFinished(false)
+{
+}
+
+FConvaihttpServerSentEventParser::~FConvaihttpServerSentEventParser()
+{
+}
+
+void FConvaihttpServerSentEventParser::SetEventCallback(TFunction<void(FConvaihttpServerSentEvent&&)> InCallback)
+{
+	EventCallback = MoveTemp(InCallback);
+}
+
+bool FConvaihttpServerSentEventParser::DequeueEvent(FConvaihttpServerSentEvent& OutEvent)
+{
+	return Events.Dequeue(OutEvent);
+}
+
+FString FConvaihttpServerSentEventParser::GetLastEventId() const
+{
+	FScopeLock Lock(&LastEventIdCriticalSection);
+	return LastEventId;
+}
+
+int32 FConvaihttpServerSentEventParser::GetReconnectionTimeMs() const
+{
+	return ReconnectionTimeMs.load();
+}
+
+bool FConvaihttpServerSentEventParser::IsFinished() const
+{
+	return bFinished.load();
+}
+
+EConvaihttpBodySinkResult FConvaihttpServerSentEventParser::Write(FMemoryView Data)
+{
+	const uint8* Ptr = static_cast<const uint8*>(Data.GetData());
+	const uint8* const End = Ptr + Data.GetSize();
+
+	// A CR ending the previous receive may be the first half of a CRLF
+	if (bSkipLeadingLF && Ptr < End)
+	{
+		bSkipLeadingLF = false;
+		if (*Ptr == '\n')
+		{
+			++Ptr;
+		}
+	}
+
+	while (Ptr < End)
+	{
+		const uint8* LineEnd = Ptr;
+		while (LineEnd < End && *LineEnd != '\n' && *LineEnd != '\r')
+		{
+			++LineEnd;
+		}
+
+		if (LineEnd == End)
+		{
+			// The rest of the line comes with the next receive
+			if (PendingLine.Num() + (End - Ptr) > MaxLineLength)
+			{
+				UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpServerSentEventParser: line longer than %lld bytes, failing the stream"), MaxLineLength);
+				return EConvaihttpBodySinkResult::Failed;
+			}
+			PendingLine.Append(Ptr, End - Ptr);
+			break;
+		}
+
+		bool bLineProcessed = false;
+		if (PendingLine.Num() > 0)
+		{
+			PendingLine.Append(Ptr, LineEnd - Ptr);
+			bLineProcessed = ProcessLine(PendingLine.GetData(), PendingLine.Num());
+			PendingLine.Reset();
+		}
+		else
+		{
+			// Common case, the whole line is in this receive and is parsed where it is
+			bLineProcessed = ProcessLine(Ptr, LineEnd - Ptr);
+		}
+		if (!bLineProcessed)
+		{
+			return EConvaihttpBodySinkResult::Failed;
+		}
+
+		if (*LineEnd == '\r')
+		{
+			if (LineEnd + 1 == End)
+			{
+				bSkipLeadingLF = true;
+			}
+			else if (LineEnd[1] == '\n')
+			{
+				++LineEnd;
+			}
+		}
+		Ptr = LineEnd + 1;
+	}
+
+	return EConvaihttpBodySinkResult::Accepted;
+}
+
+void FConvaihttpServerSentEventParser::Finish(bool bSucceeded)
+{
+	// An event that wasn't terminated by a blank line is discarded
+	PendingLine.Empty();
+	DataBuffer.Empty();
+	EventType.Empty();
+	bFinished = true;
+}
+
+bool FConvaihttpServerSentEventParser::ProcessLine(const uint8* Line, int64 Length)
+{
+	if (bFirstLine)
+	{
+		bFirstLine = false;
+		if (Length >= 3 && Line[0] == 0xEF && Line[1] == 0xBB && Line[2] == 0xBF)
+		{
+			Line += 3;
+			Length -= 3;
+		}
+	}
+
+	if (Length == 0)
+	{
+		DispatchEvent();
+		return true;
+	}
+
+	if (Line[0] == ':')
+	{
+		// Comment, typically a keep-alive
+		return true;
+	}
+
+	const uint8* Colon = ConvaihttpServerSentEvents::FindByte(Line, Length, ':');
+	if (Colon == nullptr)
+	{
+		return ProcessField(Line, Length, Line + Length, 0);
+	}
+
+	const uint8* Value = Colon + 1;
+	const uint8* const LineEnd = Line + Length;
+	if (Value < LineEnd && *Value == ' ')
+	{
+		++Value;
+	}
+	return ProcessField(Line, Colon - Line, Value, LineEnd - Value);
+}
+
+bool FConvaihttpServerSentEventParser::ProcessField(const uint8* Name, int64 NameLength, const uint8* Value, int64 ValueLength)
+{
+	using namespace ConvaihttpServerSentEvents;
+
+	if (FieldNameEquals(Name, NameLength, "data"))
+	{
+		if (DataBuffer.Num() + ValueLength + 1 > MaxEventSize)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpServerSentEventParser: event data larger than %lld bytes, failing the stream"), MaxEventSize);
+			return false;
+		}
+		DataBuffer.Append(Value, ValueLength);
+		DataBuffer.Add('\n');
+	}
+	else if (FieldNameEquals(Name, NameLength, "event"))
+	{
+		EventType = Utf8ToString(Value, ValueLength);
+	}
+	else if (FieldNameEquals(Name, NameLength, "id"))
+	{
+		if (FindByte(Value, ValueLength, 0) == nullptr)
+		{
+			FString NewLastEventId = Utf8ToString(Value, ValueLength);
+			FScopeLock Lock(&LastEventIdCriticalSection);
+			LastEventId = MoveTemp(NewLastEventId);
+		}
+	}
+	else if (FieldNameEquals(Name, NameLength, "retry"))
+	{
+		if (ValueLength > 0 && ValueLength < 10)
+		{
+			int32 NewReconnectionTimeMs = 0;
+			for (int64 Index = 0; Index < ValueLength; ++Index)
+			{
+				if (Value[Index] < '0' || Value[Index] > '9')
+				{
+					return true;
+				}
+				NewReconnectionTimeMs = NewReconnectionTimeMs * 10 + (Value[Index] - '0');
+			}
+			ReconnectionTimeMs = NewReconnectionTimeMs;
+		}
+	}
+	// Other fields are ignored
+	return true;
+}
+
+void FConvaihttpServerSentEventParser::DispatchEvent()
+{
+	using namespace ConvaihttpServerSentEvents;
+
+	if (DataBuffer.Num() == 0)
+	{
+		EventType.Reset();
+		return;
+	}
+
+	FConvaihttpServerSentEvent Event;
+	Event.Event = EventType.IsEmpty() ? FString(TEXT("message")) : MoveTemp(EventType);
+	{
+		FScopeLock Lock(&LastEventIdCriticalSection);
+		Event.Id = LastEventId;
+	}
+	// Drop the trailing \n added after the last data line
+	Event.Data = Utf8ToString(DataBuffer.GetData(), DataBuffer.Num() - 1);
+
+	DataBuffer.Reset();
+	EventType.Reset();
+
+	if (EventCallback)
+	{
+		EventCallback(MoveTemp(Event));
+	}
+	else
+	{
+		Events.Enqueue(MoveTemp(Event));
+	}
+}
+
+// FConvaihttpServerSentEvents
+
+FConvaihttpServerSentEvents::FConvaihttpServerSentEvents(const FString& InURL)
+	: URL(InURL)
+	, Verb(TEXT("GET"))
+{
+}
+
+FConvaihttpServerSentEvents::~FConvaihttpServerSentEvents()
+{
+	Close();
+}
+
+void FConvaihttpServerSentEvents::SetVerb(const FString& InVerb)
+{
+	Verb = InVerb;
+}
+
+void FConvaihttpServerSentEvents::SetHeader(const FString& HeaderName, const FString& HeaderValue)
+{
+	Headers.Add(HeaderName, HeaderValue);
+}
+
+void FConvaihttpServerSentEvents::SetContentAsString(const FString& ContentString)
+{
+	Content = ContentString;
+}
+
+void FConvaihttpServerSentEvents::SetAutoReconnect(bool bInAutoReconnect)
+{
+	bAutoReconnect = bInAutoReconnect;
+}
+
+bool FConvaihttpServerSentEvents::Connect()
+{
+	check(IsInGameThread());
+
+	if (bOpen)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpServerSentEvents: attempted to connect to %s while already connected"), *URL);
+		return false;
+	}
+
+	bOpen = true;
+	if (!StartRequest())
+	{
+		bOpen = false;
+		return false;
+	}
+	return true;
+}
+
+void FConvaihttpServerSentEvents::Close()
+{
+	bOpen = false;
+
+	if (ReconnectHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(ReconnectHandle);
+		ReconnectHandle.Reset();
+	}
+
+	if (Request.IsValid())
+	{
+		TSharedPtr<IConvaihttpRequest, ESPMode::ThreadSafe> RequestToCancel = MoveTemp(Request);
+		RequestToCancel->OnProcessRequestComplete().Unbind();
+		RequestToCancel->OnRequestProgress().Unbind();
+		RequestToCancel->CancelRequest();
+	}
+	Parser.Reset();
+}
+
+bool FConvaihttpServerSentEvents::IsOpen() const
+{
+	return bOpen;
+}
+
+const FString& FConvaihttpServerSentEvents::GetLastEventId() const
+{
+	return LastEventId;
+}
+
+bool FConvaihttpServerSentEvents::StartRequest()
+{
+	Parser = MakeShared<FConvaihttpServerSentEventParser, ESPMode::ThreadSafe>();
+
+	Request = FConvaihttpModule::Get().CreateRequest();
+	Request->SetURL(URL);
+	Request->SetVerb(Verb);
+	for (const TPair<FString, FString>& Header : Headers)
+	{
+		Request->SetHeader(Header.Key, Header.Value);
+	}
+	Request->SetHeader(TEXT("Accept"), TEXT("text/event-stream"));
+	Request->SetHeader(TEXT("Cache-Control"), TEXT("no-cache"));
+	if (!LastEventId.IsEmpty())
+	{
+		Request->SetHeader(TEXT("Last-Event-ID"), LastEventId);
+	}
+	if (!Content.IsEmpty())
+	{
+		Request->SetContentAsString(Content);
+	}
+
+	if (!Request->SetResponseBodyReceiveSink(Parser.ToSharedRef()))
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpServerSentEvents: this CONVAIHTTP implementation can't stream response bodies"));
+		Request.Reset();
+		Parser.Reset();
+		return false;
+	}
+
+	// Progress is reported on the game thread whenever more of the body arrived, which is when there may be new events
+	TWeakPtr<FConvaihttpServerSentEvents, ESPMode::ThreadSafe> WeakThis = AsShared();
+	Request->OnRequestProgress().BindLambda([WeakThis](FConvaihttpRequestPtr, uint64, uint64)
+	{
+		if (TSharedPtr<FConvaihttpServerSentEvents, ESPMode::ThreadSafe> StrongThis = WeakThis.Pin())
+		{
+			StrongThis->DeliverEvents();
+		}
+	});
+	Request->OnProcessRequestComplete().BindLambda([WeakThis](FConvaihttpRequestPtr CompletedRequest, FConvaihttpResponsePtr Response, bool bConnectedSuccessfully)
+	{
+		if (TSharedPtr<FConvaihttpServerSentEvents, ESPMode::ThreadSafe> StrongThis = WeakThis.Pin())
+		{
+			StrongThis->OnRequestComplete(CompletedRequest, Response, bConnectedSuccessfully);
+		}
+	});
+
+	UE_LOG(LogConvaihttp, Verbose, TEXT("FConvaihttpServerSentEvents: connecting to %s (Last-Event-ID='%s')"), *URL, *LastEventId);
+	return Request->ProcessRequest();
+}
+
+void FConvaihttpServerSentEvents::DeliverEvents()
+{
+	// Keep the parser alive, the delegate may close the stream
+	TSharedPtr<FConvaihttpServerSentEventParser, ESPMode::ThreadSafe> CurrentParser = Parser;
+	if (!CurrentParser.IsValid())
+	{
+		return;
+	}
+
+	FConvaihttpServerSentEvent Event;
+	while (bOpen && Parser == CurrentParser && CurrentParser->DequeueEvent(Event))
+	{
+		LastEventId = Event.Id;
+		EventDelegate.ExecuteIfBound(Event);
+	}
+}
+
+void FConvaihttpServerSentEvents::OnRequestComplete(FConvaihttpRequestPtr CompletedRequest, FConvaihttpResponsePtr Response, bool bConnectedSuccessfully)
+{
+	if (CompletedRequest != Request)
+	{
+		return;
+	}
+
+	DeliverEvents();
+	if (!bOpen || !Parser.IsValid())
+	{
+		return;
+	}
+
+	// The server may have set an ID or retry time without dispatching an event
+	LastEventId = Parser->GetLastEventId();
+	if (Parser->GetReconnectionTimeMs() >= 0)
+	{
+		ReconnectionTimeMs = Parser->GetReconnectionTimeMs();
+	}
+	Request.Reset();
+	Parser.Reset();
+
+	if (bConnectedSuccessfully && Response.IsValid())
+	{
+		const int32 ResponseCode = Response->GetResponseCode();
+		if (ResponseCode == EConvaihttpResponseCodes::NoContent)
+		{
+			// The server asked us to stop reconnecting
+			CloseWithResult(Response, true);
+			return;
+		}
+
+		if (ResponseCode != EConvaihttpResponseCodes::Ok || !Response->GetContentType().StartsWith(TEXT("text/event-stream")))
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpServerSentEvents: %s responded with %d '%s', not an event stream"), *URL, ResponseCode, *Response->GetContentType());
+			CloseWithResult(Response, false);
+			return;
+		}
+	}
+
+	if (!bAutoReconnect)
+	{
+		CloseWithResult(Response, bConnectedSuccessfully);
+		return;
+	}
+
+	UE_LOG(LogConvaihttp, Log, TEXT("FConvaihttpServerSentEvents: stream from %s ended, reconnecting in %dms"), *URL, ReconnectionTimeMs);
+
+	TWeakPtr<FConvaihttpServerSentEvents, ESPMode::ThreadSafe> WeakThis = AsShared();
+	ReconnectHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([WeakThis](float)
+	{
+		if (TSharedPtr<FConvaihttpServerSentEvents, ESPMode::ThreadSafe> StrongThis = WeakThis.Pin())
+		{
+			StrongThis->ReconnectHandle.Reset();
+			if (StrongThis->bOpen && !StrongThis->StartRequest())
+			{
+				StrongThis->CloseWithResult(nullptr, false);
+			}
+		}
+		return false;
+	}), ReconnectionTimeMs / 1000.0f);
+}
+
+void FConvaihttpServerSentEvents::CloseWithResult(FConvaihttpResponsePtr Response, bool bSucceeded)
+{
+	Close();
+	ClosedDelegate.ExecuteIfBound(Response, bSucceeded);
+}
@@ -0,0 +1,289 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "GenericPlatform/ConvaihttpUploadSource.h"
+#include "Convaihttp.h"
+#include "Async/AsyncFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+
+FConvaihttpArchiveUploadSource::FConvaihttpArchiveUploadSource(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive)
+	: Archive(InArchive)
+	, ContentLength(static_cast<uint64>(FMath::Max<int64>(InArchive->TotalSize(), 0)))
+{
+}
+
+FConvaihttpArchiveUploadSource::~FConvaihttpArchiveUploadSource()
+{
+}
+
+uint64 FConvaihttpArchiveUploadSource::GetContentLength() const
+{
+	return ContentLength;
+}
+
+uint64 FConvaihttpArchiveUploadSource::Read(FMutableMemoryView Destination, uint64 Offset)
+{
+	check(Offset <= ContentLength);
+	const uint64 SizeToRead = FMath::Min(ContentLength - Offset, Destination.GetSize());
+	if (SizeToRead == 0)
+	{
+		return 0;
+	}
+
+	if (static_cast<uint64>(Archive->Tell()) != Offset)
+	{
+		Archive->Seek(static_cast<int64>(Offset));
+	}
+	Archive->Serialize(Destination.GetData(), static_cast<int64>(SizeToRead));
+
+	if (Archive->IsError())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpArchiveUploadSource: failed to read %llu bytes at offset %llu from %s"), SizeToRead, Offset, *Archive->GetArchiveName());
+		return ReadError;
+	}
+	return SizeToRead;
+}
+
+FConvaihttpAsyncFileUploadSource::FConvaihttpAsyncFileUploadSource(const FString& InFilename, int32 InNumBlocks, uint64 InBlockSize)
+	: Filename(InFilename)
+	, BlockSize(FMath::Max<uint64>(InBlockSize, 4096))
+{
+	const int64 FileSize = IFileManager::Get().FileSize(*Filename);
+	if (FileSize < 0)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpAsyncFileUploadSource: failed to find %s"), *Filename);
+		return;
+	}
+
+	FileHandle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenAsyncRead(*Filename));
+	if (!FileHandle.IsValid())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpAsyncFileUploadSource: failed to open %s for reading"), *Filename);
+		return;
+	}
+
+	ContentLength = static_cast<uint64>(FileSize);
+	Blocks.SetNum(FMath::Max(InNumBlocks, 2));
+
+	// Start reading before the transfer asks for anything
+	IssueReads();
+}
+
+FConvaihttpAsyncFileUploadSource::~FConvaihttpAsyncFileUploadSource()
+{
+	// Completion callbacks reference this, so they all have to have run before we go away
+	ReleaseReads();
+	FileHandle.Reset();
+}
+
+bool FConvaihttpAsyncFileUploadSource::IsValid() const
+{
+	return FileHandle.IsValid();
+}
+
+uint64 FConvaihttpAsyncFileUploadSource::GetContentLength() const
+{
+	return ContentLength;
+}
+
+bool FConvaihttpAsyncFileUploadSource::IsSeekable() const
+{
+	return true;
+}
+
+void FConvaihttpAsyncFileUploadSource::IssueReads()
+{
+	while (NumIssuedBlocks < Blocks.Num() && NextIssueOffset < ContentLength)
+	{
+		FBlock& Block = Blocks[(HeadBlock + NumIssuedBlocks) % Blocks.Num()];
+		check(Block.Request == nullptr);
+
+		Block.FileOffset = NextIssueOffset;
+		Block.Size = FMath::Min(BlockSize, ContentLength - NextIssueOffset);
+		Block.Consumed = 0;
+		Block.Data.SetNumUninitialized(Block.Size, false);
+		Block.bReadComplete = false;
+		Block.bReadFailed = false;
+
+		FAsyncFileCallBack Callback = [this, &Block](bool bWasCancelled, IAsyncReadRequest* Request)
+		{
+			Block.bReadFailed = bWasCancelled || Request->GetReadResults() == nullptr;
+			Block.bReadComplete = true;
+			NotifyDataAvailable();
+		};
+		Block.Request = FileHandle->ReadRequest(static_cast<int64>(Block.FileOffset), static_cast<int64>(Block.Size), AIOP_Normal, &Callback, Block.Data.GetData());
+
+		NextIssueOffset += Block.Size;
+		++NumIssuedBlocks;
+	}
+}
+
+void FConvaihttpAsyncFileUploadSource::ReleaseReads()
+{
+	for (FBlock& Block : Blocks)
+	{
+		if (Block.Request)
+		{
+			Block.Request->Cancel();
+			Block.Request->WaitCompletion();
+			delete Block.Request;
+			Block.Request = nullptr;
+		}
+	}
+	NumIssuedBlocks = 0;
+}
+
+uint64 FConvaihttpAsyncFileUploadSource::Read(FMutableMemoryView Destination, uint64 Offset)
+{
+	if (!FileHandle.IsValid())
+	{
+		return ReadError;
+	}
+
+	if (Offset != NextReadOffset)
+	{
+		// The transfer rewound (or skipped ahead), restart the read-ahead from the requested offset
+		UE_LOG(LogConvaihttp, Verbose, TEXT("FConvaihttpAsyncFileUploadSource: restarting reads of %s at offset %llu (expected %llu)"), *Filename, Offset, NextReadOffset);
+		ReleaseReads();
+		HeadBlock = 0;
+		NextIssueOffset = Offset;
+		NextReadOffset = Offset;
+		IssueReads();
+	}
+
+	uint64 SizeWritten = 0;
+	while (SizeWritten < Destination.GetSize() && NextReadOffset < ContentLength)
+	{
+		FBlock& Block = Blocks[HeadBlock];
+		if (Block.Request == nullptr || !Block.bReadComplete)
+		{
+			// Data isn't there yet. Hand over what we have, or ask to be woken up by the completion callback
+			break;
+		}
+
+		if (Block.bReadFailed)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpAsyncFileUploadSource: failed to read %llu bytes at offset %llu from %s"), Block.Size, Block.FileOffset, *Filename);
+			return ReadError;
+		}
+
+		const uint64 SizeToCopy = FMath::Min(Block.Size - Block.Consumed, Destination.GetSize() - SizeWritten);
+		FMemory::Memcpy(static_cast<uint8*>(Destination.GetData()) + SizeWritten, Block.Data.GetData() + Block.Consumed, SizeToCopy);
+		Block.Consumed += SizeToCopy;
+		SizeWritten += SizeToCopy;
+		NextReadOffset += SizeToCopy;
+
+		if (Block.Consumed == Block.Size)
+		{
+			// Recycle the block for the next part of the file. The callback has already run, so this won't block for long
+			Block.Request->WaitCompletion();
+			delete Block.Request;
+			Block.Request = nullptr;
+			HeadBlock = (HeadBlock + 1) % Blocks.Num();
+			--NumIssuedBlocks;
+			IssueReads();
+		}
+	}
+
+	if (SizeWritten == 0 && NextReadOffset < ContentLength)
+	{
+		return ReadPending;
+	}
+	return SizeWritten;
+}
+
+FConvaihttpStreamingUploadSource::FConvaihttpStreamingUploadSource()
+	: BytesPushed(0)
+	, bFinished(false)
+{
+}
+
+FConvaihttpStreamingUploadSource::~FConvaihttpStreamingUploadSource()
+{
+}
+
+bool FConvaihttpStreamingUploadSource::PushData(FSharedBuffer Data)
+{
+	if (bFinished.load())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpStreamingUploadSource: attempted to push %llu bytes after the body was finished"), Data.GetSize());
+		return false;
+	}
+
+	if (Data.GetSize() > 0)
+	{
+		BytesPushed.fetch_add(Data.GetSize());
+		PendingData.Enqueue(Data.MakeOwned());
+		NotifyDataAvailable();
+	}
+	return true;
+}
+
+bool FConvaihttpStreamingUploadSource::PushData(const void* Data, uint64 Size)
+{
+	return PushData(FSharedBuffer::Clone(Data, Size));
+}
+
+void FConvaihttpStreamingUploadSource::Finish()
+{
+	if (!bFinished.exchange(true))
+	{
+		// Wake up the transport so it can send the end of the body
+		NotifyDataAvailable();
+	}
+}
+
+bool FConvaihttpStreamingUploadSource::IsFinished() const
+{
+	return bFinished.load();
+}
+
+uint64 FConvaihttpStreamingUploadSource::GetContentLength() const
+{
+	return BytesPushed.load();
+}
+
+bool FConvaihttpStreamingUploadSource::HasKnownContentLength() const
+{
+	return false;
+}
+
+uint64 FConvaihttpStreamingUploadSource::Read(FMutableMemoryView Destination, uint64 Offset)
+{
+	if (Offset != BytesRead)
+	{
+		// Data already sent is released, so there's no going back
+		UE_LOG(LogConvaihttp, Warning, TEXT("FConvaihttpStreamingUploadSource: can't read at offset %llu, %llu bytes were already sent"), Offset, BytesRead);
+		return ReadError;
+	}
+
+	// Read before draining the queue: Finish() can't be followed by more data, so if it was set now, an empty queue below really is the end
+	const bool bWasFinished = bFinished.load();
+
+	uint64 SizeWritten = 0;
+	while (!Destination.IsEmpty())
+	{
+		if (CurrentBufferOffset == CurrentBuffer.GetSize())
+		{
+			CurrentBuffer.Reset();
+			CurrentBufferOffset = 0;
+			if (!PendingData.Dequeue(CurrentBuffer))
+			{
+				break;
+			}
+		}
+
+		const FMemoryView Chunk = CurrentBuffer.GetView().Mid(CurrentBufferOffset, Destination.GetSize());
+		Destination = Destination.CopyFrom(Chunk);
+		CurrentBufferOffset += Chunk.GetSize();
+		SizeWritten += Chunk.GetSize();
+	}
+
+	BytesRead += SizeWritten;
+
+	if (SizeWritten == 0 && !bWasFinished)
+	{
+		return ReadPending;
+	}
+	return SizeWritten;
+}
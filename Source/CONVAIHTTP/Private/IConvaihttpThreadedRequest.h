@@ -16,5 +16,25 @@ public:
 	// Called on game thread
 	virtual void FinishRequest() = 0;
 
+	/** @return true if the request is served in process rather than by the transport of the CONVAIHTTP thread (e.g. libcurl) */
+	virtual bool IsSimulated() const
+	{
+		return false;
+	}
+
+	/** @return host of the request as throttles are keyed, parsed from its URL when it was queued */
+	const FString& GetThrottleHostKey() const
+	{
+		return ThrottleHostKey;
+	}
+
+	/** Set when the request is queued, so the CONVAIHTTP thread doesn't parse the URL of each queued request on every pass */
+	void SetThrottleHostKey(FString InThrottleHostKey)
+	{
+		ThrottleHostKey = MoveTemp(InThrottleHostKey);
+	}
+
 protected:
+	/** Host of the request, see GetThrottleHostKey() */
+	FString ThrottleHostKey;
 };
@@ -36,6 +36,7 @@ public:
 	virtual FString GetVerb() const override;
 	virtual void SetVerb(const FString& InVerb) override;
 	virtual void SetURL(const FString& InURL) override;
+	using FConvaihttpRequestImpl::SetContent;
 	virtual void SetContent(const TArray64<uint8>& ContentPayload) override;
 	virtual void SetContent(TArray64<uint8>&& ContentPayload) override;
 	virtual void SetContentAsString(const FString& ContentString) override;
@@ -0,0 +1,941 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "SimulatedConvaihttp.h"
+#include "ConvaihttpManager.h"
+#include "ConvaihttpModule.h"
+#include "ConvaihttpMetrics.h"
+#include "ConvaihttpTrace.h"
+#include "Convaihttp.h"
+#include "GenericPlatform/GenericPlatformConvaihttp.h"
+#include "GenericPlatform/ConvaihttpUploadSource.h"
+#include "Math/RandomStream.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/StringBuilder.h"
+#include "Templates/TypeHash.h"
+
+namespace SimulatedConvaihttp
+{
+	/** Settings of all simulated requests, and the index of the next request to start */
+	struct FState
+	{
+		FCriticalSection CriticalSection;
+		FSimulatedConvaihttpSettings Settings;
+		std::atomic<uint32> NextRequestIndex{ 0 };
+	};
+
+	FState& GetState()
+	{
+		static FState State;
+		return State;
+	}
+
+	/** Buffer the payload of requests is read into. Only used on the CONVAIHTTP thread */
+	static thread_local TArray64<uint8> UploadBuffer;
+	/** Bytes the bodies of responses are copied from. Only used on the CONVAIHTTP thread */
+	static thread_local TArray64<uint8> ResponseFill;
+	/** Events the bodies of event stream responses are copied from, repeated, and the data size they were built for. Only used on the CONVAIHTTP thread */
+	static thread_local TArray64<uint8> EventStreamFill;
+	static thread_local int32 EventStreamFillDataSize = 0;
+
+	/** Longest data line of the events of an event stream response */
+	static constexpr int32 MaxEventLineSize = 128;
+
+	/**
+	 * Get the part of a response body starting at an offset
+	 *
+	 * @param Settings - settings of the transfer
+	 * @param Offset - offset in the body of the first byte
+	 * @param Size - number of bytes
+	 */
+	FMemoryView GetResponseFill(const FSimulatedConvaihttpSettings& Settings, int64 Offset, int64 Size)
+	{
+		if (Settings.EventDataSize <= 0)
+		{
+			if (ResponseFill.Num() < Size)
+			{
+				ResponseFill.Init('x', Size);
+			}
+			return FMemoryView(ResponseFill.GetData(), Size);
+		}
+
+		// The body repeats the same event, so any part of it can be copied from the event at its offset and the ones after
+		const int64 EventSize = Settings.GetEventSize();
+		if (EventStreamFillDataSize != Settings.EventDataSize || EventStreamFill.Num() < Size + EventSize)
+		{
+			TAnsiStringBuilder<512> Event;
+			for (int32 Remaining = Settings.EventDataSize; Remaining > 0; Remaining -= MaxEventLineSize)
+			{
+				Event << "data: ";
+				for (int32 Index = 0, LineSize = FMath::Min(Remaining, MaxEventLineSize); Index < LineSize; ++Index)
+				{
+					Event.AppendChar(static_cast<ANSICHAR>('a' + (Index % 26)));
+				}
+				Event << "\n";
+			}
+			Event << "\n";
+			check(Event.Len() == EventSize);
+
+			EventStreamFill.Reset();
+			while (EventStreamFill.Num() < Size + EventSize)
+			{
+				EventStreamFill.Append(reinterpret_cast<const uint8*>(Event.GetData()), Event.Len());
+			}
+			EventStreamFillDataSize = Settings.EventDataSize;
+		}
+		return FMemoryView(EventStreamFill.GetData() + Offset % EventSize, Size);
+	}
+
+	/** Read an override of a setting from the query of a url, the one for the host of the url taking precedence */
+	template <typename T>
+	void ReadUrlParameter(const FString& Url, const TCHAR* ParameterName, T& OutValue, double Scale = 1.0)
+	{
+		const FString HostParameterName = FString::Printf(TEXT("%s@%s"), ParameterName, *FGenericPlatformConvaihttp::GetUrlDomain(Url));
+		for (const TCHAR* Name : { ParameterName, *HostParameterName })
+		{
+			const TOptional<FString> Value = FGenericPlatformConvaihttp::GetUrlParameter(Url, Name);
+			if (Value.IsSet() && !Value.GetValue().IsEmpty())
+			{
+				OutValue = static_cast<T>(FCString::Atod(*Value.GetValue()) * Scale);
+			}
+		}
+	}
+}
+
+void FSimulatedConvaihttpSettings::LoadConfig()
+{
+	const TCHAR* Section = TEXT("CONVAIHTTP.SimulatedConvaihttp");
+	GConfig->GetDouble(Section, TEXT("LatencySeconds"), LatencySeconds, GEngineIni);
+	GConfig->GetDouble(Section, TEXT("LatencyJitterSeconds"), LatencyJitterSeconds, GEngineIni);
+	GConfig->GetDouble(Section, TEXT("BytesPerSecond"), BytesPerSecond, GEngineIni);
+	GConfig->GetInt(Section, TEXT("ChunkSize"), ChunkSize, GEngineIni);
+	GConfig->GetDouble(Section, TEXT("StreamIntervalSeconds"), StreamIntervalSeconds, GEngineIni);
+	GConfig->GetInt64(Section, TEXT("ResponseSize"), ResponseSize, GEngineIni);
+	GConfig->GetInt(Section, TEXT("ResponseCode"), ResponseCode, GEngineIni);
+	GConfig->GetString(Section, TEXT("ContentType"), ContentType, GEngineIni);
+	GConfig->GetInt(Section, TEXT("EventDataSize"), EventDataSize, GEngineIni);
+	GConfig->GetBool(Section, TEXT("bChunkedResponse"), bChunkedResponse, GEngineIni);
+	GConfig->GetFloat(Section, TEXT("ConnectionErrorRate"), ConnectionErrorRate, GEngineIni);
+	GConfig->GetFloat(Section, TEXT("TransferErrorRate"), TransferErrorRate, GEngineIni);
+	GConfig->GetFloat(Section, TEXT("ServerErrorRate"), ServerErrorRate, GEngineIni);
+	GConfig->GetInt(Section, TEXT("RandomSeed"), RandomSeed, GEngineIni);
+}
+
+int64 FSimulatedConvaihttpSettings::GetEventSize() const
+{
+	// "data: " and a line feed per line, and the blank line dispatching the event
+	const int64 NumLines = FMath::DivideAndRoundUp<int64>(FMath::Max(EventDataSize, 1), SimulatedConvaihttp::MaxEventLineSize);
+	return FMath::Max(EventDataSize, 1) + NumLines * 7 + 1;
+}
+
+// FSimulatedConvaihttpRequest
+
+FSimulatedConvaihttpRequest::FSimulatedConvaihttpRequest()
+	: CompletionStatus(EConvaihttpRequestStatus::NotStarted)
+{
+}
+
+FSimulatedConvaihttpRequest::~FSimulatedConvaihttpRequest()
+{
+}
+
+void FSimulatedConvaihttpRequest::UpdateConfigs()
+{
+	SimulatedConvaihttp::FState& State = SimulatedConvaihttp::GetState();
+	FScopeLock Lock(&State.CriticalSection);
+	State.Settings.LoadConfig();
+	State.NextRequestIndex = 0;
+}
+
+FString FSimulatedConvaihttpRequest::GetURL() const
+{
+	return URL;
+}
+
+FString FSimulatedConvaihttpRequest::GetURLParameter(const FString& ParameterName) const
+{
+	return FGenericPlatformConvaihttp::GetUrlParameter(URL, ParameterName).Get(FString());
+}
+
+FString FSimulatedConvaihttpRequest::GetHeader(const FString& HeaderName) const
+{
+	const FString* Header = Headers.Find(HeaderName);
+	return Header != nullptr ? *Header : FString();
+}
+
+TArray64<FString> FSimulatedConvaihttpRequest::GetAllHeaders() const
+{
+	TArray64<FString> Result;
+	Result.Reserve(Headers.Num());
+	for (const TPair<FString, FString>& It : Headers)
+	{
+		Result.Emplace(It.Key + TEXT(": ") + It.Value);
+	}
+	return Result;
+}
+
+FString FSimulatedConvaihttpRequest::GetContentType() const
+{
+	return GetHeader(TEXT("Content-Type"));
+}
+
+uint64 FSimulatedConvaihttpRequest::GetContentLength() const
+{
+	return RequestPayload.IsValid() ? RequestPayload->GetContentLength() : 0;
+}
+
+const TArray64<uint8>& FSimulatedConvaihttpRequest::GetContent() const
+{
+	static const TArray64<uint8> EmptyContent;
+	return RequestPayload.IsValid() ? RequestPayload->GetContent() : EmptyContent;
+}
+
+FString FSimulatedConvaihttpRequest::GetVerb() const
+{
+	return Verb;
+}
+
+void FSimulatedConvaihttpRequest::SetVerb(const FString& InVerb)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetVerb() - attempted to set verb on a request that is inflight"));
+		return;
+	}
+
+	Verb = InVerb.ToUpper();
+}
+
+void FSimulatedConvaihttpRequest::SetURL(const FString& InURL)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetURL() - attempted to set url on a request that is inflight"));
+		return;
+	}
+
+	URL = InURL;
+}
+
+void FSimulatedConvaihttpRequest::SetContent(const TArray64<uint8>& ContentPayload)
+{
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
+	SetContent(CopyTemp(ContentPayload));
+}
+
+void FSimulatedConvaihttpRequest::SetContent(TArray64<uint8>&& ContentPayload)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContent() - attempted to set content on a request that is inflight"));
+		return;
+	}
+
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
+	RequestPayloadMemory.Set(ContentPayload.GetAllocatedSize());
+	RequestPayload = MakeUnique<FCH_RequestPayloadInMemory>(MoveTemp(ContentPayload));
+}
+
+void FSimulatedConvaihttpRequest::SetContent(const FSharedBuffer& ContentPayload)
+{
+	SetContent(FCompositeBuffer(ContentPayload));
+}
+
+void FSimulatedConvaihttpRequest::SetContent(const FCompositeBuffer& ContentPayload)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContent() - attempted to set content on a request that is inflight"));
+		return;
+	}
+
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
+	RequestPayloadMemory.Set(ContentPayload.GetSize());
+	RequestPayload = MakeUnique<FCH_RequestPayloadInSharedBuffer>(ContentPayload.MakeOwned());
+}
+
+void FSimulatedConvaihttpRequest::SetContentAsString(const FString& ContentString)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContentAsString() - attempted to set content on a request that is inflight"));
+		return;
+	}
+
+	LLM_SCOPE_BYTAG(Convaihttp_RequestPayload);
+	FTCHARToUTF8 Converter(*ContentString, ContentString.Len());
+	TArray64<uint8> Buffer(reinterpret_cast<const uint8*>(Converter.Get()), Converter.Length());
+	SetContent(MoveTemp(Buffer));
+}
+
+bool FSimulatedConvaihttpRequest::SetContentAsStreamedFile(const FString& Filename)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContentAsStreamedFile() - attempted to set content on a request that is inflight"));
+		return false;
+	}
+
+	TSharedRef<FConvaihttpAsyncFileUploadSource, ESPMode::ThreadSafe> Source = MakeShared<FConvaihttpAsyncFileUploadSource, ESPMode::ThreadSafe>(Filename);
+	RequestPayloadMemory.Set(0);
+	if (Source->IsValid())
+	{
+		RequestPayload = MakeUnique<FCH_RequestPayloadFromSource>(Source);
+	}
+	else
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContentAsStreamedFile Failed to open %s for reading"), *Filename);
+		RequestPayload.Reset();
+	}
+	return RequestPayload.IsValid();
+}
+
+bool FSimulatedConvaihttpRequest::SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContentFromStream() - attempted to set content on a request that is inflight"));
+		return false;
+	}
+
+	RequestPayloadMemory.Set(0);
+	RequestPayload = MakeUnique<FCH_RequestPayloadInFileStream>(Stream);
+	return true;
+}
+
+bool FSimulatedConvaihttpRequest::SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetContentFromSource() - attempted to set content on a request that is inflight"));
+		return false;
+	}
+
+	RequestPayloadMemory.Set(0);
+	RequestPayload = MakeUnique<FCH_RequestPayloadFromSource>(Source);
+	return true;
+}
+
+bool FSimulatedConvaihttpRequest::SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetResponseBodyReceiveSink() - attempted to set the response body sink on a request that is inflight"));
+		return false;
+	}
+
+	ResponseBodySink = Sink;
+	return true;
+}
+
+void FSimulatedConvaihttpRequest::SetHeader(const FString& HeaderName, const FString& HeaderValue)
+{
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("FSimulatedConvaihttpRequest::SetHeader() - attempted to set header on a request that is inflight"));
+		return;
+	}
+
+	LLM_SCOPE_BYTAG(Convaihttp_Headers);
+	Headers.Add(HeaderName, HeaderValue);
+	HeadersMemory.Set(GetHeadersAllocatedSize(Headers));
+}
+
+void FSimulatedConvaihttpRequest::AppendToHeader(const FString& HeaderName, const FString& AdditionalHeaderValue)
+{
+	if (!HeaderName.IsEmpty() && !AdditionalHeaderValue.IsEmpty())
+	{
+		const FString* PreviousValue = Headers.Find(HeaderName);
+		FString NewValue;
+		if (PreviousValue != nullptr && !PreviousValue->IsEmpty())
+		{
+			NewValue = (*PreviousValue) + TEXT(", ");
+		}
+		NewValue += AdditionalHeaderValue;
+
+		SetHeader(HeaderName, NewValue);
+	}
+}
+
+bool FSimulatedConvaihttpRequest::ProcessRequest()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FSimulatedConvaihttpRequest_ProcessRequest);
+
+	if (CompletionStatus == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("ProcessRequest failed. Still processing last request. %p"), this);
+		return false;
+	}
+	// A sink holding part of the body of a previous attempt can't take another one
+	if (ResponseBodySink.IsValid() && !ResponseBodySink->Restart())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("ProcessRequest failed. The response body sink can't take another body. %p"), this);
+		return false;
+	}
+
+	// Clear out the response of a re-used request
+	Response = nullptr;
+	bCanceled = false;
+	bTransferCompleted = false;
+	bTransferSucceeded = false;
+	bAnyConvaihttpActivity = false;
+	LastReportedBytesSent = 0;
+	LastReportedBytesRead = 0;
+	BytesSent.Reset();
+	if (Verb.IsEmpty())
+	{
+		Verb = TEXT("GET");
+	}
+
+	if (!FConvaihttpModule::Get().GetConvaihttpManager().IsDomainAllowed(URL))
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("ProcessRequest failed. URL '%s' is not using an allowed domain. %p"), *URL, this);
+
+		if (!IsInGameThread())
+		{
+			// Always finish on the game thread
+			FConvaihttpModule::Get().GetConvaihttpManager().AddGameThreadTask([StrongThis = StaticCastSharedRef<FSimulatedConvaihttpRequest>(AsShared())]()
+			{
+				StrongThis->FinishedRequest();
+			});
+			return true;
+		}
+		FinishedRequest();
+		return false;
+	}
+
+	// Mark as in-flight to prevent overlapped requests using the same object
+	CompletionStatus = EConvaihttpRequestStatus::Processing;
+	QueuedTimeAbsoluteSeconds = FPlatformTime::Seconds();
+	StartedTimeAbsoluteSeconds = 0.0;
+	CONVAIHTTP_TRACE_EVENT(this, Queued);
+	// Add to global list while being processed so that the ref counted request does not get deleted
+	FConvaihttpModule::Get().GetConvaihttpManager().AddThreadedRequest(SharedThis(this));
+
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: simulated request has been added to threaded queue for processing"), this);
+	return true;
+}
+
+bool FSimulatedConvaihttpRequest::StartThreadedRequest()
+{
+	ElapsedTime = 0.0f;
+	TimeSinceLastResponse = 0.0f;
+	StartedTimeAbsoluteSeconds = FPlatformTime::Seconds();
+	FirstByteTime = -1.0;
+	bUploadComplete = false;
+	bHeadersReceived = false;
+	bResponseBodySinkFinished = false;
+
+	{
+		LLM_SCOPE_BYTAG(Convaihttp);
+		Response = MakeShared<FSimulatedConvaihttpResponse, ESPMode::ThreadSafe>(*this);
+	}
+	ScriptTransfer();
+
+	UploadSize = RequestPayload.IsValid() && RequestPayload->HasKnownContentLength() ? RequestPayload->GetContentLength() : 0;
+
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: simulated request has started threaded processing"), this);
+	return true;
+}
+
+void FSimulatedConvaihttpRequest::ScriptTransfer()
+{
+	SimulatedConvaihttp::FState& State = SimulatedConvaihttp::GetState();
+	{
+		FScopeLock Lock(&State.CriticalSection);
+		Settings = State.Settings;
+	}
+
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("latency"), Settings.LatencySeconds, 0.001);
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("bps"), Settings.BytesPerSecond);
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("chunk"), Settings.ChunkSize);
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("interval"), Settings.StreamIntervalSeconds, 0.001);
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("size"), Settings.ResponseSize);
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("code"), Settings.ResponseCode);
+	SimulatedConvaihttp::ReadUrlParameter(URL, TEXT("event"), Settings.EventDataSize);
+	Settings.ChunkSize = FMath::Max(Settings.ChunkSize, 1);
+	Settings.ResponseSize = FMath::Max<int64>(Settings.ResponseSize, 0);
+	if (Settings.EventDataSize > 0)
+	{
+		Settings.ContentType = TEXT("text/event-stream");
+	}
+
+	// Outcomes are drawn in the order requests start, so a run with a fixed seed and request order is reproducible
+	const uint32 RequestIndex = State.NextRequestIndex.fetch_add(1, std::memory_order_relaxed);
+	const uint32 Seed = Settings.RandomSeed != 0 ? static_cast<uint32>(Settings.RandomSeed) : static_cast<uint32>(FPlatformTime::Cycles());
+	FRandomStream Random(static_cast<int32>(HashCombine(Seed, RequestIndex)));
+
+	const FString ForcedFailure = GetURLParameter(TEXT("fail"));
+	const float FailureRoll = Random.GetFraction();
+	if (ForcedFailure == TEXT("connect") || FailureRoll < Settings.ConnectionErrorRate)
+	{
+		Failure = EFailure::Connection;
+	}
+	else if (ForcedFailure == TEXT("transfer") || FailureRoll < Settings.ConnectionErrorRate + Settings.TransferErrorRate)
+	{
+		Failure = EFailure::Transfer;
+	}
+	else
+	{
+		Failure = EFailure::None;
+	}
+
+	ResponseCode = Random.GetFraction() < Settings.ServerErrorRate ? EConvaihttpResponseCodes::ServiceUnavail : Settings.ResponseCode;
+	Settings.LatencySeconds = FMath::Max(Settings.LatencySeconds + Random.GetFraction() * Settings.LatencyJitterSeconds, 0.0);
+}
+
+void FSimulatedConvaihttpRequest::FinishRequest()
+{
+	FinishedRequest();
+}
+
+bool FSimulatedConvaihttpRequest::IsThreadedRequestComplete()
+{
+	if (bCanceled)
+	{
+		FinishResponseBodySink(false);
+		return true;
+	}
+
+	if (bTransferCompleted)
+	{
+		// Only complete once the sink is done with the body, as a real transfer would
+		const bool bSinkFlushed = FinishResponseBodySink(bTransferSucceeded && EConvaihttpResponseCodes::IsOk(ResponseCode));
+		return bSinkFlushed && ElapsedTime >= FConvaihttpModule::Get().GetConvaihttpDelayTime();
+	}
+
+	const float ConvaihttpTimeout = GetTimeoutOrDefault();
+	if (ConvaihttpTimeout > 0 && TimeSinceLastResponse >= ConvaihttpTimeout)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("%p: CONVAIHTTP request timed out after %0.2f seconds URL=%s"), this, TimeSinceLastResponse, *GetURL());
+		FConvaihttpMetrics::Get().RecordTimeout(GetURL());
+		FinishResponseBodySink(false);
+		return true;
+	}
+
+	return false;
+}
+
+void FSimulatedConvaihttpRequest::TickThreadedRequest(float DeltaSeconds)
+{
+	ElapsedTime += DeltaSeconds;
+	if (bTransferCompleted || bCanceled)
+	{
+		return;
+	}
+
+	TimeSinceLastResponse += DeltaSeconds;
+
+	if (Failure == EFailure::Connection)
+	{
+		if (ElapsedTime >= Settings.LatencySeconds)
+		{
+			MarkAsCompleted(false);
+		}
+		return;
+	}
+
+	if (!bUploadComplete)
+	{
+		SimulateUpload();
+	}
+	if (bUploadComplete && !bTransferCompleted)
+	{
+		SimulateDownload();
+	}
+}
+
+void FSimulatedConvaihttpRequest::SimulateUpload()
+{
+	if (!RequestPayload.IsValid())
+	{
+		bUploadComplete = true;
+		FirstByteTime = ElapsedTime + Settings.LatencySeconds;
+		return;
+	}
+
+	TArray64<uint8>& UploadBuffer = SimulatedConvaihttp::UploadBuffer;
+	if (UploadBuffer.Num() < Settings.ChunkSize)
+	{
+		UploadBuffer.SetNumUninitialized(Settings.ChunkSize);
+	}
+
+	int64 Budget = Settings.BytesPerSecond > 0.0 ? static_cast<int64>(ElapsedTime * Settings.BytesPerSecond) - BytesSent.GetValue() : MAX_int64;
+	while (Budget > 0)
+	{
+		const size_t Size = static_cast<size_t>(FMath::Min<int64>(Budget, Settings.ChunkSize));
+		const size_t Filled = RequestPayload->FillOutputBuffer(UploadBuffer.GetData(), Size, static_cast<size_t>(BytesSent.GetValue()));
+		if (Filled == FCH_RequestPayload::FillError)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: simulated request failed to read its payload"), this);
+			MarkAsCompleted(false);
+			return;
+		}
+		if (Filled == FCH_RequestPayload::FillPending)
+		{
+			// Polled again on the next tick
+			TimeSinceLastResponse = 0.0f;
+			return;
+		}
+
+		if (Filled > 0)
+		{
+			BytesSent.Add(Filled);
+			Budget -= Filled;
+			TimeSinceLastResponse = 0.0f;
+			bAnyConvaihttpActivity = true;
+		}
+
+		const bool bSentAll = UploadSize > 0 ? static_cast<uint64>(BytesSent.GetValue()) >= UploadSize : Filled == 0;
+		if (bSentAll)
+		{
+			bUploadComplete = true;
+			FirstByteTime = ElapsedTime + Settings.LatencySeconds;
+			return;
+		}
+	}
+}
+
+void FSimulatedConvaihttpRequest::SimulateDownload()
+{
+	if (ElapsedTime < FirstByteTime)
+	{
+		return;
+	}
+
+	if (!bHeadersReceived)
+	{
+		ReceiveResponseHeaders();
+	}
+
+	// A lost connection ends the transfer half way through the body
+	const int64 TargetSize = Failure == EFailure::Transfer ? Settings.ResponseSize / 2 : Settings.ResponseSize;
+	const double TimeSinceFirstByte = ElapsedTime - FirstByteTime;
+	int64 AllowedSize = TargetSize;
+	if (Settings.BytesPerSecond > 0.0)
+	{
+		AllowedSize = FMath::Min(AllowedSize, static_cast<int64>(TimeSinceFirstByte * Settings.BytesPerSecond));
+	}
+	if (Settings.StreamIntervalSeconds > 0.0)
+	{
+		AllowedSize = FMath::Min(AllowedSize, (static_cast<int64>(TimeSinceFirstByte / Settings.StreamIntervalSeconds) + 1) * Settings.ChunkSize);
+	}
+
+	while (Response->TotalBytesRead.GetValue() < AllowedSize)
+	{
+		const int64 Size = FMath::Min<int64>(AllowedSize - Response->TotalBytesRead.GetValue(), Settings.ChunkSize);
+		const EConvaihttpBodySinkResult Result = ReceiveResponseBody(Size);
+		if (Result == EConvaihttpBodySinkResult::Full)
+		{
+			// Waiting on this side of the connection doesn't count towards the timeout, the chunk is offered again on the next tick
+			TimeSinceLastResponse = 0.0f;
+			return;
+		}
+		if (Result == EConvaihttpBodySinkResult::Failed)
+		{
+			UE_LOG(LogConvaihttp, Warning, TEXT("%p: simulated request: response body sink failed, aborting"), this);
+			MarkAsCompleted(false);
+			return;
+		}
+	}
+
+	if (Response->TotalBytesRead.GetValue() >= TargetSize)
+	{
+		MarkAsCompleted(Failure == EFailure::None);
+	}
+}
+
+void FSimulatedConvaihttpRequest::ReceiveResponseHeaders()
+{
+	bHeadersReceived = true;
+	bAnyConvaihttpActivity = true;
+	TimeSinceLastResponse = 0.0f;
+	CONVAIHTTP_TRACE_EVENT(this, FirstByte);
+
+	Response->ResponseCode = ResponseCode;
+	Response->NewlyReceivedHeaders.Enqueue(TPair<FString, FString>(TEXT("Content-Type"), Settings.ContentType));
+	if (Settings.bChunkedResponse)
+	{
+		Response->NewlyReceivedHeaders.Enqueue(TPair<FString, FString>(TEXT("Transfer-Encoding"), TEXT("chunked")));
+	}
+	else
+	{
+		Response->ContentLength = Settings.ResponseSize;
+		Response->NewlyReceivedHeaders.Enqueue(TPair<FString, FString>(TEXT("Content-Length"), LexToString(Settings.ResponseSize)));
+	}
+	if (ResponseCode == EConvaihttpResponseCodes::ServiceUnavail || ResponseCode == EConvaihttpResponseCodes::TooManyRequests)
+	{
+		Response->NewlyReceivedHeaders.Enqueue(TPair<FString, FString>(TEXT("Retry-After"), TEXT("1")));
+	}
+}
+
+EConvaihttpBodySinkResult FSimulatedConvaihttpRequest::ReceiveResponseBody(int64 Size)
+{
+	const FMemoryView Fill = SimulatedConvaihttp::GetResponseFill(Settings, Response->TotalBytesRead.GetValue(), Size);
+
+	// Bodies of error responses are accumulated in the response, as a real transfer does
+	if (ResponseBodySink.IsValid() && EConvaihttpResponseCodes::IsOk(ResponseCode))
+	{
+		const EConvaihttpBodySinkResult Result = ResponseBodySink->Write(Fill);
+		if (Result != EConvaihttpBodySinkResult::Accepted)
+		{
+			return Result;
+		}
+	}
+	else
+	{
+		LLM_SCOPE_BYTAG(Convaihttp_ResponsePayload);
+		Response->Payload.Append(static_cast<const uint8*>(Fill.GetData()), Size);
+		Response->PayloadMemory.Set(Response->Payload.GetAllocatedSize());
+	}
+
+	CONVAIHTTP_TRACE_EVENT(this, BodyChunk, Size);
+	Response->TotalBytesRead.Add(Size);
+	TimeSinceLastResponse = 0.0f;
+	return EConvaihttpBodySinkResult::Accepted;
+}
+
+void FSimulatedConvaihttpRequest::MarkAsCompleted(bool bSucceeded)
+{
+	FConvaihttpResponseTimings& Timings = Response->Timings;
+	Timings.QueueWaitSeconds = StartedTimeAbsoluteSeconds - QueuedTimeAbsoluteSeconds;
+	Timings.FirstByteSeconds = bHeadersReceived ? FirstByteTime : -1.0;
+	Timings.TotalSeconds = ElapsedTime;
+	Timings.Version = EConvaihttpVersion::Http1_1;
+	Timings.bIsValid = true;
+	if (Settings.bChunkedResponse || !bSucceeded)
+	{
+		Response->ContentLength = Response->TotalBytesRead.GetValue();
+	}
+
+	bTransferSucceeded = bSucceeded;
+	bTransferCompleted = true;
+
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: simulated request has completed (succeeded:%d) and has been marked as such"), this, bSucceeded ? 1 : 0);
+}
+
+bool FSimulatedConvaihttpRequest::FinishResponseBodySink(bool bSucceeded)
+{
+	if (!ResponseBodySink.IsValid())
+	{
+		return true;
+	}
+
+	if (!bResponseBodySinkFinished)
+	{
+		bResponseBodySinkFinished = true;
+		ResponseBodySink->Finish(bSucceeded);
+	}
+	return ResponseBodySink->IsFlushed();
+}
+
+void FSimulatedConvaihttpRequest::CancelRequest()
+{
+	if (bCanceled)
+	{
+		return;
+	}
+
+	bCanceled = true;
+	UE_LOG(LogConvaihttp, Verbose, TEXT("%p: CONVAIHTTP request canceled.  URL=%s"), this, *GetURL());
+
+	FConvaihttpManager& ConvaihttpManager = FConvaihttpModule::Get().GetConvaihttpManager();
+	if (ConvaihttpManager.IsValidRequest(this))
+	{
+		ConvaihttpManager.CancelThreadedRequest(SharedThis(this));
+	}
+	else if (!IsInGameThread())
+	{
+		// Always finish on the game thread
+		ConvaihttpManager.AddGameThreadTask([StrongThis = StaticCastSharedRef<FSimulatedConvaihttpRequest>(AsShared())]()
+		{
+			StrongThis->FinishedRequest();
+		});
+	}
+	else
+	{
+		// Finish immediately
+		FinishedRequest();
+	}
+}
+
+EConvaihttpRequestStatus::Type FSimulatedConvaihttpRequest::GetStatus() const
+{
+	return CompletionStatus;
+}
+
+const FConvaihttpResponsePtr FSimulatedConvaihttpRequest::GetResponse() const
+{
+	return Response;
+}
+
+void FSimulatedConvaihttpRequest::Tick(float DeltaSeconds)
+{
+	CheckProgressDelegate();
+	BroadcastNewlyReceivedHeaders();
+}
+
+float FSimulatedConvaihttpRequest::GetElapsedTime() const
+{
+	return ElapsedTime;
+}
+
+void FSimulatedConvaihttpRequest::CheckProgressDelegate()
+{
+	const uint64 CurrentBytesRead = Response.IsValid() ? Response->TotalBytesRead.GetValue() : 0;
+	const uint64 CurrentBytesSent = BytesSent.GetValue();
+
+	const bool bProcessing = CompletionStatus == EConvaihttpRequestStatus::Processing;
+	if (bProcessing && (CurrentBytesSent != LastReportedBytesSent || CurrentBytesRead != LastReportedBytesRead))
+	{
+		LastReportedBytesSent = CurrentBytesSent;
+		LastReportedBytesRead = CurrentBytesRead;
+		OnRequestProgress().ExecuteIfBound(SharedThis(this), LastReportedBytesSent, LastReportedBytesRead);
+	}
+}
+
+void FSimulatedConvaihttpRequest::BroadcastNewlyReceivedHeaders()
+{
+	check(IsInGameThread());
+	if (Response.IsValid())
+	{
+		TPair<FString, FString> NewHeader;
+		while (Response->NewlyReceivedHeaders.Dequeue(NewHeader))
+		{
+			{
+				LLM_SCOPE_BYTAG(Convaihttp_Headers);
+				Response->Headers.Add(NewHeader.Key, NewHeader.Value);
+				Response->HeadersMemory.Set(GetHeadersAllocatedSize(Response->Headers));
+			}
+
+			OnHeaderReceived().ExecuteIfBound(SharedThis(this), NewHeader.Key, NewHeader.Value);
+		}
+	}
+}
+
+void FSimulatedConvaihttpRequest::FinishedRequest()
+{
+	check(IsInGameThread());
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FSimulatedConvaihttpRequest_FinishedRequest);
+
+	CheckProgressDelegate();
+	if (Response.IsValid())
+	{
+		BroadcastNewlyReceivedHeaders();
+		Response->bIsReady = true;
+	}
+
+	if (Response.IsValid() && bTransferCompleted && bTransferSucceeded && !bCanceled)
+	{
+		UE_LOG(LogConvaihttp, Verbose, TEXT("%p: simulated request has been successfully processed. URL: %s, CONVAIHTTP code: %d, content length: %llu, elapsed: %.2fs"),
+			this, *GetURL(), Response->ResponseCode, Response->ContentLength, ElapsedTime);
+
+		CompletionStatus = EConvaihttpRequestStatus::Succeeded;
+		OnProcessRequestComplete().ExecuteIfBound(SharedThis(this), Response, true);
+	}
+	else
+	{
+		UE_LOG(LogConvaihttp, Verbose, TEXT("%p: simulated request failed. URL: %s, canceled: %d"), this, *GetURL(), bCanceled ? 1 : 0);
+
+		CompletionStatus = !bCanceled && !bAnyConvaihttpActivity ? EConvaihttpRequestStatus::Failed_ConnectionError : EConvaihttpRequestStatus::Failed;
+		OnProcessRequestComplete().ExecuteIfBound(SharedThis(this), Response, false);
+
+		// Delegate needs to know about the errors -- so clear out Response (since connection failed) afterwards...
+		Response = nullptr;
+	}
+}
+
+// FSimulatedConvaihttpResponse
+
+FSimulatedConvaihttpResponse::FSimulatedConvaihttpResponse(const FSimulatedConvaihttpRequest& InRequest)
+	: Request(InRequest)
+{
+}
+
+FString FSimulatedConvaihttpResponse::GetURL() const
+{
+	return Request.GetURL();
+}
+
+FString FSimulatedConvaihttpResponse::GetURLParameter(const FString& ParameterName) const
+{
+	return Request.GetURLParameter(ParameterName);
+}
+
+FString FSimulatedConvaihttpResponse::GetHeader(const FString& HeaderName) const
+{
+	if (!bIsReady)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Can't get cached header [%s]. Response still processing. %p"), *HeaderName, &Request);
+		return FString();
+	}
+	const FString* Header = Headers.Find(HeaderName);
+	return Header != nullptr ? *Header : FString();
+}
+
+TArray64<FString> FSimulatedConvaihttpResponse::GetAllHeaders() const
+{
+	TArray64<FString> Result;
+	if (!bIsReady)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Can't get cached headers. Response still processing. %p"), &Request);
+		return Result;
+	}
+	Result.Reserve(Headers.Num());
+	for (const TPair<FString, FString>& It : Headers)
+	{
+		Result.Emplace(It.Key + TEXT(": ") + It.Value);
+	}
+	return Result;
+}
+
+FString FSimulatedConvaihttpResponse::GetContentType() const
+{
+	return GetHeader(TEXT("Content-Type"));
+}
+
+uint64 FSimulatedConvaihttpResponse::GetContentLength() const
+{
+	return ContentLength;
+}
+
+const TArray64<uint8>& FSimulatedConvaihttpResponse::GetContent() const
+{
+	if (!bIsReady)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Payload is incomplete. Response still processing. %p"), &Request);
+	}
+	return Payload;
+}
+
+int32 FSimulatedConvaihttpResponse::GetResponseCode() const
+{
+	return ResponseCode;
+}
+
+FString FSimulatedConvaihttpResponse::GetContentAsString() const
+{
+	// Content is NOT null-terminated; we need to specify lengths here
+	FUTF8ToTCHAR TCHARData(reinterpret_cast<const ANSICHAR*>(Payload.GetData()), Payload.Num());
+	return FString(TCHARData.Length(), TCHARData.Get());
+}
+
+TArray64<uint8> FSimulatedConvaihttpResponse::TakeContent()
+{
+	if (!bIsReady)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Can't take payload. Response still processing. %p"), &Request);
+		return TArray64<uint8>();
+	}
+	PayloadMemory.Set(0);
+	return MoveTemp(Payload);
+}
+
+FConvaihttpResponseTimings FSimulatedConvaihttpResponse::GetTimings() const
+{
+	if (!bIsReady)
+	{
+		return FConvaihttpResponseTimings();
+	}
+	return Timings;
+}
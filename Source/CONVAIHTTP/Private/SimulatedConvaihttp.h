@@ -0,0 +1,281 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IConvaihttpThreadedRequest.h"
+#include "Interfaces/IConvaihttpResponse.h"
+#include "Interfaces/IConvaihttpResponseBodySink.h"
+#include "GenericPlatform/ConvaihttpRequestPayload.h"
+#include "ConvaihttpMemory.h"
+#include "ConvaiThreadSafeCounter.h"
+#include "Containers/Queue.h"
+#include <atomic>
+
+class FSimulatedConvaihttpResponse;
+
+/**
+ * How the simulated transport answers requests, from the [CONVAIHTTP.SimulatedConvaihttp] section of the engine ini.
+ * Each setting can be overridden per request by a query parameter of its url, noted below, so tests can script
+ * individual responses (e.g. /items?size=4096&latency=250&code=503). A parameter suffixed with @<host> only applies
+ * to requests to that host (e.g. latency@slow.invalid=2000), so requests moved to another domain behave differently.
+ */
+struct FSimulatedConvaihttpSettings
+{
+	/** Time from the end of the upload to the first byte of the response. Query parameter latency=, in milliseconds */
+	double LatencySeconds = 0.05;
+	/** Random extra latency, up to this much */
+	double LatencyJitterSeconds = 0.0;
+	/** Bandwidth of both directions, 0 for no limit. Query parameter bps= */
+	double BytesPerSecond = 0.0;
+	/** Most bytes handed over at once, like one receive of a socket. Query parameter chunk= */
+	int32 ChunkSize = 16 * 1024;
+	/** Time between chunks of the response, to simulate a server streaming its response (e.g. Server-Sent Events), 0 to send as fast as the bandwidth allows. Query parameter interval=, in milliseconds */
+	double StreamIntervalSeconds = 0.0;
+	/** Size of the response body. Query parameter size= */
+	int64 ResponseSize = 1024;
+	/** Status code of the response. Query parameter code= */
+	int32 ResponseCode = 200;
+	/** Content-Type of the response */
+	FString ContentType = TEXT("application/octet-stream");
+	/** When above 0, the body is a text/event-stream of events carrying this much data each, split over lines of at most 128 bytes, instead of opaque bytes. Query parameter event= */
+	int32 EventDataSize = 0;
+	/** Send the response without a Content-Length, as a chunked response would */
+	bool bChunkedResponse = false;
+	/** Share of requests failing to connect, in [0,1]. Query parameter fail=connect fails the request */
+	float ConnectionErrorRate = 0.0f;
+	/** Share of requests losing their connection half way through the response body, in [0,1]. Query parameter fail=transfer fails the request */
+	float TransferErrorRate = 0.0f;
+	/** Share of requests answered with 503 Service Unavailable and Retry-After instead of ResponseCode, in [0,1] */
+	float ServerErrorRate = 0.0f;
+	/** Seed of the outcomes of requests, which are drawn in the order requests start. 0 seeds from the time */
+	int32 RandomSeed = 0;
+
+	/** Read the settings from the config */
+	void LoadConfig();
+
+	/** @return size of each event of the body when EventDataSize is set, so a size= of a multiple of it ends on a whole event */
+	int64 GetEventSize() const;
+};
+
+/**
+ * Simulated implementation of a CONVAIHTTP request, selected with [CONVAIHTTP] bUseSimulatedConvaihttp.
+ * Unlike FNullConvaihttpRequest it goes through the same FConvaihttpManager and FConvaihttpThread pipeline as a real
+ * request, but is served in process with scripted responses, without sockets. This makes the scheduling, memory and
+ * game thread cost of many requests measurable on their own, and reproducible.
+ */
+class FSimulatedConvaihttpRequest : public IConvaihttpThreadedRequest
+{
+public:
+	// implementation friends
+	friend class FSimulatedConvaihttpResponse;
+
+	//~ Begin IConvaihttpBase Interface
+	virtual FString GetURL() const override;
+	virtual FString GetURLParameter(const FString& ParameterName) const override;
+	virtual FString GetHeader(const FString& HeaderName) const override;
+	virtual TArray64<FString> GetAllHeaders() const override;
+	virtual FString GetContentType() const override;
+	virtual uint64 GetContentLength() const override;
+	virtual const TArray64<uint8>& GetContent() const override;
+	//~ End IConvaihttpBase Interface
+
+	//~ Begin IConvaihttpRequest Interface
+	virtual FString GetVerb() const override;
+	virtual void SetVerb(const FString& InVerb) override;
+	virtual void SetURL(const FString& InURL) override;
+	virtual void SetContent(const TArray64<uint8>& ContentPayload) override;
+	virtual void SetContent(TArray64<uint8>&& ContentPayload) override;
+	virtual void SetContent(const FSharedBuffer& ContentPayload) override;
+	virtual void SetContent(const FCompositeBuffer& ContentPayload) override;
+	virtual void SetContentAsString(const FString& ContentString) override;
+	virtual bool SetContentAsStreamedFile(const FString& Filename) override;
+	virtual bool SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override;
+	virtual bool SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source) override;
+	virtual bool SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink) override;
+	virtual void SetHeader(const FString& HeaderName, const FString& HeaderValue) override;
+	virtual void AppendToHeader(const FString& HeaderName, const FString& AdditionalHeaderValue) override;
+	virtual bool ProcessRequest() override;
+	virtual void CancelRequest() override;
+	virtual EConvaihttpRequestStatus::Type GetStatus() const override;
+	virtual const FConvaihttpResponsePtr GetResponse() const override;
+	virtual void Tick(float DeltaSeconds) override;
+	virtual float GetElapsedTime() const override;
+	//~ End IConvaihttpRequest Interface
+
+	//~ Begin IConvaihttpRequestThreaded Interface
+	virtual bool StartThreadedRequest() override;
+	virtual void FinishRequest() override;
+	virtual bool IsThreadedRequestComplete() override;
+	virtual void TickThreadedRequest(float DeltaSeconds) override;
+	virtual bool IsSimulated() const override
+	{
+		return true;
+	}
+	//~ End IConvaihttpRequestThreaded Interface
+
+	FSimulatedConvaihttpRequest();
+	virtual ~FSimulatedConvaihttpRequest();
+
+	/** Reload the settings of all simulated requests from the config */
+	static void UpdateConfigs();
+
+private:
+	/** Outcomes a simulated transfer can be scripted to */
+	enum class EFailure : uint8
+	{
+		None,
+		/** Fails after the latency without a response */
+		Connection,
+		/** Fails half way through the response body */
+		Transfer
+	};
+
+	/** Apply the query parameters of the url to the settings, and draw the outcome of the request. Called on the CONVAIHTTP thread */
+	void ScriptTransfer();
+
+	/** Send as much of the request payload as the bandwidth allows. Called on the CONVAIHTTP thread */
+	void SimulateUpload();
+
+	/** Receive as much of the response as the latency, bandwidth and stream interval allow. Called on the CONVAIHTTP thread */
+	void SimulateDownload();
+
+	/** Queue the headers of the response for the game thread. Called on the CONVAIHTTP thread */
+	void ReceiveResponseHeaders();
+
+	/**
+	 * Hand part of the response body to the sink, or append it to the response. Called on the CONVAIHTTP thread
+	 *
+	 * @param Size - size of the part
+	 * @return whether the part was consumed, see EConvaihttpBodySinkResult
+	 */
+	EConvaihttpBodySinkResult ReceiveResponseBody(int64 Size);
+
+	/** Mark the transfer as over. Called on the CONVAIHTTP thread */
+	void MarkAsCompleted(bool bSucceeded);
+
+	/** Tell the response body sink the transfer is over. Called on the CONVAIHTTP thread */
+	bool FinishResponseBodySink(bool bSucceeded);
+
+	/** Process state for a finished request, and call the completion delegate. Called on the game thread */
+	void FinishedRequest();
+
+	/** Trigger the request progress delegate if progress has changed */
+	void CheckProgressDelegate();
+
+	/** Broadcast newly received headers */
+	void BroadcastNewlyReceivedHeaders();
+
+	/** Cached URL */
+	FString URL;
+	/** Cached verb */
+	FString Verb;
+	/** Mapping of header section to values */
+	TMap<FString, FString> Headers;
+	/** Memory held by Headers */
+	FConvaihttpTrackedMemory HeadersMemory{ EConvaihttpMemoryCategory::Headers };
+	/** Payload to use with the request */
+	TUniquePtr<FCH_RequestPayload> RequestPayload;
+	/** Memory held by RequestPayload */
+	FConvaihttpTrackedMemory RequestPayloadMemory{ EConvaihttpMemoryCategory::RequestPayload };
+	/** Optional consumer of the response body. When set, the body isn't accumulated in the response */
+	TSharedPtr<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> ResponseBodySink;
+	/** The response object which we will use to pair with this request */
+	TSharedPtr<FSimulatedConvaihttpResponse, ESPMode::ThreadSafe> Response;
+	/** Current status of request being processed */
+	EConvaihttpRequestStatus::Type CompletionStatus;
+
+	/** Settings of the transfer, with the overrides of the url. Only accessed on the CONVAIHTTP thread */
+	FSimulatedConvaihttpSettings Settings;
+	/** Outcome drawn for the transfer */
+	EFailure Failure = EFailure::None;
+	/** Status code drawn for the response */
+	int32 ResponseCode = 0;
+	/** Time of the transfer at which the first byte of the response arrives, once the upload is over */
+	double FirstByteTime = -1.0;
+	/** Size of the body to send, 0 when it isn't known until the payload ends */
+	uint64 UploadSize = 0;
+	/** Set once the whole payload was sent */
+	bool bUploadComplete = false;
+	/** Set once the headers of the response were queued */
+	bool bHeadersReceived = false;
+	/** Set once the response body sink was told the transfer is over */
+	bool bResponseBodySinkFinished = false;
+
+	/** Set to true if request has been canceled */
+	std::atomic<bool> bCanceled{ false };
+	/** Set once the simulated transfer is over */
+	std::atomic<bool> bTransferCompleted{ false };
+	/** Whether the simulated transfer succeeded, valid once bTransferCompleted is set */
+	bool bTransferSucceeded = false;
+	/** Set once anything was received, to tell connection errors apart */
+	bool bAnyConvaihttpActivity = false;
+	/** Total elapsed time in seconds since the start of the request */
+	float ElapsedTime = 0.0f;
+	/** Elapsed time since the last activity of the transfer, for the timeout */
+	float TimeSinceLastResponse = 0.0f;
+	/** Time the request was queued and started, for the timings of the response */
+	double QueuedTimeAbsoluteSeconds = 0.0;
+	double StartedTimeAbsoluteSeconds = 0.0;
+
+	/** Number of bytes sent already */
+	FConvaiThreadSafeCounter BytesSent;
+	/** Last reported bytes written */
+	uint64 LastReportedBytesSent = 0;
+	/** Last reported bytes read */
+	uint64 LastReportedBytesRead = 0;
+};
+
+/**
+ * Simulated implementation of a CONVAIHTTP response
+ */
+class FSimulatedConvaihttpResponse : public IConvaihttpResponse
+{
+public:
+	// implementation friends
+	friend class FSimulatedConvaihttpRequest;
+
+	//~ Begin IConvaihttpBase Interface
+	virtual FString GetURL() const override;
+	virtual FString GetURLParameter(const FString& ParameterName) const override;
+	virtual FString GetHeader(const FString& HeaderName) const override;
+	virtual TArray64<FString> GetAllHeaders() const override;
+	virtual FString GetContentType() const override;
+	virtual uint64 GetContentLength() const override;
+	virtual const TArray64<uint8>& GetContent() const override;
+	//~ End IConvaihttpBase Interface
+
+	//~ Begin IConvaihttpResponse Interface
+	virtual int32 GetResponseCode() const override;
+	virtual FString GetContentAsString() const override;
+	virtual TArray64<uint8> TakeContent() override;
+	virtual FConvaihttpResponseTimings GetTimings() const override;
+	//~ End IConvaihttpResponse Interface
+
+	FSimulatedConvaihttpResponse(const FSimulatedConvaihttpRequest& InRequest);
+	virtual ~FSimulatedConvaihttpResponse() = default;
+
+private:
+	/** Request that owns this response */
+	const FSimulatedConvaihttpRequest& Request;
+	/** Body of the response, when the request has no sink */
+	TArray64<uint8> Payload;
+	/** Memory held by Payload */
+	FConvaihttpTrackedMemory PayloadMemory{ EConvaihttpMemoryCategory::ResponsePayload };
+	/** Headers of the response, merged on the game thread */
+	TMap<FString, FString> Headers;
+	/** Memory held by Headers */
+	FConvaihttpTrackedMemory HeadersMemory{ EConvaihttpMemoryCategory::Headers };
+	/** Headers received on the CONVAIHTTP thread, not yet broadcast */
+	TQueue<TPair<FString, FString>> NewlyReceivedHeaders;
+	/** Bytes of the body received so far */
+	FConvaiThreadSafeCounter TotalBytesRead;
+	/** Status code of the response */
+	int32 ResponseCode = EConvaihttpResponseCodes::Unknown;
+	/** Length of the body announced by the headers, or received once the transfer is over */
+	uint64 ContentLength = 0;
+	/** Timings of the transfer, filled in once it is over */
+	FConvaihttpResponseTimings Timings;
+	/** True when the response has finished async processing */
+	bool bIsReady = false;
+};
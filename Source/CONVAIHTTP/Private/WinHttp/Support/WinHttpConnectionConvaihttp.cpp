@@ -147,8 +147,23 @@ bool FCH_WinHttpConnectionConvaihttp::StartRequest()
 		const uint64 NumBytesToWriteNow = FMath::Min(static_cast<uint64>(UE_WINHTTP_WRITE_BUFFER_BYTES), Payload->GetContentLength());
 		PayloadBuffer.SetNumUninitialized(NumBytesToWriteNow, false);
 
-		const uint64 BufferSize = Payload->FillOutputBuffer(PayloadBuffer, 0);
-		PayloadBuffer.SetNumUninitialized(BufferSize, false);
+		const size_t BufferSize = Payload->FillOutputBuffer(PayloadBuffer.GetData(), PayloadBuffer.Num(), 0);
+		if (BufferSize == FCH_RequestPayload::FillError)
+		{
+			UE_LOG(LogWinConvaiHttp, Warning, TEXT("WinHttp Convaihttp[%p]: Failed to read the request payload"), this);
+			PayloadBuffer.Reset(0);
+
+			if (!WinHttpSetStatusCallback(RequestHandle.Get(), nullptr, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0))
+			{
+				const DWORD ErrorCode = GetLastError();
+				FCH_WinHttpErrorHelper::LogWinConvaiHttpSetStatusCallbackFailure(ErrorCode);
+			}
+
+			KeepAlive.Reset();
+			return false;
+		}
+		// A payload that isn't ready yet is sent with the request body later on, from PumpStates
+		PayloadBuffer.SetNumUninitialized(BufferSize == FCH_RequestPayload::FillPending ? 0 : BufferSize, false);
 	}
 
 	CurrentAction = EState::SendRequest;
@@ -704,10 +719,16 @@ bool FCH_WinHttpConnectionConvaihttp::SendAdditionalRequestBody()
 	PayloadBuffer.SetNumUninitialized(OptimalAmountToWrite, false);
 
 	// Read data into our buffer if possible
-	const SIZE_T  ActualDataSize = Payload->FillOutputBuffer(PayloadBuffer, NumBytesSuccessfullySent);
-	if (ActualDataSize < 1)
+	const SIZE_T  ActualDataSize = Payload->FillOutputBuffer(PayloadBuffer.GetData(), PayloadBuffer.Num(), NumBytesSuccessfullySent);
+	if (ActualDataSize == FCH_RequestPayload::FillError)
+	{
+		UE_LOG(LogWinConvaiHttp, Warning, TEXT("WinHttp Convaihttp[%p]: Failed to read the request payload after %llu bytes"), this, NumBytesSuccessfullySent);
+		PayloadBuffer.Reset(0);
+		return false;
+	}
+	if (ActualDataSize < 1 || ActualDataSize == FCH_RequestPayload::FillPending)
 	{
-		// Set our buffer to be empty since we didn't write anything into it
+		// Set our buffer to be empty since we didn't write anything into it, we'll try again on the next pump
 		PayloadBuffer.Reset(0);
 		return true;
 	}
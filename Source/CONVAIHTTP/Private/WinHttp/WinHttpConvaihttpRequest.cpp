@@ -7,12 +7,12 @@
 #include "WinHttp/WinHttpConvaihttpResponse.h"
 #include "WinHttp/Support/WinHttpConnectionConvaihttp.h"
 #include "GenericPlatform/ConvaihttpRequestPayload.h"
+#include "GenericPlatform/ConvaihttpUploadSource.h"
 #include "Convaihttp.h"
 #include "ConvaihttpModule.h"
 
 #include "HAL/PlatformTime.h"
 #include "Containers/StringView.h"
-#include "HAL/FileManager.h"
 
 FCH_WinHttpConvaihttpRequest::FCH_WinHttpConvaihttpRequest()
 {
@@ -119,6 +119,22 @@ void FCH_WinHttpConvaihttpRequest::SetContent(TArray64<uint8>&& ContentPayload)
 	RequestData.Payload = MakeShared<FCH_RequestPayloadInMemory, ESPMode::ThreadSafe>(MoveTemp(ContentPayload));
 }
 
+void FCH_WinHttpConvaihttpRequest::SetContent(const FSharedBuffer& ContentPayload)
+{
+	SetContent(FCompositeBuffer(ContentPayload));
+}
+
+void FCH_WinHttpConvaihttpRequest::SetContent(const FCompositeBuffer& ContentPayload)
+{
+	if (State == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Attempted to set content on a request that is inflight"));
+		return;
+	}
+
+	RequestData.Payload = MakeShared<FCH_RequestPayloadInSharedBuffer, ESPMode::ThreadSafe>(ContentPayload.MakeOwned());
+}
+
 void FCH_WinHttpConvaihttpRequest::SetContentAsString(const FString& ContentString)
 {
 	if (State == EConvaihttpRequestStatus::Processing)
@@ -143,9 +159,11 @@ bool FCH_WinHttpConvaihttpRequest::SetContentAsStreamedFile(const FString& Filen
 		return false;
 	}
 
-	if (FArchive* File = IFileManager::Get().CreateFileReader(*Filename))
+	// Prefetch ahead of WinHttp so the send only copies, instead of blocking on disk IO
+	TSharedRef<FConvaihttpAsyncFileUploadSource, ESPMode::ThreadSafe> Source = MakeShared<FConvaihttpAsyncFileUploadSource, ESPMode::ThreadSafe>(Filename);
+	if (Source->IsValid())
 	{
-		RequestData.Payload = MakeShared<FCH_RequestPayloadInFileStream, ESPMode::ThreadSafe>(MakeShareable(File));
+		RequestData.Payload = MakeShared<FCH_RequestPayloadFromSource, ESPMode::ThreadSafe>(Source);
 		return true;
 	}
 	else
@@ -168,6 +186,24 @@ bool FCH_WinHttpConvaihttpRequest::SetContentFromStream(TSharedRef<FArchive, ESP
 	return true;
 }
 
+bool FCH_WinHttpConvaihttpRequest::SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source)
+{
+	if (State == EConvaihttpRequestStatus::Processing)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Attempted to set content on a request that is inflight"));
+		return false;
+	}
+
+	if (!Source->HasKnownContentLength())
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Upload sources without a known content length are not supported by WinHttp"));
+		return false;
+	}
+
+	RequestData.Payload = MakeShared<FCH_RequestPayloadFromSource, ESPMode::ThreadSafe>(Source);
+	return true;
+}
+
 void FCH_WinHttpConvaihttpRequest::SetHeader(const FString& HeaderName, const FString& HeaderValue)
 {
 	if (State == EConvaihttpRequestStatus::Processing)
@@ -481,6 +517,10 @@ void FCH_WinHttpConvaihttpRequest::HandleRequestComplete(EConvaihttpRequestStatu
 	{
 		UpdateResponseBody(true);
 	}
+	if (Response.IsValid())
+	{
+		Response->SetIsReady();
+	}
 
 	OnWinHttpRequestComplete();
 }
@@ -69,6 +69,16 @@ int32 FCH_WinHttpConvaihttpResponse::GetResponseCode() const
 	return ConvaihttpStatusCode;
 }
 
+TArray64<uint8> FCH_WinHttpConvaihttpResponse::TakeContent()
+{
+	if (!bIsReady)
+	{
+		UE_LOG(LogConvaihttp, Warning, TEXT("Can't take payload. Response still processing. %s"), *Url);
+		return TArray64<uint8>();
+	}
+	return MoveTemp(Payload);
+}
+
 FString FCH_WinHttpConvaihttpResponse::GetContentAsString() const
 {
 	// Content is NOT null-terminated; we need to specify lengths here
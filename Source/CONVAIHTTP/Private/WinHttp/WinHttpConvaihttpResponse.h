@@ -30,10 +30,13 @@ public:
 	//~ Begin IConvaihttpResponse Interface
 	virtual int32 GetResponseCode() const override;
 	virtual FString GetContentAsString() const override;
+	virtual TArray64<uint8> TakeContent() override;
 	//~ End IConvaihttpResponse Interface
 
 	void AppendHeader(const FString& HeaderKey, const FString& HeaderValue) { Headers.Add(HeaderKey, HeaderValue); }
 	void AppendPayload(const TArray64<uint8>& InPayload) { Payload.Append(InPayload); }
+	/** Called once the request has finished, after which the payload can be taken */
+	void SetIsReady() { bIsReady = true; }
 
 protected:
 	/** The URL we requested data from*/
@@ -44,6 +47,8 @@ protected:
 	TMap<FString, FString> Headers;
 	/** Byte array of the data we received */
 	TArray64<uint8> Payload;
+	/** Whether the request has finished. Only accessed on the game thread */
+	bool bIsReady = false;
 };
 
 #endif // WITH_WINHTTP
@@ -10,6 +10,7 @@
 #include "ConvaihttpPackage.h"
 #include "Containers/Ticker.h"
 #include "Misc/EnumRange.h"
+#include <atomic>
 
 class FConvaihttpThread;
 
@@ -129,6 +130,16 @@ public:
 	 */
 	void DumpRequests(FOutputDevice& Ar) const;
 
+	/**
+	 * Print the accounting of the loop of the CONVAIHTTP thread
+	 *
+	 * @param Ar - output device to log with
+	 */
+	void DumpThreadStats(FOutputDevice& Ar) const;
+
+	/** @return time the CONVAIHTTP thread spent working rather than sleeping since it started, in seconds */
+	double GetThreadBusySeconds() const;
+
 	/**
 	 * Method to check dynamic proxy setting support.
 	 *
@@ -161,6 +172,32 @@ public:
 	 */
 	bool IsDomainAllowed(const FString& Url) const;
 
+	/**
+	 * Defer the requests to a host, as asked by a 429 or 503 response with Retry-After.
+	 * Requests to the host that didn't start yet wait in the queue of the CONVAIHTTP thread until the end of the throttle,
+	 * so they don't earn more of those responses. Thread safe.
+	 *
+	 * @param Url - URL of a request to the host
+	 * @param Seconds - time to defer requests to the host for, capped by MaxHostThrottleSeconds
+	 */
+	void ThrottleHost(const FString& Url, double Seconds);
+
+	/**
+	 * Get the time requests to the host of a URL may start again. Thread safe
+	 *
+	 * @param Url - URL of a request to the host
+	 * @param NowAbsoluteSeconds - current time, from FPlatformTime::Seconds()
+	 *
+	 * @return end of the throttle of the host, 0 if it isn't throttled
+	 */
+	double GetHostThrottleEndTime(const FString& Url, double NowAbsoluteSeconds) const;
+
+	/** @return true if any host is throttled, so callers don't look up hosts when none is. Thread safe */
+	bool HasThrottledHosts() const { return NumThrottledHosts.load(std::memory_order_relaxed) > 0; }
+
+	/** @return key of the host of a URL in the throttles, its lowercase domain and port */
+	static FString GetHostThrottleKey(const FString& Url);
+
 	/**
 	 * Get the default method for creating new correlation ids for a request
 	 *
@@ -247,6 +284,18 @@ protected:
 
 	TMap<EConvaihttpFlushReason, FConvaihttpFlushTimeLimit> FlushTimeLimitsMap;
 
+	/** Throttle the host of a completed request if its response asks for it, and forget the throttles that are over */
+	void UpdateHostThrottle(const IConvaihttpRequest& Request);
+
+	/** End time of the throttle of each host, keyed by GetHostThrottleKey(). The CONVAIHTTP thread keeps its own copy */
+	TMap<FString, double> HostThrottleEndTimes;
+	/** Number of entries in HostThrottleEndTimes */
+	std::atomic<int32> NumThrottledHosts{ 0 };
+	/** Guards HostThrottleEndTimes, which ThrottleHost() and GetHostThrottleEndTime() may use on any thread */
+	mutable FCriticalSection HostThrottleLock;
+	/** Longest time a host is throttled for, whatever its Retry-After says */
+	double MaxHostThrottleSeconds = 60.0;
+
 PACKAGE_SCOPE:
 
 	/** Used to lock access to add/remove/find requests */
@@ -0,0 +1,181 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IConvaihttpRequest.h"
+#include <atomic>
+
+/**
+ * Latency histogram with log-linear buckets, as in HDR histograms: each power of two range of microseconds is split in
+ * NumSubBuckets linear buckets, so a percentile is within 1/NumSubBuckets (about 6%) of the recorded value, from a
+ * microsecond to days, in a fixed amount of memory.
+ * Recording is a few relaxed atomic operations, safe from any thread. Reading while recording gives a close snapshot.
+ */
+class CONVAIHTTP_API FConvaihttpLatencyHistogram
+{
+public:
+	/** Number of linear buckets per power of two range, as a power of two */
+	static constexpr int32 SubBucketBits = 4;
+	static constexpr int32 NumSubBuckets = 1 << SubBucketBits;
+	/** Number of power of two ranges, values above the last one are counted in its last bucket */
+	static constexpr int32 NumRanges = 37;
+	static constexpr int32 NumBuckets = NumRanges * NumSubBuckets;
+
+	FConvaihttpLatencyHistogram();
+
+	/** Record a latency */
+	void Record(double Seconds);
+
+	/** @return number of latencies recorded */
+	uint64 GetCount() const { return Count.load(std::memory_order_relaxed); }
+
+	/**
+	 * Get a percentile of the latencies recorded
+	 *
+	 * @param Percentile - percentile in [0,1]
+	 * @return the highest latency of the bucket the percentile falls in, in seconds, 0 if nothing was recorded
+	 */
+	double GetPercentile(double Percentile) const;
+
+	/** @return mean of the latencies recorded, in seconds */
+	double GetMean() const;
+
+	/** @return highest latency recorded, in seconds */
+	double GetMax() const { return static_cast<double>(MaxMicroseconds.load(std::memory_order_relaxed)) / 1000000.0; }
+
+	/** Forget the latencies recorded */
+	void Reset();
+
+	/** @return index of the bucket counting a latency */
+	static int32 GetBucketIndex(uint64 Microseconds);
+	/** @return highest latency counted by a bucket */
+	static uint64 GetBucketHighestMicroseconds(int32 BucketIndex);
+
+private:
+	std::atomic<uint64> Buckets[NumBuckets];
+	std::atomic<uint64> Count;
+	std::atomic<uint64> SumMicroseconds;
+	std::atomic<uint64> MaxMicroseconds;
+};
+
+/**
+ * Metrics of the requests to one host
+ */
+struct CONVAIHTTP_API FConvaihttpHostMetrics
+{
+	explicit FConvaihttpHostMetrics(const FString& InHost)
+		: Host(InHost)
+	{
+	}
+
+	/** Forget everything recorded */
+	void Reset();
+
+	/** Lowercase domain and port, set once when the metrics are registered */
+	const FString Host;
+
+	std::atomic<uint64> NumRequests{ 0 };
+	std::atomic<uint64> NumSucceeded{ 0 };
+	std::atomic<uint64> NumFailed{ 0 };
+	std::atomic<uint64> NumTimeouts{ 0 };
+	std::atomic<uint64> NumRetries{ 0 };
+	/** Number of requests whose response came with timings, the base of the connection reuse ratio */
+	std::atomic<uint64> NumTimedRequests{ 0 };
+	std::atomic<uint64> NumConnectionsReused{ 0 };
+	std::atomic<uint64> BytesSent{ 0 };
+	std::atomic<uint64> BytesReceived{ 0 };
+
+	/** Time requests waited in the queue of the CONVAIHTTP thread */
+	FConvaihttpLatencyHistogram QueueWaitLatency;
+	/** Time to the first byte of the response */
+	FConvaihttpLatencyHistogram FirstByteLatency;
+	/** Time of the whole transfer */
+	FConvaihttpLatencyHistogram TotalLatency;
+};
+
+/**
+ * Registry of the metrics of the module, per host, updated without locks from the CONVAIHTTP thread, the game thread,
+ * or whichever thread completes requests.
+ * Hosts are registered in a fixed-size open addressing table with a compare-and-swap, and never removed, so a lookup
+ * never waits. Hosts past the size of the table are counted together, under "other".
+ */
+class CONVAIHTTP_API FConvaihttpMetrics
+{
+public:
+	/** Most hosts with their own metrics */
+	static constexpr int32 MaxHosts = 64;
+
+	/** @return the registry of the module */
+	static FConvaihttpMetrics& Get();
+
+	FConvaihttpMetrics();
+	~FConvaihttpMetrics();
+
+	/**
+	 * Record a completed request, with the timings of its response if it has one
+	 *
+	 * @param Request - request that completed
+	 */
+	void RecordRequestCompleted(const IConvaihttpRequest& Request);
+
+	/**
+	 * Record a request sent again by the retry system
+	 *
+	 * @param Url - URL of the request
+	 */
+	void RecordRetry(const FString& Url);
+
+	/**
+	 * Record a request that timed out
+	 *
+	 * @param Url - URL of the request
+	 */
+	void RecordTimeout(const FString& Url);
+
+	/**
+	 * Update the number of requests in the CONVAIHTTP thread
+	 *
+	 * @param NumQueued - requests waiting to start
+	 * @param NumRunning - requests running
+	 */
+	void SetQueueDepth(int32 NumQueued, int32 NumRunning);
+
+	/**
+	 * Get the metrics of the host of a URL, registering it if needed
+	 *
+	 * @param Url - URL of a request to the host
+	 * @return the metrics, valid as long as the registry
+	 */
+	FConvaihttpHostMetrics& FindOrAddHost(const FString& Url);
+
+	/** Forget everything recorded. Hosts stay registered */
+	void Reset();
+
+	/**
+	 * Print the metrics of each host
+	 *
+	 * @param Ar - output device to print to
+	 */
+	void Dump(FOutputDevice& Ar) const;
+
+	/** @return the metrics of each host as CSV, one line per host */
+	FString ExportCsv() const;
+
+	/** @return the metrics as a JSON object */
+	FString ExportJson() const;
+
+private:
+	/** Call a function with the metrics of each registered host, then those of the other hosts if any */
+	void ForEachHost(TFunctionRef<void(const FConvaihttpHostMetrics&)> Function) const;
+
+	/** Open addressing table of the metrics of each host */
+	std::atomic<FConvaihttpHostMetrics*> Hosts[MaxHosts];
+	/** Metrics of the hosts that didn't fit in Hosts */
+	FConvaihttpHostMetrics OtherHosts;
+
+	std::atomic<int32> QueueDepth{ 0 };
+	std::atomic<int32> PeakQueueDepth{ 0 };
+	std::atomic<int32> NumRunning{ 0 };
+	std::atomic<int32> PeakNumRunning{ 0 };
+};
@@ -5,6 +5,7 @@
 #include "CoreMinimal.h"
 #include "Misc/CoreMisc.h"
 #include "Interfaces/IConvaihttpRequest.h"
+#include "Interfaces/IConvaihttpWebSocket.h"
 #include "Modules/ModuleInterface.h"
 
 class FConvaihttpManager;
@@ -59,6 +60,16 @@ public:
 	 */
 	virtual TSharedRef<IConvaihttpRequest, ESPMode::ThreadSafe> CreateRequest();
 
+	/**
+	 * Instantiates a new WebSocket running on the Convaihttp thread
+	 *
+	 * @param Url - ws:// or wss:// url to connect to
+	 * @param Protocols - subprotocols to offer in the handshake
+	 * @param UpgradeHeaders - additional headers to send with the handshake
+	 * @return new WebSocket, or null if the current platform's Convaihttp implementation doesn't support them
+	 */
+	virtual TSharedPtr<IConvaihttpWebSocket, ESPMode::ThreadSafe> CreateWebSocket(const FString& Url, const TArray<FString>& Protocols = TArray<FString>(), const TMap<FString, FString>& UpgradeHeaders = TMap<FString, FString>());
+
 	/**
 	 * Only meant to be used by Convaihttp request/response implementations
 	 *
@@ -159,6 +170,22 @@ public:
 		return bUseNullConvaihttp;
 	}
 
+	/**
+	 * toggle simulated convaihttp implementation
+	 */
+	inline void ToggleSimulatedConvaihttp(bool bEnabled)
+	{
+		bUseSimulatedConvaihttp = bEnabled;
+	}
+
+	/**
+	 * @return true if simulated convaihttp is being used
+	 */
+	inline bool IsSimulatedConvaihttpEnabled() const
+	{
+		return bUseSimulatedConvaihttp;
+	}
+
 	/**
 	 * @return min delay time for each convaihttp request
 	 */
@@ -343,6 +370,8 @@ private:
 	bool bEnableConvaihttp;
 	/** toggles null (mock) convaihttp requests */
 	bool bUseNullConvaihttp;
+	/** toggles simulated convaihttp requests, served in process through the CONVAIHTTP thread, see FSimulatedConvaihttpRequest */
+	bool bUseSimulatedConvaihttp;
 	/** Default headers - each request will include these headers, using the default value if not overridden */
 	TMap<FString, FString> DefaultHeaders;
 	/** singleton for the module while loaded and available */
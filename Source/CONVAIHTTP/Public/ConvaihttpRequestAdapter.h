@@ -30,9 +30,14 @@ public:
 	virtual void                          SetURL(const FString& URL) override                                      { ConvaihttpRequest->SetURL(URL); }
 	virtual void                          SetContent(const TArray64<uint8>& ContentPayload) override                 { ConvaihttpRequest->SetContent(ContentPayload); }
 	virtual void                          SetContent(TArray64<uint8>&& ContentPayload) override                      { ConvaihttpRequest->SetContent(MoveTemp(ContentPayload)); }
+	virtual void                          SetContent(const FSharedBuffer& ContentPayload) override                   { ConvaihttpRequest->SetContent(ContentPayload); }
+	virtual void                          SetContent(const FCompositeBuffer& ContentPayload) override                { ConvaihttpRequest->SetContent(ContentPayload); }
 	virtual void                          SetContentAsString(const FString& ContentString) override                { ConvaihttpRequest->SetContentAsString(ContentString); }
     virtual bool                          SetContentAsStreamedFile(const FString& Filename) override               { return ConvaihttpRequest->SetContentAsStreamedFile(Filename); }
 	virtual bool                          SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override { return ConvaihttpRequest->SetContentFromStream(Stream); }
+	virtual bool                          SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source) override { return ConvaihttpRequest->SetContentFromSource(Source); }
+	virtual bool                          SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink) override { return ConvaihttpRequest->SetResponseBodyReceiveSink(Sink); }
+	virtual bool                          SetResponseBodyReceiveStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override { return ConvaihttpRequest->SetResponseBodyReceiveStream(Stream); }
 	virtual void                          SetHeader(const FString& HeaderName, const FString& HeaderValue) override { ConvaihttpRequest->SetHeader(HeaderName, HeaderValue); }
 	virtual void                          AppendToHeader(const FString& HeaderName, const FString& AdditionalHeaderValue) override { ConvaihttpRequest->AppendToHeader(HeaderName, AdditionalHeaderValue); }
 	virtual void                          SetTimeout(float InTimeoutSecs) override                                 { ConvaihttpRequest->SetTimeout(InTimeoutSecs); }
@@ -4,6 +4,10 @@
 
 #include "CoreMinimal.h"
 #include "Templates/Atomic.h"
+#include "HAL/CriticalSection.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "Memory/CompositeBuffer.h"
 #include "Interfaces/IConvaihttpRequest.h"
 #include "ConvaihttpRequestAdapter.h"
 
@@ -33,10 +37,71 @@ namespace FConvaihttpRetrySystem
 
 	struct FRetryDomains
 	{
+		/**
+		 * Health of a domain, as seen by the circuit breaker
+		 */
+		enum class EDomainState : uint8
+		{
+			/** Reachable, requests go through */
+			Closed,
+			/** Failed repeatedly, requests skip it until the open period is over */
+			Open,
+			/** Open period over, a single probe request goes through to test whether it recovered */
+			HalfOpen
+		};
+
 		FRetryDomains(TArray64<FString>&& InDomains) 
 			: Domains(MoveTemp(InDomains))
 			, ActiveIndex(0)
-		{}
+			, SelectionRandomStream(static_cast<int32>(FPlatformTime::Cycles()))
+		{
+			Health.SetNum(Domains.Num());
+		}
+		virtual ~FRetryDomains() = default;
+
+		/**
+		 * Pick the domain for the first attempt of a request.
+		 * A half-open domain waiting for its probe gets it; otherwise the active domain is used, as for retries. With
+		 * bSpreadFirstAttempts, once a domain has recent samples, two reachable domains are drawn at random instead and the
+		 * one with the lower expected latency (EWMA latency inflated by the EWMA error rate) is used. Drawing two rather
+		 * than always taking the best spreads new requests, so they don't all herd onto the domain that was fastest a
+		 * moment ago.
+		 *
+		 * @param bOutIsProbe     set to true if the attempt is the probe of a half-open domain, whose result must be reported
+		 * @return index of the domain to use
+		 */
+		CONVAIHTTP_API int32 SelectDomain(bool& bOutIsProbe);
+
+		/**
+		 * Pick the domain for the next attempt of a request: the first one from PreferredIndex the circuit breaker lets through.
+		 * If every domain is open, the one reopening first is used anyway.
+		 *
+		 * @param PreferredIndex  index of the domain to try first
+		 * @param bOutIsProbe     set to true if the attempt is the probe of a half-open domain, whose result must be reported
+		 * @return index of the domain to use
+		 */
+		CONVAIHTTP_API int32 AcquireDomain(int32 PreferredIndex, bool& bOutIsProbe);
+
+		/**
+		 * Feed the circuit breaker and the latency and error rate of a domain with the result of an attempt
+		 *
+		 * @param Index           index of the domain the attempt was sent to
+		 * @param bReachable      true if the domain answered, whatever the answer
+		 * @param bWasProbe       true if the attempt was the probe of a half-open domain
+		 * @param bSucceeded      true if the domain answered without a server error
+		 * @param LatencySeconds  time the domain took to answer
+		 */
+		CONVAIHTTP_API void ReportResult(int32 Index, bool bReachable, bool bWasProbe, bool bSucceeded, float LatencySeconds);
+
+		/**
+		 * Let another request probe a half-open domain, when the probe was cancelled before telling anything
+		 *
+		 * @param Index  index of the domain the probe was sent to
+		 */
+		CONVAIHTTP_API void ReleaseProbe(int32 Index);
+
+		/** @return the state of a domain */
+		CONVAIHTTP_API EDomainState GetDomainState(int32 Index) const;
 
 		/** The domains to use */
 		const TArray64<FString> Domains;
@@ -45,6 +110,69 @@ namespace FConvaihttpRetrySystem
 		 * Domains are cycled through on some errors, and when we succeed on one domain, we remain on that domain until that domain results in an error
 		 */
 		TAtomic<int32> ActiveIndex;
+
+		/** Number of consecutive attempts that couldn't reach a domain before it is opened */
+		int32 FailureThreshold = 3;
+		/** How long a domain stays open the first time, doubling each time its probe fails */
+		float OpenSeconds = 5.0f;
+		/** Longest a domain stays open */
+		float MaxOpenSeconds = 60.0f;
+		/** How long a probe may go without a result before another request may probe the domain */
+		float ProbeTimeoutSeconds = 30.0f;
+		/** Weight of the latest attempt in the latency and error rate averages */
+		float LatencySmoothing = 0.2f;
+		/** How old the averages of a domain may get before it is tried again as if nothing was known about it */
+		float LatencyMaxAgeSeconds = 30.0f;
+		/**
+		 * Whether first attempts are spread over the reachable domains by expected latency, off by default so they stay on
+		 * the active domain and the others are only used when it fails. Only worth it when the domains are equivalent
+		 * mirrors rather than fallbacks
+		 */
+		bool bSpreadFirstAttempts = false;
+
+	protected:
+		/** @return the time open periods, probes and samples are measured with. Tests override it to control it */
+		virtual double GetNowAbsoluteSeconds() const { return FPlatformTime::Seconds(); }
+
+	private:
+		/** Circuit breaker state of a domain */
+		struct FDomainHealth
+		{
+			EDomainState State = EDomainState::Closed;
+			/** Attempts in a row that couldn't reach the domain */
+			int32 ConsecutiveFailures = 0;
+			/** Length of the current open period */
+			float OpenSeconds = 0.0f;
+			/** Time the current open period ends */
+			double OpenEndTimeAbsoluteSeconds = 0.0;
+			/** Whether a probe is in flight while half-open */
+			bool bProbeInFlight = false;
+			/** Time the probe in flight was sent */
+			double ProbeStartTimeAbsoluteSeconds = 0.0;
+
+			/** Exponentially weighted moving average of the latency of attempts that got an answer */
+			float LatencySeconds = 0.0f;
+			/** Exponentially weighted moving average of the attempts that failed */
+			float ErrorRate = 0.0f;
+			/** Time of the last attempt feeding the averages, 0 if none did */
+			double LastSampleTimeAbsoluteSeconds = 0.0;
+		};
+
+		/** See AcquireDomain(). HealthCriticalSection must be held */
+		int32 AcquireDomainLocked(int32 PreferredIndex, bool& bOutIsProbe, double NowAbsoluteSeconds);
+		/** Take the probe of a domain if it is half-open and nothing probes it. HealthCriticalSection must be held */
+		bool TryAcquireProbeLocked(int32 Index, double NowAbsoluteSeconds);
+		/** @return expected latency of an attempt on a domain, 0 if unknown. HealthCriticalSection must be held */
+		float GetExpectedLatencyLocked(int32 Index, double NowAbsoluteSeconds) const;
+		/** Open a domain for its next open period. HealthCriticalSection must be held */
+		void OpenDomainLocked(int32 Index, double NowAbsoluteSeconds);
+
+		/** Guards Health, shared by requests that may run on any thread */
+		mutable FCriticalSection HealthCriticalSection;
+		/** Circuit breaker state, latency and error rate of each domain */
+		TArray64<FDomainHealth> Health;
+		/** Draws the domains compared by SelectDomain() */
+		FRandomStream SelectionRandomStream;
 	};
 	typedef TSharedPtr<FRetryDomains, ESPMode::ThreadSafe> FRetryDomainsPtr;
 
@@ -84,10 +212,42 @@ namespace FConvaihttpRetrySystem
 		// IConvaihttpRequest interface
 		CONVAIHTTP_API virtual bool ProcessRequest() override;
 		CONVAIHTTP_API virtual void CancelRequest() override;
+		CONVAIHTTP_API virtual const FConvaihttpResponsePtr GetResponse() const override;
+		CONVAIHTTP_API virtual void SetContent(const TArray64<uint8>& ContentPayload) override;
+		CONVAIHTTP_API virtual void SetContent(TArray64<uint8>&& ContentPayload) override;
+		CONVAIHTTP_API virtual void SetContent(const FSharedBuffer& ContentPayload) override;
+		CONVAIHTTP_API virtual void SetContent(const FCompositeBuffer& ContentPayload) override;
+		CONVAIHTTP_API virtual void SetContentAsString(const FString& ContentString) override;
+		CONVAIHTTP_API virtual bool SetContentAsStreamedFile(const FString& Filename) override;
+		CONVAIHTTP_API virtual bool SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override;
+		CONVAIHTTP_API virtual bool SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source) override;
+		CONVAIHTTP_API virtual bool SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink) override;
+		CONVAIHTTP_API virtual bool SetResponseBodyReceiveStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override;
 		
 		// FRequest
 		EStatus::Type GetRetryStatus() const { return Status; }
 
+		/**
+		 * Whether a GET that fails midway is retried from where it stopped rather than from the start, false by default.
+		 * The body received so far is kept and the rest is asked for with a Range request, provided the server advertised
+		 * Accept-Ranges and the resource has a validator (strong ETag or Last-Modified) to send as If-Range.
+		 * Has no effect if the caller sets its own Range header, or receives the response in a body sink or stream.
+		 */
+		void SetResumeDownloads(bool bInResumeDownloads) { bResumeDownloads = bInResumeDownloads; }
+
+		/**
+		 * Hedge the request against a slow server, off by default. When no byte of the response arrived within the given
+		 * percentile of the first byte latency of recent requests, a duplicate is sent to the next domain of RetryDomains, or
+		 * over another connection to the same one, and whichever completes first is used, the other one being cancelled.
+		 * Hedges are limited by the budget of the manager, see FManager::SetHedgeBudget().
+		 * Only idempotent verbs whose body is in memory are hedged. Requests whose body is streamed, or whose response is
+		 * received in a body sink or stream, are never hedged, as the hedge can neither send nor receive the body again.
+		 * Neither are requests for a Range, or resuming a download.
+		 *
+		 * @param LatencyPercentile  percentile of recent first byte latencies to wait for before hedging, in ]0,1[, 0 to disable
+		 */
+		void SetHedging(float LatencyPercentile) { HedgeLatencyPercentile = FMath::Clamp(LatencyPercentile, 0.0f, 0.999f); }
+
     protected:
 		friend class FManager;
 
@@ -102,11 +262,36 @@ namespace FConvaihttpRetrySystem
 			);
 
 		void ConvaihttpOnRequestProgress(FConvaihttpRequestPtr InConvaihttpRequest, uint64 BytesSent, uint64 BytesRcv);
-
+		void ConvaihttpOnProcessRequestComplete(FConvaihttpRequestPtr InConvaihttpRequest, FConvaihttpResponsePtr InConvaihttpResponse, bool bSucceeded);
+
+		/** Ask for the rest of the partial body on the next attempt if there is one, or for the whole body otherwise */
+		void PrepareRangeResume();
+		/** Forget the partial body and stop asking for ranges */
+		void ResetRangeResume();
+
+		/** Start timing a new attempt */
+		void BeginAttempt();
+		/** @return true if the request may be sent twice, and its body sent again by a copy of the request */
+		bool CanHedge() const;
+		/** Send a copy of the request, which completes the attempt if it wins */
+		void StartHedge();
+		/** Handle the completion of the hedge while the original request is still in flight */
+		void ConvaihttpOnHedgeComplete(FConvaihttpResponsePtr InConvaihttpResponse, bool bSucceeded);
+		/** Make the hedge the request of the attempt */
+		void PromoteHedge();
+		/** Count a hedge that completed successfully in place of the request it duplicated */
+		void RecordHedgeWin(const IConvaihttpRequest& Hedge);
+		/** Report the result of an attempt to the circuit breaker of its domain */
+		void ReportRetryDomainResult(int32 DomainIndex, bool bWasProbe, FConvaihttpRequestPtr InConvaihttpRequest, FConvaihttpResponsePtr InConvaihttpResponse, bool bSucceeded);
+
+		/** @return URL of our CONVAIHTTP request with its domain replaced by the given one from our RetryDomains */
+		FString GetUrlForRetryDomain(int32 DomainIndex) const;
 		/** Update our CONVAIHTTP request's URL's domain from our RetryDomains */
 		void SetUrlFromRetryDomains();
 		/** Move to the next retry domain from our RetryDomains */
 		void MoveToNextRetryDomain();
+		/** Pick the domain of the next attempt from our RetryDomains, skipping those the circuit breaker opened */
+		void AcquireRetryDomain();
 
 		EStatus::Type                        Status;
 
@@ -119,6 +304,56 @@ namespace FConvaihttpRetrySystem
 		int32								 RetryDomainsIndex = 0;
 		/** The original URL before replacing anything from RetryDomains */
 		FString								 OriginalUrl;
+		/** Whether the current attempt is the probe of a half-open domain */
+		bool								 bIsDomainProbe = false;
+		/** Whether the request was cancelled, which tells nothing about the health of its domain */
+		bool								 bCancelled = false;
+
+		/** Whether to resume failed downloads with Range requests */
+		bool								 bResumeDownloads = false;
+		/** Whether the caller set its own Range header, in which case ranges are left alone */
+		bool								 bCallerSetRange = false;
+		/** Whether the current attempt was sent with our Range and If-Range headers */
+		bool								 bRangeHeadersSet = false;
+		/** Body received by the previous attempts, which the next one resumes */
+		TArray64<uint8>						 PartialBody;
+		/** ETag or Last-Modified of the resource PartialBody belongs to */
+		FString								 PartialBodyValidator;
+		/** Response of a resumed download, holding the whole body */
+		FConvaihttpResponsePtr				 ResumedResponse;
+
+		/** Percentile of recent first byte latencies to wait for before hedging, 0 if hedging is disabled */
+		float								 HedgeLatencyPercentile = 0.0f;
+		/** Time the current attempt was sent */
+		double								 AttemptStartTimeAbsoluteSeconds = 0.0;
+		/** Whether the current attempt received the first byte of its response */
+		bool								 bFirstByteReceived = false;
+		/** Whether the current attempt was considered for hedging already */
+		bool								 bHedgeConsidered = false;
+		/** Whether the request whose failure promoted the hedge in its place is waiting for the hedge to complete */
+		bool								 bWaitingOnPromotedHedge = false;
+		/** Copy of the request racing the current attempt */
+		FConvaihttpRequestPtr				 HedgeRequest;
+		/** Index in RetryDomains the hedge was sent to */
+		int32								 HedgeDomainIndex = 0;
+		/** Whether the hedge is the probe of a half-open domain */
+		bool								 bHedgeIsDomainProbe = false;
+
+		/** How the body of the request was set, which decides whether a hedge can send it again */
+		enum class EContentKind : uint8
+		{
+			/** In an array, or none */
+			InMemory,
+			/** In shared buffers, handed to the hedge as they are */
+			SharedBuffer,
+			/** Read from a file, archive or upload source, which can only be sent once */
+			Streamed
+		};
+		EContentKind						 ContentKind = EContentKind::InMemory;
+		/** Body set as shared buffers, kept so a hedge sends it without flattening it */
+		FCompositeBuffer					 SharedContent;
+		/** Whether the response is received in a body sink or stream rather than in memory */
+		bool								 bHasResponseBodySink = false;
 
 		FManager& RetryManager;
     };
@@ -158,6 +393,45 @@ namespace FConvaihttpRetrySystem
         CONVAIHTTP_API bool Update(uint32* FileCount = NULL, uint32* FailingCount = NULL, uint32* FailedCount = NULL, uint32* CompletedCount = NULL);
 		CONVAIHTTP_API void SetRandomFailureRate(float Value) { RandomFailureRate = FRandomFailureRateSetting(Value); }
 		CONVAIHTTP_API void SetDefaultRetryLimit(uint32 Value) { RetryLimitCountDefault = FRetryLimitCountSetting(Value); }
+
+		/**
+		 * Set the budget shared by the retries of all requests, so a backend outage can't turn into a retry storm.
+		 * Each retry takes a token from a bucket refilled at a constant rate; when the bucket is empty, requests fail
+		 * instead of being retried. Disabled by default, so requests get all the retries they are configured with;
+		 * e.g. SetRetryBudget(10.0f, 100.0f) allows 10 retries per second with bursts of 100.
+		 *
+		 * @param RefillPerSecond  number of retries added to the budget per second
+		 * @param Capacity         most retries the budget can accumulate, 0 to disable the budget
+		 */
+		CONVAIHTTP_API void SetRetryBudget(float RefillPerSecond, float Capacity);
+
+		/**
+		 * Counters of the hedges sent for requests with hedging enabled
+		 */
+		struct FHedgeStats
+		{
+			/** Number of hedges sent */
+			uint64 NumHedges = 0;
+			/** Number of hedges that completed successfully in place of the request they duplicated */
+			uint64 NumWins = 0;
+			/** Number of hedges not sent because the budget was exhausted */
+			uint64 NumDenied = 0;
+
+			/** @return fraction of the hedges sent that won */
+			double GetWinRate() const { return NumHedges > 0 ? static_cast<double>(NumWins) / static_cast<double>(NumHedges) : 0.0; }
+		};
+
+		/**
+		 * Set the budget of hedges, so a slow backend doesn't get twice the load. Each request with hedging enabled adds
+		 * Ratio hedges to the budget, and each hedge takes one. 10% of the requests with bursts of 10 by default.
+		 *
+		 * @param Ratio     fraction of the requests with hedging enabled that may be hedged
+		 * @param Capacity  most hedges the budget can accumulate
+		 */
+		CONVAIHTTP_API void SetHedgeBudget(float Ratio, float Capacity);
+
+		/** @return counters of the hedges sent so far */
+		const FHedgeStats& GetHedgeStats() const { return HedgeStats; }
 		
 		// @return Block the current process until all requests are flushed, or timeout has elapsed
 		CONVAIHTTP_API void BlockUntilFlushed(float TimeoutSec);
@@ -173,10 +447,21 @@ namespace FConvaihttpRetrySystem
             uint32                  CurrentRetryCount;
             double                  RequestStartTimeAbsoluteSeconds;
             double                  LockoutEndTimeAbsoluteSeconds;
+            // Time the entry must be looked at again while in lockout: the end of the lockout, or the retry timeout if sooner
+            double                  WakeTimeAbsoluteSeconds;
 
             TSharedRef<FRequest, ESPMode::ThreadSafe>	Request;
         };
 
+        // Orders LockoutHeap so the entry to wake first is on top
+        struct FWakesEarlier
+        {
+            bool operator()(const FConvaihttpRetryRequestEntry& A, const FConvaihttpRetryRequestEntry& B) const
+            {
+                return A.WakeTimeAbsoluteSeconds < B.WakeTimeAbsoluteSeconds;
+            }
+        };
+
 		bool ProcessRequest(TSharedRef<FRequest, ESPMode::ThreadSafe>& ConvaihttpRequest);
 		void CancelRequest(TSharedRef<FRequest, ESPMode::ThreadSafe>& ConvaihttpRequest);
 
@@ -190,14 +475,53 @@ namespace FConvaihttpRetrySystem
         // @return true if the retry request has timed out
         bool HasTimedOut(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry, const double NowAbsoluteSeconds);
 
+        // @return time the retry request times out at, unset if it never does
+        TOptional<double> GetRetryTimeoutAbsoluteSeconds(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry);
+
         // @return number of seconds to lockout for
         float GetLockoutPeriodSeconds(const FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry);
 
+        // @return true if the retry budget allows one more retry, which is taken from it
+        bool ConsumeRetryBudget(const double NowAbsoluteSeconds);
+
+        // Send a hedge for the entry if hedging is enabled and its first byte is late
+        void UpdateHedging(FConvaihttpRetryRequestEntry& ConvaihttpRetryRequestEntry, const double NowAbsoluteSeconds);
+
+        // Record the time an attempt took to receive its first byte
+        void AddFirstByteLatencySample(float LatencySeconds);
+
+        // @return the given percentile of the recent first byte latencies, unset until there are enough of them
+        TOptional<float> GetFirstByteLatencyPercentile(float Percentile);
+
         // Default configuration for the retry system
         FRandomFailureRateSetting            RandomFailureRate;
         FRetryLimitCountSetting              RetryLimitCountDefault;
         FRetryTimeoutRelativeSecondsSetting  RetryTimeoutRelativeSecondsDefault;
 
+        // Retry budget, disabled until SetRetryBudget() is called
+        float                                RetryBudgetRefillPerSecond = 0.0f;
+        float                                RetryBudgetCapacity = 0.0f;
+        double                               RetryBudgetTokens = 0.0;
+        double                               RetryBudgetLastRefillAbsoluteSeconds = 0.0;
+
+        // Hedge budget, in hedges
+        float                                HedgeBudgetRatio = 0.1f;
+        float                                HedgeBudgetCapacity = 10.0f;
+        float                                HedgeBudgetTokens = 10.0f;
+        FHedgeStats                          HedgeStats;
+
+        // Ring of the first byte latencies of recent attempts, and a sorted copy made when a percentile is needed
+        TArray<float>                        FirstByteLatencySamples;
+        int32                                NextFirstByteLatencySample = 0;
+        TArray<float>                        SortedFirstByteLatencySamples;
+        bool                                 bFirstByteLatencySamplesSorted = false;
+
+        // Jitter of the lockout periods
+        FRandomStream                        LockoutRandomStream;
+
+        // Entries being processed, looked at on every update
         TArray64<FConvaihttpRetryRequestEntry>        RequestList;
+        // Entries in lockout, a min-heap on their wake time so an update only looks at those whose lockout is over
+        TArray64<FConvaihttpRetryRequestEntry>        LockoutHeap;
     };
 }
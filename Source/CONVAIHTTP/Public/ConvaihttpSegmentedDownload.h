@@ -0,0 +1,206 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IConvaihttpRequest.h"
+
+class FConvaihttpSegmentBodySink;
+class FConvaihttpSharedOutputArchive;
+
+/**
+ * Delegate called when a segmented download is over
+ *
+ * @param bSucceeded - true if the whole resource was received and its length verified
+ */
+DECLARE_DELEGATE_OneParam(FConvaihttpSegmentedDownloadCompleteDelegate, bool /*bSucceeded*/);
+
+/**
+ * Delegate called each time a segment of a segmented download completes
+ *
+ * @param BytesReceived - number of bytes of the resource received so far
+ * @param TotalSize - size of the resource
+ */
+DECLARE_DELEGATE_TwoParams(FConvaihttpSegmentedDownloadProgressDelegate, uint64 /*BytesReceived*/, uint64 /*TotalSize*/);
+
+/**
+ * Downloads a large resource with several concurrent Range requests, so it isn't limited by the throughput of one connection.
+ *
+ * The first request asks for the first segment, and learns the size of the resource and its validator from the 206.
+ * A server that answers with a 200 instead just sends the whole resource over that one request.
+ * The rest of the resource is split in segments that are requested concurrently, each received straight at its offset
+ * in the output: a buffer allocated once for the whole resource, or an archive (typically a file) written behind the transfer.
+ *
+ * The number of segments in flight adapts to the measured throughput: it grows while that keeps improving the aggregate
+ * throughput, and shrinks when it makes it worse, up to SetMaxSegments(). A segment that fails is requested again from
+ * where it stopped. Every segment is sent with If-Range when the resource has a strong ETag, or has its Last-Modified
+ * compared with that of the first one otherwise, so a resource that changes during the download fails it rather than
+ * mixing two versions, and the total received is checked against the size of the resource. An empty resource, which no
+ * range can be satisfied from, is an empty download.
+ *
+ * Segments only run over separate connections up to the per-host connection limit of the CONVAIHTTP module, and not
+ * at all when the server multiplexes them over HTTP/2.
+ * Delegates are called on the game thread. Must be created with MakeShared, and keeps itself alive while it runs.
+ */
+class CONVAIHTTP_API FConvaihttpSegmentedDownload : public TSharedFromThis<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe>
+{
+public:
+	/**
+	 * @param InURL - URL of the resource to download
+	 */
+	explicit FConvaihttpSegmentedDownload(const FString& InURL);
+	~FConvaihttpSegmentedDownload();
+
+	/** Set a header sent with every request. Must be called before Start() */
+	void SetHeader(const FString& HeaderName, const FString& HeaderValue);
+
+	/**
+	 * Write the resource to an archive instead of keeping it in memory. Must be called before Start().
+	 * The archive must support seeking, and is only written to from thread pool threads until the download is over.
+	 */
+	void SetOutputArchive(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive);
+
+	/** Set the most segments in flight at once, 8 by default. Must be called before Start() */
+	void SetMaxSegments(int32 InMaxSegments);
+
+	/** Set the size of the range each request asks for, 4MB by default. Must be called before Start() */
+	void SetSegmentSize(uint64 InSegmentSize);
+
+	/** Set how many times a segment may be requested again after failing, 3 by default. Must be called before Start() */
+	void SetMaxSegmentRetries(int32 InMaxSegmentRetries);
+
+	/**
+	 * Start the download. OnComplete() is called once it is over.
+	 *
+	 * @return false if the download couldn't be started
+	 */
+	bool Start();
+
+	/** Stop the download. OnComplete() is called with a failure */
+	void Cancel();
+
+	/** @return true once the download is over */
+	bool IsFinished() const { return bFinished; }
+
+	/** @return true once the download is over and succeeded */
+	bool HasSucceeded() const { return bSucceeded; }
+
+	/** @return the resource, when it is kept in memory. Only complete once the download is over */
+	const TArray64<uint8>& GetContent() const { return Content; }
+
+	/** @return the resource, moved out of the download, when it is kept in memory. Only call once the download is over */
+	TArray64<uint8> TakeContent() { return MoveTemp(Content); }
+
+	/** @return size of the resource, 0 until the first response was received */
+	uint64 GetTotalSize() const { return TotalSize; }
+
+	/** @return number of bytes of the resource received so far */
+	uint64 GetBytesReceived() const { return BytesReceived; }
+
+	/** @return most segments that were in flight at once */
+	int32 GetPeakSegmentsInFlight() const { return PeakSegmentsInFlight; }
+
+	/** @return time from Start() to the end of the download, in seconds */
+	double GetElapsedTime() const;
+
+	/** Delegate called when the download is over */
+	FConvaihttpSegmentedDownloadCompleteDelegate& OnComplete() { return CompleteDelegate; }
+
+	/** Delegate called each time a segment completes */
+	FConvaihttpSegmentedDownloadProgressDelegate& OnProgress() { return ProgressDelegate; }
+
+private:
+	/** Part of the resource, and the request receiving it */
+	struct FSegment
+	{
+		/** Offset of the first byte of the segment not received yet */
+		uint64 Start = 0;
+		/** Offset of the last byte of the segment */
+		uint64 End = 0;
+		/** Number of times the segment was requested again */
+		int32 NumRetries = 0;
+		/** Time the current request was started */
+		double StartTime = 0.0;
+		/** Request in flight */
+		FConvaihttpRequestPtr Request;
+		/** Sink of the request in flight */
+		TSharedPtr<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe> Sink;
+	};
+
+	/** Create a request for bytes [Start, End] of the resource */
+	FConvaihttpRequestRef CreateRangeRequest(uint64 Start, uint64 End) const;
+	/** Handle the response to the first request */
+	void OnFirstSegmentComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bRequestSucceeded);
+	/** Handle the response to a segment request */
+	void OnSegmentComplete(FConvaihttpRequestPtr ConvaihttpRequest, FConvaihttpResponsePtr ConvaihttpResponse, bool bRequestSucceeded);
+	/** Start requests for pending segments until the target number is in flight */
+	void StartSegments();
+	/** Adapt the number of segments in flight once a measurement window is over */
+	void UpdateConcurrency(uint64 SegmentBytes);
+	/** Stop the requests in flight, and fail the download once they are over */
+	void Fail(const TCHAR* Reason);
+	/** End the download, calling the completion delegate */
+	void Finish(bool bInSucceeded);
+
+	/** URL of the resource */
+	FString URL;
+	/** Headers sent with every request */
+	TMap<FString, FString> Headers;
+	/** Archive the resource is written to, if not kept in memory */
+	TSharedPtr<FConvaihttpSharedOutputArchive, ESPMode::ThreadSafe> OutputArchive;
+	/** Most segments in flight at once */
+	int32 MaxSegments = 8;
+	/** Size of each range */
+	uint64 SegmentSize = 4 * 1024 * 1024;
+	/** Times a segment may be requested again */
+	int32 MaxSegmentRetries = 3;
+
+	/** Resource, when kept in memory. Preallocated once its size is known, and filled in place by the segment sinks */
+	TArray64<uint8> Content;
+	/** Size of the resource */
+	uint64 TotalSize = 0;
+	/** Strong ETag of the resource, sent as If-Range */
+	FString Validator;
+	/** Last-Modified of the resource, which every segment must match when it has no strong ETag */
+	FString LastModified;
+	/** Request for the first segment */
+	FConvaihttpRequestPtr FirstRequest;
+	/** Sink of the first segment, when writing to an archive */
+	TSharedPtr<FConvaihttpSegmentBodySink, ESPMode::ThreadSafe> FirstSink;
+	/** Segments not requested yet, or to request again */
+	TArray<FSegment> PendingSegments;
+	/** Segments being received */
+	TArray<FSegment> ActiveSegments;
+	/** Number of bytes received by completed segments */
+	uint64 BytesReceived = 0;
+
+	/** Number of segments the download tries to keep in flight */
+	int32 TargetSegmentsInFlight = 2;
+	/** Most segments that were in flight at once */
+	int32 PeakSegmentsInFlight = 0;
+	/** Start of the current measurement window */
+	double WindowStartTime = 0.0;
+	/** Bytes received by segments completed in the current measurement window */
+	uint64 WindowBytes = 0;
+	/** Segments completed in the current measurement window */
+	int32 WindowSegments = 0;
+	/** Best aggregate throughput measured, in bytes per second */
+	double BestThroughput = 0.0;
+
+	/** Time Start() was called */
+	double StartTime = 0.0;
+	/** Time the download ended */
+	double EndTime = 0.0;
+	/** Set once the download failed, while waiting for the requests in flight to be over */
+	bool bFailing = false;
+	/** Set once the download is over */
+	bool bFinished = false;
+	/** Set if the download succeeded */
+	bool bSucceeded = false;
+
+	FConvaihttpSegmentedDownloadCompleteDelegate CompleteDelegate;
+	FConvaihttpSegmentedDownloadProgressDelegate ProgressDelegate;
+
+	/** Keeps the download alive while it runs */
+	TSharedPtr<FConvaihttpSegmentedDownload, ESPMode::ThreadSafe> SelfReference;
+};
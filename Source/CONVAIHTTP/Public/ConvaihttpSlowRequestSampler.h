@@ -0,0 +1,101 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IConvaihttpRequest.h"
+#include "Interfaces/IConvaihttpResponse.h"
+#include "Misc/DateTime.h"
+#include <atomic>
+
+/**
+ * Diagnostics of a request that took longer than the slow request threshold
+ */
+struct FConvaihttpSlowRequestSample
+{
+	/** When the request completed */
+	FDateTime Timestamp;
+	FString Verb;
+	FString Url;
+	EConvaihttpRequestStatus::Type Status = EConvaihttpRequestStatus::NotStarted;
+	int32 ResponseCode = 0;
+	/** Time from queueing the request to its completion, the latency compared to the threshold */
+	double TotalSeconds = 0.0;
+	FConvaihttpResponseTimings Timings;
+	uint64 BytesSent = 0;
+	uint64 BytesReceived = 0;
+	/** Address and port of the host the request connected to, empty if unknown */
+	FString RemoteAddress;
+	int32 RemotePort = 0;
+	int32 LocalPort = 0;
+	/** Info messages of the implementation (e.g. libcurl), oldest first */
+	TArray<FString> InfoMessages;
+};
+
+/**
+ * Keeps the diagnostics of the slowest requests, so tail latency can be investigated without verbose logging.
+ *
+ * Requests slower than SlowRequestThresholdSeconds compete for SlowRequestSamplesPerWindow places in the current window of
+ * SlowRequestWindowSeconds, the slowest ones winning. When a window ends, its samples move to a ring of the last
+ * SlowRequestRingSize samples, dumped with CONVAIHTTP SLOWDUMP. All settings are in the [CONVAIHTTP] section of the engine ini.
+ * Checking a request under the threshold is a relaxed atomic load, slower requests take a lock.
+ */
+class CONVAIHTTP_API FConvaihttpSlowRequestSampler
+{
+public:
+	/** @return the sampler of the module */
+	static FConvaihttpSlowRequestSampler& Get();
+
+	/** Read the settings from the config */
+	void UpdateConfigs();
+
+	/**
+	 * Check if a request would be sampled, before gathering its diagnostics
+	 *
+	 * @param TotalSeconds - latency of the request, including the time it was queued
+	 * @return true if the request is slow enough to get a place in the current window
+	 */
+	bool ShouldSample(double TotalSeconds) const;
+
+	/**
+	 * Offer the diagnostics of a slow request. Thread safe
+	 *
+	 * @param Sample - diagnostics of the request, kept if it is still among the slowest of the window
+	 */
+	void AddSample(FConvaihttpSlowRequestSample&& Sample);
+
+	/** Forget all the samples */
+	void Reset();
+
+	/**
+	 * Print the samples, oldest first, the current window last
+	 *
+	 * @param Ar - output device to print to
+	 */
+	void Dump(FOutputDevice& Ar);
+
+private:
+	/** Move the samples of the current window to the ring if the window is over. Must hold CriticalSection */
+	void RotateWindow(double Now);
+
+	/** Latency above which requests are sampled, in seconds. 0 or less disables the sampler */
+	std::atomic<double> ThresholdSeconds{ 2.0 };
+	/** Latency of the fastest sample of a full window, 0 while the window has room */
+	std::atomic<double> WindowAdmissionSeconds{ 0.0 };
+	/** End of the current window, 0 before the first sample */
+	std::atomic<double> WindowEndTime{ 0.0 };
+
+	int32 SamplesPerWindow = 5;
+	double WindowSeconds = 60.0;
+	int32 RingSize = 64;
+
+	FCriticalSection CriticalSection;
+	/** Samples of the current window */
+	TArray<FConvaihttpSlowRequestSample> WindowSamples;
+	/** Samples of the previous windows */
+	TArray<FConvaihttpSlowRequestSample> Ring;
+	/** Index of the oldest sample in Ring once it is full */
+	int32 RingHead = 0;
+	/** Number of slow requests that didn't make it among the slowest of their window */
+	uint64 NumDiscarded = 0;
+};
@@ -0,0 +1,100 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformTime.h"
+#include "Trace/Trace.h"
+#include <atomic>
+
+class IConvaihttpRequest;
+
+#if UE_TRACE_ENABLED
+UE_TRACE_CHANNEL_EXTERN(ConvaihttpChannel, CONVAIHTTP_API);
+#endif
+
+/**
+ * Steps of the lifecycle of a request, in the order they happen
+ */
+enum class EConvaihttpTraceEvent : uint8
+{
+	/** Queued for the CONVAIHTTP thread, on the thread calling ProcessRequest() */
+	Queued,
+	/** Admitted by the CONVAIHTTP thread, which started its transfer */
+	Admitted,
+	/** Connected to the host, or found a connection to reuse */
+	Connected,
+	/** First byte of the response received */
+	FirstByte,
+	/** Part of the response body received. The value is its size */
+	BodyChunk,
+	/** Transfer over, on the CONVAIHTTP thread */
+	Completed,
+	/** Completion delegate called on the game thread */
+	Delivered
+};
+
+/**
+ * Traces the lifecycle of requests across the game and CONVAIHTTP threads.
+ *
+ * Events go to the "ConvaihttpChannel" trace channel for Unreal Insights when it is enabled (-trace=ConvaihttpChannel),
+ * and to an in-memory capture while one runs (CONVAIHTTP TRACE START), which can be exported as a Chrome trace
+ * (chrome://tracing, Perfetto) with one row per request, for machines without Insights such as headless servers.
+ * Costs a relaxed atomic load per event when neither is on.
+ */
+class CONVAIHTTP_API FConvaihttpTrace
+{
+public:
+	/** @return true if events are recorded anywhere */
+	static bool IsEnabled()
+	{
+		return bCapturing.load(std::memory_order_relaxed)
+#if UE_TRACE_ENABLED
+			|| UE_TRACE_CHANNELEXPR_IS_ENABLED(ConvaihttpChannel)
+#endif
+			;
+	}
+
+	/**
+	 * Record an event of a request. Thread safe
+	 *
+	 * @param Request - request the event is about
+	 * @param Type - step of the lifecycle of the request
+	 * @param Value - size of a body chunk, 0 otherwise
+	 * @param Cycles - time of the event, from FPlatformTime::Cycles64(), for events known after the fact
+	 */
+	static void Event(const IConvaihttpRequest* Request, EConvaihttpTraceEvent Type, uint64 Value = 0, uint64 Cycles = FPlatformTime::Cycles64());
+
+	/** Start capturing events in memory, discarding those of a previous capture */
+	static void StartCapture();
+
+	/** Stop capturing events, keeping those captured for export */
+	static void StopCapture();
+
+	/** @return true while a capture runs */
+	static bool IsCapturing() { return bCapturing.load(std::memory_order_relaxed); }
+
+	/** @return the events captured, as Chrome trace event format JSON */
+	static FString ExportChromeTrace();
+
+	/**
+	 * Save the events captured as a Chrome trace
+	 *
+	 * @param Filename - file to write
+	 * @return true if the file was written
+	 */
+	static bool SaveChromeTrace(const FString& Filename);
+
+private:
+	static std::atomic<bool> bCapturing;
+};
+
+/** Record an event of a request if tracing is on, without evaluating the arguments otherwise */
+#define CONVAIHTTP_TRACE_EVENT(Request, Type, ...) \
+	do \
+	{ \
+		if (FConvaihttpTrace::IsEnabled()) \
+		{ \
+			FConvaihttpTrace::Event(Request, EConvaihttpTraceEvent::Type, ##__VA_ARGS__); \
+		} \
+	} while (0)
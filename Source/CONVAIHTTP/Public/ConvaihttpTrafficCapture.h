@@ -0,0 +1,99 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IConvaihttpRequest.h"
+#include "Interfaces/IConvaihttpResponse.h"
+#include "Memory/CompositeBuffer.h"
+#include <atomic>
+
+/**
+ * Metadata, timing and optionally bodies of one request, as recorded by FConvaihttpTrafficCapture
+ */
+struct FConvaihttpCapturedRequest
+{
+	/** When the request was queued, since the start of the capture */
+	double ArrivalSeconds = 0.0;
+	/** Time from queueing the request to its completion */
+	double DurationSeconds = 0.0;
+	/** Time from the start of the transfer to the first byte of the response, negative if unknown */
+	double FirstByteSeconds = -1.0;
+	FString Verb;
+	FString Url;
+	/** Headers of the request as "Key: Value", with credentials redacted */
+	TArray<FString> RequestHeaders;
+	uint64 RequestSize = 0;
+	/** Body of the request, when bodies are captured and the body was in memory */
+	TArray<uint8> RequestBody;
+	EConvaihttpRequestStatus::Type Status = EConvaihttpRequestStatus::NotStarted;
+	int32 ResponseCode = 0;
+	/** Headers of the response as "Key: Value", with credentials redacted */
+	TArray<FString> ResponseHeaders;
+	uint64 ResponseSize = 0;
+	/** Body of the response, when bodies are captured and the body was accumulated in the response */
+	TArray<uint8> ResponseBody;
+
+	friend FArchive& operator<<(FArchive& Ar, FConvaihttpCapturedRequest& Request);
+};
+
+/**
+ * Records the traffic of the module to a compact binary log, to replay the same mix of requests with their original
+ * inter-arrival times against a local stand-in (CONVAIHTTP REPLAY), and reproduce the shape of production load when
+ * evaluating changes to the module.
+ *
+ * Started and stopped with CONVAIHTTP CAPTURE START|STOP. Records are buffered and written to the file in batches by a
+ * thread pool task, so the game thread doesn't wait on the disk. Values of the headers matching
+ * [CONVAIHTTP.TrafficCapture] RedactedHeaders in the engine ini are never recorded, by default credentials
+ * (Authorization, Proxy-Authorization, Cookie, Set-Cookie, Api-Key, *-Api-Key). Query strings can be stripped from
+ * urls. Bodies are only recorded on request, up to a size. Costs a relaxed atomic load per completed request when no
+ * capture runs.
+ */
+class CONVAIHTTP_API FConvaihttpTrafficCapture
+{
+public:
+	/** @return true while a capture runs */
+	static bool IsCapturing() { return bCapturing.load(std::memory_order_relaxed); }
+
+	/**
+	 * Start recording to a file, ending a capture already running
+	 *
+	 * @param Filename - file to write
+	 * @param bCaptureBodies - record the bodies of requests and responses
+	 * @param MaxBodySize - bodies larger than this are not recorded, only their size
+	 * @param bStripQueryStrings - record urls without their query string
+	 * @return true if the file could be opened
+	 */
+	static bool Start(const FString& Filename, bool bCaptureBodies, int64 MaxBodySize, bool bStripQueryStrings = false);
+
+	/** Stop recording, wait for the pending writes and close the file */
+	static void Stop();
+
+	/**
+	 * Record a completed request. Called on the game thread, before its completion delegate
+	 *
+	 * @param Request - request that completed
+	 * @param RequestBody - body of the request when it is held in memory, empty when it was streamed
+	 * @param Response - its response, null if none
+	 * @param QueuedTimeAbsoluteSeconds - when the request was queued, from FPlatformTime::Seconds()
+	 */
+	static void Record(const IConvaihttpRequest& Request, const FCompositeBuffer& RequestBody, const IConvaihttpResponse* Response, double QueuedTimeAbsoluteSeconds);
+
+	/**
+	 * Read a capture
+	 *
+	 * @param Filename - file written by a capture
+	 * @param OutRequests - requests of the capture, in the order they completed
+	 * @return false if the file couldn't be read or isn't a capture
+	 */
+	static bool Load(const FString& Filename, TArray<FConvaihttpCapturedRequest>& OutRequests);
+
+	/** @return patterns, wildcards allowed, of the headers whose values are redacted from captures */
+	static TArray<FString> GetRedactedHeaders();
+
+	/** @return true if a header name matches one of the patterns of GetRedactedHeaders(), ignoring case */
+	static bool IsRedactedHeader(const FString& Key, const TArray<FString>& RedactedHeaders);
+
+private:
+	static std::atomic<bool> bCapturing;
+};
@@ -0,0 +1,131 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "Memory/SharedBuffer.h"
+#include "Interfaces/IConvaihttpResponseBodySink.h"
+#include <atomic>
+
+/**
+ * One message decoded from a length-prefixed stream
+ */
+struct FConvaihttpDecodedFrame
+{
+	/** Flags byte of the frame prefix */
+	uint8 Flags = 0;
+	/** Message payload */
+	FSharedBuffer Message;
+};
+
+/**
+ * Response body sink that splits a stream of length-prefixed frames into messages as soon as their bytes arrive,
+ * as used by gRPC-web: a flags byte, a big-endian 32-bit length, then the message.
+ * A frame with the trailers flag carries "name: value" lines instead of a message, and is exposed with GetTrailer().
+ *
+ * Messages that arrive whole within one receive are handed over in place, straight from the transport's buffer;
+ * only those split across receives are assembled in a buffer of their exact size.
+ * Messages are handed to the message callback on the CONVAIHTTP thread if one is set, or queued for DequeueFrame() otherwise.
+ */
+class CONVAIHTTP_API FConvaihttpLengthPrefixedFrameDecoder : public IConvaihttpResponseBodySink
+{
+public:
+	/** Size of the prefix of each frame */
+	static constexpr int32 PrefixSize = 5;
+	/** Flag set on frames whose message is compressed. Decompressing is up to the consumer */
+	static constexpr uint8 CompressedFlag = 0x01;
+	/** Flag set on the frame carrying the trailers */
+	static constexpr uint8 TrailersFlag = 0x80;
+
+	/**
+	 * @param InMaxMessageSize - largest message accepted, so a corrupt length can't make us allocate without bound
+	 */
+	explicit FConvaihttpLengthPrefixedFrameDecoder(uint32 InMaxMessageSize = 64 * 1024 * 1024);
+	virtual ~FConvaihttpLengthPrefixedFrameDecoder();
+
+	/**
+	 * Set the function messages are handed to as they are decoded, instead of being queued
+	 *
+	 * @param InCallback - function to call on the thread calling Write(), with the frame flags and a view of the
+	 *                     message only valid for the duration of the call
+	 */
+	void SetMessageCallback(TFunction<void(uint8 /*Flags*/, FMemoryView /*Message*/)> InCallback);
+
+	/**
+	 * Get the next queued message
+	 *
+	 * @param OutFrame - receives the message
+	 * @return false if no message is queued
+	 */
+	bool DequeueFrame(FConvaihttpDecodedFrame& OutFrame);
+
+	/** @return true once the trailers frame was received */
+	bool HasReceivedTrailers() const;
+
+	/**
+	 * Get a trailer received at the end of the stream
+	 *
+	 * @param Name - name of the trailer, case insensitive
+	 * @return value of the trailer, empty if it wasn't received
+	 */
+	FString GetTrailer(const FString& Name) const;
+
+	/** @return all trailers received at the end of the stream */
+	TMap<FString, FString> GetAllTrailers() const;
+
+	/** @return true once the transfer feeding the decoder is over */
+	bool IsFinished() const;
+
+	/** @return true if the transfer ended in the middle of a frame */
+	bool WasTruncated() const;
+
+	/** @return number of message bytes that had to be copied to assemble messages split across receives */
+	uint64 GetNumBytesAssembled() const;
+
+	//~ Begin IConvaihttpResponseBodySink Interface
+	virtual EConvaihttpBodySinkResult Write(FMemoryView Data) override;
+	virtual void Finish(bool bSucceeded) override;
+	//~ End IConvaihttpResponseBodySink Interface
+
+private:
+	/**
+	 * Hand a complete frame over
+	 *
+	 * @param Flags - flags of the frame
+	 * @param Message - payload of the frame
+	 * @param OwnedMessage - buffer Message was assembled in, if any, which can be handed over without copying
+	 */
+	void DispatchFrame(uint8 Flags, FMemoryView Message, TArray64<uint8>* OwnedMessage);
+	/** Parse the payload of the trailers frame */
+	void ParseTrailers(FMemoryView Payload);
+
+	/** Largest message accepted */
+	const uint32 MaxMessageSize;
+	/** Prefix of the frame being received */
+	uint8 Prefix[PrefixSize];
+	/** Number of bytes of Prefix received */
+	int32 PrefixBytesReceived = 0;
+	/** Length of the message being received, once its prefix was received */
+	uint32 MessageLength = 0;
+	/** Message split across receives, being assembled */
+	TArray64<uint8> PendingMessage;
+	/** Number of message bytes copied into PendingMessage */
+	std::atomic<uint64> NumBytesAssembled;
+
+	/** Trailers received */
+	TMap<FString, FString> Trailers;
+	/** Guards Trailers, which are read from other threads */
+	mutable FCriticalSection TrailersCriticalSection;
+	/** Set once the trailers frame was received */
+	std::atomic<bool> bReceivedTrailers;
+	/** Set by Finish() */
+	std::atomic<bool> bFinished;
+	/** Set by Finish() if a frame was cut short */
+	std::atomic<bool> bTruncated;
+
+	/** Optional function receiving messages */
+	TFunction<void(uint8, FMemoryView)> MessageCallback;
+	/** Messages waiting for DequeueFrame() when there is no callback */
+	TQueue<FConvaihttpDecodedFrame, EQueueMode::Spsc> Frames;
+};
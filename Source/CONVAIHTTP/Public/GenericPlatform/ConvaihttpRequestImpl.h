@@ -11,6 +11,13 @@ class CONVAIHTTP_API FConvaihttpRequestImpl : public IConvaihttpRequest
 {
 public:
 	// IConvaihttpRequest
+	using IConvaihttpRequest::SetContent;
+	virtual void SetContent(const FSharedBuffer& ContentPayload) override;
+	virtual void SetContent(const FCompositeBuffer& ContentPayload) override;
+	virtual bool SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source) override;
+	virtual bool SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink) override;
+	virtual bool SetResponseBodyReceiveStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) override;
+
 	virtual FConvaihttpRequestCompleteDelegate& OnProcessRequestComplete() override;
 	virtual FConvaihttpRequestProgressDelegate& OnRequestProgress() override;
 	virtual FConvaihttpRequestHeaderReceivedDelegate& OnHeaderReceived() override;
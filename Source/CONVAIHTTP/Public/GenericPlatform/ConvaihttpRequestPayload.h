@@ -3,6 +3,8 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Memory/CompositeBuffer.h"
+#include "Interfaces/IConvaihttpUploadSource.h"
 
 /**
 * Abstraction that encapsulates the location of a request payload
@@ -10,44 +12,57 @@
 class FCH_RequestPayload
 {
 public:
+	/** Returned by FillOutputBuffer when the payload could not be read and the request should fail */
+	static constexpr size_t FillError = TNumericLimits<size_t>::Max();
+	/** Returned by FillOutputBuffer when no data is available yet. The data available callback is called once there is */
+	static constexpr size_t FillPending = TNumericLimits<size_t>::Max() - 1;
+
 	virtual ~FCH_RequestPayload() {}
 	/** Get the total content length of the request payload in bytes */
 	virtual uint64 GetContentLength() const = 0;
 	/** Return a reference to the underlying memory buffer. Only valid for in-memory request payloads */
 	virtual const TArray64<uint8>& GetContent() const = 0;
+	/** Return the payload without copying it, empty when it is not held in memory. A view of an in-memory payload is only valid while the payload lives */
+	virtual FCompositeBuffer GetContentView() const { return FCompositeBuffer(); }
 	/** Check if the request payload is URL encoded. This check is only performed for in-memory request payloads */
 	virtual bool CH_IsURLEncoded() const = 0;
+	/** Whether the payload can be sent again from the start */
+	virtual bool IsSeekable() const = 0;
+	/** Whether GetContentLength() is the final size of the payload. Payloads of unknown size are sent chunked */
+	virtual bool HasKnownContentLength() const { return true; }
 	/**
 	 * Read part of the underlying request payload into an output buffer.
 	 * @param OutputBuffer - the destination memory address where the payload should be copied
 	 * @param MaxOutputBufferSize - capacity of OutputBuffer in bytes
 	 * @param SizeAlreadySent - how much of payload has previously been sent.
-	 * @return Returns the number of bytes copied into OutputBuffer
+	 * @return Returns the number of bytes copied into OutputBuffer, FillPending or FillError
 	 */
 	virtual size_t FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent) = 0;
-
-	/**
-	 * Read part of the underlying request payload into an output buffer.
-	 * @param OutputBuffer - the destination memory address where the payload should be copied
-	 * @param MaxOutputBufferSize - capacity of OutputBuffer in bytes
-	 * @param SizeAlreadySent - how much of payload has previously been sent.
-	 * @return Returns the number of bytes copied into OutputBuffer
-	 */
-	virtual size_t FillOutputBuffer(TArray64<uint8> OutputBuffer, size_t SizeAlreadySent) = 0;
+	/** Set the function called (from any thread) when FillOutputBuffer can make progress after returning FillPending */
+	virtual void SetDataAvailableCallback(TFunction<void()> Callback) {}
 };
 
-class FCH_RequestPayloadInFileStream : public FCH_RequestPayload
+class FCH_RequestPayloadFromSource : public FCH_RequestPayload
 {
 public:
-	FCH_RequestPayloadInFileStream(TSharedRef<FArchive, ESPMode::ThreadSafe> InFile);
-	virtual ~FCH_RequestPayloadInFileStream();
+	FCH_RequestPayloadFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> InSource);
+	virtual ~FCH_RequestPayloadFromSource();
 	virtual uint64 GetContentLength() const override;
 	virtual const TArray64<uint8>& GetContent() const override;
 	virtual bool CH_IsURLEncoded() const override;
+	virtual bool IsSeekable() const override;
+	virtual bool HasKnownContentLength() const override;
 	virtual size_t FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent) override;
-	virtual size_t FillOutputBuffer(TArray64<uint8> OutputBuffer, size_t SizeAlreadySent) override;
-private:
-	TSharedRef<FArchive, ESPMode::ThreadSafe> File;
+	virtual void SetDataAvailableCallback(TFunction<void()> Callback) override;
+protected:
+	TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source;
+};
+
+class FCH_RequestPayloadInFileStream : public FCH_RequestPayloadFromSource
+{
+public:
+	FCH_RequestPayloadInFileStream(TSharedRef<FArchive, ESPMode::ThreadSafe> InFile);
+	virtual ~FCH_RequestPayloadInFileStream();
 };
 
 class FCH_RequestPayloadInMemory : public FCH_RequestPayload
@@ -58,9 +73,32 @@ public:
 	virtual ~FCH_RequestPayloadInMemory();
 	virtual uint64 GetContentLength() const override;
 	virtual const TArray64<uint8>& GetContent() const override;
+	virtual FCompositeBuffer GetContentView() const override;
 	virtual bool CH_IsURLEncoded() const override;
+	virtual bool IsSeekable() const override;
 	virtual size_t FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent) override;
-	virtual size_t FillOutputBuffer(TArray64<uint8> OutputBuffer, size_t SizeAlreadySent) override;
 private:
 	TArray64<uint8> Buffer;
 };
+
+class FCH_RequestPayloadInSharedBuffer : public FCH_RequestPayload
+{
+public:
+	FCH_RequestPayloadInSharedBuffer(const FCompositeBuffer& InBuffer);
+	virtual ~FCH_RequestPayloadInSharedBuffer();
+	virtual uint64 GetContentLength() const override;
+	virtual const TArray64<uint8>& GetContent() const override;
+	virtual FCompositeBuffer GetContentView() const override;
+	virtual bool CH_IsURLEncoded() const override;
+	virtual bool IsSeekable() const override;
+	virtual size_t FillOutputBuffer(void* OutputBuffer, size_t MaxOutputBufferSize, size_t SizeAlreadySent) override;
+	/** Return the shared buffer backing this payload */
+	const FCompositeBuffer& GetBuffer() const { return Buffer; }
+private:
+	/** Immutable payload, shared with whoever else holds a reference to it */
+	FCompositeBuffer Buffer;
+	/** Flattened copy created on demand by GetContent() */
+	mutable TArray64<uint8> FlattenedContent;
+	/** Guards creation of FlattenedContent */
+	mutable FCriticalSection FlattenedContentCriticalSection;
+};
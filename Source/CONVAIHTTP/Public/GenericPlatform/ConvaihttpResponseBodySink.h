@@ -0,0 +1,138 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IConvaihttpResponseBodySink.h"
+#include "Containers/Queue.h"
+#include <atomic>
+
+/**
+ * Response body sink that writes the body to an archive (typically a file) on the thread pool.
+ * Received data is queued and written behind the transfer, so the CONVAIHTTP thread never waits on the disk.
+ * The queue is bounded: when it is full the transfer pauses until the writer catches up,
+ * so memory use does not depend on the size of the body.
+ *
+ * Must be created with MakeShared, as the writer keeps the sink alive while it runs.
+ */
+class CONVAIHTTP_API FConvaihttpArchiveBodySink
+	: public IConvaihttpResponseBodySink
+	, public TSharedFromThis<FConvaihttpArchiveBodySink, ESPMode::ThreadSafe>
+{
+public:
+	/**
+	 * @param InArchive - archive the body is written to, from a thread pool thread
+	 * @param InMaxQueuedBytes - amount of received data that may wait to be written before the transfer is paused
+	 */
+	FConvaihttpArchiveBodySink(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive, uint64 InMaxQueuedBytes = 4 * 1024 * 1024);
+	virtual ~FConvaihttpArchiveBodySink();
+
+	/** @return true if writing to the archive failed */
+	bool HasFailed() const;
+
+	//~ Begin IConvaihttpResponseBodySink Interface
+	virtual EConvaihttpBodySinkResult Write(FMemoryView Data) override;
+	virtual void Finish(bool bSucceeded) override;
+	virtual bool IsFlushed() const override;
+	virtual bool Restart() override;
+	//~ End IConvaihttpResponseBodySink Interface
+
+private:
+	/** Start the writer if it isn't running. QueueCriticalSection must be held */
+	void StartWriterLocked();
+	/** Write everything queued to the archive, on a thread pool thread */
+	void WriteQueuedData();
+
+	/** Archive the body is written to */
+	TSharedRef<FArchive, ESPMode::ThreadSafe> Archive;
+	/** Maximum amount of data waiting to be written */
+	const uint64 MaxQueuedBytes;
+
+	/** Guards the members below */
+	mutable FCriticalSection QueueCriticalSection;
+	/** Received data waiting to be written */
+	TQueue<TArray64<uint8>> QueuedChunks;
+	/** Size of the data in QueuedChunks and being written */
+	uint64 QueuedBytes = 0;
+	/** Whether a writer task is running */
+	bool bWriterRunning = false;
+	/** Set by Finish() */
+	bool bFinishRequested = false;
+	/** Set once everything was written and the archive flushed */
+	bool bFlushed = false;
+	/** Set once any data was written, after which the sink can't be restarted */
+	bool bReceivedData = false;
+
+	/** Set if writing to the archive failed */
+	std::atomic<bool> bFailed;
+};
+
+/**
+ * Response body sink that holds the body in a bounded buffer until a consumer (e.g. an audio decoder) reads it.
+ * When the buffer is full the transfer pauses, and it resumes once the consumer has drained it to half its capacity,
+ * so a slow consumer slows the server down instead of growing memory.
+ */
+class CONVAIHTTP_API FConvaihttpResponseBodyBuffer : public IConvaihttpResponseBodySink
+{
+public:
+	/**
+	 * @param InCapacity - maximum amount of received data waiting for the consumer
+	 */
+	explicit FConvaihttpResponseBodyBuffer(uint64 InCapacity = 256 * 1024);
+	virtual ~FConvaihttpResponseBodyBuffer();
+
+	/**
+	 * Copy received data out of the buffer. Safe to call from any thread, but only one consumer is supported.
+	 *
+	 * @param Destination - memory to fill
+	 * @return the number of bytes copied, 0 if no data is available
+	 */
+	uint64 Read(FMutableMemoryView Destination);
+
+	/** @return the number of bytes that can be read right now */
+	uint64 GetNumBytesAvailable() const;
+
+	/** @return the size of the ring, the configured capacity unless it holds a chunk bigger than that */
+	uint64 GetBufferSize() const;
+
+	/** @return true once the transfer is over and everything received has been read */
+	bool IsEndOfBody() const;
+
+	/** @return true if the transfer is over and the whole body was received */
+	bool HasSucceeded() const;
+
+	/**
+	 * Set a function to call when data becomes available to Read(), or the transfer ends.
+	 *
+	 * @param InCallback - function to call, on the CONVAIHTTP thread
+	 */
+	void SetDataAvailableCallback(TFunction<void()> InCallback);
+
+	//~ Begin IConvaihttpResponseBodySink Interface
+	virtual EConvaihttpBodySinkResult Write(FMemoryView Data) override;
+	virtual void Finish(bool bSucceeded) override;
+	virtual bool Restart() override;
+	//~ End IConvaihttpResponseBodySink Interface
+
+private:
+	/** Guards the members below */
+	mutable FCriticalSection BufferCriticalSection;
+	/** Configured size of the ring. Buffer only grows past it to hold a single bigger chunk, and shrinks back once that is read */
+	const uint64 Capacity;
+	/** Ring buffer holding the data not read yet */
+	TArray64<uint8> Buffer;
+	/** Offset in Buffer of the first byte not read yet */
+	uint64 ReadOffset = 0;
+	/** Number of bytes not read yet */
+	uint64 NumBytesUsed = 0;
+	/** Set when Write() had to report Full, so Read() knows to resume the transfer */
+	bool bWriterWaiting = false;
+	/** Set by Finish() */
+	bool bFinished = false;
+	/** Whether the transfer received the whole body */
+	bool bSucceeded = false;
+	/** Set once any data was written, after which the sink can't be restarted */
+	bool bReceivedData = false;
+	/** Function to call when data becomes available */
+	TFunction<void()> DataAvailableCallback;
+};
@@ -0,0 +1,183 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "Containers/Ticker.h"
+#include "Interfaces/IConvaihttpRequest.h"
+#include "Interfaces/IConvaihttpResponseBodySink.h"
+#include <atomic>
+
+/**
+ * One event received on a text/event-stream
+ */
+struct FConvaihttpServerSentEvent
+{
+	/** Event type, "message" if the server didn't name it */
+	FString Event;
+	/** Last event ID received on the stream when this event was dispatched */
+	FString Id;
+	/** Event data, lines joined with \n */
+	FString Data;
+};
+
+/**
+ * Response body sink that parses a text/event-stream incrementally as it is received.
+ * Lines are parsed in place from the transport's buffer; only a line split across two receives is buffered.
+ * Events are handed to the event callback on the CONVAIHTTP thread if one is set, or queued for DequeueEvent() otherwise.
+ */
+class CONVAIHTTP_API FConvaihttpServerSentEventParser : public IConvaihttpResponseBodySink
+{
+public:
+	/** Longest line we accept before failing the stream, so a server that never ends a line can't grow memory without bound */
+	static constexpr int64 MaxLineLength = 16 * 1024 * 1024;
+	/** Largest data of one event we accept before failing the stream, so a server sending data lines without ever dispatching can't either */
+	static constexpr int64 MaxEventSize = 16 * 1024 * 1024;
+
+	FConvaihttpServerSentEventParser();
+	virtual ~FConvaihttpServerSentEventParser();
+
+	/**
+	 * Set the function events are handed to as they are parsed, instead of being queued
+	 *
+	 * @param InCallback - function to call on the thread calling Write()
+	 */
+	void SetEventCallback(TFunction<void(FConvaihttpServerSentEvent&&)> InCallback);
+
+	/**
+	 * Get the next queued event
+	 *
+	 * @param OutEvent - receives the event
+	 * @return false if no event is queued
+	 */
+	bool DequeueEvent(FConvaihttpServerSentEvent& OutEvent);
+
+	/** @return the last event ID the server set, to send as Last-Event-ID when reconnecting */
+	FString GetLastEventId() const;
+
+	/** @return the reconnection time the server asked for with a retry field, or -1 if it didn't */
+	int32 GetReconnectionTimeMs() const;
+
+	/** @return true once the transfer feeding the parser is over */
+	bool IsFinished() const;
+
+	//~ Begin IConvaihttpResponseBodySink Interface
+	virtual EConvaihttpBodySinkResult Write(FMemoryView Data) override;
+	virtual void Finish(bool bSucceeded) override;
+	//~ End IConvaihttpResponseBodySink Interface
+
+private:
+	/** Process one line, without its terminator. Returns false if the stream must fail */
+	bool ProcessLine(const uint8* Line, int64 Length);
+	/** Process a field of the event being received. Returns false if the stream must fail */
+	bool ProcessField(const uint8* Name, int64 NameLength, const uint8* Value, int64 ValueLength);
+	/** Dispatch the event being received, on a blank line */
+	void DispatchEvent();
+
+	/** Start of a line that didn't end in the last Write() */
+	TArray64<uint8> PendingLine;
+	/** Data lines of the event being received, UTF-8 */
+	TArray64<uint8> DataBuffer;
+	/** Type of the event being received */
+	FString EventType;
+	/** Last event ID set by the server */
+	FString LastEventId;
+	/** Guards LastEventId, which is read from other threads */
+	mutable FCriticalSection LastEventIdCriticalSection;
+	/** Set when the last Write() ended with a CR, so a LF starting the next one belongs to the same line terminator */
+	bool bSkipLeadingLF = false;
+	/** Set until the first line was processed, to strip a byte order mark */
+	bool bFirstLine = true;
+	/** Reconnection time set by the server, -1 if none */
+	std::atomic<int32> ReconnectionTimeMs;
+	/** Set by Finish() */
+	std::atomic<bool> bFinished;
+	/** Optional function receiving events */
+	TFunction<void(FConvaihttpServerSentEvent&&)> EventCallback;
+	/** Events waiting for DequeueEvent() when there is no callback */
+	TQueue<FConvaihttpServerSentEvent, EQueueMode::Spsc> Events;
+};
+
+/**
+ * Delegate called on the game thread for each event received
+ *
+ * @param Event - the event
+ */
+DECLARE_DELEGATE_OneParam(FConvaihttpServerSentEventDelegate, const FConvaihttpServerSentEvent& /*Event*/);
+
+/**
+ * Delegate called on the game thread when the stream is over and won't be reconnected
+ *
+ * @param Response - response of the last connection attempt, may be null
+ * @param bSucceeded - true if the server ended the stream (e.g. with a 204), false if it failed
+ */
+DECLARE_DELEGATE_TwoParams(FConvaihttpServerSentEventsClosedDelegate, FConvaihttpResponsePtr /*Response*/, bool /*bSucceeded*/);
+
+/**
+ * Server-Sent Events client. Keeps a text/event-stream request open, delivers its events on the game thread,
+ * and reconnects with Last-Event-ID when the connection drops, waiting for the retry time the server asked for.
+ *
+ * Must be created with MakeShared. Requires a CONVAIHTTP implementation supporting response body sinks.
+ */
+class CONVAIHTTP_API FConvaihttpServerSentEvents : public TSharedFromThis<FConvaihttpServerSentEvents, ESPMode::ThreadSafe>
+{
+public:
+	/** Reconnection time used until the server sets one */
+	static constexpr int32 DefaultReconnectionTimeMs = 3000;
+
+	FConvaihttpServerSentEvents(const FString& InURL);
+	~FConvaihttpServerSentEvents();
+
+	/** Sets the verb of the request, GET by default. Takes effect on the next connection */
+	void SetVerb(const FString& InVerb);
+	/** Sets a header sent with every connection */
+	void SetHeader(const FString& HeaderName, const FString& HeaderValue);
+	/** Sets the body sent with every connection, e.g. for endpoints streaming the answer to a POST */
+	void SetContentAsString(const FString& ContentString);
+	/** Whether to reconnect when the connection drops, true by default */
+	void SetAutoReconnect(bool bInAutoReconnect);
+
+	/** Open the stream */
+	bool Connect();
+	/** Close the stream. No more events or closed notification are delivered */
+	void Close();
+	/** @return true between Connect() and the stream closing */
+	bool IsOpen() const;
+	/** @return the last event ID received */
+	const FString& GetLastEventId() const;
+
+	/** Delegate called for each event received */
+	FConvaihttpServerSentEventDelegate& OnEvent() { return EventDelegate; }
+	/** Delegate called when the stream is over for good */
+	FConvaihttpServerSentEventsClosedDelegate& OnClosed() { return ClosedDelegate; }
+
+private:
+	/** Start a connection attempt */
+	bool StartRequest();
+	/** Deliver the events parsed so far */
+	void DeliverEvents();
+	/** Called when a connection attempt is over */
+	void OnRequestComplete(FConvaihttpRequestPtr CompletedRequest, FConvaihttpResponsePtr Response, bool bConnectedSuccessfully);
+	/** Stop for good and tell the owner */
+	void CloseWithResult(FConvaihttpResponsePtr Response, bool bSucceeded);
+
+	FString URL;
+	FString Verb;
+	FString Content;
+	TMap<FString, FString> Headers;
+	bool bAutoReconnect = true;
+	bool bOpen = false;
+	FString LastEventId;
+	int32 ReconnectionTimeMs = DefaultReconnectionTimeMs;
+
+	/** Current connection attempt */
+	TSharedPtr<IConvaihttpRequest, ESPMode::ThreadSafe> Request;
+	/** Parser of the current connection */
+	TSharedPtr<FConvaihttpServerSentEventParser, ESPMode::ThreadSafe> Parser;
+	/** Pending reconnection */
+	FTSTicker::FDelegateHandle ReconnectHandle;
+
+	FConvaihttpServerSentEventDelegate EventDelegate;
+	FConvaihttpServerSentEventsClosedDelegate ClosedDelegate;
+};
@@ -0,0 +1,162 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Interfaces/IConvaihttpUploadSource.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Containers/Queue.h"
+#include "Memory/SharedBuffer.h"
+#include <atomic>
+
+/**
+ * Upload source that streams the body from an archive, serializing directly into the transport's buffer
+ */
+class CONVAIHTTP_API FConvaihttpArchiveUploadSource : public IConvaihttpUploadSource
+{
+public:
+	FConvaihttpArchiveUploadSource(TSharedRef<FArchive, ESPMode::ThreadSafe> InArchive);
+	virtual ~FConvaihttpArchiveUploadSource();
+
+	//~ Begin IConvaihttpUploadSource Interface
+	virtual uint64 GetContentLength() const override;
+	virtual uint64 Read(FMutableMemoryView Destination, uint64 Offset) override;
+	//~ End IConvaihttpUploadSource Interface
+
+private:
+	/** Archive the body is read from */
+	TSharedRef<FArchive, ESPMode::ThreadSafe> Archive;
+	/** Size of the archive, cached as TotalSize() is not free for every archive type */
+	uint64 ContentLength;
+};
+
+class IAsyncReadFileHandle;
+class IAsyncReadRequest;
+
+/**
+ * Upload source that streams a file using asynchronous reads.
+ * The next blocks of the file are prefetched into a ring of buffers, so Read() on the CONVAIHTTP thread only copies
+ * memory and never waits on the disk. When the ring runs dry Read() returns ReadPending and the transfer is resumed
+ * once the outstanding read completes.
+ */
+class CONVAIHTTP_API FConvaihttpAsyncFileUploadSource : public IConvaihttpUploadSource
+{
+public:
+	/**
+	 * Opens Filename and starts prefetching its first blocks. Check IsValid() before using the source.
+	 *
+	 * @param Filename - file to upload
+	 * @param InNumBlocks - number of blocks read ahead of the transfer
+	 * @param InBlockSize - size of each read in bytes
+	 */
+	FConvaihttpAsyncFileUploadSource(const FString& Filename, int32 InNumBlocks = 4, uint64 InBlockSize = 256 * 1024);
+	virtual ~FConvaihttpAsyncFileUploadSource();
+
+	/** @return true if the file could be opened */
+	bool IsValid() const;
+
+	//~ Begin IConvaihttpUploadSource Interface
+	virtual uint64 GetContentLength() const override;
+	virtual uint64 Read(FMutableMemoryView Destination, uint64 Offset) override;
+	virtual bool IsSeekable() const override;
+	//~ End IConvaihttpUploadSource Interface
+
+private:
+	/** One read-ahead buffer of the ring */
+	struct FBlock
+	{
+		/** Memory the read completes into */
+		TArray64<uint8> Data;
+		/** Offset in the file of the first byte of Data */
+		uint64 FileOffset = 0;
+		/** Number of bytes requested */
+		uint64 Size = 0;
+		/** Number of bytes already handed to the transport */
+		uint64 Consumed = 0;
+		/** Outstanding (or completed but not yet released) read */
+		IAsyncReadRequest* Request = nullptr;
+		/** Set by the completion callback. PollCompletion() only flips after the callback returns, so we track it ourselves */
+		FThreadSafeBool bReadComplete;
+		/** Set by the completion callback if the read did not succeed */
+		FThreadSafeBool bReadFailed;
+	};
+
+	/** Issue reads for every free block, continuing from NextIssueOffset */
+	void IssueReads();
+	/** Wait for and release every outstanding read */
+	void ReleaseReads();
+
+	/** Handle used to issue reads */
+	TUniquePtr<IAsyncReadFileHandle> FileHandle;
+	/** Name of the file, for logging */
+	FString Filename;
+	/** Size of the file */
+	uint64 ContentLength = 0;
+	/** Size of each read */
+	uint64 BlockSize;
+	/** Ring of read-ahead buffers */
+	TArray<FBlock> Blocks;
+	/** Index of the block the next Read() copies from */
+	int32 HeadBlock = 0;
+	/** Number of blocks with a read issued, starting from HeadBlock */
+	int32 NumIssuedBlocks = 0;
+	/** File offset the next read will be issued at */
+	uint64 NextIssueOffset = 0;
+	/** File offset the next Read() is expected at */
+	uint64 NextReadOffset = 0;
+};
+
+/**
+ * Upload source for a body produced while the request is in flight, e.g. live microphone audio.
+ * The producer pushes data from any thread and calls Finish() once the body is complete. The size is not known up front,
+ * so the body is sent with Transfer-Encoding: chunked, and the transfer is paused whenever the producer falls behind.
+ */
+class CONVAIHTTP_API FConvaihttpStreamingUploadSource : public IConvaihttpUploadSource
+{
+public:
+	FConvaihttpStreamingUploadSource();
+	virtual ~FConvaihttpStreamingUploadSource();
+
+	/**
+	 * Queue the next part of the body. Safe to call from any thread.
+	 *
+	 * @param Data - data to append, shared with the caller rather than copied
+	 * @return false if the body was already finished
+	 */
+	bool PushData(FSharedBuffer Data);
+
+	/**
+	 * Copy and queue the next part of the body. Safe to call from any thread.
+	 *
+	 * @param Data - memory to copy
+	 * @param Size - number of bytes to copy
+	 * @return false if the body was already finished
+	 */
+	bool PushData(const void* Data, uint64 Size);
+
+	/** Mark the end of the body. The request completes its upload once everything queued has been sent */
+	void Finish();
+
+	/** @return true once Finish() has been called */
+	bool IsFinished() const;
+
+	//~ Begin IConvaihttpUploadSource Interface
+	virtual uint64 GetContentLength() const override;
+	virtual bool HasKnownContentLength() const override;
+	virtual uint64 Read(FMutableMemoryView Destination, uint64 Offset) override;
+	//~ End IConvaihttpUploadSource Interface
+
+private:
+	/** Data pushed by the producer and not yet read */
+	TQueue<FSharedBuffer, EQueueMode::Mpsc> PendingData;
+	/** Buffer the transport is currently reading from. Only accessed by Read() */
+	FSharedBuffer CurrentBuffer;
+	/** Number of bytes of CurrentBuffer already read. Only accessed by Read() */
+	uint64 CurrentBufferOffset = 0;
+	/** Number of bytes handed to the transport. Only accessed by Read() */
+	uint64 BytesRead = 0;
+	/** Number of bytes pushed so far */
+	std::atomic<uint64> BytesPushed;
+	/** Set by Finish() */
+	std::atomic<bool> bFinished;
+};
@@ -5,6 +5,7 @@
 
 #include "CoreMinimal.h"
 #include "Containers/StringView.h"
+#include "Memory/MemoryView.h"
 
 class FConvaihttpManager;
 class IConvaihttpRequest;
@@ -125,6 +126,11 @@ public:
 	 */
 	static bool CH_IsURLEncoded(const TArray64<uint8>& Payload);
 
+	/**
+	 * Helper function for checking if a block of memory is in URL encoded format.
+	 */
+	static bool CH_IsURLEncoded(FMemoryView Payload);
+
 	/**
 	 * Extract the URL-Decoded value of the specified ParameterName from Url. An unset return means the parameter was not present in Url, while an empty value means it was present, but had no value.
 	 * 
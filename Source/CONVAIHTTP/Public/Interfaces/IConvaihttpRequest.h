@@ -4,6 +4,10 @@
 
 #include "CoreMinimal.h"
 #include "Interfaces/IConvaihttpBase.h"
+#include "Interfaces/IConvaihttpUploadSource.h"
+#include "Interfaces/IConvaihttpResponseBodySink.h"
+#include "Memory/CompositeBuffer.h"
+#include "Memory/SharedBuffer.h"
 
 class IConvaihttpRequest;
 class IConvaihttpResponse;
@@ -159,6 +163,23 @@ public:
 	 */
 	virtual void SetContent(TArray64<uint8>&& ContentPayload) = 0;
 
+	/**
+	 * Sets the content of the request from a shared, immutable buffer.
+	 * The buffer is referenced rather than copied, so the same payload can be sent by several requests
+	 * (retries, fan-out) without being duplicated.
+	 *
+	 * @param ContentPayload - payload to set.
+	 */
+	virtual void SetContent(const FSharedBuffer& ContentPayload) = 0;
+
+	/**
+	 * Sets the content of the request from a composite buffer.
+	 * The segments are uploaded in order without first being flattened into a single allocation.
+	 *
+	 * @param ContentPayload - payload to set.
+	 */
+	virtual void SetContent(const FCompositeBuffer& ContentPayload) = 0;
+
 	/**
 	 * Sets the content of the request as a string encoded as UTF8.
 	 *
@@ -182,6 +203,34 @@ public:
 	 */
 	virtual bool SetContentFromStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) = 0;
 
+	/**
+	 * Sets the content of the request to be pulled from an upload source as the request is sent.
+	 * The source writes the body directly into the transport's send buffers.
+	 * Sources without a known content length (see FConvaihttpStreamingUploadSource) are sent with Transfer-Encoding: chunked where supported.
+	 *
+	 * @param Source - source from which the payload should be read.
+	 * @return True if the source can be used to stream the request. False otherwise.
+	 */
+	virtual bool SetContentFromSource(TSharedRef<IConvaihttpUploadSource, ESPMode::ThreadSafe> Source) = 0;
+
+	/**
+	 * Sets a sink the response body is handed to as it is received, instead of being accumulated in the response.
+	 * The response's content is empty when a sink is used.
+	 *
+	 * @param Sink - sink that consumes the body on the CONVAIHTTP thread.
+	 * @return True if the sink can be used for this request. False otherwise.
+	 */
+	virtual bool SetResponseBodyReceiveSink(TSharedRef<IConvaihttpResponseBodySink, ESPMode::ThreadSafe> Sink) = 0;
+
+	/**
+	 * Sets an archive the response body is written to as it is received, off the CONVAIHTTP thread.
+	 * The request completes once everything received has been written to the archive.
+	 *
+	 * @param Stream - archive the body is written to.
+	 * @return True if the archive can be used for this request. False otherwise.
+	 */
+	virtual bool SetResponseBodyReceiveStream(TSharedRef<FArchive, ESPMode::ThreadSafe> Stream) = 0;
+
 	/**
 	 * Sets optional header info.
 	 * SetHeader for a given HeaderName will overwrite any previous values
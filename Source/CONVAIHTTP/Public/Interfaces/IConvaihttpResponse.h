@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "Interfaces/IConvaihttpBase.h"
+#include "Memory/SharedBuffer.h"
 
 namespace EConvaihttpResponseCodes
 {
@@ -78,6 +79,8 @@ namespace EConvaihttpResponseCodes
 		UriTooLong = 414,
 		// the server is refusing to service the request because the entity of the request is in a format not supported by the requested resource for the requested method.
 		UnsupportedMedia = 415,
+		// none of the ranges asked for overlap the resource, e.g. any range of an empty one.
+		RangeNotSatisfiable = 416,
 		// too many requests, the server is throttling
 		TooManyRequests = 429,
 		// the request should be retried after doing the appropriate action.
@@ -106,6 +109,52 @@ namespace EConvaihttpResponseCodes
 	}
 }
 
+/**
+ * HTTP version a response was received over
+ */
+enum class EConvaihttpVersion : uint8
+{
+	Unknown,
+	Http1_0,
+	Http1_1,
+	Http2,
+	Http3
+};
+
+/**
+ * Breakdown of the time a request took, to attribute its latency to each hop.
+ * Phase times are measured from the start of the transfer and include the phases before them, as libcurl reports them:
+ * NameLookup <= Connect <= TlsHandshake <= PreTransfer <= FirstByte <= Total. Redirects come before all of them.
+ * A time is negative when the phase didn't happen (e.g. no TLS), or the implementation doesn't measure it.
+ */
+struct FConvaihttpResponseTimings
+{
+	/** Time the request waited in the queue of the CONVAIHTTP thread before its transfer started */
+	double QueueWaitSeconds = -1.0;
+	/** Time to resolve the host name */
+	double NameLookupSeconds = -1.0;
+	/** Time to connect to the host, or proxy */
+	double ConnectSeconds = -1.0;
+	/** Time to complete the TLS handshake */
+	double TlsHandshakeSeconds = -1.0;
+	/** Time until the request was about to be sent */
+	double PreTransferSeconds = -1.0;
+	/** Time until the first byte of the response was received */
+	double FirstByteSeconds = -1.0;
+	/** Time of the whole transfer */
+	double TotalSeconds = -1.0;
+	/** Time spent following redirects before the final transfer */
+	double RedirectSeconds = -1.0;
+	/** Number of redirects followed */
+	int32 NumRedirects = 0;
+	/** Whether the transfer reused a connection rather than opening a new one */
+	bool bConnectionReused = false;
+	/** HTTP version of the response */
+	EConvaihttpVersion Version = EConvaihttpVersion::Unknown;
+	/** Whether the implementation filled the timings */
+	bool bIsValid = false;
+};
+
 /**
  * Inteface for Convaihttp responses that come back after starting an Convaihttp request
  */
@@ -128,6 +177,38 @@ public:
 	 */
 	virtual FString GetContentAsString() const = 0;
 
+	/**
+	 * Takes ownership of the payload, leaving the response content empty.
+	 * Avoids copying large bodies out of GetContent(). Implementations that can not release their storage return a copy.
+	 *
+	 * @return the payload.
+	 */
+	virtual TArray64<uint8> TakeContent()
+	{
+		return GetContent();
+	}
+
+	/**
+	 * Takes ownership of the payload as a shared buffer, leaving the response content empty.
+	 * The buffer can then be handed to other systems (or sent by other requests) without further copies.
+	 *
+	 * @return the payload.
+	 */
+	FSharedBuffer TakeContentAsSharedBuffer()
+	{
+		return MakeSharedBufferFromArray(TakeContent());
+	}
+
+	/**
+	 * Gets the breakdown of the time the request took. Only complete once the request is.
+	 *
+	 * @return the timings, not valid if the implementation doesn't measure them.
+	 */
+	virtual FConvaihttpResponseTimings GetTimings() const
+	{
+		return FConvaihttpResponseTimings();
+	}
+
 	/** 
 	 * Destructor for overrides 
 	 */
@@ -0,0 +1,106 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Memory/MemoryView.h"
+#include "Misc/ScopeLock.h"
+
+/**
+ * Enumerates the outcomes of handing part of a response body to a sink
+ */
+enum class EConvaihttpBodySinkResult : uint8
+{
+	/** All of the data was consumed */
+	Accepted,
+	/** None of the data was consumed, the sink is full. The transport pauses until NotifyReadyForData() and offers the same data again */
+	Full,
+	/** The sink failed, the request should be aborted */
+	Failed
+};
+
+/**
+ * Push-based consumer of response body data.
+ * When a request has a sink, the body of a successful (2xx) response is handed to it as it arrives instead of being
+ * accumulated in the response. Bodies of error responses are accumulated in the response as without a sink.
+ * Write() and Finish() are called on the CONVAIHTTP thread, and must not block it.
+ */
+class IConvaihttpResponseBodySink
+{
+public:
+
+	/**
+	 * Consume the next part of the body.
+	 *
+	 * @param Data - received data, only valid for the duration of the call
+	 * @return whether the data was consumed, see EConvaihttpBodySinkResult
+	 */
+	virtual EConvaihttpBodySinkResult Write(FMemoryView Data) = 0;
+
+	/**
+	 * Called once the transfer is over, whether it succeeded or not. No more data will be written.
+	 *
+	 * @param bSucceeded - true if the whole body was received
+	 */
+	virtual void Finish(bool bSucceeded)
+	{
+	}
+
+	/**
+	 * Whether everything handed to the sink has been processed. The request does not complete until this is true,
+	 * so by the time the completion delegate runs the data is where the sink was asked to put it.
+	 *
+	 * @return true once the sink is done with the data written to it
+	 */
+	virtual bool IsFlushed() const
+	{
+		return true;
+	}
+
+	/**
+	 * Called when a request with the sink is processed, including again after a previous attempt
+	 * (e.g. by the retry system). A sink holding part of the body of a previous attempt that it can't discard must
+	 * refuse, and the request then fails to start rather than appending a second body to the first.
+	 *
+	 * @return true if the sink is ready for a new body
+	 */
+	virtual bool Restart()
+	{
+		return true;
+	}
+
+	/**
+	 * Set the function to call when a full sink can accept data again. Set by the transport before the first Write().
+	 *
+	 * @param InCallback - function to call, may be called from any thread
+	 */
+	void SetReadyForDataCallback(TFunction<void()> InCallback)
+	{
+		FScopeLock Lock(&ReadyForDataCriticalSection);
+		ReadyForDataCallback = MoveTemp(InCallback);
+	}
+
+	/**
+	 * Destructor for overrides
+	 */
+	virtual ~IConvaihttpResponseBodySink() = default;
+
+protected:
+
+	/** Wake up the transport after Write() returned Full. Safe to call from any thread */
+	void NotifyReadyForData()
+	{
+		FScopeLock Lock(&ReadyForDataCriticalSection);
+		if (ReadyForDataCallback)
+		{
+			ReadyForDataCallback();
+		}
+	}
+
+private:
+
+	/** Guards ReadyForDataCallback */
+	FCriticalSection ReadyForDataCriticalSection;
+	/** Function the transport uses to resume a paused transfer */
+	TFunction<void()> ReadyForDataCallback;
+};
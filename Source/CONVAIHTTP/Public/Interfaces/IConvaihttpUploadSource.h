@@ -0,0 +1,99 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Memory/MemoryView.h"
+#include "Misc/ScopeLock.h"
+
+/**
+ * Pull-based source of request body data.
+ * The transport asks the source to write the next part of the body straight into its own send buffer,
+ * so the body is never staged in an intermediate copy. Read() is called on the CONVAIHTTP thread.
+ *
+ * Sources that can't supply data immediately return ReadPending, and call NotifyDataAvailable() (from any thread)
+ * once a read can make progress, so the transport can pause the transfer instead of blocking its thread.
+ */
+class IConvaihttpUploadSource
+{
+public:
+
+	/** Returned by Read() when the source has failed and the request should be aborted */
+	static constexpr uint64 ReadError = MAX_uint64;
+
+	/** Returned by Read() when no data is available yet. NotifyDataAvailable() will be called once there is */
+	static constexpr uint64 ReadPending = MAX_uint64 - 1;
+
+	/**
+	 * Get the total size of the body.
+	 * If HasKnownContentLength() is false, this is the number of bytes made available so far.
+	 *
+	 * @return the size of the body in bytes
+	 */
+	virtual uint64 GetContentLength() const = 0;
+
+	/**
+	 * Whether the size of the body is known before it is sent.
+	 * Bodies of unknown size are sent with Transfer-Encoding: chunked, and end when Read() returns 0.
+	 *
+	 * @return true if GetContentLength() is the final size of the body
+	 */
+	virtual bool HasKnownContentLength() const
+	{
+		return true;
+	}
+
+	/**
+	 * Write the next part of the body into memory owned by the transport.
+	 *
+	 * @param Destination - memory to fill, only valid for the duration of the call
+	 * @param Offset - offset into the body of the first byte to write
+	 * @return the number of bytes written (0 once the end of the body was reached), ReadPending or ReadError
+	 */
+	virtual uint64 Read(FMutableMemoryView Destination, uint64 Offset) = 0;
+
+	/**
+	 * Whether the body can be read again from the start, e.g. when libcurl has to resend it after a redirect.
+	 *
+	 * @return true if Read() may be called again with an Offset of 0
+	 */
+	virtual bool IsSeekable() const
+	{
+		return false;
+	}
+
+	/**
+	 * Set the function to call when a pending read can make progress. Set by the transport before the first Read().
+	 *
+	 * @param InCallback - function to call, may be called from any thread
+	 */
+	void SetDataAvailableCallback(TFunction<void()> InCallback)
+	{
+		FScopeLock Lock(&DataAvailableCriticalSection);
+		DataAvailableCallback = MoveTemp(InCallback);
+	}
+
+	/**
+	 * Destructor for overrides
+	 */
+	virtual ~IConvaihttpUploadSource() = default;
+
+protected:
+
+	/** Wake up the transport after Read() returned ReadPending. Safe to call from any thread */
+	void NotifyDataAvailable()
+	{
+		FScopeLock Lock(&DataAvailableCriticalSection);
+		if (DataAvailableCallback)
+		{
+			DataAvailableCallback();
+		}
+	}
+
+private:
+
+	/** Guards DataAvailableCallback */
+	FCriticalSection DataAvailableCriticalSection;
+	/** Function the transport uses to resume a paused transfer */
+	TFunction<void()> DataAvailableCallback;
+};
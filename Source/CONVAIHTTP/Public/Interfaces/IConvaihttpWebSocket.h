@@ -0,0 +1,108 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Memory/SharedBuffer.h"
+
+/**
+ * Delegate called when the WebSocket handshake succeeded
+ */
+DECLARE_DELEGATE(FConvaihttpWebSocketConnectedDelegate);
+
+/**
+ * Delegate called when the WebSocket could not be connected
+ *
+ * @param Error - description of the failure
+ */
+DECLARE_DELEGATE_OneParam(FConvaihttpWebSocketConnectionErrorDelegate, const FString& /*Error*/);
+
+/**
+ * Delegate called once a connected WebSocket is closed
+ *
+ * @param StatusCode - close status code sent by the peer, or 1006 if the connection was lost
+ * @param Reason - close reason sent by the peer
+ * @param bWasClean - true if the close handshake completed
+ */
+DECLARE_DELEGATE_ThreeParams(FConvaihttpWebSocketClosedDelegate, int32 /*StatusCode*/, const FString& /*Reason*/, bool /*bWasClean*/);
+
+/**
+ * Delegate called for each text message received
+ *
+ * @param Message - the message
+ */
+DECLARE_DELEGATE_OneParam(FConvaihttpWebSocketMessageDelegate, const FString& /*Message*/);
+
+/**
+ * Delegate called for each binary message received
+ *
+ * @param Data - the message, received directly into this buffer. Keep a reference to hold on to it without copying
+ */
+DECLARE_DELEGATE_OneParam(FConvaihttpWebSocketBinaryMessageDelegate, const FSharedBuffer& /*Data*/);
+
+/**
+ * WebSocket channel running on the CONVAIHTTP thread.
+ * Messages sent from the game thread are queued and written by the CONVAIHTTP thread, and messages received are delivered
+ * on the game thread in batches, once per tick. Delegates are called on the game thread.
+ */
+class IConvaihttpWebSocket
+{
+public:
+
+	/**
+	 * Start the opening handshake. OnConnected() or OnConnectionError() is called once it is over.
+	 */
+	virtual void Connect() = 0;
+
+	/**
+	 * Start the closing handshake, after sending what was already queued. OnClosed() is called once it is over.
+	 *
+	 * @param StatusCode - close status code to send
+	 * @param Reason - close reason to send, at most 123 bytes once converted to UTF-8
+	 */
+	virtual void Close(int32 StatusCode = 1000, const FString& Reason = FString()) = 0;
+
+	/**
+	 * @return true between a successful handshake and the socket closing
+	 */
+	virtual bool IsConnected() const = 0;
+
+	/**
+	 * Queue a text message.
+	 *
+	 * @param Message - the message, sent as UTF-8
+	 */
+	virtual void Send(const FString& Message) = 0;
+
+	/**
+	 * Queue a message. The buffer is sent from where it is, without being copied.
+	 *
+	 * @param Data - the message
+	 * @param bIsBinary - true to send a binary message, false for text (Data must then be UTF-8)
+	 */
+	virtual void Send(FSharedBuffer Data, bool bIsBinary = true) = 0;
+
+	/**
+	 * Set how often to ping the peer while connected. The connection is considered lost if no pong
+	 * comes back within twice the interval. Must be called before Connect().
+	 *
+	 * @param IntervalSeconds - ping interval, 0 to disable
+	 */
+	virtual void SetPingInterval(float IntervalSeconds) = 0;
+
+	/** Delegate called when the handshake succeeded */
+	virtual FConvaihttpWebSocketConnectedDelegate& OnConnected() = 0;
+	/** Delegate called when the handshake failed */
+	virtual FConvaihttpWebSocketConnectionErrorDelegate& OnConnectionError() = 0;
+	/** Delegate called when a connected socket closed */
+	virtual FConvaihttpWebSocketClosedDelegate& OnClosed() = 0;
+	/** Delegate called for each text message */
+	virtual FConvaihttpWebSocketMessageDelegate& OnMessage() = 0;
+	/** Delegate called for each binary message */
+	virtual FConvaihttpWebSocketBinaryMessageDelegate& OnBinaryMessage() = 0;
+
+	/**
+	 * Destructor for overrides
+	 */
+	virtual ~IConvaihttpWebSocket() = default;
+};